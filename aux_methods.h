@@ -4,6 +4,7 @@
 #include <string>
 #include <cxxabi.h>
 #include <functional>
+#include <system_error>
 
 #define BOOST_NO_CXX11_SCOPED_ENUMS
 #include <boost/filesystem.hpp>
@@ -32,6 +33,28 @@ void copy_folder( const std::string & src, const std::string & dst );
 std::string read_file( const std::string& path, bool binary = false,
                        const std::pair< bool, size_t > max_size_limit = { true, DEF_MAX_FILE_SIZE } );
 
+/// \brief Same, but failures are reported through ec. Also works for files of /proc and /sys, which report no size
+std::string read_file( const std::string& path, std::error_code& ec,
+                       const std::pair< bool, size_t > max_size_limit = { true, DEF_MAX_FILE_SIZE } );
+
+/// \brief Atomically replace file content: temp file in the same dir, optional fdatasync, rename, dir fsync.
+/// Mode and owner of the replaced file are kept, symlinks are followed and their target is replaced.
+/// Returns false without writing if content is the same
+bool write_file_atomic( const std::string& path, const std::string& content, bool sync = true );
+
+/// \brief Temp file of stage_file
+struct staged_file
+{
+  std::string target;   // symlinks resolved
+  std::string tmp_path; // empty if content is the same
+};
+
+/// \brief The two halves of write_file_atomic, so that several files can be written first and replaced
+/// only when all of them are. commit_file removes the temp file if rename fails, discard_file removes it unused
+staged_file stage_file( const std::string& path, const std::string& content, bool sync = true );
+void commit_file( const staged_file& file, bool sync = true );
+void discard_file( const staged_file& file ) noexcept;
+
 }
 
 }
@@ -1,6 +1,17 @@
 #include "../aux_methods.h"
 
+#include <array>
 #include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <memory>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../sys_error.h"
 
 namespace utils
 {
@@ -68,6 +79,246 @@ std::string read_file( const std::string& path, bool binary, const std::pair< bo
   return result;
 }
 
+std::string read_file( const std::string& path, std::error_code& ec, const std::pair< bool, size_t > max_size_limit )
+{
+  ec.clear();
+  std::string result;
+
+  int fd{ open( path.c_str(), O_RDONLY | O_CLOEXEC ) };
+  if( fd == -1 )
+  {
+    ec = sys::errno_code();
+    return result;
+  }
+
+  std::array< char, 4096 > buf;
+  for( ;; )
+  {
+    ssize_t res{ ::read( fd, buf.data(), buf.size() ) };
+    if( res < 0 && errno == EINTR )
+    {
+      continue;
+    }
+
+    if( res < 0 )
+    {
+      ec = sys::errno_code();
+      break;
+    }
+
+    if( res == 0 )
+    {
+      break;
+    }
+
+    if( max_size_limit.first && result.size() + res > max_size_limit.second )
+    {
+      ec = sys::errc::invalid_argument;
+      break;
+    }
+
+    result.append( buf.data(), res );
+  }
+
+  close( fd );
+
+  if( ec )
+  {
+    result.clear();
+  }
+
+  return result;
+}
+
+namespace details
+{
+
+bool write_all( int fd, const char* data, size_t size )
+{
+  while( size )
+  {
+    ssize_t res{ ::write( fd, data, size ) };
+    if( res < 0 && errno == EINTR )
+    {
+      continue;
+    }
+
+    if( res <= 0 )
+    {
+      return false;
+    }
+
+    data += res;
+    size -= res;
+  }
+
+  return true;
+}
+
+bool same_content( int fd, size_t size, const std::string& content )
+{
+  if( size != content.size() )
+  {
+    return false;
+  }
+
+  std::array< char, 65536 > buf;
+  size_t offset{ 0 };
+
+  while( offset < size )
+  {
+    ssize_t res{ pread( fd, buf.data(), std::min( buf.size(), size - offset ), offset ) };
+    if( res < 0 && errno == EINTR )
+    {
+      continue;
+    }
+
+    if( res <= 0 || content.compare( offset, res, buf.data(), res ) != 0 )
+    {
+      return false;
+    }
+
+    offset += res;
+  }
+
+  return true;
+}
+
+// The file a symlink points to gets the content, not the link itself. Dangling links are followed by hand,
+// since realpath needs the target to exist
+std::string resolve_target( const std::string& path )
+{
+  std::unique_ptr< char, void( * )( void* ) > real{ realpath( path.c_str(), nullptr ), std::free };
+  if( real )
+  {
+    return real.get();
+  }
+
+  std::string target{ path };
+  for( int depth{ 0 }; depth < 40; ++depth )
+  {
+    struct stat info;
+    if( lstat( target.c_str(), &info ) != 0 || !S_ISLNK( info.st_mode ) )
+    {
+      return target;
+    }
+
+    std::array< char, PATH_MAX > buf;
+    ssize_t size{ readlink( target.c_str(), buf.data(), buf.size() - 1 ) };
+    if( size < 0 )
+    {
+      return target;
+    }
+
+    boost::filesystem::path link{ std::string{ buf.data(), static_cast< size_t >( size ) } };
+    target = link.is_absolute()? link.string() : ( boost::filesystem::path{ target }.parent_path() / link ).string();
+  }
+
+  throw std::runtime_error{ "Too many levels of symbolic links: " + path };
+}
+
+}// details
+
+staged_file stage_file( const std::string& path, const std::string& content, bool sync )
+{
+  if( path.empty() )
+  {
+    throw std::invalid_argument{ "Path is empty" };
+  }
+
+  staged_file result;
+  result.target = details::resolve_target( path );
+
+  struct stat info;
+  bool exists{ false };
+
+  int old_fd{ open( result.target.c_str(), O_RDONLY | O_CLOEXEC ) };
+  if( old_fd != -1 )
+  {
+    exists = fstat( old_fd, &info ) == 0 && S_ISREG( info.st_mode );
+    bool same{ exists && details::same_content( old_fd, info.st_size, content ) };
+    close( old_fd );
+
+    if( same )
+    {
+      return result;
+    }
+  }
+
+  boost::filesystem::path target{ result.target };
+  std::string dir{ target.has_parent_path()? target.parent_path().string() : "." };
+  std::string tmp_path{ ( boost::filesystem::path{ dir } / ( "." + target.filename().string() + ".XXXXXX" ) ).string() };
+
+  int fd{ mkostemp( &tmp_path[ 0 ], O_CLOEXEC ) };
+  if( fd == -1 )
+  {
+    throw std::runtime_error{ "Failed to create temp file for " + path + ": " + sys::error_message( errno ) };
+  }
+
+  bool ok{ details::write_all( fd, content.data(), content.size() ) &&
+           fchmod( fd, exists? info.st_mode & 07777 : 0644 ) == 0 };
+
+  // owner can only be kept by root, not being able to do it is not an error
+  if( ok && exists && ( info.st_uid != geteuid() || info.st_gid != getegid() ) )
+  {
+    ok = fchown( fd, info.st_uid, info.st_gid ) == 0 || errno == EPERM;
+  }
+
+  ok = ok && ( !sync || fdatasync( fd ) == 0 );
+  ok = ( close( fd ) == 0 ) && ok;
+
+  if( !ok )
+  {
+    std::string error{ sys::error_message( errno ) };
+    unlink( tmp_path.c_str() );
+    throw std::runtime_error{ "Failed to write file " + path + ": " + error };
+  }
+
+  result.tmp_path = tmp_path;
+  return result;
+}
+
+void commit_file( const staged_file& file, bool sync )
+{
+  if( file.tmp_path.empty() )
+  {
+    return;
+  }
+
+  if( std::rename( file.tmp_path.c_str(), file.target.c_str() ) != 0 )
+  {
+    std::string error{ sys::error_message( errno ) };
+    unlink( file.tmp_path.c_str() );
+    throw std::runtime_error{ "Failed to write file " + file.target + ": " + error };
+  }
+
+  if( sync )
+  {
+    boost::filesystem::path target{ file.target };
+    std::string dir{ target.has_parent_path()? target.parent_path().string() : "." };
+    int dir_fd{ open( dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC ) };
+    if( dir_fd != -1 )
+    {
+      fsync( dir_fd );
+      close( dir_fd );
+    }
+  }
+}
+
+void discard_file( const staged_file& file ) noexcept
+{
+  if( !file.tmp_path.empty() )
+  {
+    unlink( file.tmp_path.c_str() );
+  }
+}
+
+bool write_file_atomic( const std::string& path, const std::string& content, bool sync )
+{
+  staged_file file{ stage_file( path, content, sync ) };
+  commit_file( file, sync );
+  return !file.tmp_path.empty();
+}
 
 }// aux
 
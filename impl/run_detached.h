@@ -0,0 +1,68 @@
+#ifndef __RUN_DETACHED_H__
+#define __RUN_DETACHED_H__
+
+#include <future>
+#include <memory>
+#include <thread>
+#include <exception>
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace details
+{
+
+template< class Result >
+struct promise_setter
+{
+  template< class Func >
+  static void set( std::promise< Result >& promise, Func& func )
+  {
+    promise.set_value( func() );
+  }
+};
+
+template<>
+struct promise_setter< void >
+{
+  template< class Func >
+  static void set( std::promise< void >& promise, Func& func )
+  {
+    func();
+    promise.set_value();
+  }
+};
+
+// Unlike std::async, future of a promise doesn't block in destructor, so the result may be ignored
+template< class Func >
+auto run_detached( Func func ) -> std::future< decltype( func() ) >
+{
+  using result_type = decltype( func() );
+  auto promise = std::make_shared< std::promise< result_type > >();
+  std::future< result_type > result{ promise->get_future() };
+
+  std::thread{ [ promise, func ]() mutable
+  {
+    try
+    {
+      promise_setter< result_type >::set( *promise, func );
+    }
+    catch( ... )
+    {
+      promise->set_exception( std::current_exception() );
+    }
+  } }.detach();
+
+  return result;
+}
+
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,458 @@
+#include "../sys_cpu_topology.h"
+
+#include <set>
+#include <cmath>
+#include <cerrno>
+#include <cstdlib>
+#include <mutex>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include "../aux_methods.h"
+#include "../sys_io_batch.h"
+#include "../sys_proc_sched.h"
+
+#define PROC_CGROUP_FILE "/proc/self/cgroup"
+#define PROC_MOUNTINFO_FILE "/proc/self/mountinfo"
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace cpu
+{
+
+namespace details
+{
+
+std::string read_value( const std::string& path )
+{
+  std::error_code ec;
+  return boost::trim_copy( aux::read_file( path, ec ) );
+}
+
+unsigned long to_number( const std::string& value ) noexcept
+{
+  return std::strtoul( value.c_str(), nullptr, 10 );
+}
+
+// Cache sizes are like "32K" or "2048K"
+size_t to_size( const std::string& value ) noexcept
+{
+  char* end{ nullptr };
+  size_t size{ std::strtoul( value.c_str(), &end, 10 ) };
+  switch( end? *end : '\0' )
+  {
+  case 'K': return size << 10;
+  case 'M': return size << 20;
+  case 'G': return size << 30;
+  default: return size;
+  }
+}
+
+std::vector< std::string > list_dir( const std::string& path, const std::string& prefix )
+{
+  std::vector< std::string > names;
+  std::unique_ptr< DIR, int( * )( DIR* ) > dir{ opendir( path.c_str() ), closedir };
+  if( !dir )
+  {
+    return names;
+  }
+
+  while( dirent* entry = readdir( dir.get() ) )
+  {
+    if( boost::starts_with( entry->d_name, prefix ) )
+    {
+      names.emplace_back( entry->d_name );
+    }
+  }
+
+  std::sort( names.begin(), names.end() );
+  return names;
+}
+
+struct cgroup_mount
+{
+  std::string root;
+  std::string mount_point;
+  std::string type;
+  std::vector< std::string > options;
+};
+
+std::vector< cgroup_mount > get_cgroup_mounts()
+{
+  std::vector< cgroup_mount > mounts;
+
+  std::ifstream file{ PROC_MOUNTINFO_FILE };
+  for( std::string line; std::getline( file, line ); )
+  {
+    // id parent dev root mount_point options [optional fields] - type source super_options
+    std::vector< std::string > fields;
+    boost::split( fields, line, boost::is_any_of( " " ) );
+    auto separator = std::find( fields.begin(), fields.end(), "-" );
+    if( fields.size() < 5 || std::distance( separator, fields.end() ) < 4 || ( separator[ 1 ] != "cgroup" && separator[ 1 ] != "cgroup2" ) )
+    {
+      continue;
+    }
+
+    cgroup_mount mount;
+    mount.root = fields[ 3 ];
+    mount.mount_point = fields[ 4 ];
+    mount.type = separator[ 1 ];
+    boost::split( mount.options, separator[ 3 ], boost::is_any_of( "," ) );
+    mounts.push_back( mount );
+  }
+
+  return mounts;
+}
+
+// Quota of the cgroup or the smallest one of its parents
+double read_quota( const cgroup_mount& mount, const std::string& cgroup_path, bool v2 )
+{
+  std::string path{ cgroup_path };
+  if( mount.root != "/" && boost::starts_with( path, mount.root ) )
+  {
+    path = path.substr( mount.root.size() );
+  }
+
+  double quota{ 0.0 };
+  for( std::string dir{ mount.mount_point + path }; ; )
+  {
+    double limit{ 0.0 };
+    if( v2 )
+    {
+      // "max 100000" or "200000 100000"
+      std::istringstream max{ read_value( dir + "/cpu.max" ) };
+      std::string value;
+      double period{ 0.0 };
+      if( max >> value >> period && value != "max" && period > 0 )
+      {
+        limit = std::strtod( value.c_str(), nullptr ) / period;
+      }
+    }
+    else
+    {
+      double value{ std::strtod( read_value( dir + "/cpu.cfs_quota_us" ).c_str(), nullptr ) };
+      double period{ std::strtod( read_value( dir + "/cpu.cfs_period_us" ).c_str(), nullptr ) };
+      if( value > 0 && period > 0 )
+      {
+        limit = value / period;
+      }
+    }
+
+    if( limit > 0 && ( quota == 0.0 || limit < quota ) )
+    {
+      quota = limit;
+    }
+
+    size_t slash{ dir.rfind( '/' ) };
+    if( dir.size() <= mount.mount_point.size() || slash == std::string::npos )
+    {
+      break;
+    }
+
+    dir.erase( slash );
+  }
+
+  return quota;
+}
+
+// Both cgroup v1 cpu controller and v2 cpu.max, a hybrid setup may have both
+double get_cgroup_quota()
+{
+  std::vector< cgroup_mount > mounts{ get_cgroup_mounts() };
+  double quota{ 0.0 };
+
+  std::ifstream file{ PROC_CGROUP_FILE };
+  for( std::string line; std::getline( file, line ); )
+  {
+    // id:controllers:path
+    size_t first{ line.find( ':' ) };
+    size_t second{ first == std::string::npos? first : line.find( ':', first + 1 ) };
+    if( second == std::string::npos )
+    {
+      continue;
+    }
+
+    std::vector< std::string > controllers;
+    boost::split( controllers, line.substr( first + 1, second - first - 1 ), boost::is_any_of( "," ) );
+    std::string path{ line.substr( second + 1 ) };
+
+    bool v2{ line.compare( 0, 3, "0::" ) == 0 };
+    bool cpu{ std::find( controllers.begin(), controllers.end(), "cpu" ) != controllers.end() };
+    if( !v2 && !cpu )
+    {
+      continue;
+    }
+
+    for( const cgroup_mount& mount : mounts )
+    {
+      bool matches{ v2? mount.type == "cgroup2" :
+                        mount.type == "cgroup" && std::find( mount.options.begin(), mount.options.end(), "cpu" ) != mount.options.end() };
+      if( matches )
+      {
+        double limit{ read_quota( mount, path == "/"? "" : path, v2 ) };
+        if( limit > 0 && ( quota == 0.0 || limit < quota ) )
+        {
+          quota = limit;
+        }
+
+        break;
+      }
+    }
+  }
+
+  return quota;
+}
+
+std::shared_ptr< const topology > load_topology()
+{
+  auto result = std::make_shared< topology >();
+
+  std::vector< unsigned int > online{ parse_cpu_list( read_value( SYS_CPU_DIR "/online" ) ) };
+  if( online.empty() )
+  {
+    long count{ sysconf( _SC_NPROCESSORS_ONLN ) };
+    for( long cpu{ 0 }; cpu < count; ++cpu )
+    {
+      online.push_back( static_cast< unsigned int >( cpu ) );
+    }
+  }
+
+  // all the small sysfs files are read in one batch
+  struct cpu_requests
+  {
+    size_t core_id;
+    size_t package_id;
+    size_t siblings;
+    size_t min_frequency;
+    size_t max_frequency;
+    std::vector< size_t > caches; // level, type, size, line size and shared cpus of each
+  };
+
+  io::batch requests;
+  std::vector< cpu_requests > cpu_ids;
+  for( unsigned int cpu : online )
+  {
+    std::string dir{ SYS_CPU_DIR "/cpu" + std::to_string( cpu ) };
+
+    cpu_requests ids;
+    ids.core_id = requests.add_read( dir + "/topology/core_id" );
+    ids.package_id = requests.add_read( dir + "/topology/physical_package_id" );
+    ids.siblings = requests.add_read( dir + "/topology/thread_siblings_list" );
+    ids.min_frequency = requests.add_read( dir + "/cpufreq/cpuinfo_min_freq" );
+    ids.max_frequency = requests.add_read( dir + "/cpufreq/cpuinfo_max_freq" );
+    for( const std::string& index : list_dir( dir + "/cache", "index" ) )
+    {
+      for( const char* name : { "level", "type", "size", "coherency_line_size", "shared_cpu_list" } )
+      {
+        ids.caches.push_back( requests.add_read( dir + "/cache/" + index + "/" + name ) );
+      }
+    }
+
+    cpu_ids.push_back( ids );
+  }
+
+  std::vector< std::pair< size_t, size_t > > node_ids;
+  std::vector< unsigned int > nodes{ parse_cpu_list( read_value( SYS_NODE_DIR "/online" ) ) };
+  for( unsigned int node : nodes )
+  {
+    std::string dir{ SYS_NODE_DIR "/node" + std::to_string( node ) };
+    node_ids.emplace_back( requests.add_read( dir + "/cpulist" ), requests.add_read( dir + "/meminfo" ) );
+  }
+
+  requests.run();
+
+  auto value = [ &requests ]( size_t id ){ return boost::trim_copy( requests.get( id ).content ); };
+
+  std::set< std::pair< unsigned long, unsigned long > > cores;
+  std::set< unsigned long > packages;
+  for( size_t i{ 0 }; i < online.size(); ++i )
+  {
+    const cpu_requests& ids( cpu_ids[ i ] );
+
+    cpu_info info;
+    info.id = online[ i ];
+    info.core_id = to_number( value( ids.core_id ) );
+    info.package_id = to_number( value( ids.package_id ) );
+    info.siblings = parse_cpu_list( value( ids.siblings ) );
+    info.min_frequency = to_number( value( ids.min_frequency ) );
+    info.max_frequency = to_number( value( ids.max_frequency ) );
+    if( info.siblings.empty() )
+    {
+      info.siblings.push_back( info.id );
+    }
+
+    for( size_t c{ 0 }; c + 4 < ids.caches.size(); c += 5 )
+    {
+      cache_info cache;
+      cache.level = to_number( value( ids.caches[ c ] ) );
+      cache.type = value( ids.caches[ c + 1 ] );
+      cache.size = to_size( value( ids.caches[ c + 2 ] ) );
+      cache.line_size = to_number( value( ids.caches[ c + 3 ] ) );
+      cache.shared_cpus = parse_cpu_list( value( ids.caches[ c + 4 ] ) );
+      info.caches.push_back( cache );
+    }
+
+    cores.emplace( info.package_id, info.core_id );
+    packages.insert( info.package_id );
+    result->cpus.push_back( info );
+  }
+
+  for( size_t i{ 0 }; i < nodes.size(); ++i )
+  {
+    numa_node node;
+    node.id = nodes[ i ];
+    node.cpus = parse_cpu_list( value( node_ids[ i ].first ) );
+
+    // "Node 0 MemTotal:        5340920 kB"
+    std::string meminfo{ value( node_ids[ i ].second ) };
+    size_t total{ meminfo.find( "MemTotal:" ) };
+    if( total != std::string::npos )
+    {
+      node.memory = static_cast< size_t >( to_number( meminfo.substr( total + 9 ) ) ) * 1024;
+    }
+
+    for( unsigned int cpu : node.cpus )
+    {
+      auto it = std::find_if( result->cpus.begin(), result->cpus.end(), [ cpu ]( const cpu_info& info ){ return info.id == cpu; } );
+      if( it != result->cpus.end() )
+      {
+        it->node = static_cast< int >( node.id );
+      }
+    }
+
+    result->nodes.push_back( node );
+  }
+
+  result->cores = static_cast< unsigned int >( cores.size() );
+  result->packages = static_cast< unsigned int >( packages.size() );
+  result->affinity = proc::get_affinity();
+  result->quota = get_cgroup_quota();
+  return result;
+}
+
+}// details
+
+unsigned int topology::effective_concurrency() const noexcept
+{
+  size_t count{ affinity.empty()? cpus.size() : affinity.size() };
+  if( quota > 0 )
+  {
+    count = std::min( count, static_cast< size_t >( std::ceil( quota ) ) );
+  }
+
+  return static_cast< unsigned int >( std::max< size_t >( count, 1 ) );
+}
+
+const cpu_info* topology::find( unsigned int cpu ) const noexcept
+{
+  for( const cpu_info& info : cpus )
+  {
+    if( info.id == cpu )
+    {
+      return &info;
+    }
+  }
+
+  return nullptr;
+}
+
+std::shared_ptr< const topology > get_topology( bool reload )
+{
+  static std::mutex mutex;
+  static std::shared_ptr< const topology > cached;
+
+  std::lock_guard< std::mutex > lock{ mutex };
+  if( !cached || reload )
+  {
+    cached = details::load_topology();
+  }
+
+  return cached;
+}
+
+unsigned long current_frequency( unsigned int cpu )
+{
+  std::string value{ details::read_value( SYS_CPU_DIR "/cpu" + std::to_string( cpu ) + "/cpufreq/scaling_cur_freq" ) };
+  if( !value.empty() )
+  {
+    return details::to_number( value );
+  }
+
+  // VMs and some ARM boards have no cpufreq, x86 reports the frequency in cpuinfo
+  std::ifstream file{ "/proc/cpuinfo" };
+  bool found{ false };
+  for( std::string line; std::getline( file, line ); )
+  {
+    size_t colon{ line.find( ':' ) };
+    if( colon == std::string::npos )
+    {
+      continue;
+    }
+
+    std::string key{ boost::trim_copy( line.substr( 0, colon ) ) };
+    if( key == "processor" )
+    {
+      found = details::to_number( line.substr( colon + 1 ) ) == cpu;
+    }
+    else if( found && key == "cpu MHz" )
+    {
+      return static_cast< unsigned long >( std::strtod( line.c_str() + colon + 1, nullptr ) * 1000 );
+    }
+  }
+
+  return 0;
+}
+
+std::vector< unsigned int > parse_cpu_list( const std::string& list )
+{
+  std::vector< unsigned int > cpus;
+
+  std::vector< std::string > ranges;
+  std::string trimmed{ boost::trim_copy( list ) };
+  boost::split( ranges, trimmed, boost::is_any_of( "," ) );
+  for( const std::string& range : ranges )
+  {
+    if( range.empty() )
+    {
+      continue;
+    }
+
+    size_t dash{ range.find( '-' ) };
+    if( range.find_first_not_of( "0123456789-" ) != std::string::npos || dash == 0 ||
+        ( dash != std::string::npos && ( dash + 1 == range.size() || range.find( '-', dash + 1 ) != std::string::npos ) ) )
+    {
+      throw std::invalid_argument{ "Invalid cpu list: " + list };
+    }
+
+    unsigned long first{ std::stoul( range ) };
+    unsigned long last{ dash == std::string::npos? first : std::stoul( range.substr( dash + 1 ) ) };
+    if( last < first )
+    {
+      throw std::invalid_argument{ "Invalid cpu list: " + list };
+    }
+
+    for( unsigned long cpu{ first }; cpu <= last; ++cpu )
+    {
+      cpus.push_back( static_cast< unsigned int >( cpu ) );
+    }
+  }
+
+  return cpus;
+}
+
+}// cpu
+
+}// sys
+
+}// utils
@@ -1,7 +1,21 @@
 #include "../sys_cron_methods.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cctype>
+#include <cstring>
 #include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/algorithm/string.hpp>
 
+#include "../aux_methods.h"
+#include "../sys_error.h"
+#include "../sys_user_resolver.h"
 #include "execute_sys_command.h"
 
 namespace utils
@@ -13,27 +27,473 @@ namespace sys
 namespace cron
 {
 
-void add_cron_script( const std::string& user, const std::string& script_path )
+namespace details
 {
-  if( user.empty() )
+
+void validate_user( const std::string& user )
+{
+  if( user.empty() || user[ 0 ] == '.' || user[ 0 ] == '-' )
   {
     throw std::invalid_argument{ "Invalid user name" };
   }
 
-  std::stringstream ss;
-  ss << "crontab -u " << user << " " << script_path;
+  // ends up in paths and commands
+  for( char c : user )
+  {
+    if( !std::isalnum( static_cast< unsigned char >( c ) ) && !std::strchr( "_.-", c ) )
+    {
+      throw std::invalid_argument{ "Invalid user name: " + user };
+    }
+  }
+}
+
+bool is_nickname( const std::string& schedule )
+{
+  static const std::vector< std::string > nicknames{ "@reboot", "@yearly", "@annually", "@monthly",
+                                                     "@weekly", "@daily", "@midnight", "@hourly" };
+  return std::find( nicknames.begin(), nicknames.end(), schedule ) != nicknames.end();
+}
+
+// Fields separated by single spaces, throws if it's not a schedule
+std::string normalize_schedule( const std::string& schedule )
+{
+  std::vector< std::string > fields;
+  std::string trimmed{ boost::trim_copy( schedule ) };
+  boost::split( fields, trimmed, boost::is_any_of( " \t" ), boost::token_compress_on );
+
+  bool valid{ fields.size() == 5 || ( fields.size() == 1 && is_nickname( fields[ 0 ] ) ) };
+  for( size_t i{ 0 }; valid && fields.size() == 5 && i < fields.size(); ++i )
+  {
+    valid = !fields[ i ].empty() && std::all_of( fields[ i ].begin(), fields[ i ].end(), []( char c )
+    {
+      return std::isalnum( static_cast< unsigned char >( c ) ) || std::strchr( "*/,-", c );
+    } );
+  }
+
+  if( !valid )
+  {
+    throw std::invalid_argument{ "Invalid cron schedule: " + schedule };
+  }
+
+  return boost::join( fields, " " );
+}
+
+// Lines that are not entries, like variables, are left to cron
+bool parse_entry( const std::string& text, bool system, cron_entry& entry )
+{
+  std::istringstream ss{ text };
+  std::string field;
+  if( !( ss >> field ) || ( field[ 0 ] != '@' && !std::strchr( "0123456789*", field[ 0 ] ) ) )
+  {
+    return false;
+  }
+
+  std::string schedule{ field };
+  for( size_t i{ 1 }; field[ 0 ] != '@' && i < 5; ++i )
+  {
+    if( !( ss >> field ) )
+    {
+      return false;
+    }
+
+    schedule += " " + field;
+  }
+
+  std::string user;
+  if( system && !( ss >> user ) )
+  {
+    return false;
+  }
+
+  std::string command;
+  std::getline( ss, command );
+  boost::trim( command );
+  if( command.empty() )
+  {
+    return false;
+  }
+
+  try
+  {
+    entry.schedule = normalize_schedule( schedule );
+  }
+  catch( const std::invalid_argument& )
+  {
+    return false;
+  }
+
+  entry.user = user;
+  entry.command = command;
+  return true;
+}
+
+std::string format_entry( const cron_entry& entry )
+{
+  std::string text;
+  if( !entry.tag.empty() )
+  {
+    text = CRON_TAG_PREFIX + entry.tag + "\n";
+  }
+
+  text += entry.schedule + " ";
+  if( !entry.user.empty() )
+  {
+    text += entry.user + " ";
+  }
+
+  return text + entry.command;
+}
+
+bool same_entry( const cron_entry& l, const cron_entry& r ) noexcept
+{
+  return l.tag == r.tag && l.schedule == r.schedule && l.user == r.user && l.command == r.command;
+}
+
+std::string spool_dir()
+{
+  struct stat info;
+  return stat( CRON_SPOOL_DIR, &info ) == 0 && S_ISDIR( info.st_mode )? CRON_SPOOL_DIR : CRON_SPOOL_DIR_ALT;
+}
+
+std::string read_table( const std::string& path )
+{
+  struct stat info;
+  if( stat( path.c_str(), &info ) != 0 )
+  {
+    if( errno == ENOENT )
+    {
+      return std::string{};
+    }
+
+    throw std::runtime_error{ "Could not read crontab " + path + ": " + sys::error_message( errno ) };
+  }
+
+  return aux::read_file( path );
+}
+
+// New tables are created empty first, so the content is written with the right owner and mode from the start
+bool write_table( const std::string& path, const std::string& content, mode_t mode, uid_t uid, gid_t gid )
+{
+  if( content.empty() )
+  {
+    if( unlink( path.c_str() ) == 0 )
+    {
+      return true;
+    }
+
+    if( errno == ENOENT )
+    {
+      return false;
+    }
+
+    throw std::runtime_error{ "Could not remove crontab " + path + ": " + sys::error_message( errno ) };
+  }
+
+  int fd{ open( path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode ) };
+  if( fd != -1 )
+  {
+    bool ok{ fchmod( fd, mode ) == 0 && ( uid == static_cast< uid_t >( -1 ) || fchown( fd, uid, gid ) == 0 ) };
+    int error{ errno };
+    close( fd );
+
+    if( !ok )
+    {
+      unlink( path.c_str() );
+      throw std::runtime_error{ "Could not create crontab " + path + ": " + sys::error_message( error ) };
+    }
+  }
+  else if( errno != EEXIST )
+  {
+    throw std::runtime_error{ "Could not create crontab " + path + ": " + sys::error_message( errno ) };
+  }
+
+  return aux::write_file_atomic( path, content );
+}
+
+std::shared_ptr< const user::user_info > find_user( const std::string& user )
+{
+  auto info = user::get_user_resolver().find_user( user );
+  if( !info )
+  {
+    throw std::invalid_argument{ "Unknown user: " + user };
+  }
+
+  return info;
+}
+
+// Only root may touch the spool, others go through the setgid crontab(1) for their own table
+bool use_crontab_command( const std::string& user )
+{
+  if( geteuid() == 0 )
+  {
+    return false;
+  }
+
+  if( find_user( user )->uid != geteuid() )
+  {
+    throw std::runtime_error{ "Only root can change crontab of user " + user };
+  }
+
+  return true;
+}
+
+std::string read_user_table( const std::string& user )
+{
+  validate_user( user );
+
+  if( use_crontab_command( user ) )
+  {
+    std::string content{ sys::details::execute_sys_command( "crontab -l 2>/dev/null" ) };
+    return content.empty()? content : content + "\n";
+  }
+
+  return read_table( spool_dir() + "/" + user );
+}
+
+bool install_user_table( const std::string& user, const std::string& content )
+{
+  validate_user( user );
+
+  if( !use_crontab_command( user ) )
+  {
+    auto owner = find_user( user );
+
+    // Debian cron wants the crontab group, others the user's one
+    auto crontab_group = user::get_user_resolver().find_group( "crontab" );
+
+    return write_table( spool_dir() + "/" + user, content, 0600, owner->uid, crontab_group? crontab_group->gid : owner->gid );
+  }
+
+  if( read_user_table( user ) == content )
+  {
+    return false;
+  }
+
+  std::string command{ "crontab -r" };
+  std::string tmp_path{ "/tmp/crontab.XXXXXX" };
+  if( !content.empty() )
+  {
+    int fd{ mkostemp( &tmp_path[ 0 ], O_CLOEXEC ) };
+    if( fd == -1 )
+    {
+      throw std::runtime_error{ std::string{ "Could not create temp crontab: " } + sys::error_message( errno ) };
+    }
+
+    close( fd );
+    aux::write_file_atomic( tmp_path, content, false );
+    command = "crontab " + tmp_path;
+  }
+
+  std::string code{ sys::details::execute_sys_command( command + " >/dev/null 2>&1; echo $?" ) };
+  if( !content.empty() )
+  {
+    unlink( tmp_path.c_str() );
+  }
+
+  if( code != "0" )
+  {
+    throw std::runtime_error{ "crontab failed with code " + code };
+  }
 
-  details::execute_sys_command( ss.str() );
+  return true;
+}
+
+}// details
+
+void add_cron_script( const std::string& user, const std::string& script_path )
+{
+  std::string script{ aux::read_file( script_path ) };
+  if( !script.empty() && script.back() != '\n' )
+  {
+    // cron ignores the last line without newline
+    script += '\n';
+  }
+
+  details::install_user_table( user, script );
 }
 
 void remove_all_cron_scripts( const std::string& user )
 {
-  if( user.empty() )
+  details::install_user_table( user, std::string{} );
+}
+
+crontab crontab::parse( const std::string& content, bool system )
+{
+  crontab table;
+  table.system_ = system;
+  table.parse_content( content );
+  return table;
+}
+
+crontab crontab::load_user( const std::string& user )
+{
+  crontab table;
+  table.user_ = user;
+  table.parse_content( details::read_user_table( user ) );
+  return table;
+}
+
+crontab crontab::load_dropin( const std::string& name )
+{
+  // run-parts naming, files with other names are skipped by cron
+  if( name.empty() || !std::all_of( name.begin(), name.end(), []( char c )
+      {
+        return std::isalnum( static_cast< unsigned char >( c ) ) || c == '_' || c == '-';
+      } ) )
   {
-    throw std::invalid_argument{ "Invalid user name" };
+    throw std::invalid_argument{ "Invalid cron.d name: " + name };
+  }
+
+  return load_file( std::string{ CRON_DROPIN_DIR } + "/" + name, true );
+}
+
+crontab crontab::load_file( const std::string& path, bool system )
+{
+  if( path.empty() )
+  {
+    throw std::invalid_argument{ "Path is empty" };
+  }
+
+  crontab table;
+  table.system_ = system;
+  table.path_ = path;
+  table.parse_content( details::read_table( path ) );
+  return table;
+}
+
+void crontab::parse_content( const std::string& content )
+{
+  std::vector< std::string > texts;
+  boost::split( texts, content, boost::is_any_of( "\n" ) );
+  if( !texts.empty() && texts.back().empty() )
+  {
+    texts.pop_back();
+  }
+
+  std::string tag;
+  for( const std::string& text : texts )
+  {
+    line l;
+    l.text = text;
+    l.is_entry = details::parse_entry( text, system_, l.entry );
+
+    // the tag comment is merged into the entry below it
+    if( l.is_entry && !tag.empty() )
+    {
+      l.entry.tag = tag;
+      l.text = lines_.back().text + "\n" + text;
+      lines_.pop_back();
+    }
+
+    std::string trimmed{ boost::trim_copy( text ) };
+    tag = boost::starts_with( trimmed, CRON_TAG_PREFIX )? boost::trim_copy( trimmed.substr( std::strlen( CRON_TAG_PREFIX ) ) )
+                                                        : std::string{};
+    lines_.push_back( l );
+  }
+}
+
+std::vector< cron_entry > crontab::entries() const
+{
+  std::vector< cron_entry > result;
+  for( const line& l : lines_ )
+  {
+    if( l.is_entry )
+    {
+      result.push_back( l.entry );
+    }
+  }
+
+  return result;
+}
+
+const cron_entry* crontab::find( const std::string& tag ) const
+{
+  auto it = std::find_if( lines_.begin(), lines_.end(), [ & ]( const line& l ){ return l.is_entry && l.entry.tag == tag; } );
+  return it != lines_.end() && !tag.empty()? &it->entry : nullptr;
+}
+
+bool crontab::set( const cron_entry& entry )
+{
+  line l;
+  l.is_entry = true;
+  l.entry = entry;
+  l.entry.tag = boost::trim_copy( entry.tag );
+  l.entry.command = boost::trim_copy( entry.command );
+  l.entry.schedule = details::normalize_schedule( entry.schedule );
+
+  if( l.entry.tag.empty() || l.entry.tag.find( '\n' ) != std::string::npos )
+  {
+    throw std::invalid_argument{ "Invalid cron entry tag" };
+  }
+
+  if( l.entry.command.empty() || l.entry.command.find( '\n' ) != std::string::npos )
+  {
+    throw std::invalid_argument{ "Invalid cron command" };
+  }
+
+  if( system_ )
+  {
+    details::validate_user( l.entry.user );
+  }
+  else if( !l.entry.user.empty() )
+  {
+    throw std::invalid_argument{ "User is only set in system crontabs" };
+  }
+
+  l.text = details::format_entry( l.entry );
+
+  auto it = std::find_if( lines_.begin(), lines_.end(), [ & ]( const line& o ){ return o.is_entry && o.entry.tag == l.entry.tag; } );
+  if( it == lines_.end() )
+  {
+    lines_.push_back( l );
+    return true;
+  }
+
+  if( details::same_entry( it->entry, l.entry ) )
+  {
+    return false;
+  }
+
+  *it = l;
+  return true;
+}
+
+bool crontab::remove( const std::string& tag )
+{
+  auto it = std::find_if( lines_.begin(), lines_.end(), [ & ]( const line& l ){ return l.is_entry && l.entry.tag == tag; } );
+  if( tag.empty() || it == lines_.end() )
+  {
+    return false;
+  }
+
+  lines_.erase( it );
+  return true;
+}
+
+std::string crontab::to_string() const
+{
+  std::string content;
+  for( const line& l : lines_ )
+  {
+    content += l.text + "\n";
+  }
+
+  return content;
+}
+
+bool crontab::save()
+{
+  if( !user_.empty() )
+  {
+    return details::install_user_table( user_, to_string() );
+  }
+
+  if( path_.empty() )
+  {
+    throw std::logic_error{ "Crontab was not loaded from a file" };
   }
 
-  details::execute_sys_command( "crontab -r -u " + user );
+  return details::write_table( path_, to_string(), 0644, static_cast< uid_t >( -1 ), static_cast< gid_t >( -1 ) );
 }
 
 }// cron
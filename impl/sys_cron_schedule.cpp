@@ -0,0 +1,675 @@
+#include "../sys_cron_schedule.h"
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <cctype>
+#include <ctime>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <condition_variable>
+
+#include <boost/algorithm/string.hpp>
+
+#include "../sys_time_zone.h"
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace cron
+{
+
+namespace details
+{
+
+const std::vector< std::string > month_names{ "", "jan", "feb", "mar", "apr", "may", "jun",
+                                              "jul", "aug", "sep", "oct", "nov", "dec" };
+const std::vector< std::string > weekday_names{ "sun", "mon", "tue", "wed", "thu", "fri", "sat" };
+
+int parse_cron_number( const std::string& value, int min, int max, const std::vector< std::string >* names )
+{
+  if( names && !value.empty() && std::isalpha( static_cast< unsigned char >( value[ 0 ] ) ) )
+  {
+    for( size_t i{ 0 }; i < names->size(); ++i )
+    {
+      if( !( *names )[ i ].empty() && boost::iequals( value, ( *names )[ i ] ) )
+      {
+        return static_cast< int >( i );
+      }
+    }
+  }
+  else if( !value.empty() && value.size() < 4 &&
+           std::all_of( value.begin(), value.end(), []( char c ){ return std::isdigit( static_cast< unsigned char >( c ) ); } ) )
+  {
+    int number{ std::stoi( value ) };
+    if( number >= min && number <= max )
+    {
+      return number;
+    }
+  }
+
+  throw std::invalid_argument{ "Invalid cron field value: " + value };
+}
+
+// Lists of "*", "a" or "a-b", each with an optional "/step"
+template< size_t N >
+void parse_cron_field( const std::string& field, int min, int max, const std::vector< std::string >* names, std::bitset< N >& bits )
+{
+  std::vector< std::string > items;
+  boost::split( items, field, boost::is_any_of( "," ) );
+
+  for( const std::string& item : items )
+  {
+    std::string range{ item };
+    int step{ 1 };
+
+    size_t slash{ item.find( '/' ) };
+    if( slash != std::string::npos )
+    {
+      range = item.substr( 0, slash );
+      step = parse_cron_number( item.substr( slash + 1 ), 1, max, nullptr );
+    }
+
+    int first{ min };
+    int last{ max };
+    if( range != "*" )
+    {
+      size_t dash{ range.find( '-' ) };
+      first = parse_cron_number( range.substr( 0, dash ), min, max, names );
+      if( dash != std::string::npos )
+      {
+        last = parse_cron_number( range.substr( dash + 1 ), min, max, names );
+      }
+      else if( slash == std::string::npos )
+      {
+        last = first;
+      }
+
+      if( last < first )
+      {
+        throw std::invalid_argument{ "Invalid cron range: " + range };
+      }
+    }
+
+    for( int i{ first }; i <= last; i += step )
+    {
+      // 7 is Sunday too
+      bits.set( static_cast< size_t >( i ) % N );
+    }
+  }
+}
+
+template< size_t N >
+int next_bit( const std::bitset< N >& bits, int from ) noexcept
+{
+  for( size_t i( from ); i < N; ++i )
+  {
+    if( bits.test( i ) )
+    {
+      return static_cast< int >( i );
+    }
+  }
+
+  return -1;
+}
+
+std::string expand_nickname( const std::string& expression )
+{
+  static const std::map< std::string, std::string > nicknames{ { "@yearly", "0 0 1 1 *" },
+                                                               { "@annually", "0 0 1 1 *" },
+                                                               { "@monthly", "0 0 1 * *" },
+                                                               { "@weekly", "0 0 * * 0" },
+                                                               { "@daily", "0 0 * * *" },
+                                                               { "@midnight", "0 0 * * *" },
+                                                               { "@hourly", "0 * * * *" } };
+
+  auto it = nicknames.find( expression );
+  if( it == nicknames.end() )
+  {
+    // @reboot has no fire times either
+    throw std::invalid_argument{ "Invalid cron expression: " + expression };
+  }
+
+  return it->second;
+}
+
+int64_t to_seconds( const std::chrono::system_clock::time_point& time )
+{
+  auto since_epoch = time.time_since_epoch();
+  auto seconds = std::chrono::duration_cast< std::chrono::seconds >( since_epoch );
+  if( seconds > since_epoch )
+  {
+    seconds -= std::chrono::seconds{ 1 };
+  }
+
+  return seconds.count();
+}
+
+std::chrono::system_clock::time_point from_seconds( int64_t seconds )
+{
+  return std::chrono::system_clock::time_point{ std::chrono::seconds{ seconds } };
+}
+
+}// details
+
+cron_expression::cron_expression( const std::string& expression, const std::string& time_zone )
+  : expression_( expression )
+{
+  std::string trimmed{ boost::trim_copy( expression ) };
+  if( !trimmed.empty() && trimmed[ 0 ] == '@' )
+  {
+    trimmed = details::expand_nickname( trimmed );
+  }
+
+  std::vector< std::string > fields;
+  boost::split( fields, trimmed, boost::is_any_of( " \t" ), boost::token_compress_on );
+  if( fields.size() == 5 )
+  {
+    fields.insert( fields.begin(), "0" );
+  }
+
+  if( fields.size() != 6 )
+  {
+    throw std::invalid_argument{ "Invalid cron expression: " + expression };
+  }
+
+  details::parse_cron_field( fields[ 0 ], 0, 59, nullptr, seconds_ );
+  details::parse_cron_field( fields[ 1 ], 0, 59, nullptr, minutes_ );
+  details::parse_cron_field( fields[ 2 ], 0, 23, nullptr, hours_ );
+  details::parse_cron_field( fields[ 3 ], 1, 31, nullptr, days_ );
+  details::parse_cron_field( fields[ 4 ], 1, 12, &details::month_names, months_ );
+  details::parse_cron_field( fields[ 5 ], 0, 7, &details::weekday_names, weekdays_ );
+
+  any_day_ = fields[ 3 ][ 0 ] == '*';
+  any_weekday_ = fields[ 5 ][ 0 ] == '*';
+
+  // with a weekday some day always matches, otherwise the days must exist in the months
+  bool fires{ !any_weekday_ };
+  static const int month_days[]{ 0, 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  for( int month{ 1 }; !fires && month <= 12; ++month )
+  {
+    int day{ details::next_bit( days_, 1 ) };
+    fires = months_.test( month ) && day != -1 && day <= month_days[ month ];
+  }
+
+  if( !fires )
+  {
+    throw std::invalid_argument{ "Cron expression never fires: " + expression };
+  }
+
+  if( time_zone == "UTC" )
+  {
+    utc_ = true;
+  }
+  else if( !time_zone.empty() )
+  {
+    zone_ = time::load_time_zone( time_zone );
+  }
+}
+
+const std::string& cron_expression::expression() const noexcept
+{
+  return expression_;
+}
+
+bool cron_expression::day_matches( int day, int weekday ) const noexcept
+{
+  if( any_day_ || any_weekday_ )
+  {
+    return days_.test( day ) && weekdays_.test( weekday );
+  }
+
+  return days_.test( day ) || weekdays_.test( weekday );
+}
+
+int32_t cron_expression::offset_at( int64_t unix_time ) const
+{
+  if( utc_ )
+  {
+    return 0;
+  }
+
+  if( zone_ )
+  {
+    return zone_->offset_at( unix_time ).utc_offset;
+  }
+
+  time_t time( unix_time );
+  std::tm local;
+  localtime_r( &time, &local );
+  return static_cast< int32_t >( local.tm_gmtoff );
+}
+
+// Local time is counted in seconds like UTC, so gmtime_r and timegm do the calendar work.
+// Units that don't match skip straight to the next matching value of the bitset
+int64_t cron_expression::next_local( int64_t local ) const
+{
+  time_t time( local );
+  std::tm t;
+  gmtime_r( &time, &t );
+
+  // every valid expression fires within the 28 year calendar cycle
+  const int last_year{ t.tm_year + 30 };
+
+  while( t.tm_year <= last_year )
+  {
+    int bit;
+    if( !months_.test( t.tm_mon + 1 ) )
+    {
+      bit = details::next_bit( months_, t.tm_mon + 1 );
+      if( bit == -1 )
+      {
+        ++t.tm_year;
+        bit = details::next_bit( months_, 1 );
+      }
+
+      t.tm_mon = bit - 1;
+      t.tm_mday = 1;
+      t.tm_hour = t.tm_min = t.tm_sec = 0;
+    }
+    else if( !day_matches( t.tm_mday, t.tm_wday ) )
+    {
+      ++t.tm_mday;
+      t.tm_hour = t.tm_min = t.tm_sec = 0;
+    }
+    else if( !hours_.test( t.tm_hour ) )
+    {
+      bit = details::next_bit( hours_, t.tm_hour );
+      t.tm_mday += bit == -1? 1 : 0;
+      t.tm_hour = bit == -1? 0 : bit;
+      t.tm_min = t.tm_sec = 0;
+    }
+    else if( !minutes_.test( t.tm_min ) )
+    {
+      bit = details::next_bit( minutes_, t.tm_min );
+      t.tm_hour += bit == -1? 1 : 0;
+      t.tm_min = bit == -1? 0 : bit;
+      t.tm_sec = 0;
+    }
+    else if( !seconds_.test( t.tm_sec ) )
+    {
+      bit = details::next_bit( seconds_, t.tm_sec );
+      t.tm_min += bit == -1? 1 : 0;
+      t.tm_sec = bit == -1? 0 : bit;
+    }
+    else
+    {
+      return timegm( &t );
+    }
+
+    // normalizes the carried fields and sets the weekday
+    timegm( &t );
+  }
+
+  return -1;
+}
+
+// First instant in ( from, to ] with the offset
+int64_t cron_expression::transition_between( int64_t from, int64_t to, int32_t offset ) const
+{
+  while( to - from > 1 )
+  {
+    int64_t middle{ from + ( to - from ) / 2 };
+    if( offset_at( middle ) == offset )
+    {
+      to = middle;
+    }
+    else
+    {
+      from = middle;
+    }
+  }
+
+  return to;
+}
+
+std::chrono::system_clock::time_point cron_expression::next( const std::chrono::system_clock::time_point& after ) const
+{
+  int64_t from{ details::to_seconds( after ) + 1 };
+  int64_t local{ from + offset_at( from ) };
+  int64_t result{ -1 };
+
+  // each iteration skips a local time that has already passed in UTC, which only happens around DST changes
+  for( int i{ 0 }; i < 1000; ++i )
+  {
+    local = next_local( local );
+    if( local == -1 )
+    {
+      break;
+    }
+
+    // offsets before and after a possible change around this local time
+    int32_t before{ offset_at( local - 86400 ) };
+    int32_t after_change{ offset_at( local + 86400 ) };
+    int64_t first{ local - before };
+    int64_t second{ local - after_change };
+    bool first_valid{ offset_at( first ) == before };
+    bool second_valid{ before != after_change && offset_at( second ) == after_change };
+
+    if( !first_valid && !second_valid )
+    {
+      // skipped by the change, fires when it happens
+      int64_t change{ transition_between( std::min( first, second ), std::max( first, second ), after_change ) };
+      if( change >= from )
+      {
+        result = change;
+        break;
+      }
+    }
+    else if( first_valid && second_valid )
+    {
+      // repeated by the change
+      int64_t earlier{ std::min( first, second ) };
+      int64_t later{ std::max( first, second ) };
+      if( earlier >= from || ( later >= from && hours_.all() ) )
+      {
+        result = earlier >= from? earlier : later;
+        break;
+      }
+    }
+    else
+    {
+      int64_t time{ first_valid? first : second };
+      if( time >= from )
+      {
+        result = time;
+        break;
+      }
+    }
+
+    ++local;
+  }
+
+  if( result == -1 )
+  {
+    return std::chrono::system_clock::time_point::max();
+  }
+
+  // clocks went back in between: local times already passed repeat, and jobs running every hour fire again
+  int32_t result_offset{ offset_at( result ) };
+  if( hours_.all() && result_offset < offset_at( from ) )
+  {
+    int64_t change{ transition_between( from, result, result_offset ) };
+    int64_t repeated{ next_local( change + result_offset ) };
+    if( repeated != -1 && repeated - result_offset < result )
+    {
+      result = repeated - result_offset;
+    }
+  }
+
+  return details::from_seconds( result );
+}
+
+std::vector< std::chrono::system_clock::time_point > cron_expression::next( const std::chrono::system_clock::time_point& after,
+                                                                            size_t count ) const
+{
+  std::vector< std::chrono::system_clock::time_point > result;
+  auto time = after;
+  while( result.size() < count )
+  {
+    time = next( time );
+    if( time == std::chrono::system_clock::time_point::max() )
+    {
+      break;
+    }
+
+    result.push_back( time );
+  }
+
+  return result;
+}
+
+struct scheduler::impl
+{
+  struct entry
+  {
+    entry( size_t id, const cron_expression& expression, const job& task )
+      : id( id ), expression( expression ), task( task ) {}
+
+    size_t id;
+    cron_expression expression;
+    job task;
+    int64_t due{ 0 }; // seconds since the epoch
+  };
+
+  using entry_ptr = std::shared_ptr< entry >;
+
+  impl() : wheel( CRON_WHEEL_SLOTS ) {}
+
+  bool alive( const entry_ptr& e ) const;
+  void schedule( const entry_ptr& e, int64_t after );
+  void reschedule_all( int64_t after );
+  void tick( size_t slot, int64_t now, std::vector< entry_ptr >& fired );
+  void run();
+
+  mutable std::mutex mutex;
+  std::condition_variable wakeup;
+
+  // a slot holds the jobs due at seconds equal to its index modulo the wheel size, whatever the round
+  std::vector< std::vector< entry_ptr > > wheel;
+  std::unordered_map< size_t, entry_ptr > entries;
+  size_t next_id{ 0 };
+  int64_t cursor{ 0 }; // last processed second
+
+  std::atomic< bool > running{ false };
+  std::thread thread;
+};
+
+bool scheduler::impl::alive( const entry_ptr& e ) const
+{
+  auto it = entries.find( e->id );
+  return it != entries.end() && it->second == e;
+}
+
+void scheduler::impl::schedule( const entry_ptr& e, int64_t after )
+{
+  auto next = e->expression.next( details::from_seconds( after ) );
+  if( next == std::chrono::system_clock::time_point::max() )
+  {
+    entries.erase( e->id );
+    return;
+  }
+
+  e->due = details::to_seconds( next );
+  wheel[ static_cast< size_t >( e->due ) % wheel.size() ].push_back( e );
+}
+
+void scheduler::impl::reschedule_all( int64_t after )
+{
+  for( auto& slot : wheel )
+  {
+    slot.clear();
+  }
+
+  std::vector< entry_ptr > all;
+  for( const auto& it : entries )
+  {
+    all.push_back( it.second );
+  }
+
+  for( const entry_ptr& e : all )
+  {
+    schedule( e, after );
+  }
+}
+
+// Removed jobs are dropped from their slot lazily
+void scheduler::impl::tick( size_t slot, int64_t now, std::vector< entry_ptr >& fired )
+{
+  std::vector< entry_ptr >& jobs( wheel[ slot ] );
+  size_t kept{ 0 };
+  std::vector< entry_ptr > due;
+  for( size_t i{ 0 }; i < jobs.size(); ++i )
+  {
+    if( !alive( jobs[ i ] ) )
+    {
+      continue;
+    }
+
+    if( jobs[ i ]->due <= now )
+    {
+      due.push_back( jobs[ i ] );
+    }
+    else
+    {
+      jobs[ kept++ ] = jobs[ i ];
+    }
+  }
+
+  jobs.resize( kept );
+
+  for( const entry_ptr& e : due )
+  {
+    fired.push_back( e );
+    schedule( e, now );
+  }
+}
+
+void scheduler::impl::run()
+{
+  std::unique_lock< std::mutex > lock{ mutex };
+  std::vector< entry_ptr > fired;
+
+  while( running )
+  {
+    auto now = std::chrono::system_clock::now();
+    int64_t second{ details::to_seconds( now ) };
+
+    fired.clear();
+    if( second < cursor - 1 )
+    {
+      // clock was set back, the jobs would wait for the old time otherwise
+      cursor = second;
+      reschedule_all( cursor );
+    }
+    else if( second - cursor >= static_cast< int64_t >( wheel.size() ) )
+    {
+      // clock jumped over the whole wheel, everything missed fires once
+      for( size_t slot{ 0 }; slot < wheel.size(); ++slot )
+      {
+        tick( slot, second, fired );
+      }
+
+      cursor = second;
+    }
+    else
+    {
+      for( ; cursor < second; ++cursor )
+      {
+        tick( static_cast< size_t >( cursor + 1 ) % wheel.size(), cursor + 1, fired );
+      }
+    }
+
+    if( !fired.empty() )
+    {
+      lock.unlock();
+      for( const entry_ptr& e : fired )
+      {
+        try
+        {
+          e->task();
+        }
+        catch( ... ){}
+      }
+
+      lock.lock();
+      continue;
+    }
+
+    auto left = std::chrono::seconds{ 1 } - ( now.time_since_epoch() - std::chrono::seconds{ second } );
+    wakeup.wait_for( lock, left );
+  }
+}
+
+scheduler::scheduler()
+  : impl_( new impl )
+{
+}
+
+scheduler::~scheduler()
+{
+  stop();
+}
+
+size_t scheduler::add( const cron_expression& expression, const job& task )
+{
+  if( !task )
+  {
+    throw std::invalid_argument{ "Job is empty" };
+  }
+
+  std::lock_guard< std::mutex > lock{ impl_->mutex };
+
+  auto e = std::make_shared< impl::entry >( impl_->next_id++, expression, task );
+  impl_->entries.emplace( e->id, e );
+
+  // the tick for seconds up to the cursor is already done
+  int64_t now{ details::to_seconds( std::chrono::system_clock::now() ) };
+  impl_->schedule( e, impl_->running? std::max( now, impl_->cursor ) : now );
+  return e->id;
+}
+
+void scheduler::remove( size_t id )
+{
+  std::lock_guard< std::mutex > lock{ impl_->mutex };
+  impl_->entries.erase( id );
+}
+
+size_t scheduler::size() const
+{
+  std::lock_guard< std::mutex > lock{ impl_->mutex };
+  return impl_->entries.size();
+}
+
+void scheduler::start()
+{
+  if( impl_->running.exchange( true ) )
+  {
+    return;
+  }
+
+  if( impl_->thread.joinable() )
+  {
+    impl_->thread.join();
+  }
+
+  {
+    // jobs missed while stopped are not run
+    std::lock_guard< std::mutex > lock{ impl_->mutex };
+    impl_->cursor = details::to_seconds( std::chrono::system_clock::now() );
+    impl_->reschedule_all( impl_->cursor );
+  }
+
+  impl_->thread = std::thread{ &impl::run, impl_.get() };
+}
+
+void scheduler::stop()
+{
+  {
+    std::lock_guard< std::mutex > lock{ impl_->mutex };
+    impl_->running = false;
+  }
+
+  impl_->wakeup.notify_all();
+
+  if( impl_->thread.joinable() && impl_->thread.get_id() != std::this_thread::get_id() )
+  {
+    impl_->thread.join();
+  }
+}
+
+bool scheduler::running() const noexcept
+{
+  return impl_->running;
+}
+
+}// cron
+
+}// sys
+
+}// utils
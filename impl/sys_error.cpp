@@ -0,0 +1,89 @@
+#include "../sys_error.h"
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace details
+{
+
+class sys_error_category : public std::error_category
+{
+public:
+  const char* name() const noexcept override
+  {
+    return "utils.sys";
+  }
+
+  std::string message( int error ) const override
+  {
+    switch( static_cast< errc >( error ) )
+    {
+      case errc::invalid_argument: return "Invalid argument";
+      case errc::not_found: return "Not found";
+      case errc::invalid_format: return "Invalid format";
+      case errc::not_supported: return "Not supported";
+    }
+
+    return "Unknown error " + std::to_string( error );
+  }
+
+  std::error_condition default_error_condition( int error ) const noexcept override
+  {
+    switch( static_cast< errc >( error ) )
+    {
+      case errc::invalid_argument: return std::errc::invalid_argument;
+      case errc::not_found: return std::errc::no_such_file_or_directory;
+      case errc::not_supported: return std::errc::not_supported;
+      default: return std::error_condition{ error, *this };
+    }
+  }
+};
+
+}// details
+
+const std::error_category& error_category() noexcept
+{
+  static const details::sys_error_category category;
+  return category;
+}
+
+std::error_code make_error_code( errc error ) noexcept
+{
+  return std::error_code{ static_cast< int >( error ), error_category() };
+}
+
+std::error_code errno_code( int error ) noexcept
+{
+  return std::error_code{ error, std::system_category() };
+}
+
+std::string error_message( int error )
+{
+  std::array< char, 256 > buf;
+#if defined( _GNU_SOURCE )
+  return strerror_r( error, buf.data(), buf.size() );
+#else
+  return strerror_r( error, buf.data(), buf.size() ) == 0? buf.data() : "Unknown error " + std::to_string( error );
+#endif
+}
+
+void throw_error( const std::error_code& error, const std::string& context )
+{
+  if( error == make_error_code( errc::invalid_argument ) )
+  {
+    throw std::invalid_argument{ context };
+  }
+
+  throw std::system_error{ error, context };
+}
+
+}// sys
+
+}// utils
@@ -4,10 +4,15 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <array>
+#include <cstring>
+#include <algorithm>
+
 #define BOOST_NO_CXX11_SCOPED_ENUMS
 #include <boost/filesystem.hpp>
 #undef BOOST_NO_CXX11_SCOPED_ENUMS
 
+#include "../sys_error.h"
 #include "execute_sys_command.h"
 
 namespace utils
@@ -34,7 +39,7 @@ void move_file( const std::string& from, const std::string& to )
   {
     if( std::rename( from.c_str(), to.c_str() ) != 0 )
     {
-      throw std::runtime_error{ std::string{ "Failed to move file: " } + std::strerror( errno ) };
+      throw std::runtime_error{ std::string{ "Failed to move file: " } + sys::error_message( errno ) };
     }
   }
   else // cross-partition
@@ -55,7 +60,7 @@ std::string get_partition_by_path( const std::string& path )
   struct stat s;
   if( stat( path.c_str(), &s ) != 0 )
   {
-    throw std::runtime_error{ std::string{ "stat failed for path: " } + path + " : " + std::strerror( errno ) };
+    throw std::runtime_error{ std::string{ "stat failed for path: " } + path + " : " + sys::error_message( errno ) };
   }
 
   dev_t dev{ s.st_dev };
@@ -66,17 +71,38 @@ std::string get_partition_by_path( const std::string& path )
     throw std::runtime_error{ "setmntent failed on /proc/mounts" };
   }
 
-  std::string partition_name;
+  // only mount points on the path can hold it, the others are not stat'ed, so a hung one elsewhere doesn't matter
+  std::string real_path{ boost::filesystem::canonical( path ).string() };
+  std::vector< std::pair< std::string, std::string > > candidates; // mount point, partition
   mntent mnt;
   std::array< char, 512 > arr;
 
   while( getmntent_r( fp.get(), &mnt, arr.data(), arr.size() ) )
   {
-    if( stat( mnt.mnt_dir, &s ) == 0 &&
-        s.st_dev == dev &&
-        ( strcmp( mnt.mnt_fsname, "rootfs" ) != 0 ) )
+    size_t length{ strlen( mnt.mnt_dir ) };
+    bool on_path{ length && real_path.compare( 0, length, mnt.mnt_dir ) == 0 &&
+                  ( length == real_path.size() || real_path[ length ] == '/' || mnt.mnt_dir[ length - 1 ] == '/' ) };
+    if( on_path && strcmp( mnt.mnt_fsname, "rootfs" ) != 0 )
+    {
+      candidates.emplace_back( mnt.mnt_dir, mnt.mnt_fsname );
+    }
+  }
+
+  // the deepest first, and of those mounted on the same point the last one, which hides the others
+  std::reverse( candidates.begin(), candidates.end() );
+  std::stable_sort( candidates.begin(), candidates.end(), []( const std::pair< std::string, std::string >& l,
+                                                              const std::pair< std::string, std::string >& r )
+  {
+    return l.first.size() > r.first.size();
+  } );
+
+  std::string partition_name;
+  for( const std::pair< std::string, std::string >& candidate : candidates )
+  {
+    struct stat mount_point;
+    if( stat( candidate.first.c_str(), &mount_point ) == 0 && mount_point.st_dev == dev )
     {
-      partition_name = mnt.mnt_fsname;
+      partition_name = candidate.second;
       break;
     }
   }
@@ -0,0 +1,514 @@
+#include "../sys_gpio_chip.h"
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include <boost/filesystem.hpp>
+
+#include "../sys_error.h"
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace gpio
+{
+
+namespace details
+{
+
+std::runtime_error gpio_error( const std::string& what )
+{
+  return std::runtime_error{ what + ": " + sys::error_message( errno ) };
+}
+
+void copy_name( char* dst, const std::string& src )
+{
+  std::strncpy( dst, src.c_str(), GPIO_MAX_NAME_SIZE - 1 );
+  dst[ GPIO_MAX_NAME_SIZE - 1 ] = '\0';
+}
+
+uint64_t config_flags( const line_config& config )
+{
+  uint64_t flags{ 0 };
+
+  if( config.direction == gpio_direction::in )
+  {
+    flags |= GPIO_V2_LINE_FLAG_INPUT;
+
+    if( config.edge == gpio_edge::rising || config.edge == gpio_edge::both )
+    {
+      flags |= GPIO_V2_LINE_FLAG_EDGE_RISING;
+    }
+
+    if( config.edge == gpio_edge::falling || config.edge == gpio_edge::both )
+    {
+      flags |= GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    }
+
+    if( config.edge != gpio_edge::none && config.realtime_timestamps )
+    {
+      flags |= GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME;
+    }
+  }
+  else
+  {
+    if( config.edge != gpio_edge::none || config.debounce.count() )
+    {
+      throw std::invalid_argument{ "Edge detection and debounce are only available for inputs" };
+    }
+
+    flags |= GPIO_V2_LINE_FLAG_OUTPUT;
+
+    if( config.drive == gpio_drive::open_drain )
+    {
+      flags |= GPIO_V2_LINE_FLAG_OPEN_DRAIN;
+    }
+    else if( config.drive == gpio_drive::open_source )
+    {
+      flags |= GPIO_V2_LINE_FLAG_OPEN_SOURCE;
+    }
+  }
+
+  switch( config.bias )
+  {
+    case gpio_bias::disabled: flags |= GPIO_V2_LINE_FLAG_BIAS_DISABLED; break;
+    case gpio_bias::pull_up: flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_UP; break;
+    case gpio_bias::pull_down: flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN; break;
+    case gpio_bias::as_is: break;
+  }
+
+  if( config.active_low )
+  {
+    flags |= GPIO_V2_LINE_FLAG_ACTIVE_LOW;
+  }
+
+  return flags;
+}
+
+gpio_v2_line_config make_config( const line_config& config, const std::vector< int8_t >& output_values, size_t lines )
+{
+  gpio_v2_line_config result;
+  std::memset( &result, 0, sizeof( result ) );
+  result.flags = config_flags( config );
+
+  uint64_t all_lines{ lines == 64? ~uint64_t{ 0 } : ( uint64_t{ 1 } << lines ) - 1 };
+
+  if( config.direction == gpio_direction::out && !output_values.empty() )
+  {
+    if( output_values.size() != lines )
+    {
+      throw std::invalid_argument{ "Output values count doesn't match lines count" };
+    }
+
+    gpio_v2_line_config_attribute& attr( result.attrs[ result.num_attrs++ ] );
+    attr.attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    attr.mask = all_lines;
+    for( size_t i{ 0 }; i < lines; ++i )
+    {
+      if( output_values[ i ] )
+      {
+        attr.attr.values |= uint64_t{ 1 } << i;
+      }
+    }
+  }
+
+  if( config.debounce.count() )
+  {
+    gpio_v2_line_config_attribute& attr( result.attrs[ result.num_attrs++ ] );
+    attr.attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+    attr.attr.debounce_period_us = config.debounce.count();
+    attr.mask = all_lines;
+  }
+
+  return result;
+}
+
+}// details
+
+line_request::line_request( int fd, const std::vector< uint32_t >& offsets )
+  : fd_( fd ),
+    offsets_( offsets )
+{
+}
+
+line_request::line_request( line_request&& other ) noexcept
+  : fd_( other.fd_ ),
+    offsets_( std::move( other.offsets_ ) )
+{
+  other.fd_ = -1;
+}
+
+line_request& line_request::operator=( line_request&& other ) noexcept
+{
+  if( this != &other )
+  {
+    if( fd_ != -1 )
+    {
+      close( fd_ );
+    }
+
+    fd_ = other.fd_;
+    offsets_ = std::move( other.offsets_ );
+    other.fd_ = -1;
+  }
+
+  return *this;
+}
+
+line_request::~line_request()
+{
+  if( fd_ != -1 )
+  {
+    close( fd_ );
+  }
+}
+
+const std::vector< uint32_t >& line_request::offsets() const noexcept
+{
+  return offsets_;
+}
+
+int line_request::fd() const noexcept
+{
+  return fd_;
+}
+
+uint64_t line_request::mask_of( const std::vector< uint32_t >& offsets ) const
+{
+  uint64_t mask{ 0 };
+  for( uint32_t offset : offsets )
+  {
+    auto it = std::find( offsets_.begin(), offsets_.end(), offset );
+    if( it == offsets_.end() )
+    {
+      throw std::invalid_argument{ "Line " + std::to_string( offset ) + " is not requested" };
+    }
+
+    mask |= uint64_t{ 1 } << ( it - offsets_.begin() );
+  }
+
+  return mask;
+}
+
+std::vector< int8_t > line_request::get_values() const
+{
+  gpio_v2_line_values values;
+  values.bits = 0;
+  values.mask = offsets_.size() == 64? ~uint64_t{ 0 } : ( uint64_t{ 1 } << offsets_.size() ) - 1;
+
+  if( ioctl( fd_, GPIO_V2_LINE_GET_VALUES_IOCTL, &values ) == -1 )
+  {
+    throw details::gpio_error( "Could not get line values" );
+  }
+
+  std::vector< int8_t > result( offsets_.size() );
+  for( size_t i{ 0 }; i < result.size(); ++i )
+  {
+    result[ i ] = ( values.bits >> i ) & 1;
+  }
+
+  return result;
+}
+
+int8_t line_request::get_value( uint32_t offset ) const
+{
+  gpio_v2_line_values values;
+  values.bits = 0;
+  values.mask = mask_of( { offset } );
+
+  if( ioctl( fd_, GPIO_V2_LINE_GET_VALUES_IOCTL, &values ) == -1 )
+  {
+    throw details::gpio_error( "Could not get line value" );
+  }
+
+  return ( values.bits & values.mask )? 1 : 0;
+}
+
+void line_request::set_values( const std::vector< int8_t >& values )
+{
+  set_values( offsets_, values );
+}
+
+void line_request::set_values( const std::vector< uint32_t >& offsets, const std::vector< int8_t >& values )
+{
+  if( offsets.size() != values.size() )
+  {
+    throw std::invalid_argument{ "Values count doesn't match lines count" };
+  }
+
+  gpio_v2_line_values line_values;
+  line_values.bits = 0;
+  line_values.mask = 0;
+
+  for( size_t i{ 0 }; i < offsets.size(); ++i )
+  {
+    uint64_t bit{ mask_of( { offsets[ i ] } ) };
+    line_values.mask |= bit;
+    if( values[ i ] )
+    {
+      line_values.bits |= bit;
+    }
+  }
+
+  if( ioctl( fd_, GPIO_V2_LINE_SET_VALUES_IOCTL, &line_values ) == -1 )
+  {
+    throw details::gpio_error( "Could not set line values" );
+  }
+}
+
+void line_request::set_value( uint32_t offset, int8_t value )
+{
+  set_values( std::vector< uint32_t >{ offset }, std::vector< int8_t >{ value } );
+}
+
+void line_request::reconfigure( const line_config& config, const std::vector< int8_t >& output_values )
+{
+  gpio_v2_line_config line_config( details::make_config( config, output_values, offsets_.size() ) );
+  if( ioctl( fd_, GPIO_V2_LINE_SET_CONFIG_IOCTL, &line_config ) == -1 )
+  {
+    throw details::gpio_error( "Could not reconfigure lines" );
+  }
+}
+
+bool line_request::wait_events( std::chrono::milliseconds timeout ) const
+{
+  pollfd fd{ fd_, POLLIN, 0 };
+  while( true )
+  {
+    int result{ poll( &fd, 1, timeout.count() < 0? -1 : timeout.count() ) };
+    if( result == -1 && errno == EINTR )
+    {
+      continue;
+    }
+
+    if( result == -1 )
+    {
+      throw details::gpio_error( "Could not wait for line events" );
+    }
+
+    return result > 0;
+  }
+}
+
+std::vector< line_event > line_request::read_events()
+{
+  std::array< gpio_v2_line_event, 16 > buf;
+  ssize_t size;
+  do
+  {
+    size = read( fd_, buf.data(), sizeof( buf ) );
+  }
+  while( size == -1 && errno == EINTR );
+
+  if( size == -1 )
+  {
+    throw details::gpio_error( "Could not read line events" );
+  }
+
+  std::vector< line_event > result;
+  for( size_t i{ 0 }; i < size / sizeof( gpio_v2_line_event ); ++i )
+  {
+    line_event event;
+    event.offset = buf[ i ].offset;
+    event.edge = buf[ i ].id == GPIO_V2_LINE_EVENT_RISING_EDGE? gpio_edge::rising : gpio_edge::falling;
+    event.timestamp = std::chrono::nanoseconds{ buf[ i ].timestamp_ns };
+    event.seqno = buf[ i ].seqno;
+    event.line_seqno = buf[ i ].line_seqno;
+    result.push_back( event );
+  }
+
+  return result;
+}
+
+chip::chip( const std::string& device )
+  : path_( device.find( '/' ) == std::string::npos? GPIO_DEV_DIR "/" + device : device )
+{
+  fd_ = open( path_.c_str(), O_RDWR | O_CLOEXEC );
+  if( fd_ == -1 )
+  {
+    throw details::gpio_error( "Could not open " + path_ );
+  }
+}
+
+chip::chip( chip&& other ) noexcept
+  : path_( std::move( other.path_ ) ),
+    fd_( other.fd_ )
+{
+  other.fd_ = -1;
+}
+
+chip& chip::operator=( chip&& other ) noexcept
+{
+  if( this != &other )
+  {
+    if( fd_ != -1 )
+    {
+      close( fd_ );
+    }
+
+    path_ = std::move( other.path_ );
+    fd_ = other.fd_;
+    other.fd_ = -1;
+  }
+
+  return *this;
+}
+
+chip::~chip()
+{
+  if( fd_ != -1 )
+  {
+    close( fd_ );
+  }
+}
+
+std::vector< std::string > chip::list()
+{
+  namespace bfs = boost::filesystem;
+
+  std::vector< std::string > result;
+  boost::system::error_code ec;
+  for( bfs::directory_iterator it{ GPIO_DEV_DIR, ec }, end; !ec && it != end; it.increment( ec ) )
+  {
+    if( it->path().filename().string().compare( 0, 8, "gpiochip" ) == 0 )
+    {
+      result.push_back( it->path().string() );
+    }
+  }
+
+  // gpiochip2 before gpiochip10
+  std::sort( result.begin(), result.end(), []( const std::string& l, const std::string& r )
+  {
+    return l.size() != r.size()? l.size() < r.size() : l < r;
+  } );
+
+  return result;
+}
+
+const std::string& chip::path() const noexcept
+{
+  return path_;
+}
+
+chip_info chip::info() const
+{
+  gpiochip_info info;
+  std::memset( &info, 0, sizeof( info ) );
+  if( ioctl( fd_, GPIO_GET_CHIPINFO_IOCTL, &info ) == -1 )
+  {
+    throw details::gpio_error( "Could not get chip info" );
+  }
+
+  chip_info result;
+  result.name = info.name;
+  result.label = info.label;
+  result.lines = info.lines;
+  return result;
+}
+
+line_info chip::get_line_info( uint32_t offset ) const
+{
+  gpio_v2_line_info info;
+  std::memset( &info, 0, sizeof( info ) );
+  info.offset = offset;
+
+  if( ioctl( fd_, GPIO_V2_GET_LINEINFO_IOCTL, &info ) == -1 )
+  {
+    throw details::gpio_error( "Could not get info of line " + std::to_string( offset ) );
+  }
+
+  line_info result;
+  result.offset = info.offset;
+  result.name = info.name;
+  result.consumer = info.consumer;
+  result.direction = ( info.flags & GPIO_V2_LINE_FLAG_OUTPUT )? gpio_direction::out : gpio_direction::in;
+  result.used = info.flags & GPIO_V2_LINE_FLAG_USED;
+  result.active_low = info.flags & GPIO_V2_LINE_FLAG_ACTIVE_LOW;
+
+  bool rising( info.flags & GPIO_V2_LINE_FLAG_EDGE_RISING );
+  bool falling( info.flags & GPIO_V2_LINE_FLAG_EDGE_FALLING );
+  result.edge = ( rising && falling )? gpio_edge::both :
+                rising? gpio_edge::rising :
+                falling? gpio_edge::falling : gpio_edge::none;
+
+  if( info.flags & GPIO_V2_LINE_FLAG_BIAS_DISABLED )
+  {
+    result.bias = gpio_bias::disabled;
+  }
+  else if( info.flags & GPIO_V2_LINE_FLAG_BIAS_PULL_UP )
+  {
+    result.bias = gpio_bias::pull_up;
+  }
+  else if( info.flags & GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN )
+  {
+    result.bias = gpio_bias::pull_down;
+  }
+
+  if( info.flags & GPIO_V2_LINE_FLAG_OPEN_DRAIN )
+  {
+    result.drive = gpio_drive::open_drain;
+  }
+  else if( info.flags & GPIO_V2_LINE_FLAG_OPEN_SOURCE )
+  {
+    result.drive = gpio_drive::open_source;
+  }
+
+  return result;
+}
+
+uint32_t chip::find_line( const std::string& name ) const
+{
+  uint32_t lines{ info().lines };
+  for( uint32_t offset{ 0 }; offset < lines; ++offset )
+  {
+    if( get_line_info( offset ).name == name )
+    {
+      return offset;
+    }
+  }
+
+  throw std::invalid_argument{ "No line named " + name + " on " + path_ };
+}
+
+line_request chip::request_lines( const std::vector< uint32_t >& offsets,
+                                  const line_config& config,
+                                  const std::vector< int8_t >& output_values,
+                                  const std::string& consumer ) const
+{
+  if( offsets.empty() || offsets.size() > GPIO_V2_LINES_MAX )
+  {
+    throw std::invalid_argument{ "Invalid lines count" };
+  }
+
+  gpio_v2_line_request request;
+  std::memset( &request, 0, sizeof( request ) );
+  std::copy( offsets.begin(), offsets.end(), request.offsets );
+  details::copy_name( request.consumer, consumer );
+  request.config = details::make_config( config, output_values, offsets.size() );
+  request.num_lines = offsets.size();
+
+  if( ioctl( fd_, GPIO_V2_GET_LINE_IOCTL, &request ) == -1 )
+  {
+    throw details::gpio_error( "Could not request lines from " + path_ );
+  }
+
+  return line_request{ request.fd, offsets };
+}
+
+}// gpio
+
+}// sys
+
+}// utils
@@ -1,16 +1,19 @@
 #include "../sys_gpio_methods.h"
 
+#include <mutex>
 #include <thread>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
-#include <boost/format.hpp>
-#include <boost/filesystem.hpp>
-#include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string.hpp>
 
 #include "../aux_methods.h"
-#include "execute_sys_command.h"
+#include "../sys_error.h"
 
 namespace utils
 {
@@ -47,57 +50,140 @@ namespace details
   {
     return ( direction == gpio_direction::in )? "in" : "out";
   }
-}
 
-void enable_gpio_line( uint32_t line, const gpio_direction& direction )
-{
-  if( !gpio_line_enabled( line ) )
+  std::string line_path( uint32_t line, const char* attribute = nullptr )
   {
-    int gpio_enabler{ open( "/sys/class/gpio/export", O_WRONLY ) };
-    if( gpio_enabler != -1 )
+    std::string path{ GPIO_SYSFS_DIR "/gpio" + std::to_string( line ) };
+    if( attribute )
     {
-      std::string line_str{ std::to_string( line ) };
-      ssize_t res{ write( gpio_enabler, line_str.c_str(), line_str.length() ) };
-      close( gpio_enabler );
+      path += '/';
+      path += attribute;
+    }
+
+    return path;
+  }
+
+  // Writes value and closes fd
+  void write_fd( int fd, const std::string& value, const char* what )
+  {
+    ssize_t res{ write( fd, value.c_str(), value.length() ) };
+    close( fd );
+
+    if( res < 0 || ( size_t )res != value.length() )
+    {
+      throw std::runtime_error{ std::string{ "Could not write to " } + what + " file" };
+    }
+  }
+
+  // Returns false if the file could not be opened, throws if the write failed
+  bool write_attribute( const std::string& path, const std::string& value, const char* what )
+  {
+    int fd{ open( path.c_str(), O_WRONLY | O_CLOEXEC ) };
+    if( fd == -1 )
+    {
+      return false;
+    }
+
+    write_fd( fd, value, what );
+    return true;
+  }
 
-      if( res < 0 || ( size_t )res != line_str.length() )
+  std::mutex timing_mutex;
+  gpio_timing timing;
+
+  // Attribute files of a freshly exported line may be unwritable until udev fixes permissions
+  int open_when_ready( const std::string& path, std::chrono::steady_clock::time_point deadline,
+                       const gpio_timing& timing, int flags = O_WRONLY )
+  {
+    std::chrono::milliseconds backoff{ timing.initial_backoff };
+    while( true )
+    {
+      int fd{ open( path.c_str(), flags | O_CLOEXEC ) };
+      if( fd != -1 )
       {
-        throw std::runtime_error{ "Could not write to export file" };
+        return fd;
       }
+
+      int error{ errno };
+      bool retry{ error == ENOENT || error == EACCES || error == EPERM };
+      if( !retry || std::chrono::steady_clock::now() + backoff > deadline )
+      {
+        throw std::runtime_error{ "Could not open " + path + ": " + sys::error_message( error ) };
+      }
+
+      std::this_thread::sleep_for( backoff );
+      backoff = std::min( backoff * 2, timing.max_backoff );
     }
-    else
+  }
+
+  const char* edge_to_str( gpio_edge edge ) noexcept
+  {
+    switch( edge )
     {
-      throw std::runtime_error{ "Could not open export file" };
+      case gpio_edge::rising: return "rising";
+      case gpio_edge::falling: return "falling";
+      case gpio_edge::both: return "both";
+      case gpio_edge::none: break;
     }
 
-    std::this_thread::sleep_for( std::chrono::milliseconds{ 100 } );
+    return "none";
   }
 
-  set_gpio_line_direction( line, direction );
+  int8_t parse_value( char value )
+  {
+    if( value != '0' && value != '1' )
+    {
+      throw std::runtime_error{ "Invalid gpio line value" };
+    }
+
+    return value - '0';
+  }
 }
 
-void disable_gpio_line( uint32_t line )
+void set_gpio_timing( const gpio_timing& timing )
 {
-  if( !gpio_line_enabled( line ) )
+  if( timing.ready_timeout.count() < 0 || timing.initial_backoff.count() <= 0 || timing.max_backoff < timing.initial_backoff )
   {
-    return;
+    throw std::invalid_argument{ "Invalid gpio timing" };
   }
 
-  int gpio_line_file{ open( "/sys/class/gpio/unexport", O_WRONLY ) };
-  if( gpio_line_file != -1 )
-  {
-    std::string line_str{ std::to_string( line ) };
-    ssize_t res{ write( gpio_line_file, line_str.c_str(), line_str.size() ) };
-    close( gpio_line_file );
+  std::lock_guard< std::mutex > lock{ details::timing_mutex };
+  details::timing = timing;
+}
+
+gpio_timing get_gpio_timing()
+{
+  std::lock_guard< std::mutex > lock{ details::timing_mutex };
+  return details::timing;
+}
 
-    if( res < 0 || ( size_t )res != line_str.length() )
+void enable_gpio_line( uint32_t line, const gpio_direction& direction )
+{
+  if( !gpio_line_enabled( line ) )
+  {
+    if( !details::write_attribute( GPIO_SYSFS_DIR "/export", std::to_string( line ), "export" ) )
     {
-      throw std::runtime_error{ "Could not write to unexport file" };
+      throw std::runtime_error{ "Could not open export file" };
     }
+  }
+
+  gpio_timing timing{ get_gpio_timing() };
+  int fd{ details::open_when_ready( details::line_path( line, "direction" ),
+                                    std::chrono::steady_clock::now() + timing.ready_timeout,
+                                    timing ) };
+
+  details::write_fd( fd, details::direction_to_str( direction ), "line direction" );
+}
 
-    std::this_thread::sleep_for( std::chrono::milliseconds{ 100 } );
+void disable_gpio_line( uint32_t line )
+{
+  if( !gpio_line_enabled( line ) )
+  {
+    return;
   }
-  else
+
+  // unexport removes the line synchronously
+  if( !details::write_attribute( GPIO_SYSFS_DIR "/unexport", std::to_string( line ), "unexport" ) )
   {
     throw std::runtime_error{ "Could not open unexport file" };
   }
@@ -110,21 +196,7 @@ void set_gpio_line_direction( uint32_t line, const gpio_direction& direction )
     throw std::runtime_error{ "Line not opened" };
   }
 
-  std::string direction_path{ boost::str( boost::format{ "/sys/class/gpio/gpio%u/direction" } % line ) };
-
-  int gpio_line_mode{ open( direction_path.c_str(), O_WRONLY ) };
-  if( gpio_line_mode != -1 )
-  {
-    std::string direction_str{ details::direction_to_str( direction ) };
-    ssize_t res{ write( gpio_line_mode, direction_str.c_str(), direction_str.length() ) };
-    close( gpio_line_mode );
-
-    if( res < 0 || ( size_t )res != direction_str.length() )
-    {
-      throw std::runtime_error{ "Could not write to line direction file" };
-    }
-  }
-  else
+  if( !details::write_attribute( details::line_path( line, "direction" ), details::direction_to_str( direction ), "line direction" ) )
   {
     throw std::invalid_argument{ "Could not open line direction file" };
   }
@@ -137,18 +209,18 @@ gpio_direction get_gpio_line_direction( uint32_t line )
     throw std::runtime_error{ "Line not opened" };
   }
 
-  std::string direction_path{ boost::str( boost::format{ "/sys/class/gpio/gpio%u/direction" } % line ) };
-  std::string direction_str{ utils::aux::read_file( direction_path ) };
+  std::string direction_str{ utils::aux::read_file( details::line_path( line, "direction" ) ) };
   boost::trim_if( direction_str, boost::is_any_of( "\n" ) );
   return details::str_to_direction( direction_str );
 }
 
 bool gpio_line_enabled( uint32_t line )
 {
-  return boost::filesystem::exists( boost::str( boost::format{ "/sys/class/gpio/gpio%u" } % line ) );
+  struct stat info;
+  return stat( details::line_path( line ).c_str(), &info ) == 0;
 }
 
-void set_gpio_line_status( uint32_t line, int8_t status )
+void set_gpio_line_status( uint32_t line, int8_t status, std::chrono::milliseconds settle )
 {
     if( !gpio_line_enabled( line ) )
     {
@@ -160,25 +232,14 @@ void set_gpio_line_status( uint32_t line, int8_t status )
       throw std::invalid_argument{ "Incorrect line direction" };
     }
 
-    std::string path{ boost::str( boost::format{ "/sys/class/gpio/gpio%u/value" } % line ) };
-
-    int gpio_line_file{ open( path.c_str(), O_WRONLY ) };
-    if( gpio_line_file != -1 )
+    if( !details::write_attribute( details::line_path( line, "value" ), status? "1" : "0", "gpio line" ) )
     {
-        auto str_status = boost::lexical_cast< std::string >( ( uint32_t )status );
-        ssize_t res{ write( gpio_line_file, str_status.c_str(), str_status.length() ) };
-        close( gpio_line_file );
-
-        if( res < 0 || ( size_t )res != str_status.length() )
-        {
-          throw std::runtime_error{ "Could not write to gpio line file" };
-        }
-
-        std::this_thread::sleep_for( std::chrono::milliseconds{ 100 } );
+      throw std::runtime_error{ "Could not open gpio line file" };
     }
-    else
+
+    if( settle.count() > 0 )
     {
-      throw std::runtime_error{ "Could not open gpio line file" };
+      std::this_thread::sleep_for( settle );
     }
 }
 
@@ -195,9 +256,9 @@ int8_t get_gpio_line_status( uint32_t line )
   }
 
   int8_t line_status{ 0 };
-  std::string path{ boost::str( boost::format{ "/sys/class/gpio/gpio%u/value" } % line ) };
+  std::string path{ details::line_path( line, "value" ) };
 
-  int gpio_line_file{ open( path.c_str(), O_RDONLY ) };
+  int gpio_line_file{ open( path.c_str(), O_RDONLY | O_CLOEXEC ) };
   if( gpio_line_file != -1 )
   {
     char val{ 0 };
@@ -209,7 +270,7 @@ int8_t get_gpio_line_status( uint32_t line )
       throw std::runtime_error{ "Could not read from gpio line file" };
     }
 
-    line_status = boost::lexical_cast< uint8_t >( val );
+    line_status = details::parse_value( val );
   }
   else
   {
@@ -219,6 +280,429 @@ int8_t get_gpio_line_status( uint32_t line )
   return line_status;
 }
 
+line::line( uint32_t number, gpio_direction direction )
+  : number_( number ),
+    direction_( direction ),
+    exported_( !gpio_line_enabled( number ) )
+{
+  try
+  {
+    enable_gpio_line( number_, direction_ );
+
+    gpio_timing timing{ get_gpio_timing() };
+    value_fd_ = details::open_when_ready( details::line_path( number_, "value" ),
+                                          std::chrono::steady_clock::now() + timing.ready_timeout,
+                                          timing, O_RDWR );
+  }
+  catch( ... )
+  {
+    release();
+    throw;
+  }
+}
+
+line::line( line&& other ) noexcept
+  : number_( other.number_ ),
+    direction_( other.direction_ ),
+    edge_( other.edge_ ),
+    value_fd_( other.value_fd_ ),
+    exported_( other.exported_ )
+{
+  other.value_fd_ = -1;
+  other.exported_ = false;
+  other.edge_ = gpio_edge::none;
+}
+
+line& line::operator=( line&& other ) noexcept
+{
+  if( this != &other )
+  {
+    release();
+
+    number_ = other.number_;
+    direction_ = other.direction_;
+    value_fd_ = other.value_fd_;
+    exported_ = other.exported_;
+    edge_ = other.edge_;
+
+    other.value_fd_ = -1;
+    other.exported_ = false;
+    other.edge_ = gpio_edge::none;
+  }
+
+  return *this;
+}
+
+line::~line()
+{
+  release();
+}
+
+void line::release() noexcept
+{
+  if( value_fd_ != -1 )
+  {
+    close( value_fd_ );
+    value_fd_ = -1;
+  }
+
+  if( exported_ )
+  {
+    try
+    {
+      disable_gpio_line( number_ );
+    }
+    catch( ... ){}
+
+    exported_ = false;
+  }
+}
+
+uint32_t line::number() const noexcept
+{
+  return number_;
+}
+
+int line::fd() const noexcept
+{
+  return value_fd_;
+}
+
+gpio_direction line::direction() const noexcept
+{
+  return direction_;
+}
+
+void line::set_direction( gpio_direction direction )
+{
+  if( direction == direction_ )
+  {
+    return;
+  }
+
+  if( !details::write_attribute( details::line_path( number_, "direction" ), details::direction_to_str( direction ), "line direction" ) )
+  {
+    throw std::runtime_error{ "Could not open line direction file" };
+  }
+
+  direction_ = direction;
+}
+
+int8_t line::get_value() const
+{
+  char val{ 0 };
+  if( pread( value_fd_, &val, sizeof( val ), 0 ) != sizeof( val ) )
+  {
+    throw std::runtime_error{ "Could not read from gpio line file" };
+  }
+
+  return details::parse_value( val );
+}
+
+void line::set_value( int8_t value )
+{
+  if( direction_ != gpio_direction::out )
+  {
+    throw std::invalid_argument{ "Incorrect line direction" };
+  }
+
+  if( pwrite( value_fd_, value? "1" : "0", 1, 0 ) != 1 )
+  {
+    throw std::runtime_error{ "Could not write to gpio line file" };
+  }
+}
+
+gpio_edge line::edge() const noexcept
+{
+  return edge_;
+}
+
+void line::set_edge( gpio_edge edge )
+{
+  if( edge != gpio_edge::none && direction_ != gpio_direction::in )
+  {
+    throw std::invalid_argument{ "Edges are only available for inputs" };
+  }
+
+  if( !details::write_attribute( details::line_path( number_, "edge" ), details::edge_to_str( edge ), "line edge" ) )
+  {
+    throw std::runtime_error{ "Could not open line edge file" };
+  }
+
+  edge_ = edge;
+
+  // sysfs reports the line as changed until the value is read
+  get_value();
+}
+
+bool line::wait_edge( std::chrono::milliseconds timeout, std::chrono::milliseconds debounce ) const
+{
+  return !wait_gpio_edges( { this }, timeout, debounce ).empty();
+}
+
+std::vector< gpio_event > wait_gpio_edges( const std::vector< const line* >& lines,
+                                           std::chrono::milliseconds timeout,
+                                           std::chrono::milliseconds debounce )
+{
+  if( lines.empty() )
+  {
+    throw std::invalid_argument{ "No lines to wait for" };
+  }
+
+  std::vector< pollfd > fds;
+  std::vector< int8_t > initial_values;
+  for( const line* l : lines )
+  {
+    if( !l || l->edge() == gpio_edge::none )
+    {
+      throw std::invalid_argument{ "Line edge is not set" };
+    }
+
+    fds.push_back( pollfd{ l->fd(), POLLPRI | POLLERR, 0 } );
+
+    // values to compare with, so that glitches shorter than debounce are dropped
+    if( debounce.count() )
+    {
+      initial_values.push_back( l->get_value() );
+    }
+  }
+
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  std::vector< gpio_event > events( lines.size() );
+  std::vector< bool > changed( lines.size(), false );
+  bool any_changed{ false };
+  std::vector< gpio_event > result;
+
+  while( result.empty() )
+  {
+    int wait_ms{ -1 };
+    if( timeout.count() >= 0 )
+    {
+      auto left = std::chrono::duration_cast< std::chrono::milliseconds >( deadline - std::chrono::steady_clock::now() );
+      wait_ms = std::max< int64_t >( left.count(), 0 );
+    }
+
+    // a line that keeps bouncing must not outlive the timeout
+    if( any_changed )
+    {
+      wait_ms = wait_ms == -1? debounce.count() : std::min< int64_t >( wait_ms, debounce.count() );
+    }
+
+    int res{ poll( fds.data(), fds.size(), wait_ms ) };
+    if( res == -1 )
+    {
+      if( errno == EINTR )
+      {
+        continue;
+      }
+
+      throw std::runtime_error{ std::string{ "Could not wait for gpio edges: " } + sys::error_message( errno ) };
+    }
+
+    if( res == 0 && !any_changed )
+    {
+      break; // timeout
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    bool expired{ timeout.count() >= 0 && now >= deadline };
+    for( size_t i{ 0 }; i < fds.size(); ++i )
+    {
+      if( fds[ i ].revents & ( POLLPRI | POLLERR ) )
+      {
+        events[ i ].line = lines[ i ]->number();
+        events[ i ].value = lines[ i ]->get_value();
+        events[ i ].time = now;
+        changed[ i ] = true;
+        any_changed = true;
+      }
+    }
+
+    // without debounce report at once, otherwise when nothing changed for the debounce period or time is out
+    if( any_changed && ( !debounce.count() || res == 0 || expired ) )
+    {
+      for( size_t i{ 0 }; i < events.size(); ++i )
+      {
+        if( changed[ i ] && ( !debounce.count() || events[ i ].value != initial_values[ i ] ) )
+        {
+          result.push_back( events[ i ] );
+        }
+      }
+
+      // glitches only, keep waiting
+      changed.assign( changed.size(), false );
+      any_changed = false;
+    }
+
+    if( expired )
+    {
+      break;
+    }
+  }
+
+  return result;
+}
+
+std::vector< line_result > configure_gpio_lines( const std::vector< line_setup >& lines )
+{
+  std::vector< line_result > results( lines.size() );
+  std::vector< size_t > pending;
+
+  // export all at once
+  int export_fd{ -1 };
+  for( size_t i{ 0 }; i < lines.size(); ++i )
+  {
+    results[ i ].line = lines[ i ].line;
+
+    if( !gpio_line_enabled( lines[ i ].line ) )
+    {
+      if( export_fd == -1 )
+      {
+        export_fd = open( GPIO_SYSFS_DIR "/export", O_WRONLY | O_CLOEXEC );
+        if( export_fd == -1 )
+        {
+          results[ i ].error = std::string{ "Could not open export file: " } + sys::error_message( errno );
+          continue;
+        }
+      }
+
+      std::string line_str{ std::to_string( lines[ i ].line ) };
+      if( write( export_fd, line_str.c_str(), line_str.length() ) != static_cast< ssize_t >( line_str.length() ) )
+      {
+        results[ i ].error = std::string{ "Could not write to export file: " } + sys::error_message( errno );
+        continue;
+      }
+    }
+
+    pending.push_back( i );
+  }
+
+  if( export_fd != -1 )
+  {
+    close( export_fd );
+  }
+
+  // wait for all the lines together, direction and initial value of outputs are set with one write
+  gpio_timing timing{ get_gpio_timing() };
+  auto deadline = std::chrono::steady_clock::now() + timing.ready_timeout;
+  std::chrono::milliseconds backoff{ timing.initial_backoff };
+
+  while( !pending.empty() )
+  {
+    std::vector< size_t > not_ready;
+    for( size_t i : pending )
+    {
+      std::string path{ details::line_path( lines[ i ].line, "direction" ) };
+      int fd{ open( path.c_str(), O_WRONLY | O_CLOEXEC ) };
+      if( fd == -1 )
+      {
+        if( errno == ENOENT || errno == EACCES || errno == EPERM )
+        {
+          not_ready.push_back( i );
+        }
+        else
+        {
+          results[ i ].error = "Could not open " + path + ": " + sys::error_message( errno );
+        }
+
+        continue;
+      }
+
+      const char* direction{ lines[ i ].direction == gpio_direction::in? "in" :
+                             lines[ i ].value? "high" : "low" };
+
+      try
+      {
+        details::write_fd( fd, direction, "line direction" );
+        results[ i ].ok = true;
+      }
+      catch( const std::exception& e )
+      {
+        results[ i ].error = e.what();
+      }
+    }
+
+    pending.swap( not_ready );
+    if( pending.empty() )
+    {
+      break;
+    }
+
+    if( std::chrono::steady_clock::now() + backoff > deadline )
+    {
+      for( size_t i : pending )
+      {
+        results[ i ].error = "Line is not ready after export";
+      }
+
+      break;
+    }
+
+    std::this_thread::sleep_for( backoff );
+    backoff = std::min( backoff * 2, timing.max_backoff );
+  }
+
+  return results;
+}
+
+std::vector< line_result > set_gpio_lines_status( const std::vector< std::pair< uint32_t, int8_t > >& values )
+{
+  std::vector< line_result > results( values.size() );
+  for( size_t i{ 0 }; i < values.size(); ++i )
+  {
+    results[ i ].line = values[ i ].first;
+
+    // writing value of an input fails with EPERM, no need to read direction first
+    std::string path{ details::line_path( values[ i ].first, "value" ) };
+    int fd{ open( path.c_str(), O_WRONLY | O_CLOEXEC ) };
+    if( fd == -1 )
+    {
+      results[ i ].error = errno == ENOENT? "Line is disabled" : "Could not open " + path + ": " + sys::error_message( errno );
+      continue;
+    }
+
+    ssize_t res{ write( fd, values[ i ].second? "1" : "0", 1 ) };
+    int error{ errno };
+    close( fd );
+
+    if( res != 1 )
+    {
+      results[ i ].error = error == EPERM? "Incorrect line direction" :
+                                           std::string{ "Could not write to gpio line file: " } + sys::error_message( error );
+      continue;
+    }
+
+    results[ i ].ok = true;
+  }
+
+  return results;
+}
+
+void write_gpio_pattern( const std::vector< line* >& lines, uint64_t pattern )
+{
+  if( lines.empty() || lines.size() > 64 )
+  {
+    throw std::invalid_argument{ "Invalid lines count" };
+  }
+
+  for( const line* l : lines )
+  {
+    if( !l || l->direction() != gpio_direction::out )
+    {
+      throw std::invalid_argument{ "Incorrect line direction" };
+    }
+  }
+
+  // nothing but the writes between the first and the last line
+  for( size_t i{ 0 }; i < lines.size(); ++i )
+  {
+    if( pwrite( lines[ i ]->fd(), ( pattern >> i ) & 1? "1" : "0", 1, 0 ) != 1 )
+    {
+      throw std::runtime_error{ "Could not write to gpio line " + std::to_string( lines[ i ]->number() ) };
+    }
+  }
+}
+
 }// gpio
 
 }// sys
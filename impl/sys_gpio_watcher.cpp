@@ -0,0 +1,315 @@
+#include "../sys_gpio_watcher.h"
+
+#include <map>
+#include <mutex>
+#include <array>
+#include <atomic>
+#include <thread>
+#include <limits>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "../sys_error.h"
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace gpio
+{
+
+struct watcher::impl
+{
+  struct entry
+  {
+    entry( uint32_t number ) : gpio_line( number, gpio_direction::in ) {}
+
+    line gpio_line;
+    callback on_event;
+    int8_t last_value{ 0 };
+    bool pending{ false };
+    std::chrono::steady_clock::time_point deadline;
+  };
+
+  using notification = std::pair< callback, gpio_event >;
+
+  static constexpr uint64_t wakeup_token{ std::numeric_limits< uint64_t >::max() };
+
+  explicit impl( std::chrono::milliseconds debounce );
+  ~impl();
+
+  static gpio_event make_event( const entry& e, int8_t value, std::chrono::steady_clock::time_point time );
+
+  void run();
+  int next_timeout() const;
+  void handle_edge( entry& e, std::chrono::steady_clock::time_point now, std::vector< notification >& notifications );
+  void handle_settled( std::chrono::steady_clock::time_point now, std::vector< notification >& notifications );
+
+  std::chrono::milliseconds debounce;
+  int epoll_fd{ -1 };
+  int wakeup_fd{ -1 };
+
+  mutable std::mutex mutex;
+  std::map< uint32_t, std::shared_ptr< entry > > entries;
+
+  std::atomic< bool > running{ false };
+  std::thread thread;
+};
+
+constexpr uint64_t watcher::impl::wakeup_token;
+
+watcher::impl::impl( std::chrono::milliseconds debounce )
+  : debounce( debounce )
+{
+  epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+  wakeup_fd = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+  if( epoll_fd == -1 || wakeup_fd == -1 )
+  {
+    int error{ errno };
+    if( epoll_fd != -1 ) close( epoll_fd );
+    if( wakeup_fd != -1 ) close( wakeup_fd );
+    throw std::runtime_error{ std::string{ "Could not create gpio watcher: " } + sys::error_message( error ) };
+  }
+
+  epoll_event event;
+  event.events = EPOLLIN;
+  event.data.u64 = wakeup_token;
+  epoll_ctl( epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &event );
+}
+
+watcher::impl::~impl()
+{
+  close( wakeup_fd );
+  close( epoll_fd );
+}
+
+gpio_event watcher::impl::make_event( const entry& e, int8_t value, std::chrono::steady_clock::time_point time )
+{
+  gpio_event event;
+  event.line = e.gpio_line.number();
+  event.value = value;
+  event.time = time;
+  return event;
+}
+
+int watcher::impl::next_timeout() const
+{
+  std::lock_guard< std::mutex > lock{ mutex };
+
+  auto now = std::chrono::steady_clock::now();
+  int timeout{ -1 };
+  for( const auto& e : entries )
+  {
+    if( e.second->pending )
+    {
+      // rounded up, waking up early would only cause another wait
+      auto left = std::chrono::duration_cast< std::chrono::milliseconds >(
+                    e.second->deadline - now + std::chrono::microseconds{ 999 } ).count();
+      int left_ms( left > 0? left : 0 );
+      timeout = timeout == -1? left_ms : std::min( timeout, left_ms );
+    }
+  }
+
+  return timeout;
+}
+
+void watcher::impl::handle_edge( entry& e, std::chrono::steady_clock::time_point now, std::vector< notification >& notifications )
+{
+  // reading the value also resets the sysfs edge state
+  int8_t value{ e.gpio_line.get_value() };
+  if( debounce.count() )
+  {
+    e.pending = true;
+    e.deadline = now + debounce;
+    return;
+  }
+
+  e.last_value = value;
+  notifications.emplace_back( e.on_event, make_event( e, value, now ) );
+}
+
+void watcher::impl::handle_settled( std::chrono::steady_clock::time_point now, std::vector< notification >& notifications )
+{
+  for( auto& it : entries )
+  {
+    entry& e( *it.second );
+    if( !e.pending || e.deadline > now )
+    {
+      continue;
+    }
+
+    e.pending = false;
+
+    int8_t value{ e.gpio_line.get_value() };
+    if( value != e.last_value )
+    {
+      e.last_value = value;
+      notifications.emplace_back( e.on_event, make_event( e, value, now ) );
+    }
+  }
+}
+
+void watcher::impl::run()
+{
+  std::array< epoll_event, 16 > events;
+  std::vector< notification > notifications;
+
+  while( running )
+  {
+    int count{ epoll_wait( epoll_fd, events.data(), events.size(), next_timeout() ) };
+    if( count == -1 && errno != EINTR )
+    {
+      break;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    notifications.clear();
+
+    {
+      std::lock_guard< std::mutex > lock{ mutex };
+      for( int i{ 0 }; i < count; ++i )
+      {
+        if( events[ i ].data.u64 == wakeup_token )
+        {
+          uint64_t value;
+          while( read( wakeup_fd, &value, sizeof( value ) ) == sizeof( value ) ){}
+          continue;
+        }
+
+        auto it = entries.find( events[ i ].data.u32 );
+        if( it != entries.end() )
+        {
+          try
+          {
+            handle_edge( *it->second, now, notifications );
+          }
+          catch( ... ){}
+        }
+      }
+
+      try
+      {
+        handle_settled( now, notifications );
+      }
+      catch( ... ){}
+    }
+
+    for( const notification& n : notifications )
+    {
+      try
+      {
+        if( n.first )
+        {
+          n.first( n.second );
+        }
+      }
+      catch( ... ){}
+    }
+  }
+}
+
+watcher::watcher( std::chrono::milliseconds debounce )
+  : impl_( new impl{ debounce } )
+{
+}
+
+watcher::~watcher()
+{
+  stop();
+}
+
+void watcher::add( uint32_t line, gpio_edge edge, const callback& on_event )
+{
+  if( edge == gpio_edge::none )
+  {
+    throw std::invalid_argument{ "Line edge is not set" };
+  }
+
+  std::lock_guard< std::mutex > lock{ impl_->mutex };
+
+  auto it = impl_->entries.find( line );
+  if( it != impl_->entries.end() )
+  {
+    it->second->gpio_line.set_edge( edge );
+    it->second->on_event = on_event;
+    return;
+  }
+
+  auto e = std::make_shared< impl::entry >( line );
+  e->gpio_line.set_edge( edge );
+  e->on_event = on_event;
+  e->last_value = e->gpio_line.get_value();
+
+  epoll_event event;
+  event.events = EPOLLPRI | EPOLLERR;
+  event.data.u64 = 0;
+  event.data.u32 = line;
+  if( epoll_ctl( impl_->epoll_fd, EPOLL_CTL_ADD, e->gpio_line.fd(), &event ) == -1 )
+  {
+    throw std::runtime_error{ std::string{ "Could not watch gpio line: " } + sys::error_message( errno ) };
+  }
+
+  impl_->entries.emplace( line, e );
+}
+
+void watcher::remove( uint32_t line )
+{
+  std::lock_guard< std::mutex > lock{ impl_->mutex };
+
+  auto it = impl_->entries.find( line );
+  if( it == impl_->entries.end() )
+  {
+    return;
+  }
+
+  epoll_ctl( impl_->epoll_fd, EPOLL_CTL_DEL, it->second->gpio_line.fd(), nullptr );
+  impl_->entries.erase( it );
+}
+
+void watcher::start()
+{
+  if( impl_->running.exchange( true ) )
+  {
+    return;
+  }
+
+  if( impl_->thread.joinable() )
+  {
+    impl_->thread.join();
+  }
+
+  impl_->thread = std::thread{ &impl::run, impl_.get() };
+}
+
+void watcher::stop()
+{
+  impl_->running = false;
+
+  // fails only if the counter is full, then the thread is awake anyway
+  uint64_t value{ 1 };
+  ssize_t res{ write( impl_->wakeup_fd, &value, sizeof( value ) ) };
+  static_cast< void >( res );
+
+  if( impl_->thread.joinable() && impl_->thread.get_id() != std::this_thread::get_id() )
+  {
+    impl_->thread.join();
+  }
+}
+
+bool watcher::running() const noexcept
+{
+  return impl_->running;
+}
+
+}// gpio
+
+}// sys
+
+}// utils
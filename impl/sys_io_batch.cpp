@@ -0,0 +1,510 @@
+#include "../sys_io_batch.h"
+
+#include <cerrno>
+#include <stdexcept>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#include <sys/sysmacros.h>
+#endif
+
+#include "../sys_error.h"
+
+#define IO_BATCH_READ_CHUNK 4096
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace io
+{
+
+namespace details
+{
+
+struct request
+{
+  enum kind{ stat_request, read_request };
+
+  kind type;
+  std::string path;
+  bool follow{ true };
+  size_t limit{ 0 };
+
+  int fd{ -1 };
+  size_t offset{ 0 };
+  bool done{ false };
+#ifdef HAVE_LIBURING
+  struct statx stx;
+#endif
+
+  result res;
+};
+
+void stat_sync( request& r )
+{
+  if( ( r.follow? ::stat : ::lstat )( r.path.c_str(), &r.res.info ) != 0 )
+  {
+    r.res.error = errno;
+  }
+}
+
+void read_sync( request& r )
+{
+  int fd{ open( r.path.c_str(), O_RDONLY | O_CLOEXEC ) };
+  if( fd == -1 )
+  {
+    r.res.error = errno;
+    return;
+  }
+
+  // no size is known beforehand for /proc and /sys
+  std::string& content( r.res.content );
+  while( r.offset < r.limit )
+  {
+    size_t chunk{ std::min( r.limit - r.offset, std::max< size_t >( IO_BATCH_READ_CHUNK, r.offset ) ) };
+    content.resize( r.offset + chunk );
+
+    ssize_t count{ read( fd, &content[ r.offset ], chunk ) };
+    if( count < 0 && errno == EINTR )
+    {
+      continue;
+    }
+
+    if( count <= 0 )
+    {
+      r.res.error = count < 0? errno : 0;
+      break;
+    }
+
+    r.offset += static_cast< size_t >( count );
+  }
+
+  content.resize( r.res.error? 0 : r.offset );
+  close( fd );
+}
+
+#ifdef HAVE_LIBURING
+
+void to_stat( const struct statx& stx, struct stat& info ) noexcept
+{
+  info = {};
+  info.st_dev = makedev( stx.stx_dev_major, stx.stx_dev_minor );
+  info.st_ino = stx.stx_ino;
+  info.st_mode = stx.stx_mode;
+  info.st_nlink = stx.stx_nlink;
+  info.st_uid = stx.stx_uid;
+  info.st_gid = stx.stx_gid;
+  info.st_rdev = makedev( stx.stx_rdev_major, stx.stx_rdev_minor );
+  info.st_size = static_cast< off_t >( stx.stx_size );
+  info.st_blksize = static_cast< blksize_t >( stx.stx_blksize );
+  info.st_blocks = static_cast< blkcnt_t >( stx.stx_blocks );
+  info.st_atim.tv_sec = stx.stx_atime.tv_sec;
+  info.st_atim.tv_nsec = stx.stx_atime.tv_nsec;
+  info.st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+  info.st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+  info.st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+  info.st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+}
+
+// The kernel may support io_uring but not the operations needed, those before 5.6 don't have statx and openat
+bool supports_operations( io_uring& ring )
+{
+  io_uring_probe* probe{ io_uring_get_probe_ring( &ring ) };
+  if( !probe )
+  {
+    return false;
+  }
+
+  bool supported{ true };
+  for( int op : { IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE } )
+  {
+    supported = supported && io_uring_opcode_supported( probe, op );
+  }
+
+  io_uring_free_probe( probe );
+  return supported;
+}
+
+// Setting up a ring costs more than the I/O of a short batch, so the batches of a thread share one
+class thread_ring
+{
+public:
+  thread_ring( const thread_ring& ) = delete;
+  thread_ring& operator=( const thread_ring& ) = delete;
+
+  thread_ring() = default;
+  ~thread_ring()
+  {
+    reset();
+  }
+
+  // nullptr if io_uring can't be used, fails under seccomp, with kernel.io_uring_disabled and on old kernels
+  io_uring* get() noexcept
+  {
+    if( !ready_ && !unsupported_ )
+    {
+      ready_ = io_uring_queue_init( IO_BATCH_QUEUE_DEPTH, &ring_, 0 ) == 0;
+      if( ready_ && !supports_operations( ring_ ) )
+      {
+        reset();
+        unsupported_ = true;
+      }
+    }
+
+    return ready_? &ring_ : nullptr;
+  }
+
+  // drops whatever is left in the queues, the next get sets up a new ring
+  void reset() noexcept
+  {
+    if( ready_ )
+    {
+      io_uring_queue_exit( &ring_ );
+      ready_ = false;
+    }
+  }
+
+private:
+  io_uring ring_;
+  bool ready_{ false };
+  bool unsupported_{ false };
+};
+
+thread_ring& get_thread_ring() noexcept
+{
+  thread_local thread_ring ring;
+  return ring;
+}
+
+#endif
+
+}// details
+
+struct batch::impl
+{
+  explicit impl( unsigned int queue_depth );
+
+  void run_sync();
+
+#ifdef HAVE_LIBURING
+  template< class Prepare, class Complete >
+  void execute( io_uring& ring, const std::vector< size_t >& ids, const Prepare& prepare, const Complete& complete );
+  void run_uring( io_uring& ring );
+#endif
+
+  unsigned int queue_depth;
+  std::vector< details::request > requests;
+};
+
+batch::impl::impl( unsigned int queue_depth )
+  : queue_depth( queue_depth )
+{
+}
+
+void batch::impl::run_sync()
+{
+  for( details::request& r : requests )
+  {
+    if( r.type == details::request::stat_request )
+    {
+      details::stat_sync( r );
+    }
+    else
+    {
+      details::read_sync( r );
+    }
+  }
+}
+
+#ifdef HAVE_LIBURING
+
+// Keeps up to queue_depth requests in flight, completions are handled as they come
+template< class Prepare, class Complete >
+void batch::impl::execute( io_uring& ring, const std::vector< size_t >& ids, const Prepare& prepare, const Complete& complete )
+{
+  size_t depth{ std::min< size_t >( queue_depth, ring.sq.ring_entries ) };
+  size_t next{ 0 };
+  size_t queued{ 0 };    // not taken by the kernel yet
+  size_t in_flight{ 0 }; // taken, not completed yet
+  try
+  {
+    while( next < ids.size() || queued || in_flight )
+    {
+      while( next < ids.size() && queued + in_flight < depth )
+      {
+        io_uring_sqe* sqe{ io_uring_get_sqe( &ring ) };
+        if( !sqe )
+        {
+          break;
+        }
+
+        details::request& r( requests[ ids[ next ] ] );
+        prepare( sqe, r );
+        io_uring_sqe_set_data( sqe, &r );
+        ++next;
+        ++queued;
+      }
+
+      // the count of the taken ones is returned if any were, the error otherwise
+      int res{ io_uring_submit_and_wait( &ring, 1 ) };
+      if( res < 0 && res != -EINTR && res != -EAGAIN && res != -EBUSY )
+      {
+        throw std::runtime_error{ "io_uring submission failed: " + error_message( -res ) };
+      }
+
+      if( res > 0 )
+      {
+        queued -= static_cast< size_t >( res );
+        in_flight += static_cast< size_t >( res );
+      }
+
+      unsigned head;
+      unsigned count{ 0 };
+      io_uring_cqe* cqe;
+      io_uring_for_each_cqe( &ring, head, cqe )
+      {
+        complete( *static_cast< details::request* >( io_uring_cqe_get_data( cqe ) ), cqe->res );
+        ++count;
+      }
+
+      io_uring_cq_advance( &ring, count );
+      in_flight -= count;
+    }
+  }
+  catch( ... )
+  {
+    // the kernel still writes to the buffers of the taken ones, and opens may yet return fds to close.
+    // The queued ones go away with the ring
+    while( in_flight )
+    {
+      io_uring_cqe* cqe;
+      int res{ io_uring_wait_cqe( &ring, &cqe ) };
+      if( res == -EINTR )
+      {
+        continue;
+      }
+
+      if( res < 0 )
+      {
+        break;
+      }
+
+      complete( *static_cast< details::request* >( io_uring_cqe_get_data( cqe ) ), cqe->res );
+      io_uring_cqe_seen( &ring, cqe );
+      --in_flight;
+    }
+
+    throw;
+  }
+}
+
+// Stats and opens go first, then rounds of reads until every file is read, then closes
+void batch::impl::run_uring( io_uring& ring )
+{
+  std::vector< size_t > ids( requests.size() );
+  for( size_t i{ 0 }; i < ids.size(); ++i )
+  {
+    ids[ i ] = i;
+  }
+
+  execute( ring, ids, []( io_uring_sqe* sqe, details::request& r )
+  {
+    if( r.type == details::request::stat_request )
+    {
+      io_uring_prep_statx( sqe, AT_FDCWD, r.path.c_str(), r.follow? 0 : AT_SYMLINK_NOFOLLOW, STATX_BASIC_STATS, &r.stx );
+    }
+    else
+    {
+      io_uring_prep_openat( sqe, AT_FDCWD, r.path.c_str(), O_RDONLY | O_CLOEXEC, 0 );
+    }
+  },
+  []( details::request& r, int res )
+  {
+    if( res < 0 )
+    {
+      r.res.error = -res;
+    }
+    else if( r.type == details::request::stat_request )
+    {
+      details::to_stat( r.stx, r.res.info );
+    }
+    else
+    {
+      r.fd = res;
+    }
+  } );
+
+  std::vector< size_t > reads;
+  for( size_t i{ 0 }; i < requests.size(); ++i )
+  {
+    if( requests[ i ].fd != -1 )
+    {
+      reads.push_back( i );
+    }
+  }
+
+  std::vector< size_t > closes( reads );
+  while( !reads.empty() )
+  {
+    execute( ring, reads, []( io_uring_sqe* sqe, details::request& r )
+    {
+      size_t chunk{ std::min( r.limit - r.offset, std::max< size_t >( IO_BATCH_READ_CHUNK, r.offset ) ) };
+      r.res.content.resize( r.offset + chunk );
+      io_uring_prep_read( sqe, r.fd, &r.res.content[ r.offset ], static_cast< unsigned >( chunk ), r.offset );
+    },
+    []( details::request& r, int res )
+    {
+      if( res == -EINTR || res == -EAGAIN )
+      {
+        return;
+      }
+
+      if( res <= 0 )
+      {
+        r.res.error = res < 0? -res : 0;
+        r.done = true;
+        return;
+      }
+
+      r.offset += static_cast< size_t >( res );
+      r.done = r.offset >= r.limit;
+    } );
+
+    reads.erase( std::remove_if( reads.begin(), reads.end(), [ this ]( size_t id ){ return requests[ id ].done; } ), reads.end() );
+  }
+
+  execute( ring, closes, []( io_uring_sqe* sqe, details::request& r )
+  {
+    io_uring_prep_close( sqe, r.fd );
+  },
+  []( details::request& r, int )
+  {
+    r.fd = -1;
+    r.res.content.resize( r.res.error? 0 : r.offset );
+  } );
+}
+
+#endif
+
+batch::batch( unsigned int queue_depth )
+{
+  if( !queue_depth )
+  {
+    throw std::invalid_argument{ "Queue depth must be positive" };
+  }
+
+  impl_.reset( new impl{ queue_depth } );
+}
+
+batch::~batch() = default;
+
+size_t batch::add_stat( const std::string& path, bool follow_symlinks )
+{
+  if( path.empty() )
+  {
+    throw std::invalid_argument{ "Path is empty" };
+  }
+
+  details::request r;
+  r.type = details::request::stat_request;
+  r.path = path;
+  r.follow = follow_symlinks;
+  impl_->requests.push_back( std::move( r ) );
+  return impl_->requests.size() - 1;
+}
+
+size_t batch::add_read( const std::string& path, size_t limit )
+{
+  if( path.empty() )
+  {
+    throw std::invalid_argument{ "Path is empty" };
+  }
+
+  details::request r;
+  r.type = details::request::read_request;
+  r.path = path;
+  r.limit = limit;
+  impl_->requests.push_back( std::move( r ) );
+  return impl_->requests.size() - 1;
+}
+
+void batch::run()
+{
+  for( details::request& r : impl_->requests )
+  {
+    r.offset = 0;
+    r.done = false;
+    r.res = result{};
+  }
+
+#ifdef HAVE_LIBURING
+  details::thread_ring& shared( details::get_thread_ring() );
+  if( io_uring* ring = shared.get() )
+  {
+    try
+    {
+      impl_->run_uring( *ring );
+    }
+    catch( ... )
+    {
+      shared.reset();
+      for( details::request& r : impl_->requests )
+      {
+        if( r.fd != -1 )
+        {
+          close( r.fd );
+          r.fd = -1;
+        }
+      }
+
+      throw;
+    }
+
+    return;
+  }
+#endif
+
+  impl_->run_sync();
+}
+
+const result& batch::get( size_t id ) const
+{
+  if( id >= impl_->requests.size() )
+  {
+    throw std::out_of_range{ "Invalid request id" };
+  }
+
+  return impl_->requests[ id ].res;
+}
+
+size_t batch::size() const noexcept
+{
+  return impl_->requests.size();
+}
+
+void batch::clear() noexcept
+{
+  impl_->requests.clear();
+}
+
+bool batch::uses_uring() const noexcept
+{
+#ifdef HAVE_LIBURING
+  return details::get_thread_ring().get() != nullptr;
+#else
+  return false;
+#endif
+}
+
+}// io
+
+}// sys
+
+}// utils
@@ -0,0 +1,374 @@
+#include "sys_netlink.h"
+
+#include <array>
+#include <vector>
+#include <cstring>
+
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <boost/scope_exit.hpp>
+
+#include "../sys_error.h"
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace network
+{
+
+namespace netlink
+{
+
+namespace details
+{
+
+struct request
+{
+  nlmsghdr hdr;
+  union
+  {
+    ifaddrmsg addr;
+    rtmsg route;
+  };
+  std::array< char, 256 > attrs;
+};
+
+void add_attr( request& req, int type, const void* data, size_t len )
+{
+  size_t attr_len{ RTA_LENGTH( len ) };
+  if( NLMSG_ALIGN( req.hdr.nlmsg_len ) + RTA_ALIGN( attr_len ) > sizeof( req ) )
+  {
+    throw std::length_error{ "Netlink request is too long" };
+  }
+
+  rtattr* attr{ reinterpret_cast< rtattr* >( reinterpret_cast< char* >( &req ) + NLMSG_ALIGN( req.hdr.nlmsg_len ) ) };
+  attr->rta_type = type;
+  attr->rta_len = attr_len;
+  memcpy( RTA_DATA( attr ), data, len );
+
+  req.hdr.nlmsg_len = NLMSG_ALIGN( req.hdr.nlmsg_len ) + RTA_ALIGN( attr_len );
+}
+
+in_addr to_addr( const std::string& ip )
+{
+  in_addr addr;
+  if( inet_pton( AF_INET, ip.c_str(), &addr ) != 1 )
+  {
+    throw std::invalid_argument{ "Invalid ipv4 address: " + ip };
+  }
+
+  return addr;
+}
+
+int open_socket()
+{
+  int sock{ socket( AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE ) };
+  if( sock == -1 )
+  {
+    throw std::runtime_error{ std::string{ "Failed to open netlink socket: " } + sys::error_message( errno ) };
+  }
+
+  return sock;
+}
+
+void send_request( int sock, request& req )
+{
+  sockaddr_nl addr;
+  memset( &addr, 0, sizeof( addr ) );
+  addr.nl_family = AF_NETLINK;
+
+  if( sendto( sock, &req, req.hdr.nlmsg_len, 0, reinterpret_cast< sockaddr* >( &addr ), sizeof( addr ) ) < 0 )
+  {
+    throw std::runtime_error{ std::string{ "Failed to send netlink request: " } + sys::error_message( errno ) };
+  }
+}
+
+// Runs request and waits for the ack. Errors listed in ignored are treated as success
+void execute( request& req, const char* what, int ignored )
+{
+  int sock{ open_socket() };
+  BOOST_SCOPE_EXIT( sock ){ close( sock ); } BOOST_SCOPE_EXIT_END
+
+  req.hdr.nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+  req.hdr.nlmsg_seq = 1;
+  send_request( sock, req );
+
+  std::array< char, 8192 > buf;
+  while( true )
+  {
+    ssize_t len{ recv( sock, buf.data(), buf.size(), 0 ) };
+    if( len < 0 )
+    {
+      if( errno == EINTR )
+      {
+        continue;
+      }
+
+      throw std::runtime_error{ std::string{ what } + " failed: " + sys::error_message( errno ) };
+    }
+
+    for( nlmsghdr* hdr{ reinterpret_cast< nlmsghdr* >( buf.data() ) };
+         NLMSG_OK( hdr, static_cast< size_t >( len ) );
+         hdr = NLMSG_NEXT( hdr, len ) )
+    {
+      if( hdr->nlmsg_type != NLMSG_ERROR )
+      {
+        continue;
+      }
+
+      int error{ -reinterpret_cast< nlmsgerr* >( NLMSG_DATA( hdr ) )->error };
+      if( error != 0 && error != ignored )
+      {
+        throw std::runtime_error{ std::string{ what } + " failed: " + sys::error_message( error ) };
+      }
+
+      return;
+    }
+  }
+}
+
+request address_request( int type, int flags, int ifindex, const std::string& ip, uint32_t prefix_len )
+{
+  if( prefix_len > 32 )
+  {
+    throw std::invalid_argument{ "Invalid prefix length" };
+  }
+
+  in_addr addr( to_addr( ip ) );
+
+  request req;
+  memset( &req, 0, sizeof( req ) );
+  req.hdr.nlmsg_len = NLMSG_LENGTH( sizeof( ifaddrmsg ) );
+  req.hdr.nlmsg_type = type;
+  req.hdr.nlmsg_flags = flags;
+  req.addr.ifa_family = AF_INET;
+  req.addr.ifa_prefixlen = prefix_len;
+  req.addr.ifa_scope = RT_SCOPE_UNIVERSE;
+  req.addr.ifa_index = ifindex;
+
+  add_attr( req, IFA_LOCAL, &addr, sizeof( addr ) );
+  add_attr( req, IFA_ADDRESS, &addr, sizeof( addr ) );
+
+  if( type == RTM_NEWADDR && prefix_len < 31 )
+  {
+    in_addr broadcast;
+    broadcast.s_addr = addr.s_addr | htonl( prefix_len? ~( ~uint32_t{ 0 } << ( 32 - prefix_len ) ) : ~uint32_t{ 0 } );
+    add_attr( req, IFA_BROADCAST, &broadcast, sizeof( broadcast ) );
+  }
+
+  return req;
+}
+
+request route_request( int type, int flags, int ifindex )
+{
+  request req;
+  memset( &req, 0, sizeof( req ) );
+  req.hdr.nlmsg_len = NLMSG_LENGTH( sizeof( rtmsg ) );
+  req.hdr.nlmsg_type = type;
+  req.hdr.nlmsg_flags = flags;
+  req.route.rtm_family = AF_INET;
+  req.route.rtm_table = RT_TABLE_MAIN;
+  req.route.rtm_dst_len = 0;
+
+  if( type == RTM_NEWROUTE )
+  {
+    req.route.rtm_protocol = RTPROT_BOOT;
+    req.route.rtm_scope = RT_SCOPE_UNIVERSE;
+    req.route.rtm_type = RTN_UNICAST;
+  }
+  else
+  {
+    req.route.rtm_scope = RT_SCOPE_NOWHERE;
+  }
+
+  uint32_t oif( ifindex );
+  add_attr( req, RTA_OIF, &oif, sizeof( oif ) );
+
+  return req;
+}
+
+// Sends dump request, handler gets each message of the reply
+template< class Handler >
+void dump( request& req, const char* what, const Handler& handler )
+{
+  int sock{ open_socket() };
+  BOOST_SCOPE_EXIT_TPL( sock ){ close( sock ); } BOOST_SCOPE_EXIT_END
+
+  req.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  req.hdr.nlmsg_seq = 1;
+  send_request( sock, req );
+
+  std::array< char, 16384 > buf;
+  while( true )
+  {
+    ssize_t len{ recv( sock, buf.data(), buf.size(), 0 ) };
+    if( len < 0 )
+    {
+      if( errno == EINTR )
+      {
+        continue;
+      }
+
+      throw std::runtime_error{ std::string{ what } + " failed: " + sys::error_message( errno ) };
+    }
+
+    for( nlmsghdr* hdr{ reinterpret_cast< nlmsghdr* >( buf.data() ) };
+         NLMSG_OK( hdr, static_cast< size_t >( len ) );
+         hdr = NLMSG_NEXT( hdr, len ) )
+    {
+      if( hdr->nlmsg_type == NLMSG_DONE )
+      {
+        return;
+      }
+
+      if( hdr->nlmsg_type == NLMSG_ERROR )
+      {
+        int error{ -reinterpret_cast< nlmsgerr* >( NLMSG_DATA( hdr ) )->error };
+        throw std::runtime_error{ std::string{ what } + " failed: " + sys::error_message( error ) };
+      }
+
+      handler( hdr );
+    }
+  }
+}
+
+// Secondary ipv4 addresses of iface in the same subnet as primary, the kernel deletes them along with it
+std::vector< std::pair< std::string, uint32_t > > get_secondaries( int ifindex, const in_addr& primary, uint32_t prefix_len )
+{
+  request req;
+  memset( &req, 0, sizeof( req ) );
+  req.hdr.nlmsg_len = NLMSG_LENGTH( sizeof( ifaddrmsg ) );
+  req.hdr.nlmsg_type = RTM_GETADDR;
+  req.addr.ifa_family = AF_INET;
+
+  uint32_t mask{ htonl( prefix_len? ~uint32_t{ 0 } << ( 32 - prefix_len ) : 0 ) };
+  std::vector< std::pair< std::string, uint32_t > > result;
+  dump( req, "Address dump", [ & ]( nlmsghdr* hdr )
+  {
+    ifaddrmsg* addr{ reinterpret_cast< ifaddrmsg* >( NLMSG_DATA( hdr ) ) };
+    if( hdr->nlmsg_type != RTM_NEWADDR || static_cast< int >( addr->ifa_index ) != ifindex ||
+        !( addr->ifa_flags & IFA_F_SECONDARY ) || addr->ifa_prefixlen != prefix_len )
+    {
+      return;
+    }
+
+    int attr_len( IFA_PAYLOAD( hdr ) );
+    for( rtattr* attr{ IFA_RTA( addr ) }; RTA_OK( attr, attr_len ); attr = RTA_NEXT( attr, attr_len ) )
+    {
+      const in_addr* local{ reinterpret_cast< const in_addr* >( RTA_DATA( attr ) ) };
+      std::array< char, INET_ADDRSTRLEN > addr_buf;
+      if( attr->rta_type == IFA_LOCAL && !( ( local->s_addr ^ primary.s_addr ) & mask ) &&
+          inet_ntop( AF_INET, local, addr_buf.data(), addr_buf.size() ) )
+      {
+        result.emplace_back( addr_buf.data(), prefix_len );
+      }
+    }
+  } );
+
+  return result;
+}
+
+}// details
+
+std::map< int, std::string > get_default_gateways()
+{
+  details::request req;
+  memset( &req, 0, sizeof( req ) );
+  req.hdr.nlmsg_len = NLMSG_LENGTH( sizeof( rtmsg ) );
+  req.hdr.nlmsg_type = RTM_GETROUTE;
+  req.route.rtm_family = AF_INET;
+
+  std::map< int, std::string > result;
+  details::dump( req, "Route dump", [ &result ]( nlmsghdr* hdr )
+  {
+    rtmsg* route{ reinterpret_cast< rtmsg* >( NLMSG_DATA( hdr ) ) };
+    if( hdr->nlmsg_type != RTM_NEWROUTE || route->rtm_dst_len != 0 || route->rtm_table != RT_TABLE_MAIN )
+    {
+      return;
+    }
+
+    int oif{ 0 };
+    const in_addr* gateway{ nullptr };
+
+    int attr_len( RTM_PAYLOAD( hdr ) );
+    for( rtattr* attr{ RTM_RTA( route ) }; RTA_OK( attr, attr_len ); attr = RTA_NEXT( attr, attr_len ) )
+    {
+      if( attr->rta_type == RTA_OIF )
+      {
+        oif = *reinterpret_cast< int* >( RTA_DATA( attr ) );
+      }
+      else if( attr->rta_type == RTA_GATEWAY )
+      {
+        gateway = reinterpret_cast< const in_addr* >( RTA_DATA( attr ) );
+      }
+    }
+
+    std::array< char, INET_ADDRSTRLEN > addr_buf;
+    if( oif && gateway && inet_ntop( AF_INET, gateway, addr_buf.data(), addr_buf.size() ) )
+    {
+      result.emplace( oif, addr_buf.data() );
+    }
+  } );
+
+  return result;
+}
+
+void add_address( int ifindex, const std::string& ip, uint32_t prefix_len )
+{
+  details::request req( details::address_request( RTM_NEWADDR, NLM_F_CREATE | NLM_F_EXCL, ifindex, ip, prefix_len ) );
+  details::execute( req, "RTM_NEWADDR", EEXIST );
+}
+
+void delete_address( int ifindex, const std::string& ip, uint32_t prefix_len )
+{
+  details::request req( details::address_request( RTM_DELADDR, 0, ifindex, ip, prefix_len ) );
+  details::execute( req, "RTM_DELADDR", EADDRNOTAVAIL );
+}
+
+void replace_address( int ifindex, const std::string& old_ip, uint32_t old_prefix_len, const std::string& ip, uint32_t prefix_len )
+{
+  if( old_prefix_len > 32 )
+  {
+    throw std::invalid_argument{ "Invalid prefix length" };
+  }
+
+  // added before, the new address would be a secondary of the old one and go away with it
+  std::vector< std::pair< std::string, uint32_t > > secondaries{ details::get_secondaries( ifindex, details::to_addr( old_ip ), old_prefix_len ) };
+  delete_address( ifindex, old_ip, old_prefix_len );
+  add_address( ifindex, ip, prefix_len );
+
+  for( const std::pair< std::string, uint32_t >& secondary : secondaries )
+  {
+    add_address( ifindex, secondary.first, secondary.second );
+  }
+}
+
+void add_default_route( int ifindex, const std::string& gateway )
+{
+  in_addr addr( details::to_addr( gateway ) );
+
+  details::request req( details::route_request( RTM_NEWROUTE, NLM_F_CREATE | NLM_F_EXCL, ifindex ) );
+  details::add_attr( req, RTA_GATEWAY, &addr, sizeof( addr ) );
+  details::execute( req, "RTM_NEWROUTE", EEXIST );
+}
+
+void delete_default_route( int ifindex )
+{
+  details::request req( details::route_request( RTM_DELROUTE, 0, ifindex ) );
+  details::execute( req, "RTM_DELROUTE", ESRCH );
+}
+
+}// netlink
+
+}// network
+
+}// sys
+
+}// utils
@@ -0,0 +1,48 @@
+#ifndef __SYS_NETLINK_H__
+#define __SYS_NETLINK_H__
+
+#include <map>
+#include <string>
+#include <stdexcept>
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace network
+{
+
+namespace netlink
+{
+
+/// \brief Ipv4 default gateways of the main table, by iface index
+std::map< int, std::string > get_default_gateways();
+
+/// \brief Add ipv4 address to iface, existing address is not an error
+void add_address( int ifindex, const std::string& ip, uint32_t prefix_len );
+
+/// \brief Remove ipv4 address from iface, missing address is not an error
+void delete_address( int ifindex, const std::string& ip, uint32_t prefix_len );
+
+/// \brief Replace ipv4 address of iface, normally the primary one. Its secondaries in the same subnet,
+/// which the kernel deletes along with it, are added back after the new address
+void replace_address( int ifindex, const std::string& old_ip, uint32_t old_prefix_len, const std::string& ip, uint32_t prefix_len );
+
+/// \brief Add ipv4 default route of the main table via gateway on iface.
+/// Default route that already exists ( possibly via other iface ) is left as is, same as ifupdown does
+void add_default_route( int ifindex, const std::string& gateway );
+
+/// \brief Remove ipv4 default route going through iface, missing route is not an error
+void delete_default_route( int ifindex );
+
+}
+
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,779 @@
+#include "../sys_network_interfaces.h"
+
+#include <map>
+#include <mutex>
+#include <algorithm>
+#include <stdexcept>
+
+#include <glob.h>
+#include <sys/stat.h>
+
+#include <boost/regex.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include "../aux_methods.h"
+#include "../sys_error.h"
+
+#define MAX_SOURCE_DEPTH 8
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace network
+{
+
+namespace details
+{
+
+// Throws std::system_error with errno of the failed call
+std::string read_config_file( const std::string& path )
+{
+  std::error_code ec;
+  std::string content{ aux::read_file( path, ec ) };
+  if( ec )
+  {
+    throw_error( ec, "Failed to read " + path );
+  }
+
+  return content;
+}
+
+bool is_blank_or_comment( const std::string& line )
+{
+  size_t pos{ line.find_first_not_of( " \t\r\n" ) };
+  return pos == std::string::npos || line[ pos ] == '#';
+}
+
+std::string leading_whitespace( const std::string& line )
+{
+  return line.substr( 0, line.find_first_not_of( " \t" ) );
+}
+
+// Splits content into logical lines, keeping physical text of each one.
+// Lines ending with backslash are continued on the next line
+std::vector< std::pair< std::string, std::string > > split_lines( const std::string& content )
+{
+  std::vector< std::pair< std::string, std::string > > result;
+  std::string raw;
+  std::string logical;
+
+  size_t pos{ 0 };
+  while( pos < content.size() )
+  {
+    size_t end{ content.find( '\n', pos ) };
+    end = ( end == std::string::npos )? content.size() : end + 1;
+
+    std::string line{ content.substr( pos, end - pos ) };
+    pos = end;
+    raw += line;
+
+    boost::trim_right_if( line, boost::is_any_of( "\r\n" ) );
+    if( !line.empty() && line.back() == '\\' && !is_blank_or_comment( line ) )
+    {
+      line.pop_back();
+      logical += line + " ";
+      continue;
+    }
+
+    logical += line;
+    result.emplace_back( std::move( raw ), std::move( logical ) );
+    raw.clear();
+    logical.clear();
+  }
+
+  if( !raw.empty() )
+  {
+    result.emplace_back( std::move( raw ), std::move( logical ) );
+  }
+
+  return result;
+}
+
+std::vector< std::string > split_words( const std::string& line )
+{
+  std::string trimmed{ boost::trim_copy( line ) };
+  std::vector< std::string > words;
+  boost::split( words, trimmed, boost::is_any_of( " \t" ), boost::token_compress_on );
+  return words;
+}
+
+}// details
+
+std::string iface_stanza::option( const std::string& name ) const
+{
+  for( const iface_option& opt : options )
+  {
+    if( opt.name == name )
+    {
+      return opt.value;
+    }
+  }
+
+  return std::string{};
+}
+
+void iface_stanza::set_option( const std::string& name, const std::string& value )
+{
+  auto it = std::find_if( options.begin(), options.end(),
+                          [ &name ]( const iface_option& opt ){ return opt.name == name; } );
+
+  if( value.empty() )
+  {
+    if( it != options.end() )
+    {
+      options.erase( it );
+    }
+  }
+  else if( it != options.end() )
+  {
+    it->value = value;
+  }
+  else
+  {
+    options.push_back( iface_option{ name, value } );
+  }
+}
+
+interfaces_file::interfaces_file( const std::string& path )
+{
+  add_stamp( path );
+  parse_file( path, details::read_config_file( path ), 0 );
+}
+
+interfaces_file::interfaces_file( const std::string& path, const std::string& content )
+{
+  parse_file( path, content, 0 );
+}
+
+const std::string& interfaces_file::path() const noexcept
+{
+  return files_.front().path;
+}
+
+size_t interfaces_file::parse_file( const std::string& path, const std::string& content, size_t depth )
+{
+  size_t index{ files_.size() };
+  files_.emplace_back();
+  files_.back().path = path;
+
+  std::vector< block > blocks;
+  std::string pending; // comments and blank lines inside of a stanza
+  bool in_stanza{ false };
+
+  auto add_text = [ &blocks ]( const std::string& text )
+  {
+    if( text.empty() )
+    {
+      return;
+    }
+
+    if( blocks.empty() || blocks.back().type != block_type::text )
+    {
+      blocks.emplace_back();
+    }
+
+    blocks.back().text += text;
+  };
+
+  for( const auto& line : details::split_lines( content ) )
+  {
+    const std::string& raw( line.first );
+
+    if( details::is_blank_or_comment( line.second ) )
+    {
+      if( in_stanza )
+      {
+        pending += raw;
+      }
+      else
+      {
+        add_text( raw );
+      }
+
+      continue;
+    }
+
+    std::vector< std::string > words{ details::split_words( line.second ) };
+    const std::string& keyword( words.front() );
+
+    block b;
+    b.keyword = keyword;
+    b.text = raw;
+    b.args.assign( words.begin() + 1, words.end() );
+
+    if( keyword == "iface" && words.size() >= 2 )
+    {
+      b.type = block_type::iface;
+      b.iface.name = words[ 1 ];
+      b.iface.family = words.size() > 2? words[ 2 ] : "inet";
+      b.iface.method = words.size() > 3? words[ 3 ] : "";
+    }
+    else if( keyword == "mapping" )
+    {
+      b.type = block_type::mapping;
+      b.mapping.patterns = b.args;
+    }
+    else if( keyword == "auto" )
+    {
+      b.type = block_type::auto_iface;
+    }
+    else if( boost::starts_with( keyword, "allow-" ) )
+    {
+      b.type = block_type::allow;
+    }
+    else if( keyword == "source" )
+    {
+      b.type = block_type::source;
+    }
+    else if( keyword == "source-directory" || keyword == "source-dir" )
+    {
+      b.type = block_type::source_directory;
+    }
+    else if( in_stanza )
+    {
+      // option line of the current stanza
+      block& stanza( blocks.back() );
+      std::string value{ boost::trim_copy( line.second ) };
+      value = boost::trim_copy( value.substr( keyword.length() ) );
+
+      std::vector< iface_option >& options( stanza.type == block_type::iface? stanza.iface.options : stanza.mapping.options );
+
+      option_comment comment;
+      comment.option = keyword;
+      comment.occurrence = static_cast< size_t >( std::count_if( options.begin(), options.end(),
+                                                                 [ &keyword ]( const iface_option& opt ){ return opt.name == keyword; } ) );
+      comment.text = pending;
+      stanza.comments.push_back( std::move( comment ) );
+
+      options.push_back( iface_option{ keyword, value } );
+
+      if( stanza.iface.options.size() + stanza.mapping.options.size() == 1 )
+      {
+        stanza.indent = details::leading_whitespace( raw );
+      }
+
+      stanza.text += pending + raw;
+      pending.clear();
+      continue;
+    }
+    else
+    {
+      b.type = block_type::other;
+    }
+
+    add_text( pending );
+    pending.clear();
+
+    in_stanza = ( b.type == block_type::iface || b.type == block_type::mapping );
+    blocks.emplace_back( std::move( b ) );
+  }
+
+  add_text( pending );
+
+  // sourced files are parsed after the blocks are in place, since files_ may reallocate
+  std::string base_dir{ boost::filesystem::path{ path }.parent_path().string() };
+  for( block& b : blocks )
+  {
+    if( b.type == block_type::source || b.type == block_type::source_directory )
+    {
+      add_sourced( b, base_dir, depth );
+    }
+  }
+
+  files_[ index ].blocks = std::move( blocks );
+  return index;
+}
+
+void interfaces_file::add_sourced( block& source_block, const std::string& base_dir, size_t depth )
+{
+  namespace bfs = boost::filesystem;
+
+  if( depth >= MAX_SOURCE_DEPTH )
+  {
+    throw std::runtime_error{ "Source directives are nested too deep in " + files_.front().path };
+  }
+
+  std::vector< std::string > paths;
+
+  for( const std::string& arg : source_block.args )
+  {
+    bfs::path target{ arg };
+    if( target.is_relative() )
+    {
+      target = bfs::path{ base_dir } / target;
+    }
+
+    if( source_block.type == block_type::source )
+    {
+      // a file added to the directory must invalidate the model as well
+      add_stamp( target.parent_path().string() );
+
+      glob_t matches;
+      if( glob( target.string().c_str(), 0, nullptr, &matches ) == 0 )
+      {
+        for( size_t i{ 0 }; i < matches.gl_pathc; ++i )
+        {
+          paths.emplace_back( matches.gl_pathv[ i ] );
+        }
+      }
+
+      globfree( &matches );
+    }
+    else
+    {
+      add_stamp( target.string() );
+
+      static const boost::regex name_regex{ "[a-zA-Z0-9_-]+" };
+      std::vector< std::string > dir_paths;
+
+      boost::system::error_code ec;
+      for( bfs::directory_iterator it{ target, ec }; !ec && it != bfs::directory_iterator{}; ++it )
+      {
+        if( boost::regex_match( it->path().filename().string(), name_regex ) )
+        {
+          dir_paths.emplace_back( it->path().string() );
+        }
+      }
+
+      std::sort( dir_paths.begin(), dir_paths.end() );
+      paths.insert( paths.end(), dir_paths.begin(), dir_paths.end() );
+    }
+  }
+
+  for( const std::string& sourced_path : paths )
+  {
+    if( bfs::is_regular_file( sourced_path ) )
+    {
+      add_stamp( sourced_path );
+      source_block.sourced.push_back( parse_file( sourced_path, details::read_config_file( sourced_path ), depth + 1 ) );
+    }
+  }
+}
+
+void interfaces_file::add_stamp( const std::string& path )
+{
+  file_stamp stamp;
+  stamp.path = path;
+
+  struct stat info;
+  if( ::stat( path.c_str(), &info ) == 0 )
+  {
+    stamp.ino = info.st_ino;
+    stamp.size = info.st_size;
+    stamp.mtime_sec = info.st_mtim.tv_sec;
+    stamp.mtime_nsec = info.st_mtim.tv_nsec;
+  }
+
+  auto it = std::find_if( stamps_.begin(), stamps_.end(),
+                          [ &path ]( const file_stamp& s ){ return s.path == path; } );
+  if( it != stamps_.end() )
+  {
+    *it = stamp;
+  }
+  else
+  {
+    stamps_.emplace_back( std::move( stamp ) );
+  }
+}
+
+bool interfaces_file::up_to_date() const
+{
+  for( const file_stamp& stamp : stamps_ )
+  {
+    struct stat info;
+    if( ::stat( stamp.path.c_str(), &info ) != 0 )
+    {
+      info.st_ino = 0;
+      info.st_size = 0;
+      info.st_mtim.tv_sec = 0;
+      info.st_mtim.tv_nsec = 0;
+    }
+
+    if( info.st_ino != stamp.ino ||
+        info.st_size != stamp.size ||
+        info.st_mtim.tv_sec != stamp.mtime_sec ||
+        info.st_mtim.tv_nsec != stamp.mtime_nsec )
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template< class Func >
+bool interfaces_file::for_each_block( size_t file, const Func& func )
+{
+  for( size_t i{ 0 }; i < files_[ file ].blocks.size(); ++i )
+  {
+    if( func( file, i ) )
+    {
+      return true;
+    }
+
+    // copy, func is allowed to modify blocks
+    std::vector< size_t > sourced( files_[ file ].blocks[ i ].sourced );
+    for( size_t sourced_file : sourced )
+    {
+      if( for_each_block( sourced_file, func ) )
+      {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+template< class Func >
+bool interfaces_file::for_each_block( size_t file, const Func& func ) const
+{
+  return const_cast< interfaces_file* >( this )->for_each_block( file, func );
+}
+
+const iface_stanza* interfaces_file::find_iface( const std::string& name, const std::string& family ) const
+{
+  const iface_stanza* result{ nullptr };
+
+  for_each_block( 0, [ & ]( size_t file, size_t index )
+  {
+    const block& b( files_[ file ].blocks[ index ] );
+    if( b.type == block_type::iface && b.iface.name == name && b.iface.family == family )
+    {
+      result = &b.iface;
+    }
+
+    return result != nullptr;
+  } );
+
+  return result;
+}
+
+std::vector< iface_stanza > interfaces_file::ifaces() const
+{
+  std::vector< iface_stanza > result;
+
+  for_each_block( 0, [ & ]( size_t file, size_t index )
+  {
+    const block& b( files_[ file ].blocks[ index ] );
+    if( b.type == block_type::iface )
+    {
+      result.push_back( b.iface );
+    }
+
+    return false;
+  } );
+
+  return result;
+}
+
+std::vector< mapping_stanza > interfaces_file::mappings() const
+{
+  std::vector< mapping_stanza > result;
+
+  for_each_block( 0, [ & ]( size_t file, size_t index )
+  {
+    const block& b( files_[ file ].blocks[ index ] );
+    if( b.type == block_type::mapping )
+    {
+      result.push_back( b.mapping );
+    }
+
+    return false;
+  } );
+
+  return result;
+}
+
+bool interfaces_file::is_auto( const std::string& name ) const
+{
+  return for_each_block( 0, [ & ]( size_t file, size_t index )
+  {
+    const block& b( files_[ file ].blocks[ index ] );
+    return ( b.type == block_type::auto_iface || ( b.type == block_type::allow && b.keyword == "allow-auto" ) ) &&
+           std::find( b.args.begin(), b.args.end(), name ) != b.args.end();
+  } );
+}
+
+std::vector< std::string > interfaces_file::files() const
+{
+  std::vector< std::string > result;
+  for( const file_data& file : files_ )
+  {
+    result.push_back( file.path );
+  }
+
+  return result;
+}
+
+void interfaces_file::set_iface( const iface_stanza& stanza, bool auto_start )
+{
+  if( stanza.name.empty() || stanza.family.empty() || stanza.method.empty() )
+  {
+    throw std::invalid_argument{ "Invalid iface stanza" };
+  }
+
+  size_t found_file{ 0 };
+  size_t found_index{ 0 };
+
+  bool found{ for_each_block( 0, [ & ]( size_t file, size_t index )
+  {
+    const block& b( files_[ file ].blocks[ index ] );
+    found_file = file;
+    found_index = index;
+    return b.type == block_type::iface && b.iface.name == stanza.name && b.iface.family == stanza.family;
+  } ) };
+
+  bool add_auto{ auto_start && !is_auto( stanza.name ) };
+
+  if( found )
+  {
+    file_data& file( files_[ found_file ] );
+    block& b( file.blocks[ found_index ] );
+
+    if( b.iface.method != stanza.method || b.iface.options != stanza.options )
+    {
+      b.iface.method = stanza.method;
+      b.iface.options = stanza.options;
+      b.dirty = true;
+      file.modified = true;
+    }
+
+    if( add_auto )
+    {
+      block auto_block;
+      auto_block.type = block_type::auto_iface;
+      auto_block.keyword = "auto";
+      auto_block.args.push_back( stanza.name );
+      auto_block.dirty = true;
+
+      file.blocks.insert( file.blocks.begin() + found_index, std::move( auto_block ) );
+      file.modified = true;
+    }
+
+    return;
+  }
+
+  file_data& file( files_.front() );
+
+  // separate new stanza from the previous content with a blank line
+  std::string text{ render( file ) };
+  if( !text.empty() && !boost::ends_with( text, "\n\n" ) )
+  {
+    block separator;
+    separator.text = boost::ends_with( text, "\n" )? "\n" : "\n\n";
+    file.blocks.emplace_back( std::move( separator ) );
+  }
+
+  if( add_auto )
+  {
+    block auto_block;
+    auto_block.type = block_type::auto_iface;
+    auto_block.keyword = "auto";
+    auto_block.args.push_back( stanza.name );
+    auto_block.dirty = true;
+    file.blocks.emplace_back( std::move( auto_block ) );
+  }
+
+  block iface_block;
+  iface_block.type = block_type::iface;
+  iface_block.keyword = "iface";
+  iface_block.iface = stanza;
+  iface_block.dirty = true;
+  file.blocks.emplace_back( std::move( iface_block ) );
+
+  file.modified = true;
+}
+
+bool interfaces_file::remove_iface( const std::string& name, const std::string& family )
+{
+  bool removed{ false };
+
+  for( file_data& file : files_ )
+  {
+    auto it = std::remove_if( file.blocks.begin(), file.blocks.end(),
+                              [ & ]( const block& b )
+                              { return b.type == block_type::iface && b.iface.name == name && b.iface.family == family; } );
+
+    if( it != file.blocks.end() )
+    {
+      file.blocks.erase( it, file.blocks.end() );
+      file.modified = true;
+      removed = true;
+    }
+  }
+
+  if( !removed )
+  {
+    return false;
+  }
+
+  // other families of the iface still need to be brought up
+  bool has_other_stanzas{ false };
+  for( const file_data& file : files_ )
+  {
+    for( const block& b : file.blocks )
+    {
+      has_other_stanzas = has_other_stanzas || ( b.type == block_type::iface && b.iface.name == name );
+    }
+  }
+
+  if( has_other_stanzas )
+  {
+    return true;
+  }
+
+  for( file_data& file : files_ )
+  {
+    for( block& b : file.blocks )
+    {
+      if( b.type != block_type::auto_iface && b.type != block_type::allow )
+      {
+        continue;
+      }
+
+      auto it = std::remove( b.args.begin(), b.args.end(), name );
+      if( it != b.args.end() )
+      {
+        b.args.erase( it, b.args.end() );
+        b.dirty = true;
+        file.modified = true;
+      }
+    }
+
+    file.blocks.erase( std::remove_if( file.blocks.begin(), file.blocks.end(),
+                                       []( const block& b )
+                                       {
+                                         return ( b.type == block_type::auto_iface || b.type == block_type::allow ) &&
+                                                b.args.empty();
+                                       } ),
+                       file.blocks.end() );
+  }
+
+  return true;
+}
+
+bool interfaces_file::modified() const noexcept
+{
+  return std::any_of( files_.begin(), files_.end(), []( const file_data& file ){ return file.modified; } );
+}
+
+std::string interfaces_file::render( const block& b )
+{
+  std::string text{ b.keyword };
+
+  if( b.type != block_type::iface && b.type != block_type::mapping )
+  {
+    return text + " " + boost::join( b.args, " " ) + "\n";
+  }
+
+  const std::vector< iface_option >& options( b.type == block_type::iface? b.iface.options : b.mapping.options );
+  if( b.type == block_type::iface )
+  {
+    text += " " + b.iface.name + " " + b.iface.family + " " + b.iface.method + "\n";
+  }
+  else
+  {
+    text += " " + boost::join( b.mapping.patterns, " " ) + "\n";
+  }
+
+  // comments of removed options move to the next old option that is still there, or to the end
+  std::map< std::pair< std::string, size_t >, std::string > comments;
+  std::string carried;
+  for( const option_comment& comment : b.comments )
+  {
+    size_t count{ static_cast< size_t >( std::count_if( options.begin(), options.end(),
+                                                        [ &comment ]( const iface_option& opt ){ return opt.name == comment.option; } ) ) };
+    carried += comment.text;
+    if( comment.occurrence < count && !carried.empty() )
+    {
+      comments[ std::make_pair( comment.option, comment.occurrence ) ] = carried;
+      carried.clear();
+    }
+  }
+
+  std::map< std::string, size_t > occurrences;
+  for( const iface_option& opt : options )
+  {
+    auto comment = comments.find( std::make_pair( opt.name, occurrences[ opt.name ]++ ) );
+    if( comment != comments.end() )
+    {
+      text += comment->second;
+    }
+
+    text += b.indent + opt.name + " " + opt.value + "\n";
+  }
+
+  return text + carried;
+}
+
+std::string interfaces_file::render( const file_data& file ) const
+{
+  std::string text;
+  for( const block& b : file.blocks )
+  {
+    text += b.dirty? render( b ) : b.text;
+  }
+
+  return text;
+}
+
+std::string interfaces_file::to_string() const
+{
+  return render( files_.front() );
+}
+
+bool interfaces_file::save()
+{
+  bool saved{ false };
+
+  for( file_data& file : files_ )
+  {
+    if( !file.modified )
+    {
+      continue;
+    }
+
+    saved = aux::write_file_atomic( file.path, render( file ) ) || saved;
+
+    for( block& b : file.blocks )
+    {
+      if( b.dirty )
+      {
+        b.text = render( b );
+        b.dirty = false;
+      }
+    }
+
+    file.modified = false;
+    add_stamp( file.path );
+  }
+
+  return saved;
+}
+
+std::shared_ptr< const interfaces_file > load_interfaces( const std::string& path )
+{
+  static std::mutex mutex;
+  static std::map< std::string, std::shared_ptr< const interfaces_file > > cache;
+
+  std::lock_guard< std::mutex > lock{ mutex };
+
+  std::shared_ptr< const interfaces_file >& cached( cache[ path ] );
+  if( !cached || !cached->up_to_date() )
+  {
+    cached = std::make_shared< interfaces_file >( path );
+  }
+
+  return cached;
+}
+
+}// network
+
+}// sys
+
+}// utils
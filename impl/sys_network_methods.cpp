@@ -2,8 +2,14 @@
 
 #include <stdio.h>
 #include <cstdio>
+#include <cerrno>
+#include <cstdlib>
 #include <unistd.h>
 #include <string.h>
+#include <map>
+#include <array>
+#include <memory>
+#include <algorithm>
 #include <stdexcept>
 #include <sstream>
 #include <fstream>
@@ -17,6 +23,7 @@
 #include <sys/types.h>
 #include <ifaddrs.h>
 #include <net/if_arp.h>
+#include <net/route.h>
 
 #include <boost/scope_exit.hpp>
 #include <boost/filesystem.hpp>
@@ -24,13 +31,17 @@
 #include <boost/asio/ip/host_name.hpp>
 
 #include "../sys_user_methods.h"
+#include "../sys_network_interfaces.h"
 #include "../aux_methods.h"
+#include "../sys_error.h"
 #include "execute_sys_command.h"
+#include "sys_netlink.h"
 
-#define INTERFACES_FILE "/etc/network/interfaces"
 #define RESOLV_CONF_FILE "/etc/resolv.conf"
 #define RESOLV_CONF_BASE_FILE "/etc/resolvconf/resolv.conf.d/base"
 #define RESOLV_CONF_RUN_FILE "/run/resolvconf/resolv.conf"
+#define PROC_NET_ROUTE_FILE "/proc/net/route"
+
 namespace utils
 {
 
@@ -84,37 +95,50 @@ std::vector< std::string > get_dns_list()
   return dns_list;
 }
 
-void update_network_info( const std::vector< netw_iface_info >& ifaces, const std::vector< std::string >& dns_servers )
+bool update_iface_config( interfaces_file& config, const netw_iface_info& iface )
 {
-  std::string interfaces_text{ "# This file was generated by Kraftway Smart Video Detector 3\n\n"
-                               "auto lo\n"
-                               "iface lo inet loopback\n\n"};
-
-  for( const netw_iface_info& iface : ifaces )
+  // Чтобы DHCP корректно заработал, необходимо что файл не содержал записи по нужным интерфейсам
+  if( iface.mode == iface_mode::dynamic_ip )
   {
-    // Чтобы DHCP корректно заработал, необходимо что файл не содержал записи по нужным интерфейсам
-    if( iface.mode != iface_mode::dynamic_ip )
-    {
-      interfaces_text.append( "auto " + iface.name + "\n"
-                              "iface " + iface.name + " inet static\n" );
+    return config.remove_iface( iface.name );
+  }
 
-      if( !iface.ip.empty() )
-      {
-        interfaces_text.append( "address " + iface.ip + "\n" );
-      }
+  // options the caller doesn't know about are kept
+  const iface_stanza* current{ config.find_iface( iface.name ) };
+  iface_stanza stanza{ current? *current : iface_stanza{} };
 
-      if( !iface.mask.empty() )
-      {
-        interfaces_text.append( "netmask " + iface.mask + "\n" );
-      }
+  stanza.name = iface.name;
+  stanza.method = "static";
+  stanza.set_option( "address", iface.ip );
+  stanza.set_option( "netmask", iface.mask );
+  stanza.set_option( "gateway", iface.gateway );
 
-      if( !iface.gateway.empty() )
-      {
-        interfaces_text.append( "gateway " + iface.gateway + "\n\n" );
-      }
-    }
+  bool changed{ !current ||
+                 current->method != stanza.method ||
+                 current->options != stanza.options ||
+                 !config.is_auto( iface.name ) };
+
+  if( changed )
+  {
+    config.set_iface( stanza );
   }
 
+  return changed;
+}
+
+namespace details
+{
+
+interfaces_file load_config()
+{
+  return boost::filesystem::exists( INTERFACES_FILE )?
+         interfaces_file{ *load_interfaces() } :
+         interfaces_file{ INTERFACES_FILE, "auto lo\niface lo inet loopback\n" };
+}
+
+// Writes dns servers, resolvconf is only updated when the servers actually changed
+bool update_dns( const std::vector< std::string >& dns_servers )
+{
   std::string dns_text;
   for( const std::string& dns_server : dns_servers )
   {
@@ -124,253 +148,824 @@ void update_network_info( const std::vector< netw_iface_info >& ifaces, const st
     }
   }
 
-  // write ifaces
-  if( !interfaces_text.empty() )
+  if( dns_text.empty() )
   {
-    std::ofstream ifaces_file{ INTERFACES_FILE };
-    if( !ifaces_file.is_open() )
-    {
-      throw std::ios_base::failure{ std::string{ "Could not open file: " } + INTERFACES_FILE + " for write" };
-    }
+    return false;
+  }
+
+  utils::sys::user::chmod( RESOLV_CONF_BASE_FILE, 0666 );
+  if( !boost::filesystem::exists( RESOLV_CONF_FILE ) &&
+      ( symlink( RESOLV_CONF_RUN_FILE, RESOLV_CONF_FILE ) != 0 ) )
+  {
+    throw std::runtime_error{ std::string{ "Failed to create symlink: " } + sys::error_message(errno) };
+  }
 
-    ifaces_file << interfaces_text;
-    ifaces_file.close();
+  if( !aux::write_file_atomic( RESOLV_CONF_BASE_FILE, dns_text ) )
+  {
+    return false;
   }
 
-  // write dns
-  if( !dns_text.empty() )
+  if( ::system( "resolvconf -u" ) != 0 )
   {
-    utils::sys::user::chmod( RESOLV_CONF_BASE_FILE, 0666 );
-    if( !boost::filesystem::exists( RESOLV_CONF_FILE ) &&
-        ( symlink( RESOLV_CONF_RUN_FILE, RESOLV_CONF_FILE ) != 0 ) )
+    throw std::runtime_error{ "Failed to update resolvconf" };
+  }
+
+  return true;
+}
+
+}// details
+
+void update_network_info( const std::vector< netw_iface_info >& ifaces, const std::vector< std::string >& dns_servers )
+{
+  interfaces_file config{ details::load_config() };
+
+  for( const netw_iface_info& iface : ifaces )
+  {
+    update_iface_config( config, iface );
+  }
+
+  config.save();
+  details::update_dns( dns_servers );
+}
+
+int get_iface_type( const std::string& iface_name )
+{
+  std::error_code ec;
+  int type{ get_iface_type( iface_name, ec ) };
+  if( ec )
+  {
+    throw_error( ec, iface_name.empty()? "Invalid interface" : "Could not get type of interface " + iface_name );
+  }
+
+  return type;
+}
+
+int get_iface_type( const std::string& iface_name, std::error_code& ec )
+{
+  ec.clear();
+  if( iface_name.empty() || iface_name.find( '/' ) != std::string::npos )
+  {
+    ec = errc::invalid_argument;
+    return ARPHRD_NONE;
+  }
+
+  std::string type_str{ aux::read_file( "/sys/class/net/" + iface_name + "/type", ec ) };
+  if( ec )
+  {
+    return ARPHRD_NONE;
+  }
+
+  char* end{ nullptr };
+  long type{ std::strtol( type_str.c_str(), &end, 10 ) };
+  if( end == type_str.c_str() )
+  {
+    ec = errc::invalid_format;
+    return ARPHRD_NONE;
+  }
+
+  return static_cast< int >( type );
+}
+
+std::string get_iface_gateway( const std::string& iface_name )
+{
+  std::error_code ec;
+  std::string gateway{ get_iface_gateway( iface_name, ec ) };
+  if( ec )
+  {
+    throw_error( ec, iface_name.empty()? "Invalid interface" : "Could not get gateway of interface " + iface_name );
+  }
+
+  return gateway;
+}
+
+std::string get_iface_gateway( const std::string& iface_name, std::error_code& ec )
+{
+  ec.clear();
+  if( iface_name.empty() )
+  {
+    ec = errc::invalid_argument;
+    return std::string{};
+  }
+
+  std::string routes{ aux::read_file( PROC_NET_ROUTE_FILE, ec ) };
+  if( ec )
+  {
+    return std::string{};
+  }
+
+  // "Iface Destination Gateway Flags ...", addresses are hex of the network order value
+  std::istringstream in{ routes };
+  std::string line;
+  std::getline( in, line );
+
+  std::string gateway;
+  while( std::getline( in, line ) )
+  {
+    std::istringstream fields{ line };
+    std::string name;
+    unsigned long destination{ 0 };
+    unsigned long gateway_addr{ 0 };
+    unsigned long flags{ 0 };
+    if( !( fields >> name >> std::hex >> destination >> gateway_addr >> flags ) || name != iface_name )
     {
-      throw std::runtime_error{ std::string{ "Failed to create symlink: " } + std::strerror(errno) };
+      continue;
     }
 
-    std::ofstream dns_file{ RESOLV_CONF_BASE_FILE };
-    if( !dns_file.is_open() )
+    if( ( flags & ( RTF_UP | RTF_GATEWAY ) ) != ( RTF_UP | RTF_GATEWAY ) )
     {
-      throw std::ios_base::failure{ std::string{ "Could not open file: " } + RESOLV_CONF_BASE_FILE + " for write" };
+      continue;
     }
 
-    dns_file << dns_text;
-    dns_file.close();
+    in_addr addr;
+    addr.s_addr = static_cast< in_addr_t >( gateway_addr );
+
+    std::array< char, INET_ADDRSTRLEN > buf;
+    if( !inet_ntop( AF_INET, &addr, buf.data(), buf.size() ) )
+    {
+      continue;
+    }
 
-    if( ::system( "resolvconf -u" ) != 0 )
+    // the default route wins over other routes through a gateway
+    if( gateway.empty() || destination == 0 )
     {
-      throw std::runtime_error{ "Failed to update resolvconf" };
+      gateway = buf.data();
+    }
+
+    if( destination == 0 )
+    {
+      break;
     }
   }
+
+  return gateway;
 }
 
-int get_iface_type( const std::string& iface_name )
+namespace details
 {
-  if( iface_name.empty() )
+
+using addresses_map = std::map< std::string, std::vector< iface_address > >;
+
+uint32_t prefix_length( const unsigned char* mask, size_t size ) noexcept
+{
+  uint32_t result{ 0 };
+  for( size_t byte{ 0 }; byte < size; ++byte )
   {
-    throw std::invalid_argument{ "Invalid interface" };
+    for( unsigned char bit = 0x80; bit && ( mask[ byte ] & bit ); bit >>= 1 )
+    {
+      ++result;
+    }
   }
 
-  std::string str{ "/sys/class/net/" + iface_name + "/type" };
-  std::string type_str{ aux::read_file( str ) };
-
-  return std::stoi( type_str );
+  return result;
 }
 
-std::string get_iface_gateway( const std::string& iface_name )
+addr_scope ipv4_scope( const in_addr& addr ) noexcept
 {
-  if( iface_name.empty() )
+  uint32_t host_addr{ ntohl( addr.s_addr ) };
+  if( ( host_addr >> 24 ) == 127 )
   {
-    throw std::invalid_argument{ "Invalid interface" };
+    return addr_scope::host;
   }
 
-  std::stringstream ss;
-  ss << "route -n | grep " << iface_name << " | grep 'UG[ \t]' | awk '{print $2}'";
+  if( ( host_addr >> 16 ) == 0xA9FE ) // 169.254/16
+  {
+    return addr_scope::link;
+  }
 
-  return details::execute_sys_command( ss.str() );
+  return addr_scope::global;
 }
 
-netw_iface_info get_eth_iface_info( const std::string& iface_name )
+addr_scope ipv6_scope( const in6_addr& addr ) noexcept
 {
-  if( iface_name.empty() )
+  if( IN6_IS_ADDR_LOOPBACK( &addr ) )
   {
-    throw std::invalid_argument{ "Invalid interface" };
+    return addr_scope::host;
   }
 
-  netw_iface_info result;
+  if( IN6_IS_ADDR_LINKLOCAL( &addr ) )
+  {
+    return addr_scope::link;
+  }
 
-  result.name = iface_name;
-  result.type = get_iface_type( iface_name );
-  result.gateway = get_iface_gateway( iface_name );
+  if( IN6_IS_ADDR_SITELOCAL( &addr ) )
+  {
+    return addr_scope::site;
+  }
+
+  return addr_scope::global;
+}
+
+// Groups all AF_INET and AF_INET6 entries of the list by interface name.
+// Ipv4 aliases ( eth0:1 ) are attached to their base interface
+addresses_map collect_addresses( const ifaddrs* addr_list )
+{
+  addresses_map result;
 
-  int sock{ socket( PF_INET, SOCK_DGRAM, 0 ) };
-  if ( sock != -1 )
+  for( const ifaddrs* curr_if{ addr_list }; curr_if; curr_if = curr_if->ifa_next )
   {
-    BOOST_SCOPE_EXIT( &sock ){ close( sock ); } BOOST_SCOPE_EXIT_END
+    if( !curr_if->ifa_addr ||
+        ( curr_if->ifa_addr->sa_family != AF_INET && curr_if->ifa_addr->sa_family != AF_INET6 ) )
+    {
+      continue;
+    }
+
+    iface_address address;
+    address.family = curr_if->ifa_addr->sa_family;
 
-    ifreq ifr;
-    ifr.ifr_addr.sa_family = AF_INET;
-    strncpy( ifr.ifr_name , iface_name.c_str() , IFNAMSIZ-1 );
+    std::array< char, INET6_ADDRSTRLEN > buf;
+    const void* addr_data{ nullptr };
 
-    if( ioctl( sock, SIOCGIFFLAGS, &ifr ) != -1 )
+    if( address.family == AF_INET )
     {
-      result.enabled = ifr.ifr_flags & IFF_UP;
+      const in_addr& addr( reinterpret_cast< const sockaddr_in* >( curr_if->ifa_addr )->sin_addr );
+      addr_data = &addr;
+      address.scope = ipv4_scope( addr );
+
+      if( curr_if->ifa_netmask )
+      {
+        const in_addr& mask( reinterpret_cast< const sockaddr_in* >( curr_if->ifa_netmask )->sin_addr );
+        address.prefix_len = prefix_length( reinterpret_cast< const unsigned char* >( &mask ), sizeof( mask ) );
+      }
     }
     else
     {
-      throw std::runtime_error{ "SIOCGIFFLAGS ioctl failed, errno: " +
-                                 std::string{ std::strerror( errno ) } };
+      const in6_addr& addr( reinterpret_cast< const sockaddr_in6* >( curr_if->ifa_addr )->sin6_addr );
+      addr_data = &addr;
+      address.scope = ipv6_scope( addr );
+
+      if( curr_if->ifa_netmask )
+      {
+        const in6_addr& mask( reinterpret_cast< const sockaddr_in6* >( curr_if->ifa_netmask )->sin6_addr );
+        address.prefix_len = prefix_length( mask.s6_addr, sizeof( mask.s6_addr ) );
+      }
     }
 
-    // mac
-    if( ioctl( sock, SIOCGIFHWADDR, &ifr ) != -1 )
+    if( !inet_ntop( address.family, addr_data, buf.data(), buf.size() ) )
     {
-      std::array< char, 32 > mac;
+      continue;
+    }
 
-      for( int octet = 0, indent = 0; octet < 6; ++octet )
-      {
-        indent += snprintf( mac.data() + indent,
-                            mac.size() - indent - 1,
-                            octet? ":%02X" : "%02X",
-                            ( unsigned char )ifr.ifr_hwaddr.sa_data[ octet ] );
-      }
+    address.address = buf.data();
 
-      mac[ mac.size() - 1 ] = '\0';
+    std::string name{ curr_if->ifa_name };
+    name = name.substr( 0, name.find( ':' ) );
 
-      result.mac = mac.data();
-    }
-    else
+    result[ name ].emplace_back( std::move( address ) );
+  }
+
+  return result;
+}
+
+std::string prefix_to_mask( uint32_t prefix_len )
+{
+  in_addr mask;
+  mask.s_addr = htonl( prefix_len? ~uint32_t{ 0 } << ( 32 - std::min( prefix_len, 32u ) ) : 0 );
+
+  std::array< char, INET_ADDRSTRLEN > buf;
+  return inet_ntop( AF_INET, &mask, buf.data(), buf.size() );
+}
+
+std::shared_ptr< const interfaces_file > load_interfaces_config( std::error_code& ec )
+{
+  try
+  {
+    return load_interfaces();
+  }
+  catch( const std::system_error& e )
+  {
+    ec = e.code();
+  }
+  catch( const std::runtime_error& )
+  {
+    ec = errc::invalid_format;
+  }
+
+  return nullptr;
+}
+
+// Failures are reported through ec, ENODEV means the interface is gone
+netw_iface_info get_iface_info( const std::string& iface_name,
+                                std::vector< iface_address > addresses,
+                                const interfaces_file& config,
+                                std::error_code& ec )
+{
+  netw_iface_info result;
+
+  result.name = iface_name;
+  result.type = get_iface_type( iface_name, ec );
+  if( ec )
+  {
+    return result;
+  }
+
+  result.gateway = get_iface_gateway( iface_name, ec );
+  if( ec )
+  {
+    return result;
+  }
+
+  result.addresses = std::move( addresses );
+
+  // ip & mask, the primary ipv4 address goes first in the kernel dump
+  auto primary = std::find_if( result.addresses.begin(), result.addresses.end(),
+                               []( const iface_address& address ){ return address.family == AF_INET; } );
+  if( primary != result.addresses.end() )
+  {
+    result.ip = primary->address;
+    result.mask = prefix_to_mask( primary->prefix_len );
+  }
+
+  int sock{ socket( PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0 ) };
+  if( sock == -1 )
+  {
+    ec = errno_code();
+    return result;
+  }
+
+  BOOST_SCOPE_EXIT( &sock ){ close( sock ); } BOOST_SCOPE_EXIT_END
+
+  ifreq ifr;
+  ifr.ifr_addr.sa_family = AF_INET;
+  strncpy( ifr.ifr_name , iface_name.c_str() , IFNAMSIZ-1 );
+  ifr.ifr_name[ IFNAMSIZ - 1 ] = '\0';
+
+  if( ioctl( sock, SIOCGIFFLAGS, &ifr ) == -1 )
+  {
+    ec = errno_code();
+    return result;
+  }
+
+  result.enabled = ifr.ifr_flags & IFF_UP;
+
+  // mac
+  if( ioctl( sock, SIOCGIFHWADDR, &ifr ) == -1 )
+  {
+    ec = errno_code();
+    return result;
+  }
+
+  std::array< char, 32 > mac;
+
+  for( int octet = 0, indent = 0; octet < 6; ++octet )
+  {
+    indent += snprintf( mac.data() + indent,
+                        mac.size() - indent - 1,
+                        octet? ":%02X" : "%02X",
+                        ( unsigned char )ifr.ifr_hwaddr.sa_data[ octet ] );
+  }
+
+  mac[ mac.size() - 1 ] = '\0';
+
+  result.mac = mac.data();
+
+  // mtu
+  if( ioctl ( sock, SIOCGIFMTU, &ifr ) == -1 )
+  {
+    ec = errno_code();
+    return result;
+  }
+
+  result.mtu = ifr.ifr_mtu;
+
+  // speed
+  ethtool_cmd edata;
+  edata.cmd = ETHTOOL_GSET;
+  ifr.ifr_data = reinterpret_cast< char* >( &edata );
+
+  if( ioctl( sock, SIOCETHTOOL, &ifr ) != -1 )
+  {
+    result.speed = ethtool_cmd_speed( &edata );
+    result.duplex = edata.duplex;
+  }
+  else if( iface_name != "lo" )
+  {
+    ec = errno_code();
+    return result;
+  }
+
+  // mode
+  const iface_stanza* stanza{ config.find_iface( iface_name ) };
+  result.mode = ( stanza && stanza->method == "static" )? iface_mode::static_ip : iface_mode::dynamic_ip;
+
+  return result;
+}
+
+}// details
+
+netw_iface_info get_eth_iface_info( const std::string& iface_name )
+{
+  std::error_code ec;
+  netw_iface_info result{ get_eth_iface_info( iface_name, ec ) };
+  if( ec )
+  {
+    throw_error( ec, iface_name.empty()? "Invalid interface" : "Could not get info of interface " + iface_name );
+  }
+
+  return result;
+}
+
+netw_iface_info get_eth_iface_info( const std::string& iface_name, std::error_code& ec )
+{
+  ec.clear();
+  if( iface_name.empty() )
+  {
+    ec = errc::invalid_argument;
+    return netw_iface_info{};
+  }
+
+  ifaddrs* addr_list{ nullptr };
+  if( getifaddrs( &addr_list ) == -1 )
+  {
+    ec = errno_code();
+    return netw_iface_info{};
+  }
+
+  details::addresses_map addresses;
+  {
+    BOOST_SCOPE_EXIT( addr_list ){ freeifaddrs( addr_list ); } BOOST_SCOPE_EXIT_END
+    addresses = details::collect_addresses( addr_list );
+  }
+
+  std::shared_ptr< const interfaces_file > config{ details::load_interfaces_config( ec ) };
+  if( ec )
+  {
+    return netw_iface_info{};
+  }
+
+  return details::get_iface_info( iface_name, std::move( addresses[ iface_name ] ), *config, ec );
+}
+
+std::vector< netw_iface_info > get_ifaces_of_type( int type )
+{
+  std::error_code ec;
+  std::vector< netw_iface_info > result{ get_ifaces_of_type( type, ec ) };
+  if( ec )
+  {
+    throw_error( ec, "Could not get interfaces" );
+  }
+
+  return result;
+}
+
+std::vector< netw_iface_info > get_ifaces_of_type( int type, std::error_code& ec )
+{
+  ec.clear();
+  std::vector< netw_iface_info > result;
+
+  ifaddrs* addr_list{ nullptr };
+  if( getifaddrs( &addr_list ) == -1 )
+  {
+    ec = errno_code();
+    return result;
+  }
+
+  BOOST_SCOPE_EXIT( addr_list ){ freeifaddrs( addr_list ); } BOOST_SCOPE_EXIT_END
+
+  // Addresses of all families are taken from the same dump
+  details::addresses_map addresses{ details::collect_addresses( addr_list ) };
+  std::shared_ptr< const interfaces_file > config{ details::load_interfaces_config( ec ) };
+  if( ec )
+  {
+    return result;
+  }
+
+  for( ifaddrs* curr_if{ addr_list }; curr_if; curr_if = curr_if->ifa_next )
+  {
+    if( !curr_if->ifa_addr || curr_if->ifa_addr->sa_family != AF_PACKET )
     {
-      throw std::runtime_error{ "SIOCGIFHWADDR ioctl failed, errno: " +
-                                std::string{ std::strerror( errno ) } };
+      continue;
     }
 
-    // mtu
-    if( ioctl ( sock, SIOCGIFMTU, &ifr ) != -1 )
+    // interfaces removed since the dump are skipped
+    std::string name{ curr_if->ifa_name };
+    std::error_code iface_ec;
+    if( get_iface_type( name, iface_ec ) != type || iface_ec )
     {
-      result.mtu = ifr.ifr_mtu;
+      continue;
     }
-    else
+
+    netw_iface_info info{ details::get_iface_info( name, std::move( addresses[ name ] ), *config, iface_ec ) };
+    if( iface_ec == std::errc::no_such_device || iface_ec == std::errc::no_such_file_or_directory )
     {
-      throw std::runtime_error{ "SIOCGIFMTU ioctl failed, errno: "+
-                                std::string{ std::strerror( errno ) } };
+      continue;
     }
 
-    // ip
-    if( ioctl ( sock, SIOCGIFADDR, &ifr ) != -1 )
+    if( iface_ec )
     {
-      result.ip = inet_ntoa( ( ( sockaddr_in* )&ifr.ifr_addr )->sin_addr );
-    }    
+      ec = iface_ec;
+      result.clear();
+      return result;
+    }
 
-    // Mask
-    if( ioctl(sock, SIOCGIFNETMASK, &ifr ) != -1 )
-    {
-      result.mask = inet_ntoa( ( ( sockaddr_in* )&ifr.ifr_netmask )->sin_addr );
-    }   
+    result.emplace_back( std::move( info ) );
+  }
 
-    // speed
-    ethtool_cmd edata;
-    edata.cmd = ETHTOOL_GSET;
-    ifr.ifr_data = reinterpret_cast< char* >( &edata );
+  return result;
+}
 
-    if( ioctl( sock, SIOCETHTOOL, &ifr ) != -1 )
+namespace details
+{
+
+// Splits "10.0.0.1/24" or address + dotted mask into address and prefix length
+bool parse_static_address( const netw_iface_info& iface, std::string& ip, uint32_t& prefix_len )
+{
+  ip = iface.ip;
+
+  size_t slash{ ip.find( '/' ) };
+  if( slash != std::string::npos )
+  {
+    std::string prefix{ ip.substr( slash + 1 ) };
+    ip.erase( slash );
+
+    // strtoul skips spaces and takes signs
+    if( prefix.empty() || prefix[ 0 ] < '0' || prefix[ 0 ] > '9' )
     {
-      result.speed = ethtool_cmd_speed( &edata );
-      result.duplex = edata.duplex;
+      return false;
     }
-    else if( iface_name != "lo" )
+
+    char* end{ nullptr };
+    errno = 0;
+    unsigned long value{ std::strtoul( prefix.c_str(), &end, 10 ) };
+    if( *end || errno || value > 32 )
     {
-      throw std::runtime_error{ "SIOCETHTOOL ioctl failed, errrno: " +
-                                 std::string{ std::strerror( errno ) } };
+      return false;
     }
 
-    // mode
-    std::unique_ptr< FILE, int( * )( FILE* ) > f{ fopen( INTERFACES_FILE, "r" ), fclose };
-    if( !f )
+    prefix_len = static_cast< uint32_t >( value );
+  }
+  else
+  {
+    in_addr mask;
+    if( inet_pton( AF_INET, iface.mask.c_str(), &mask ) != 1 )
     {
-      throw std::ios_base::failure{ " Failed opening /etc/network/interfaces" };
+      return false;
     }
 
-    result.mode = iface_mode::dynamic_ip;
-    std::array< char, IFNAMSIZ > dname;
-    std::array< char, IFNAMSIZ > inet;
-    std::array< char, IFNAMSIZ > mode;
-    std::array< char, 1024 > buffer;
+    prefix_len = prefix_length( reinterpret_cast< const unsigned char* >( &mask ), sizeof( mask ) );
+  }
+
+  in_addr addr;
+  return inet_pton( AF_INET, ip.c_str(), &addr ) == 1;
+}
+
+// Replaces the primary ipv4 address and default route of the iface with the requested ones.
+// Other addresses ( aliases ) are left as they are
+void reconfigure_iface( int ifindex,
+                        const std::string& ip,
+                        uint32_t prefix_len,
+                        const std::string& gateway,
+                        const iface_address* current_primary,
+                        const std::string& current_gateway )
+{
+  bool replace{ current_primary && ( current_primary->address != ip || current_primary->prefix_len != prefix_len ) };
+  if( replace )
+  {
+    netlink::replace_address( ifindex, current_primary->address, current_primary->prefix_len, ip, prefix_len );
+  }
+  else
+  {
+    netlink::add_address( ifindex, ip, prefix_len );
+  }
 
-    while( !feof( f.get() ) )
+  // the route may have gone with the old address
+  if( replace || current_gateway != gateway )
+  {
+    if( !current_gateway.empty() )
     {
-      if( fgets( buffer.data(), buffer.size(), f.get() ) )
-      {
-        sscanf( buffer.data(),"iface %s %s %s", dname.data(), inet.data(), mode.data() );
-
-        if( strcmp( iface_name.c_str(), dname.data() ) == 0 &&
-            strcmp( inet.data(), "inet" ) == 0 )
-        {
-          if( strcmp( mode.data(), "static" ) == 0 )
-          {
-            result.mode = iface_mode::static_ip;
-          }
-
-          break;
-        }
-      }
+      netlink::delete_default_route( ifindex );
     }
+
+    if( !gateway.empty() )
+    {
+      netlink::add_default_route( ifindex, gateway );
+    }
+  }
+}
+
+// The primary ipv4 address goes first in the kernel dump
+const iface_address* primary_address( const std::vector< iface_address >& addresses ) noexcept
+{
+  auto primary = std::find_if( addresses.begin(), addresses.end(),
+                               []( const iface_address& address ){ return address.family == AF_INET; } );
+  return primary != addresses.end()? &*primary : nullptr;
+}
+
+void set_link_state( const std::string& iface_name, bool up )
+{
+  int sock{ socket( PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0 ) };
+  if( sock == -1 )
+  {
+    throw_error( errno_code(), "Could not open socket" );
+  }
+
+  BOOST_SCOPE_EXIT( &sock ){ close( sock ); } BOOST_SCOPE_EXIT_END
+
+  ifreq ifr;
+  memset( &ifr, 0, sizeof( ifr ) );
+  strncpy( ifr.ifr_name , iface_name.c_str() , IFNAMSIZ-1 );
+
+  if( ioctl( sock, SIOCGIFFLAGS, &ifr ) == -1 )
+  {
+    throw_error( errno_code(), "Could not get flags of iface " + iface_name );
+  }
+
+  ifr.ifr_flags = up? ( ifr.ifr_flags | IFF_UP ) : ( ifr.ifr_flags & ~IFF_UP );
+  if( ioctl( sock, SIOCSIFFLAGS, &ifr ) == -1 )
+  {
+    throw_error( errno_code(), "Could not turn iface " + iface_name + ( up? " up" : " down" ) );
+  }
+}
+
+// Ifaces with a stanza are brought up by ifup, those without one are left to the dhcp client once the link is up
+void bring_up( const interfaces_file& config, const std::string& iface_name )
+{
+  if( config.find_iface( iface_name ) )
+  {
+    set_iface_state( iface_name, true );
   }
   else
   {
-    throw std::runtime_error{ "Could not open socket" };
+    set_link_state( iface_name, true );
   }
+}
 
-  return result;
+// Puts the stanza of iface_name back as it was in original
+void restore_iface( interfaces_file& config, const interfaces_file& original, const std::string& iface_name )
+{
+  const iface_stanza* stanza{ original.find_iface( iface_name ) };
+  if( stanza )
+  {
+    config.set_iface( *stanza, original.is_auto( iface_name ) );
+  }
+  else
+  {
+    config.remove_iface( iface_name );
+  }
 }
 
-std::vector< netw_iface_info > get_ifaces_of_type( int type )
+}// details
+
+network_apply_report apply_network_info( const std::vector< netw_iface_info >& ifaces,
+                                         const std::vector< std::string >& dns_servers )
 {
-  std::vector< netw_iface_info > result;
+  network_apply_report report;
+  const interfaces_file original{ details::load_config() };
+
+  // the model tells which ifaces really change, it's saved only after the restarted ones are down
+  interfaces_file config{ original };
+  std::vector< bool > changed;
+  for( const netw_iface_info& iface : ifaces )
+  {
+    changed.push_back( update_iface_config( config, iface ) );
+  }
 
+  // current state, taken once for all the ifaces
   ifaddrs* addr_list{ nullptr };
+  if( getifaddrs( &addr_list ) == -1 )
+  {
+    throw std::runtime_error{ "Could not get ifaces list" };
+  }
 
-  if( getifaddrs( &addr_list ) != -1 )
+  details::addresses_map addresses;
   {
     BOOST_SCOPE_EXIT( addr_list ){ freeifaddrs( addr_list ); } BOOST_SCOPE_EXIT_END
+    addresses = details::collect_addresses( addr_list );
+  }
+
+  std::map< int, std::string > gateways{ netlink::get_default_gateways() };
+
+  std::vector< const netw_iface_info* > to_reconfigure;
+  std::vector< std::string > to_restart;
+
+  for( size_t i{ 0 }; i < ifaces.size(); ++i )
+  {
+    const netw_iface_info& iface( ifaces[ i ] );
+    const iface_stanza* current{ original.find_iface( iface.name ) };
+    bool was_static{ current && current->method == "static" };
+    bool is_static{ iface.mode != iface_mode::dynamic_ip };
+    unsigned int ifindex{ if_nametoindex( iface.name.c_str() ) };
 
-    ifaddrs* curr_if{ addr_list };
-    while (curr_if)
+    if( ifindex == 0 )
     {
-      if( curr_if->ifa_addr && curr_if->ifa_addr->sa_family == AF_PACKET )
+      // not present on the system, only the configuration is updated
+      continue;
+    }
+
+    std::string ip;
+    uint32_t prefix_len{ 0 };
+
+    if( was_static != is_static )
+    {
+      to_restart.push_back( iface.name );
+    }
+    else if( is_static && !details::parse_static_address( iface, ip, prefix_len ) )
+    {
+      // can't be set over netlink, ifupdown gets the new stanza if there is one
+      if( changed[ i ] )
       {
-        std::string name{ curr_if->ifa_name };
-
-        try
-        {
-          netw_iface_info if_info{ get_eth_iface_info( name ) };
-          if( if_info.type == type )
-          {
-            if_info.name = name;
-            result.emplace_back( if_info );
-          }
-        }
-        catch( const std::exception& e )
-        {
-          std::string error{ name + " : get_eth_iface_info exception: " + e.what() };
-          throw std::runtime_error{ error };
-        }
+        to_restart.push_back( iface.name );
       }
+    }
+    else if( is_static )
+    {
+      const std::vector< iface_address >& current_addresses( addresses[ iface.name ] );
+      bool address_set{ std::any_of( current_addresses.begin(), current_addresses.end(),
+                                     [ & ]( const iface_address& address )
+                                     {
+                                       return address.family == AF_INET &&
+                                              address.address == ip &&
+                                              address.prefix_len == prefix_len;
+                                     } ) };
+
+      if( !address_set || gateways[ ifindex ] != iface.gateway )
+      {
+        to_reconfigure.push_back( &iface );
+      }
+    }
+  }
 
-      curr_if = curr_if->ifa_next;
+  // ifdown has to run while the old configuration is still on disk, so netlink goes first as well,
+  // its failures fall back to a restart
+  for( const netw_iface_info* iface : to_reconfigure )
+  {
+    int ifindex( if_nametoindex( iface->name.c_str() ) );
+    std::string ip;
+    uint32_t prefix_len{ 0 };
+    details::parse_static_address( *iface, ip, prefix_len );
+
+    try
+    {
+      details::reconfigure_iface( ifindex, ip, prefix_len, iface->gateway,
+                                  details::primary_address( addresses[ iface->name ] ), gateways[ ifindex ] );
+      report.reconfigured.push_back( iface->name );
+    }
+    catch( const std::exception& )
+    {
+      to_restart.push_back( iface->name );
     }
   }
-  else
+
+  for( const std::string& name : to_restart )
   {
-    throw std::runtime_error{ "Could not get ifaces list" };
+    try
+    {
+      set_iface_state( name, false );
+    }
+    catch( const std::exception& )
+    {
+      // iface may be down already
+    }
   }
 
-  return result;
+  report.config_updated = config.save();
+
+  for( const std::string& name : to_restart )
+  {
+    try
+    {
+      details::bring_up( config, name );
+      report.restarted.push_back( name );
+    }
+    catch( const std::exception& )
+    {
+      // the old settings are put back, so the iface isn't left down
+      try
+      {
+        set_iface_state( name, false );
+      }
+      catch( const std::exception& ){}
+
+      details::restore_iface( config, original, name );
+      bool saved{ false };
+      try
+      {
+        config.save();
+        saved = true;
+      }
+      catch( const std::exception& )
+      {
+        // the rest of the ifaces and dns are still done
+      }
+
+      try
+      {
+        details::bring_up( config, name );
+      }
+      catch( const std::exception& ){}
+
+      ( saved? report.restored : report.restore_failed ).push_back( name );
+    }
+  }
+
+  report.dns_updated = details::update_dns( dns_servers );
+
+  return report;
 }
 
 void apply_iptables_settings()
 {
-  details::execute_sys_command( "service iptables.rules apply-acl-hosts" );
-  details::execute_sys_command( "service iptables.rules apply-acl-ports" );
+  sys::details::execute_sys_command( "service iptables.rules apply-acl-hosts" );
+  sys::details::execute_sys_command( "service iptables.rules apply-acl-ports" );
 }
 
 }// iface
@@ -0,0 +1,487 @@
+#include "../sys_ntp_client.h"
+
+#include <map>
+#include <array>
+#include <limits>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "../sys_error.h"
+#include "run_detached.h"
+
+#define NTP_PACKET_SIZE 48
+#define NTP_PORT "123"
+#define NTP_UNIX_EPOCH_DIFF 2208988800U
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace time
+{
+
+namespace details
+{
+
+// 32.32 fixed point ntp timestamp
+uint64_t to_ntp( const timespec& ts ) noexcept
+{
+  uint64_t seconds{ static_cast< uint32_t >( ts.tv_sec + NTP_UNIX_EPOCH_DIFF ) };
+  uint64_t fraction{ ( static_cast< uint64_t >( ts.tv_nsec ) << 32 ) / 1000000000 };
+  return ( seconds << 32 ) | fraction;
+}
+
+uint64_t read_ntp( const unsigned char* data ) noexcept
+{
+  uint64_t result{ 0 };
+  for( int i{ 0 }; i < 8; ++i )
+  {
+    result = ( result << 8 ) | data[ i ];
+  }
+
+  return result;
+}
+
+void write_ntp( unsigned char* data, uint64_t value ) noexcept
+{
+  for( int i{ 7 }; i >= 0; --i )
+  {
+    data[ i ] = value & 0xFF;
+    value >>= 8;
+  }
+}
+
+// Difference of two timestamps in seconds, correct across era boundary
+double ntp_diff( uint64_t lhs, uint64_t rhs ) noexcept
+{
+  return static_cast< double >( static_cast< int64_t >( lhs - rhs ) ) / 4294967296.0;
+}
+
+timespec now() noexcept
+{
+  timespec ts;
+  clock_gettime( CLOCK_REALTIME, &ts );
+  return ts;
+}
+
+// v4-mapped addresses of the dual stack socket are shown as ipv4 ones
+std::string address_to_string( const sockaddr_storage& addr )
+{
+  std::array< char, INET6_ADDRSTRLEN > buf;
+  const in6_addr& in6( reinterpret_cast< const sockaddr_in6& >( addr ).sin6_addr );
+  if( addr.ss_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED( &in6 ) )
+  {
+    return inet_ntop( AF_INET, &in6.s6_addr[ 12 ], buf.data(), buf.size() )? buf.data() : std::string{};
+  }
+
+  const void* data{ addr.ss_family == AF_INET6?
+                    static_cast< const void* >( &reinterpret_cast< const sockaddr_in6& >( addr ).sin6_addr ) :
+                    static_cast< const void* >( &reinterpret_cast< const sockaddr_in& >( addr ).sin_addr ) };
+
+  return inet_ntop( addr.ss_family, data, buf.data(), buf.size() )? buf.data() : std::string{};
+}
+
+// "host", "host:port" or "[ipv6]:port"
+void split_host_port( const std::string& server, std::string& host, std::string& port )
+{
+  host = server;
+  port = NTP_PORT;
+
+  size_t colon{ std::string::npos };
+  if( server.front() == '[' )
+  {
+    size_t bracket{ server.find( ']' ) };
+    if( bracket == std::string::npos || ( bracket + 1 < server.size() && server[ bracket + 1 ] != ':' ) )
+    {
+      return;
+    }
+
+    host = server.substr( 1, bracket - 1 );
+    colon = bracket + 1 < server.size()? bracket + 1 : std::string::npos;
+  }
+  else if( std::count( server.begin(), server.end(), ':' ) == 1 )
+  {
+    colon = server.find( ':' );
+    host = server.substr( 0, colon );
+  }
+
+  if( colon != std::string::npos && colon + 1 < server.size() )
+  {
+    port = server.substr( colon + 1 );
+  }
+}
+
+}// details
+
+struct ntp_client::impl
+{
+  struct endpoint
+  {
+    sockaddr_storage addr;
+    socklen_t addr_len{ 0 };
+  };
+
+  struct server_state
+  {
+    std::string name;
+    std::vector< endpoint > endpoints; // all the resolved addresses, each retransmission goes to the next one
+    size_t current{ 0 };
+    uint64_t sent_ts{ 0 };
+    uint32_t sent_count{ 0 };
+    std::chrono::steady_clock::time_point deadline;
+    bool done{ false };
+  };
+
+  std::vector< server_state > servers;
+  std::chrono::milliseconds timeout;
+  uint32_t attempts{ 0 };
+  int sock{ -1 };
+  int family{ AF_INET6 };
+  bool started{ false };
+  ntp_result result;
+
+  void fail( server_state& server, const std::string& error )
+  {
+    server.done = true;
+    result.errors.emplace_back( server.name, error );
+  }
+
+  void send( server_state& server )
+  {
+    std::array< unsigned char, NTP_PACKET_SIZE > packet{ { 0 } };
+    packet[ 0 ] = 0x23; // LI 0, version 4, client mode
+
+    // Transmit timestamp is echoed by the server as origin, so the answer can be matched to the request.
+    // Low bits of the fraction are below clock precision and are made unique per request
+    server.sent_ts = details::to_ntp( details::now() );
+    server.sent_ts = ( server.sent_ts & ~uint64_t{ 0xFFFF } ) | ( ( &server - servers.data() ) & 0xFFFF );
+    details::write_ntp( packet.data() + 40, server.sent_ts );
+
+    server.current = server.sent_count % server.endpoints.size();
+    const endpoint& to( server.endpoints[ server.current ] );
+
+    ++server.sent_count;
+    server.deadline = std::chrono::steady_clock::now() + timeout;
+
+    ssize_t res{ sendto( sock, packet.data(), packet.size(), 0, reinterpret_cast< const sockaddr* >( &to.addr ), to.addr_len ) };
+    if( res < 0 && server.sent_count >= attempts )
+    {
+      fail( server, std::string{ "sendto failed: " } + sys::error_message( errno ) );
+    }
+    else if( res < 0 )
+    {
+      // e.g. no route to an ipv6 address, the next one is tried right away
+      server.deadline = std::chrono::steady_clock::now();
+    }
+  }
+
+  void receive( const unsigned char* packet, size_t size, const sockaddr_storage& from, const timespec& received )
+  {
+    if( size < NTP_PACKET_SIZE )
+    {
+      return;
+    }
+
+    uint64_t origin{ details::read_ntp( packet + 24 ) };
+    auto server = std::find_if( servers.begin(), servers.end(),
+                                [ origin ]( const server_state& s ){ return !s.done && s.sent_ts == origin; } );
+    if( server == servers.end() ||
+        details::address_to_string( from ) != details::address_to_string( server->endpoints[ server->current ].addr ) )
+    {
+      return; // stale or spoofed answer
+    }
+
+    int leap{ packet[ 0 ] >> 6 };
+    int mode{ packet[ 0 ] & 0x07 };
+    int stratum{ packet[ 1 ] };
+
+    if( mode != 4 )
+    {
+      return;
+    }
+
+    if( stratum == 0 )
+    {
+      fail( *server, "Kiss-o'-Death: " + std::string( reinterpret_cast< const char* >( packet + 12 ), 4 ) );
+      return;
+    }
+
+    if( leap == 3 || stratum > 15 )
+    {
+      fail( *server, "Server is not synchronized" );
+      return;
+    }
+
+    uint64_t t1{ server->sent_ts };
+    uint64_t t2{ details::read_ntp( packet + 32 ) };
+    uint64_t t3{ details::read_ntp( packet + 40 ) };
+    uint64_t t4{ details::to_ntp( received ) };
+
+    ntp_sample sample;
+    sample.server = server->name;
+    sample.address = details::address_to_string( server->endpoints[ server->current ].addr );
+    sample.stratum = stratum;
+    sample.offset = ( details::ntp_diff( t2, t1 ) + details::ntp_diff( t3, t4 ) ) / 2;
+    sample.delay = std::max( 0.0, details::ntp_diff( t4, t1 ) - details::ntp_diff( t3, t2 ) );
+
+    std::chrono::nanoseconds local{ std::chrono::seconds{ received.tv_sec } + std::chrono::nanoseconds{ received.tv_nsec } };
+    std::chrono::nanoseconds offset{ static_cast< int64_t >( sample.offset * 1e9 ) };
+    sample.time = std::chrono::system_clock::time_point{
+                    std::chrono::duration_cast< std::chrono::system_clock::duration >( local + offset ) };
+
+    server->done = true;
+    result.samples.emplace_back( std::move( sample ) );
+  }
+};
+
+const ntp_sample* ntp_result::best() const noexcept
+{
+  auto it = std::min_element( samples.begin(), samples.end(),
+                              []( const ntp_sample& lhs, const ntp_sample& rhs ){ return lhs.delay < rhs.delay; } );
+
+  return it != samples.end()? &*it : nullptr;
+}
+
+ntp_client::ntp_client( const std::vector< std::string >& servers, std::chrono::milliseconds timeout, uint32_t attempts )
+  : impl_{ new impl }
+{
+  if( servers.empty() )
+  {
+    throw std::invalid_argument{ "No servers specified" };
+  }
+
+  if( !attempts || timeout.count() <= 0 )
+  {
+    throw std::invalid_argument{ "Invalid timeout or number of attempts" };
+  }
+
+  for( const std::string& server : servers )
+  {
+    if( server.empty() )
+    {
+      throw std::invalid_argument{ "Invalid server name" };
+    }
+
+    impl_->servers.emplace_back();
+    impl_->servers.back().name = server;
+  }
+
+  impl_->timeout = timeout;
+  impl_->attempts = attempts;
+}
+
+ntp_client::~ntp_client()
+{
+  if( impl_->sock != -1 )
+  {
+    close( impl_->sock );
+  }
+}
+
+void ntp_client::start()
+{
+  if( impl_->started )
+  {
+    throw std::logic_error{ "Query is already started" };
+  }
+
+  impl_->started = true;
+
+  // dual stack socket serves both ipv4 and ipv6 servers
+  impl_->sock = socket( AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+  if( impl_->sock != -1 )
+  {
+    int off{ 0 };
+    setsockopt( impl_->sock, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof( off ) );
+  }
+  else
+  {
+    impl_->family = AF_INET;
+    impl_->sock = socket( AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+  }
+
+  if( impl_->sock == -1 )
+  {
+    throw std::runtime_error{ std::string{ "Failed to open socket: " } + sys::error_message( errno ) };
+  }
+
+  for( impl::server_state& server : impl_->servers )
+  {
+    std::string host;
+    std::string port;
+    details::split_host_port( server.name, host, port );
+
+    addrinfo hints;
+    memset( &hints, 0, sizeof( hints ) );
+    hints.ai_family = impl_->family == AF_INET6? AF_UNSPEC : AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    addrinfo* info{ nullptr };
+    int res{ getaddrinfo( host.c_str(), port.c_str(), &hints, &info ) };
+    if( res != 0 || !info )
+    {
+      impl_->fail( server, std::string{ "Failed to resolve host name: " } + gai_strerror( res ) );
+      continue;
+    }
+
+    for( const addrinfo* curr{ info }; curr; curr = curr->ai_next )
+    {
+      impl::endpoint to;
+      memset( &to.addr, 0, sizeof( to.addr ) );
+      if( impl_->family == AF_INET6 && curr->ai_family == AF_INET )
+      {
+        // v4-mapped address
+        const sockaddr_in& in4( *reinterpret_cast< const sockaddr_in* >( curr->ai_addr ) );
+        sockaddr_in6& in6( reinterpret_cast< sockaddr_in6& >( to.addr ) );
+        in6.sin6_family = AF_INET6;
+        in6.sin6_port = in4.sin_port;
+        in6.sin6_addr.s6_addr[ 10 ] = 0xFF;
+        in6.sin6_addr.s6_addr[ 11 ] = 0xFF;
+        memcpy( &in6.sin6_addr.s6_addr[ 12 ], &in4.sin_addr, sizeof( in4.sin_addr ) );
+        to.addr_len = sizeof( sockaddr_in6 );
+      }
+      else
+      {
+        memcpy( &to.addr, curr->ai_addr, curr->ai_addrlen );
+        to.addr_len = curr->ai_addrlen;
+      }
+
+      server.endpoints.push_back( to );
+    }
+
+    freeaddrinfo( info );
+    impl_->send( server );
+  }
+}
+
+int ntp_client::fd() const noexcept
+{
+  return impl_->sock;
+}
+
+std::chrono::milliseconds ntp_client::next_timeout() const
+{
+  auto now = std::chrono::steady_clock::now();
+  std::chrono::milliseconds result{ impl_->timeout };
+
+  for( const impl::server_state& server : impl_->servers )
+  {
+    if( !server.done )
+    {
+      auto left = std::chrono::duration_cast< std::chrono::milliseconds >( server.deadline - now );
+      result = std::min( result, std::max( left, std::chrono::milliseconds{ 0 } ) );
+    }
+  }
+
+  return result;
+}
+
+bool ntp_client::process()
+{
+  if( !impl_->started )
+  {
+    throw std::logic_error{ "Query is not started" };
+  }
+
+  std::array< unsigned char, 512 > buf;
+  while( !finished() )
+  {
+    sockaddr_storage from;
+    socklen_t from_len{ sizeof( from ) };
+
+    ssize_t res{ recvfrom( impl_->sock, buf.data(), buf.size(), 0, reinterpret_cast< sockaddr* >( &from ), &from_len ) };
+    if( res < 0 )
+    {
+      if( errno == EINTR )
+      {
+        continue;
+      }
+
+      break; // EAGAIN or ICMP error, lost servers are handled by timeouts
+    }
+
+    impl_->receive( buf.data(), res, from, details::now() );
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  for( impl::server_state& server : impl_->servers )
+  {
+    if( server.done || now < server.deadline )
+    {
+      continue;
+    }
+
+    if( server.sent_count < impl_->attempts )
+    {
+      impl_->send( server );
+    }
+    else
+    {
+      impl_->fail( server, "No answer after " + std::to_string( server.sent_count ) + " attempts" );
+    }
+  }
+
+  return finished();
+}
+
+bool ntp_client::finished() const noexcept
+{
+  return std::all_of( impl_->servers.begin(), impl_->servers.end(),
+                      []( const impl::server_state& server ){ return server.done; } );
+}
+
+ntp_result ntp_client::result() const
+{
+  return impl_->result;
+}
+
+ntp_result ntp_client::query()
+{
+  start();
+
+  while( !process() )
+  {
+    pollfd pfd{ impl_->sock, POLLIN, 0 };
+    int res{ poll( &pfd, 1, static_cast< int >( next_timeout().count() ) ) };
+    if( res < 0 && errno != EINTR )
+    {
+      throw std::runtime_error{ std::string{ "poll failed: " } + sys::error_message( errno ) };
+    }
+  }
+
+  return result();
+}
+
+ntp_result query_ntp_servers( const std::vector< std::string >& servers, std::chrono::milliseconds timeout, uint32_t attempts )
+{
+  ntp_client client{ servers, timeout, attempts };
+  return client.query();
+}
+
+std::future< ntp_result > query_ntp_servers_async( const std::vector< std::string >& servers,
+                                                   std::chrono::milliseconds timeout,
+                                                   uint32_t attempts )
+{
+  return sys::details::run_detached( [ servers, timeout, attempts ]
+  {
+    return query_ntp_servers( servers, timeout, attempts );
+  } );
+}
+
+}// time
+
+}// sys
+
+}// utils
@@ -1,17 +1,19 @@
 #include "../sys_proc_methods.h"
 
-#include <pwd.h>
+#include <dirent.h>
 
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <memory>
+#include <climits>
+
 #include <boost/regex.hpp>
-#include <boost/format.hpp>
-#include <boost/filesystem.hpp>
-#include <boost/algorithm/string.hpp>
 
 #include "../aux_methods.h"
-#include "execute_sys_command.h"
+#include "../sys_error.h"
+#include "../sys_io_batch.h"
+#include "../sys_user_resolver.h"
 
 namespace utils
 {
@@ -22,65 +24,178 @@ namespace sys
 namespace proc
 {
 
+namespace details
+{
+
+bool is_pid( const char* name ) noexcept
+{
+  if( !*name )
+  {
+    return false;
+  }
+
+  for( ; *name; ++name )
+  {
+    if( *name < '0' || *name > '9' )
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Name of the executable from cmdline, empty for kernel threads and exited processes
+std::string process_name( std::string cmd_line )
+{
+  cmd_line = cmd_line.substr( 0, cmd_line.find( '\0' ) );
+  size_t slash{ cmd_line.rfind( '/' ) };
+  return slash == std::string::npos? cmd_line : cmd_line.substr( slash + 1 );
+}
+
+bool find_uid( const std::string& username, uid_t& uid )
+{
+  auto info = user::get_user_resolver().find_user( username );
+  if( !info )
+  {
+    return false;
+  }
+
+  uid = info->uid;
+  return true;
+}
+
+}// details
+
 std::string get_file_owner( const std::string& path )
 {
-  if( !boost::filesystem::exists( path ) )
+  std::error_code ec;
+  std::string owner{ get_file_owner( path, ec ) };
+  if( ec == errc::invalid_argument || ec == std::errc::no_such_file_or_directory )
   {
     throw std::invalid_argument{ "Path is invalid" };
   }
 
+  if( ec )
+  {
+    throw_error( ec, "Failed to get owner of " + path );
+  }
+
+  return owner;
+}
+
+std::string get_file_owner( const std::string& path, std::error_code& ec )
+{
+  ec.clear();
+  if( path.empty() )
+  {
+    ec = errc::invalid_argument;
+    return std::string{};
+  }
+
   struct stat info;
   if( stat( path.c_str(), &info ) != 0 )
   {
-    throw std::runtime_error{ "Failed to get stat info" };
+    ec = errno_code();
+    return std::string{};
   }
 
-  passwd* pw{ getpwuid( info.st_uid ) };
-  return pw->pw_name;
+  auto owner = user::get_user_resolver().find_user( info.st_uid );
+  if( !owner )
+  {
+    // like ls, owners without a passwd entry are shown by id
+    return std::to_string( info.st_uid );
+  }
+
+  return owner->name;
 }
 
 std::vector< pid_t > get_pids( const std::string& proc_name_regex, const std::string& username )
 {
-  namespace bfs = boost::filesystem;
+  std::error_code ec;
+  std::vector< pid_t > pids{ get_pids( proc_name_regex, username, ec ) };
+  if( ec )
+  {
+    throw_error( ec, ec == errc::invalid_argument? "Invalid process name regex: " + proc_name_regex : "Failed to list processes" );
+  }
+
+  return pids;
+}
+
+std::vector< pid_t > get_pids( const std::string& proc_name_regex, const std::string& username, std::error_code& ec )
+{
+  ec.clear();
   std::vector< pid_t > pids;
 
-  static const bfs::path p{ "/proc" };
-  static boost::format cmdline_format{ "%s/cmdline" };
-  static const boost::regex pid_regex{ "[0-9]+" };
-  boost::regex proc_regex{ proc_name_regex };
+  boost::regex proc_regex;
+  try
+  {
+    proc_regex.assign( proc_name_regex );
+  }
+  catch( const boost::regex_error& )
+  {
+    ec = errc::invalid_argument;
+    return pids;
+  }
 
-  for( bfs::directory_entry& entry : boost::make_iterator_range( bfs::directory_iterator( p ), {} ) )
+  // owner is compared by uid, so the user is looked up once and not for every process
+  uid_t uid{ 0 };
+  if( !username.empty() && !details::find_uid( username, uid ) )
   {
-    std::string name{ entry.path().filename().string() };
+    return pids;
+  }
 
-    if( boost::regex_match( name, pid_regex ) && bfs::is_directory( entry ) )
+  std::unique_ptr< DIR, int( * )( DIR* ) > dir{ opendir( "/proc" ), closedir };
+  if( !dir )
+  {
+    ec = errno_code();
+    return pids;
+  }
+
+  // owners and command lines of all processes are read in one batch
+  io::batch requests;
+  std::vector< std::pair< pid_t, size_t > > processes;
+  while( dirent* entry = readdir( dir.get() ) )
+  {
+    if( details::is_pid( entry->d_name ) )
     {
-      std::string cmd_path{ boost::str( cmdline_format % entry.path().string() ) };
-      std::string cmd_line{ aux::read_file( cmd_path ) };
+      std::string proc_dir{ std::string{ "/proc/" } + entry->d_name };
+      if( !username.empty() )
+      {
+        requests.add_stat( proc_dir );
+      }
+
+      processes.emplace_back( std::stoi( entry->d_name ), requests.add_read( proc_dir + "/cmdline", PATH_MAX ) );
+    }
+  }
+
+  try
+  {
+    requests.run();
+  }
+  catch( const std::runtime_error& )
+  {
+    ec = errno_code( EIO );
+    return pids;
+  }
 
-      if( !cmd_line.empty() )
+  for( const auto& process : processes )
+  {
+    // the stat request goes right before the read one, failed if the process is gone
+    if( !username.empty() )
+    {
+      const io::result& owner( requests.get( process.second - 1 ) );
+      if( owner.error || owner.info.st_uid != uid )
       {
-        size_t pos{ cmd_line.find( '\0' ) };
-        if ( pos != std::string::npos )
-        {
-          cmd_line = cmd_line.substr( 0, pos );
-        }
-
-        std::vector< std::string > parts;
-        boost::split( parts, cmd_line, boost::is_any_of( "/" ) );
-
-        if( parts.empty() )
-        {
-          continue;
-        }
-
-        if( boost::regex_match( parts[ parts.size() - 1 ], proc_regex ) &&
-            ( username.empty() || username == get_file_owner( entry.path().string() ) ) )
-        {
-          pids.emplace_back( std::stoi( name ) );
-        }
+        continue;
       }
     }
+
+    std::string name{ details::process_name( requests.get( process.second ).content ) };
+    if( !name.empty() && boost::regex_match( name, proc_regex ) )
+    {
+      pids.push_back( process.first );
+    }
   }
 
   return pids;
@@ -96,17 +211,35 @@ int kill_by_pid( pid_t pid, int sig )
   return ::kill( pid, sig );
 }
 
+bool kill_by_pid( pid_t pid, int sig, std::error_code& ec ) noexcept
+{
+  ec.clear();
+  if( pid <= 0 )
+  {
+    ec = errc::invalid_argument;
+    return false;
+  }
+
+  if( ::kill( pid, sig ) != 0 )
+  {
+    ec = errno_code();
+    return false;
+  }
+
+  return true;
+}
+
 std::map< pid_t, int > kill_by_procname( const std::string& procname_regex, int sig )
 {
   std::vector< pid_t > pids{ get_pids( procname_regex ) };
   std::map< pid_t, int > errors;
 
+  std::error_code ec;
   for( auto pid : pids )
   {
-    int result{ kill_by_pid( pid, sig ) };
-    if( result != 0 )
+    if( !kill_by_pid( pid, sig, ec ) )
     {
-      errors.emplace( pid, result );
+      errors.emplace( pid, -1 );
     }
   }
 
@@ -118,12 +251,12 @@ std::map< pid_t, int > kill_by_user( const std::string& username, int sig )
   std::vector< pid_t > pids{ get_pids( ".*", username ) };
   std::map< pid_t, int > errors;
 
+  std::error_code ec;
   for( auto pid : pids )
   {
-    int result{ kill_by_pid( pid, sig ) };
-    if( result != 0 )
+    if( !kill_by_pid( pid, sig, ec ) )
     {
-      errors.emplace( pid, result );
+      errors.emplace( pid, -1 );
     }
   }
 
@@ -0,0 +1,427 @@
+#include "../sys_proc_sched.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "../sys_error.h"
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+#ifndef SCHED_RESET_ON_FORK
+#define SCHED_RESET_ON_FORK 0x40000000
+#endif
+
+#define SCHED_FLAG_RESET_ON_FORK 0x01
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace proc
+{
+
+namespace details
+{
+
+// Not in glibc before 2.41
+struct sched_attr
+{
+  uint32_t size;
+  uint32_t sched_policy;
+  uint64_t sched_flags;
+  int32_t sched_nice;
+  uint32_t sched_priority;
+  uint64_t sched_runtime;
+  uint64_t sched_deadline;
+  uint64_t sched_period;
+};
+
+using cpu_set_ptr = std::unique_ptr< cpu_set_t, void( * )( cpu_set_t* ) >;
+
+cpu_set_ptr alloc_cpu_set( int count )
+{
+  cpu_set_ptr set{ CPU_ALLOC( count ), []( cpu_set_t* s ){ CPU_FREE( s ); } };
+  if( !set )
+  {
+    throw std::bad_alloc{};
+  }
+
+  CPU_ZERO_S( CPU_ALLOC_SIZE( count ), set.get() );
+  return set;
+}
+
+void check_affinity( const std::vector< unsigned int >& cpus )
+{
+  if( cpus.empty() )
+  {
+    throw std::invalid_argument{ "CPU list is empty" };
+  }
+
+  if( *std::max_element( cpus.begin(), cpus.end() ) >= ( 1u << 20 ) )
+  {
+    throw std::invalid_argument{ "Invalid CPU number" };
+  }
+}
+
+void check_scheduler( const sched_params& params )
+{
+  switch( params.policy )
+  {
+  case sched_policy::fifo:
+  case sched_policy::rr:
+  {
+    int policy{ static_cast< int >( params.policy ) };
+    if( params.priority < static_cast< unsigned int >( sched_get_priority_min( policy ) ) ||
+        params.priority > static_cast< unsigned int >( sched_get_priority_max( policy ) ) )
+    {
+      throw std::invalid_argument{ "Invalid real time priority: " + std::to_string( params.priority ) };
+    }
+
+    break;
+  }
+  case sched_policy::other:
+  case sched_policy::batch:
+  case sched_policy::idle:
+    if( params.priority )
+    {
+      throw std::invalid_argument{ "Priority is only valid for fifo and rr" };
+    }
+
+    break;
+  case sched_policy::deadline:
+    if( !params.runtime || params.runtime > params.deadline || ( params.period && params.deadline > params.period ) )
+    {
+      throw std::invalid_argument{ "Deadline parameters should be runtime <= deadline <= period" };
+    }
+
+    break;
+  default:
+    throw std::invalid_argument{ "Invalid scheduling policy" };
+  }
+}
+
+void check_nice( int nice )
+{
+  if( nice < -20 || nice > 19 )
+  {
+    throw std::invalid_argument{ "Invalid nice value: " + std::to_string( nice ) };
+  }
+}
+
+void check_io_priority( const io_priority& priority )
+{
+  if( priority.type < io_class::none || priority.type > io_class::idle )
+  {
+    throw std::invalid_argument{ "Invalid I/O priority class" };
+  }
+
+  if( priority.level > 7 )
+  {
+    throw std::invalid_argument{ "Invalid I/O priority level: " + std::to_string( priority.level ) };
+  }
+}
+
+// The calls below return errno, 0 on success
+
+int affinity_call( pid_t tid, const std::vector< unsigned int >& cpus ) noexcept
+{
+  int count{ static_cast< int >( *std::max_element( cpus.begin(), cpus.end() ) ) + 1 };
+  cpu_set_t* set{ CPU_ALLOC( count ) };
+  if( !set )
+  {
+    return ENOMEM;
+  }
+
+  size_t size{ CPU_ALLOC_SIZE( count ) };
+  CPU_ZERO_S( size, set );
+  for( unsigned int cpu : cpus )
+  {
+    CPU_SET_S( cpu, size, set );
+  }
+
+  int error{ sched_setaffinity( tid, size, set ) == 0? 0 : errno };
+  CPU_FREE( set );
+  return error;
+}
+
+int scheduler_call( pid_t tid, const sched_params& params ) noexcept
+{
+  if( params.policy != sched_policy::deadline )
+  {
+    sched_param param{};
+    param.sched_priority = static_cast< int >( params.priority );
+    int policy{ static_cast< int >( params.policy ) | ( params.reset_on_fork? SCHED_RESET_ON_FORK : 0 ) };
+    return sched_setscheduler( tid, policy, &param ) == 0? 0 : errno;
+  }
+
+#ifdef SYS_sched_setattr
+  sched_attr attr{};
+  attr.size = sizeof( attr );
+  attr.sched_policy = static_cast< uint32_t >( params.policy );
+  attr.sched_flags = params.reset_on_fork? SCHED_FLAG_RESET_ON_FORK : 0;
+  attr.sched_runtime = params.runtime;
+  attr.sched_deadline = params.deadline;
+  attr.sched_period = params.period;
+  return syscall( SYS_sched_setattr, tid, &attr, 0 ) == 0? 0 : errno;
+#else
+  return ENOSYS;
+#endif
+}
+
+int nice_call( pid_t tid, int nice ) noexcept
+{
+  return setpriority( PRIO_PROCESS, static_cast< id_t >( tid ), nice ) == 0? 0 : errno;
+}
+
+int io_priority_call( pid_t tid, const io_priority& priority ) noexcept
+{
+  // the kernel refuses levels for none
+  unsigned int level{ priority.type == io_class::best_effort || priority.type == io_class::realtime? priority.level : 0 };
+  int value{ static_cast< int >( ( static_cast< unsigned int >( priority.type ) << IOPRIO_CLASS_SHIFT ) | level ) };
+  return syscall( SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, value ) == 0? 0 : errno;
+}
+
+template< class Call >
+std::map< pid_t, int > apply_to_pids( const std::vector< pid_t >& pids, sched_scope scope, const Call& call )
+{
+  std::map< pid_t, int > errors;
+  for( pid_t pid : pids )
+  {
+    if( pid <= 0 )
+    {
+      errors.emplace( pid, EINVAL );
+      continue;
+    }
+
+    if( scope == sched_scope::thread )
+    {
+      int error{ call( pid ) };
+      if( error )
+      {
+        errors.emplace( pid, error );
+      }
+
+      continue;
+    }
+
+    // threads started after the listing inherit the settings of the creating one,
+    // which is already changed unless it's started meanwhile too
+    std::vector< pid_t > threads{ get_threads( pid ) };
+    if( threads.empty() )
+    {
+      errors.emplace( pid, ESRCH );
+      continue;
+    }
+
+    for( pid_t tid : threads )
+    {
+      int error{ call( tid ) };
+      if( error && error != ESRCH )
+      {
+        errors.emplace( pid, error );
+        break;
+      }
+    }
+  }
+
+  return errors;
+}
+
+void check_result( int error, const std::string& context, pid_t tid )
+{
+  if( error )
+  {
+    throw_error( errno_code( error ), context + " of " + std::to_string( tid ) );
+  }
+}
+
+}// details
+
+std::vector< unsigned int > get_affinity( pid_t tid )
+{
+  for( int count{ CPU_SETSIZE }; ; count *= 2 )
+  {
+    details::cpu_set_ptr set{ details::alloc_cpu_set( count ) };
+    size_t size{ CPU_ALLOC_SIZE( count ) };
+    if( sched_getaffinity( tid, size, set.get() ) == 0 )
+    {
+      std::vector< unsigned int > cpus;
+      for( int cpu{ 0 }; cpu < count; ++cpu )
+      {
+        if( CPU_ISSET_S( cpu, size, set.get() ) )
+        {
+          cpus.push_back( static_cast< unsigned int >( cpu ) );
+        }
+      }
+
+      return cpus;
+    }
+
+    // EINVAL if the mask is smaller than the kernel one
+    if( errno != EINVAL || count >= ( 1 << 20 ) )
+    {
+      details::check_result( errno, "Failed to get CPU affinity", tid );
+    }
+  }
+}
+
+void set_affinity( pid_t tid, const std::vector< unsigned int >& cpus )
+{
+  details::check_affinity( cpus );
+  details::check_result( details::affinity_call( tid, cpus ), "Failed to set CPU affinity", tid );
+}
+
+sched_params get_scheduler( pid_t tid )
+{
+  int policy{ sched_getscheduler( tid ) };
+  if( policy == -1 )
+  {
+    details::check_result( errno, "Failed to get scheduling policy", tid );
+  }
+
+  sched_params params;
+  params.reset_on_fork = policy & SCHED_RESET_ON_FORK;
+  params.policy = static_cast< sched_policy >( policy & ~SCHED_RESET_ON_FORK );
+
+  if( params.policy == sched_policy::deadline )
+  {
+#ifdef SYS_sched_getattr
+    details::sched_attr attr{};
+    if( syscall( SYS_sched_getattr, tid, &attr, sizeof( attr ), 0 ) != 0 )
+    {
+      details::check_result( errno, "Failed to get deadline parameters", tid );
+    }
+
+    params.runtime = attr.sched_runtime;
+    params.deadline = attr.sched_deadline;
+    params.period = attr.sched_period;
+#else
+    details::check_result( ENOSYS, "Failed to get deadline parameters", tid );
+#endif
+    return params;
+  }
+
+  sched_param param{};
+  if( sched_getparam( tid, &param ) != 0 )
+  {
+    details::check_result( errno, "Failed to get scheduling priority", tid );
+  }
+
+  params.priority = static_cast< unsigned int >( param.sched_priority );
+  return params;
+}
+
+void set_scheduler( pid_t tid, const sched_params& params )
+{
+  details::check_scheduler( params );
+  details::check_result( details::scheduler_call( tid, params ), "Failed to set scheduling policy", tid );
+}
+
+int get_nice( pid_t tid )
+{
+  // -1 is a valid value
+  errno = 0;
+  int nice{ getpriority( PRIO_PROCESS, static_cast< id_t >( tid ) ) };
+  if( nice == -1 && errno )
+  {
+    details::check_result( errno, "Failed to get nice value", tid );
+  }
+
+  return nice;
+}
+
+void set_nice( pid_t tid, int nice )
+{
+  details::check_nice( nice );
+  details::check_result( details::nice_call( tid, nice ), "Failed to set nice value", tid );
+}
+
+io_priority get_io_priority( pid_t tid )
+{
+  long value{ syscall( SYS_ioprio_get, IOPRIO_WHO_PROCESS, tid ) };
+  if( value == -1 )
+  {
+    details::check_result( errno, "Failed to get I/O priority", tid );
+  }
+
+  io_priority priority;
+  priority.type = static_cast< io_class >( value >> IOPRIO_CLASS_SHIFT );
+  priority.level = static_cast< unsigned int >( value & 0xff );
+  return priority;
+}
+
+void set_io_priority( pid_t tid, const io_priority& priority )
+{
+  details::check_io_priority( priority );
+  details::check_result( details::io_priority_call( tid, priority ), "Failed to set I/O priority", tid );
+}
+
+std::vector< pid_t > get_threads( pid_t pid )
+{
+  if( pid <= 0 )
+  {
+    throw std::invalid_argument{ "Pid should be positive" };
+  }
+
+  std::vector< pid_t > threads;
+  std::unique_ptr< DIR, int( * )( DIR* ) > dir{ opendir( ( "/proc/" + std::to_string( pid ) + "/task" ).c_str() ), closedir };
+  if( !dir )
+  {
+    return threads;
+  }
+
+  while( dirent* entry = readdir( dir.get() ) )
+  {
+    char* end;
+    long tid{ strtol( entry->d_name, &end, 10 ) };
+    if( tid > 0 && !*end )
+    {
+      threads.push_back( static_cast< pid_t >( tid ) );
+    }
+  }
+
+  return threads;
+}
+
+std::map< pid_t, int > set_affinity( const std::vector< pid_t >& pids, const std::vector< unsigned int >& cpus, sched_scope scope )
+{
+  details::check_affinity( cpus );
+  return details::apply_to_pids( pids, scope, [ &cpus ]( pid_t tid ){ return details::affinity_call( tid, cpus ); } );
+}
+
+std::map< pid_t, int > set_scheduler( const std::vector< pid_t >& pids, const sched_params& params, sched_scope scope )
+{
+  details::check_scheduler( params );
+  return details::apply_to_pids( pids, scope, [ &params ]( pid_t tid ){ return details::scheduler_call( tid, params ); } );
+}
+
+std::map< pid_t, int > set_nice( const std::vector< pid_t >& pids, int nice, sched_scope scope )
+{
+  details::check_nice( nice );
+  return details::apply_to_pids( pids, scope, [ nice ]( pid_t tid ){ return details::nice_call( tid, nice ); } );
+}
+
+std::map< pid_t, int > set_io_priority( const std::vector< pid_t >& pids, const io_priority& priority, sched_scope scope )
+{
+  details::check_io_priority( priority );
+  return details::apply_to_pids( pids, scope, [ &priority ]( pid_t tid ){ return details::io_priority_call( tid, priority ); } );
+}
+
+}// proc
+
+}// sys
+
+}// utils
@@ -0,0 +1,751 @@
+#include "../sys_service_backend.h"
+
+#include <cerrno>
+#include <cctype>
+#include <cstring>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#ifdef HAVE_SYSTEMD
+#include <systemd/sd-bus.h>
+#endif
+
+#include "../sys_error.h"
+#include "execute_sys_command.h"
+#include "run_detached.h"
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace service
+{
+
+namespace details
+{
+
+// Names end up in shell commands and unit names
+void validate_name( const std::string& service )
+{
+  if( service.empty() )
+  {
+    throw std::invalid_argument{ "Invalid service name" };
+  }
+
+  for( char c : service )
+  {
+    if( !std::isalnum( static_cast< unsigned char >( c ) ) && !std::strchr( "_.@-:", c ) )
+    {
+      throw std::invalid_argument{ "Invalid service name: " + service };
+    }
+  }
+}
+
+std::future< void > ready_future( std::exception_ptr error = nullptr )
+{
+  std::promise< void > result;
+  if( error )
+  {
+    result.set_exception( error );
+  }
+  else
+  {
+    result.set_value();
+  }
+
+  return result.get_future();
+}
+
+service_state parse_active_state( const std::string& state ) noexcept
+{
+  static const std::map< std::string, service_state > states{ { "active", service_state::active },
+                                                              { "reloading", service_state::reloading },
+                                                              { "inactive", service_state::inactive },
+                                                              { "failed", service_state::failed },
+                                                              { "activating", service_state::activating },
+                                                              { "deactivating", service_state::deactivating } };
+
+  auto it = states.find( state );
+  return it != states.end()? it->second : service_state::unknown;
+}
+
+class sysv_backend : public service_backend
+{
+public:
+  std::string name() const override
+  {
+    return "sysv";
+  }
+
+  std::future< void > start( const std::string& service ) override
+  {
+    return run_job( service, "start" );
+  }
+
+  std::future< void > stop( const std::string& service ) override
+  {
+    return run_job( service, "stop" );
+  }
+
+  std::future< void > restart( const std::string& service ) override
+  {
+    return run_job( service, "restart" );
+  }
+
+  std::future< void > reload( const std::string& service ) override
+  {
+    return run_job( service, "reload" );
+  }
+
+  std::vector< service_status > status( const std::vector< std::string >& services ) override
+  {
+    std::vector< service_status > result;
+    for( const std::string& service : services )
+    {
+      validate_name( service );
+
+      service_status status;
+      status.name = service;
+      status.loaded = true;
+
+      // LSB status codes
+      switch( run_script( service, "status" ) )
+      {
+        case 0: status.state = service_state::active; status.sub_state = "running"; break;
+        case 2: status.state = service_state::failed; status.sub_state = "dead"; break;
+        case 3: status.state = service_state::inactive; status.sub_state = "dead"; break;
+        // 1 is also what service returns for unrecognized services
+        default: status.loaded = false; break;
+      }
+
+      result.push_back( status );
+    }
+
+    return result;
+  }
+
+private:
+  static int run_script( const std::string& service, const char* verb )
+  {
+    std::string code{ sys::details::execute_sys_command( "service " + service + " " + verb + " >/dev/null 2>&1; echo $?" ) };
+    try
+    {
+      return std::stoi( code );
+    }
+    catch( const std::exception& )
+    {
+      throw std::runtime_error{ "Unexpected output of service " + service + " " + verb };
+    }
+  }
+
+  static std::future< void > run_job( const std::string& service, const char* verb )
+  {
+    validate_name( service );
+
+    return sys::details::run_detached( [ service, verb ]()
+    {
+      int code{ run_script( service, verb ) };
+      if( code != 0 )
+      {
+        throw std::runtime_error{ "service " + service + " " + verb + " failed with code " + std::to_string( code ) };
+      }
+    } );
+  }
+};
+
+#ifdef HAVE_SYSTEMD
+
+#define SYSTEMD_DESTINATION "org.freedesktop.systemd1"
+#define SYSTEMD_PATH "/org/freedesktop/systemd1"
+#define SYSTEMD_MANAGER "org.freedesktop.systemd1.Manager"
+
+struct bus_deleter
+{
+  void operator()( sd_bus* bus ) const noexcept
+  {
+    sd_bus_flush_close_unref( bus );
+  }
+};
+
+struct slot_deleter
+{
+  void operator()( sd_bus_slot* slot ) const noexcept
+  {
+    sd_bus_slot_unref( slot );
+  }
+};
+
+struct message_deleter
+{
+  void operator()( sd_bus_message* message ) const noexcept
+  {
+    sd_bus_message_unref( message );
+  }
+};
+
+using bus_ptr = std::unique_ptr< sd_bus, bus_deleter >;
+using slot_ptr = std::unique_ptr< sd_bus_slot, slot_deleter >;
+using message_ptr = std::unique_ptr< sd_bus_message, message_deleter >;
+
+struct bus_error
+{
+  bus_error() : error( SD_BUS_ERROR_NULL ) {}
+  ~bus_error(){ sd_bus_error_free( &error ); }
+
+  std::string message( int code ) const
+  {
+    return error.message? error.message : sys::error_message( -code );
+  }
+
+  sd_bus_error error;
+};
+
+bus_ptr open_bus()
+{
+  sd_bus* bus{ nullptr };
+  int r{ sd_bus_open_system( &bus ) };
+  if( r < 0 )
+  {
+    throw std::runtime_error{ std::string{ "Could not connect to the system bus: " } + sys::error_message( -r ) };
+  }
+
+  return bus_ptr{ bus };
+}
+
+std::string unit_name( const std::string& service )
+{
+  return service.find( '.' ) == std::string::npos? service + ".service" : service;
+}
+
+struct job_waiter
+{
+  std::string job;
+  std::string result;
+  bool done{ false };
+};
+
+int on_job_removed( sd_bus_message* message, void* userdata, sd_bus_error* )
+{
+  job_waiter* waiter{ static_cast< job_waiter* >( userdata ) };
+
+  uint32_t id;
+  const char* job;
+  const char* unit;
+  const char* result;
+  if( sd_bus_message_read( message, "uoss", &id, &job, &unit, &result ) >= 0 && waiter->job == job )
+  {
+    waiter->result = result;
+    waiter->done = true;
+  }
+
+  return 0;
+}
+
+// Runs in its own thread with its own connection, sd-bus connections are not thread safe
+void run_systemd_job( const char* method, const std::string& service )
+{
+  std::string unit{ unit_name( service ) };
+  bus_ptr bus{ open_bus() };
+
+  job_waiter waiter;
+  sd_bus_slot* slot{ nullptr };
+  int r{ sd_bus_match_signal( bus.get(), &slot, SYSTEMD_DESTINATION, SYSTEMD_PATH, SYSTEMD_MANAGER,
+                              "JobRemoved", on_job_removed, &waiter ) };
+  if( r < 0 )
+  {
+    throw std::runtime_error{ std::string{ "Could not subscribe to systemd jobs: " } + sys::error_message( -r ) };
+  }
+
+  slot_ptr slot_guard{ slot };
+
+  // job signals are only sent while some client is subscribed
+  sd_bus_call_method( bus.get(), SYSTEMD_DESTINATION, SYSTEMD_PATH, SYSTEMD_MANAGER, "Subscribe", nullptr, nullptr, "" );
+
+  bus_error error;
+  sd_bus_message* reply{ nullptr };
+  r = sd_bus_call_method( bus.get(), SYSTEMD_DESTINATION, SYSTEMD_PATH, SYSTEMD_MANAGER, method,
+                          &error.error, &reply, "ss", unit.c_str(), "replace" );
+  if( r < 0 )
+  {
+    throw std::runtime_error{ std::string{ method } + " " + unit + " failed: " + error.message( r ) };
+  }
+
+  message_ptr reply_guard{ reply };
+
+  const char* job{ nullptr };
+  r = sd_bus_message_read( reply, "o", &job );
+  if( r < 0 )
+  {
+    throw std::runtime_error{ std::string{ method } + " " + unit + " returned invalid reply" };
+  }
+
+  // signal may already be queued, it's dispatched by sd_bus_process only
+  waiter.job = job;
+
+  while( !waiter.done )
+  {
+    r = sd_bus_process( bus.get(), nullptr );
+    if( r > 0 )
+    {
+      continue;
+    }
+
+    if( r == 0 )
+    {
+      r = sd_bus_wait( bus.get(), UINT64_MAX );
+    }
+
+    if( r < 0 )
+    {
+      throw std::runtime_error{ "Waiting for " + unit + " job failed: " + sys::error_message( -r ) };
+    }
+  }
+
+  if( waiter.result != "done" )
+  {
+    throw std::runtime_error{ std::string{ method } + " " + unit + " failed: " + waiter.result };
+  }
+}
+
+class systemd_backend : public service_backend
+{
+public:
+  systemd_backend() : bus_( open_bus() ) {}
+
+  std::string name() const override
+  {
+    return "systemd";
+  }
+
+  std::future< void > start( const std::string& service ) override
+  {
+    return run_job( "StartUnit", service );
+  }
+
+  std::future< void > stop( const std::string& service ) override
+  {
+    return run_job( "StopUnit", service );
+  }
+
+  std::future< void > restart( const std::string& service ) override
+  {
+    return run_job( "RestartUnit", service );
+  }
+
+  std::future< void > reload( const std::string& service ) override
+  {
+    return run_job( "ReloadUnit", service );
+  }
+
+  std::vector< service_status > status( const std::vector< std::string >& services ) override
+  {
+    std::vector< std::string > units;
+    for( const std::string& service : services )
+    {
+      validate_name( service );
+      units.push_back( unit_name( service ) );
+    }
+
+    std::vector< char* > names;
+    for( std::string& unit : units )
+    {
+      names.push_back( &unit[ 0 ] );
+    }
+
+    names.push_back( nullptr );
+
+    std::lock_guard< std::mutex > lock{ mutex_ };
+
+    sd_bus_message* request{ nullptr };
+    int r{ sd_bus_message_new_method_call( bus_.get(), &request, SYSTEMD_DESTINATION, SYSTEMD_PATH,
+                                           SYSTEMD_MANAGER, "ListUnitsByNames" ) };
+    message_ptr request_guard{ request };
+    if( r >= 0 )
+    {
+      r = sd_bus_message_append_strv( request, names.data() );
+    }
+
+    bus_error error;
+    sd_bus_message* reply{ nullptr };
+    if( r >= 0 )
+    {
+      r = sd_bus_call( bus_.get(), request, 0, &error.error, &reply );
+    }
+
+    if( r < 0 )
+    {
+      throw std::runtime_error{ "ListUnitsByNames failed: " + error.message( r ) };
+    }
+
+    message_ptr reply_guard{ reply };
+
+    std::map< std::string, service_status > found;
+    r = sd_bus_message_enter_container( reply, SD_BUS_TYPE_ARRAY, "(ssssssouso)" );
+    while( r >= 0 )
+    {
+      const char* name;
+      const char* description;
+      const char* load_state;
+      const char* active_state;
+      const char* sub_state;
+      const char* following;
+      const char* path;
+      uint32_t job_id;
+      const char* job_type;
+      const char* job_path;
+
+      r = sd_bus_message_read( reply, "(ssssssouso)", &name, &description, &load_state, &active_state,
+                               &sub_state, &following, &path, &job_id, &job_type, &job_path );
+      if( r <= 0 )
+      {
+        break;
+      }
+
+      service_status status;
+      status.state = parse_active_state( active_state );
+      status.sub_state = sub_state;
+      status.loaded = std::strcmp( load_state, "not-found" ) != 0;
+      found.emplace( name, status );
+    }
+
+    if( r < 0 )
+    {
+      throw std::runtime_error{ std::string{ "Invalid ListUnitsByNames reply: " } + sys::error_message( -r ) };
+    }
+
+    std::vector< service_status > result;
+    for( size_t i{ 0 }; i < services.size(); ++i )
+    {
+      auto it = found.find( units[ i ] );
+      service_status status{ it != found.end()? it->second : service_status{} };
+      status.name = services[ i ];
+      result.push_back( status );
+    }
+
+    return result;
+  }
+
+  std::unique_ptr< change_source > watch_changes() override;
+
+private:
+  static std::future< void > run_job( const char* method, const std::string& service )
+  {
+    validate_name( service );
+    return sys::details::run_detached( [ method, service ]()
+    {
+      run_systemd_job( method, service );
+    } );
+  }
+
+  std::mutex mutex_;
+  bus_ptr bus_;
+};
+
+int on_properties_changed( sd_bus_message*, void*, sd_bus_error* )
+{
+  return 0;
+}
+
+// Own connection, so its fd can be polled by the caller without interfering with status calls
+class systemd_change_source : public change_source
+{
+public:
+  systemd_change_source() : bus_( open_bus() )
+  {
+    // ActiveState and SubState changes of every unit arrive as PropertiesChanged of the unit object
+    sd_bus_slot* slot{ nullptr };
+    int r{ sd_bus_match_signal( bus_.get(), &slot, SYSTEMD_DESTINATION, nullptr, "org.freedesktop.DBus.Properties",
+                                "PropertiesChanged", on_properties_changed, nullptr ) };
+    if( r < 0 )
+    {
+      throw std::runtime_error{ std::string{ "Could not subscribe to unit changes: " } + sys::error_message( -r ) };
+    }
+
+    slot_.reset( slot );
+
+    sd_bus_call_method( bus_.get(), SYSTEMD_DESTINATION, SYSTEMD_PATH, SYSTEMD_MANAGER, "Subscribe", nullptr, nullptr, "" );
+  }
+
+  int fd() const override
+  {
+    return sd_bus_get_fd( bus_.get() );
+  }
+
+  void process() override
+  {
+    // drains the messages already buffered by sd-bus too, they would not wake up a poll
+    int r;
+    while( ( r = sd_bus_process( bus_.get(), nullptr ) ) > 0 ){}
+
+    if( r < 0 )
+    {
+      throw std::runtime_error{ std::string{ "Reading unit changes failed: " } + sys::error_message( -r ) };
+    }
+  }
+
+private:
+  bus_ptr bus_;
+  slot_ptr slot_;
+};
+
+std::unique_ptr< change_source > systemd_backend::watch_changes()
+{
+  return std::unique_ptr< change_source >{ new systemd_change_source };
+}
+
+#endif
+
+}// details
+
+bool service_status::running() const noexcept
+{
+  return state == service_state::active || state == service_state::reloading;
+}
+
+std::unique_ptr< change_source > service_backend::watch_changes()
+{
+  return nullptr;
+}
+
+std::shared_ptr< service_backend > make_systemd_backend()
+{
+#ifdef HAVE_SYSTEMD
+  struct stat info;
+  if( stat( "/run/systemd/system", &info ) != 0 )
+  {
+    throw std::runtime_error{ "System is not running systemd" };
+  }
+
+  return std::make_shared< details::systemd_backend >();
+#else
+  throw std::runtime_error{ "Built without systemd support" };
+#endif
+}
+
+std::shared_ptr< service_backend > make_sysv_backend()
+{
+  return std::make_shared< details::sysv_backend >();
+}
+
+struct local_backend::change_watchers
+{
+  std::mutex mutex;
+  std::vector< int > fds;
+};
+
+class local_backend::local_change_source : public change_source
+{
+public:
+  explicit local_change_source( const std::shared_ptr< change_watchers >& watchers )
+    : watchers_( watchers ), fd_( eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK ) )
+  {
+    if( fd_ == -1 )
+    {
+      throw std::runtime_error{ std::string{ "Could not create eventfd: " } + sys::error_message( errno ) };
+    }
+
+    std::lock_guard< std::mutex > lock{ watchers_->mutex };
+    watchers_->fds.push_back( fd_ );
+  }
+
+  ~local_change_source()
+  {
+    {
+      std::lock_guard< std::mutex > lock{ watchers_->mutex };
+      auto& fds( watchers_->fds );
+      fds.erase( std::remove( fds.begin(), fds.end(), fd_ ), fds.end() );
+    }
+
+    close( fd_ );
+  }
+
+  int fd() const override
+  {
+    return fd_;
+  }
+
+  void process() override
+  {
+    uint64_t value;
+    while( read( fd_, &value, sizeof( value ) ) == sizeof( value ) ){}
+  }
+
+private:
+  std::shared_ptr< change_watchers > watchers_;
+  int fd_;
+};
+
+local_backend::local_backend()
+  : watchers_( std::make_shared< change_watchers >() )
+{
+}
+
+std::string local_backend::name() const
+{
+  return "local";
+}
+
+std::unique_ptr< change_source > local_backend::watch_changes()
+{
+  return std::unique_ptr< change_source >{ new local_change_source{ watchers_ } };
+}
+
+void local_backend::notify() noexcept
+{
+  std::lock_guard< std::mutex > lock{ watchers_->mutex };
+  for( int fd : watchers_->fds )
+  {
+    // fails only if the counter is full, then the watcher is woken up anyway
+    uint64_t value{ 1 };
+    ssize_t res{ write( fd, &value, sizeof( value ) ) };
+    static_cast< void >( res );
+  }
+}
+
+std::future< void > local_backend::run_job( const std::string& service, const char* job, bool reload )
+{
+  std::unique_lock< std::mutex > lock{ mutex_ };
+
+  auto it = units_.find( service );
+  if( it == units_.end() )
+  {
+    return details::ready_future( std::make_exception_ptr( std::runtime_error{ "Unit " + service + " not found" } ) );
+  }
+
+  unit& u( it->second );
+  if( reload && u.state != service_state::active )
+  {
+    return details::ready_future( std::make_exception_ptr( std::runtime_error{ "Unit " + service + " is not active" } ) );
+  }
+
+  service_state previous{ u.state };
+  std::exception_ptr error;
+  if( u.failing )
+  {
+    u.state = service_state::failed;
+    error = std::make_exception_ptr( std::runtime_error{ std::string{ job } + " " + service + " failed" } );
+  }
+  else
+  {
+    u.state = std::strcmp( job, "stop" ) == 0? service_state::inactive : service_state::active;
+  }
+
+  bool changed{ u.state != previous };
+  lock.unlock();
+
+  if( changed )
+  {
+    notify();
+  }
+
+  return details::ready_future( error );
+}
+
+std::future< void > local_backend::start( const std::string& service )
+{
+  return run_job( service, "start", false );
+}
+
+std::future< void > local_backend::stop( const std::string& service )
+{
+  return run_job( service, "stop", false );
+}
+
+std::future< void > local_backend::restart( const std::string& service )
+{
+  return run_job( service, "restart", false );
+}
+
+std::future< void > local_backend::reload( const std::string& service )
+{
+  return run_job( service, "reload", true );
+}
+
+std::vector< service_status > local_backend::status( const std::vector< std::string >& services )
+{
+  std::lock_guard< std::mutex > lock{ mutex_ };
+
+  std::vector< service_status > result;
+  for( const std::string& service : services )
+  {
+    service_status status;
+    status.name = service;
+
+    auto it = units_.find( service );
+    if( it != units_.end() )
+    {
+      status.loaded = true;
+      status.state = it->second.state;
+    }
+    else
+    {
+      status.state = service_state::inactive;
+    }
+
+    status.sub_state = status.running()? "running" : status.state == service_state::failed? "failed" : "dead";
+    result.push_back( status );
+  }
+
+  return result;
+}
+
+void local_backend::set_state( const std::string& service, service_state state )
+{
+  {
+    std::lock_guard< std::mutex > lock{ mutex_ };
+    units_[ service ].state = state;
+  }
+
+  notify();
+}
+
+void local_backend::set_failing( const std::string& service, bool failing )
+{
+  std::lock_guard< std::mutex > lock{ mutex_ };
+  units_[ service ].failing = failing;
+}
+
+namespace details
+{
+
+std::mutex backend_mutex;
+std::shared_ptr< service_backend > backend;
+
+}// details
+
+std::shared_ptr< service_backend > get_service_backend()
+{
+  std::lock_guard< std::mutex > lock{ details::backend_mutex };
+  if( !details::backend )
+  {
+    try
+    {
+      details::backend = make_systemd_backend();
+    }
+    catch( const std::runtime_error& )
+    {
+      details::backend = make_sysv_backend();
+    }
+  }
+
+  return details::backend;
+}
+
+void set_service_backend( const std::shared_ptr< service_backend >& backend )
+{
+  std::lock_guard< std::mutex > lock{ details::backend_mutex };
+  details::backend = backend;
+}
+
+}// service
+
+}// sys
+
+}// utils
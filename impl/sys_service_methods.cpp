@@ -1,5 +1,6 @@
 #include "../sys_service_methods.h"
-#include "execute_sys_command.h"
+
+#include <stdexcept>
 
 namespace utils
 {
@@ -10,55 +11,79 @@ namespace sys
 namespace service
 {
 
-void start_service(const std::string &service)
+std::future< void > start_service_async( const std::string& service )
 {
   if( service.empty() )
   {
     throw std::invalid_argument{ "Invalid service name" };
   }
 
-  details::execute_sys_command( "service " + service + " start" );
+  return get_service_backend()->start( service );
 }
 
-void stop_service( const std::string& service )
+std::future< void > stop_service_async( const std::string& service )
 {
   if( service.empty() )
   {
     throw std::invalid_argument{ "Invalid service name" };
   }
 
-  details::execute_sys_command( "service " + service + " stop" );
+  return get_service_backend()->stop( service );
 }
 
-void restart_service( const std::string& service )
+std::future< void > restart_service_async( const std::string& service )
 {
   if( service.empty() )
   {
     throw std::invalid_argument{ "Invalid service name" };
   }
 
-  details::execute_sys_command( "service " + service + " restart" );
+  return get_service_backend()->restart( service );
 }
 
-void reload_service( const std::string& service )
+std::future< void > reload_service_async( const std::string& service )
 {
   if( service.empty() )
   {
     throw std::invalid_argument{ "Invalid service name" };
   }
 
-  details::execute_sys_command( "service " + service + " reload" );
+  return get_service_backend()->reload( service );
+}
+
+void start_service( const std::string& service )
+{
+  start_service_async( service ).get();
+}
+
+void stop_service( const std::string& service )
+{
+  stop_service_async( service ).get();
+}
+
+void restart_service( const std::string& service )
+{
+  restart_service_async( service ).get();
+}
+
+void reload_service( const std::string& service )
+{
+  reload_service_async( service ).get();
 }
 
 bool service_is_running( const std::string& service )
 {
-    if( service.empty() )
-    {
-      throw std::invalid_argument{ "Invalid service name" };
-    }
+  if( service.empty() )
+  {
+    throw std::invalid_argument{ "Invalid service name" };
+  }
 
-    std::string responce{} details::execute_sys_command( "service " + service + " status" ) };
-    return ( responce.find( "is running" ) != std::string::npos );
+  return get_service_backend()->status( { service } ).front().running();
+}
+
+std::vector< service_status > get_services_status( const std::vector< std::string >& services )
+{
+  return get_service_backend()->status( services );
 }
 
 }// service
@@ -0,0 +1,429 @@
+#include "../sys_service_monitor.h"
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#include "../sys_error.h"
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace service
+{
+
+namespace details
+{
+
+bool file_exists( const std::string& path )
+{
+  struct stat info;
+  return stat( path.c_str(), &info ) == 0;
+}
+
+// Usual locations of pidfiles written by init scripts
+std::string find_pidfile( const std::string& service )
+{
+  for( const char* dir : { "/run/", "/var/run/" } )
+  {
+    std::string path{ dir + service + ".pid" };
+    if( file_exists( path ) )
+    {
+      return path;
+    }
+
+    path = dir + service + "/" + service + ".pid";
+    if( file_exists( path ) )
+    {
+      return path;
+    }
+  }
+
+  return std::string{};
+}
+
+// Same meaning as the LSB status codes: no pidfile is stopped, a stale one is dead
+service_status pidfile_status( const std::string& service, const std::string& pidfile )
+{
+  service_status status;
+  status.name = service;
+  status.loaded = true;
+  status.state = service_state::inactive;
+  status.sub_state = "dead";
+
+  std::ifstream file{ pidfile };
+  long pid{ 0 };
+  if( file >> pid && pid > 0 )
+  {
+    if( file_exists( "/proc/" + std::to_string( pid ) ) )
+    {
+      status.state = service_state::active;
+      status.sub_state = "running";
+    }
+    else
+    {
+      status.state = service_state::failed;
+    }
+  }
+
+  return status;
+}
+
+bool same_state( const service_status& l, const service_status& r ) noexcept
+{
+  return l.state == r.state && l.sub_state == r.sub_state && l.loaded == r.loaded;
+}
+
+}// details
+
+struct state_monitor::impl
+{
+  struct entry
+  {
+    std::string pidfile;
+    bool find_pidfile{ false }; // SysV service without an explicit pidfile, it's looked up until found
+    service_status status;
+  };
+
+  using change = std::pair< service_status, service_status >;
+
+  impl( const std::shared_ptr< service_backend >& backend, std::chrono::milliseconds poll_interval );
+  ~impl();
+
+  void run();
+  void wakeup() noexcept;
+  void refresh( bool query_backend );
+
+  std::shared_ptr< service_backend > backend;
+  std::chrono::milliseconds poll_interval;
+  int wakeup_fd{ -1 };
+  std::unique_ptr< change_source > source; // used by the monitor thread only
+
+  mutable std::mutex mutex;
+  std::unordered_map< std::string, entry > entries;
+  std::map< size_t, callback > callbacks;
+  size_t next_id{ 0 };
+
+  // keeps the callbacks in order of changes
+  std::mutex refresh_mutex;
+
+  std::atomic< bool > running{ false };
+  std::thread thread;
+};
+
+state_monitor::impl::impl( const std::shared_ptr< service_backend >& backend, std::chrono::milliseconds poll_interval )
+  : backend( backend ),
+    poll_interval( poll_interval )
+{
+  if( !backend )
+  {
+    throw std::invalid_argument{ "Service backend is not set" };
+  }
+
+  if( poll_interval.count() <= 0 )
+  {
+    throw std::invalid_argument{ "Invalid poll interval" };
+  }
+
+  wakeup_fd = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+  if( wakeup_fd == -1 )
+  {
+    throw std::runtime_error{ std::string{ "Could not create service monitor: " } + sys::error_message( errno ) };
+  }
+}
+
+state_monitor::impl::~impl()
+{
+  close( wakeup_fd );
+}
+
+void state_monitor::impl::wakeup() noexcept
+{
+  // fails only if the counter is full, then the thread is awake anyway
+  uint64_t value{ 1 };
+  ssize_t res{ write( wakeup_fd, &value, sizeof( value ) ) };
+  static_cast< void >( res );
+}
+
+void state_monitor::impl::refresh( bool query_backend )
+{
+  std::lock_guard< std::mutex > refresh_lock{ refresh_mutex };
+
+  std::vector< std::string > backend_services;
+  std::vector< std::pair< std::string, std::string > > pidfile_services;
+  bool sysv{ backend->name() == "sysv" };
+
+  {
+    std::lock_guard< std::mutex > lock{ mutex };
+    for( auto& it : entries )
+    {
+      entry& e( it.second );
+      if( e.find_pidfile && sysv )
+      {
+        e.pidfile = details::find_pidfile( it.first );
+        e.find_pidfile = e.pidfile.empty();
+      }
+
+      if( !e.pidfile.empty() )
+      {
+        pidfile_services.emplace_back( it.first, e.pidfile );
+      }
+      else if( query_backend || e.status.state == service_state::unknown )
+      {
+        backend_services.push_back( it.first );
+      }
+    }
+  }
+
+  // all services known to the init system are read with one backend call
+  std::vector< service_status > states;
+  if( !backend_services.empty() )
+  {
+    states = backend->status( backend_services );
+  }
+
+  for( const auto& service : pidfile_services )
+  {
+    states.push_back( details::pidfile_status( service.first, service.second ) );
+  }
+
+  std::vector< change > changes;
+  std::vector< callback > to_call;
+  {
+    std::lock_guard< std::mutex > lock{ mutex };
+    for( const service_status& status : states )
+    {
+      // may have been removed meanwhile
+      auto it = entries.find( status.name );
+      if( it != entries.end() && !details::same_state( it->second.status, status ) )
+      {
+        changes.emplace_back( it->second.status, status );
+        it->second.status = status;
+      }
+    }
+
+    if( !changes.empty() )
+    {
+      for( const auto& it : callbacks )
+      {
+        to_call.push_back( it.second );
+      }
+    }
+  }
+
+  for( const change& c : changes )
+  {
+    for( const callback& on_change : to_call )
+    {
+      try
+      {
+        on_change( c.first, c.second );
+      }
+      catch( ... ){}
+    }
+  }
+}
+
+void state_monitor::impl::run()
+{
+  while( running )
+  {
+    pollfd fds[ 2 ];
+    fds[ 0 ].fd = wakeup_fd;
+    fds[ 0 ].events = POLLIN;
+    fds[ 1 ].fd = source? source->fd() : -1;
+    fds[ 1 ].events = POLLIN;
+
+    int count{ poll( fds, 2, static_cast< int >( poll_interval.count() ) ) };
+    if( count == -1 && errno != EINTR )
+    {
+      break;
+    }
+
+    if( !running )
+    {
+      break;
+    }
+
+    // without notifications the backend is polled on every timeout
+    bool query_backend{ !source };
+    if( count > 0 && fds[ 0 ].revents )
+    {
+      uint64_t value;
+      while( read( wakeup_fd, &value, sizeof( value ) ) == sizeof( value ) ){}
+      query_backend = true;
+    }
+
+    if( count > 0 && fds[ 1 ].revents )
+    {
+      try
+      {
+        source->process();
+      }
+      catch( const std::exception& )
+      {
+        // connection to the init system is lost, fall back to polling
+        source.reset();
+      }
+
+      query_backend = true;
+    }
+
+    try
+    {
+      refresh( query_backend );
+    }
+    catch( const std::exception& ){}
+  }
+}
+
+state_monitor::state_monitor( const std::shared_ptr< service_backend >& backend, std::chrono::milliseconds poll_interval )
+  : impl_( new impl{ backend, poll_interval } )
+{
+}
+
+state_monitor::~state_monitor()
+{
+  stop();
+}
+
+void state_monitor::add( const std::string& service, const std::string& pidfile )
+{
+  if( service.empty() )
+  {
+    throw std::invalid_argument{ "Invalid service name" };
+  }
+
+  {
+    std::lock_guard< std::mutex > lock{ impl_->mutex };
+
+    impl::entry& e( impl_->entries[ service ] );
+    e.pidfile = pidfile;
+    e.find_pidfile = pidfile.empty();
+    e.status = service_status{};
+    e.status.name = service;
+  }
+
+  if( impl_->running )
+  {
+    impl_->wakeup();
+  }
+}
+
+void state_monitor::remove( const std::string& service )
+{
+  std::lock_guard< std::mutex > lock{ impl_->mutex };
+  impl_->entries.erase( service );
+}
+
+bool state_monitor::is_running( const std::string& service ) const
+{
+  std::lock_guard< std::mutex > lock{ impl_->mutex };
+
+  auto it = impl_->entries.find( service );
+  return it != impl_->entries.end() && it->second.status.running();
+}
+
+service_status state_monitor::status( const std::string& service ) const
+{
+  std::lock_guard< std::mutex > lock{ impl_->mutex };
+
+  auto it = impl_->entries.find( service );
+  if( it == impl_->entries.end() )
+  {
+    throw std::out_of_range{ "Service " + service + " is not monitored" };
+  }
+
+  return it->second.status;
+}
+
+size_t state_monitor::subscribe( const callback& on_change )
+{
+  std::lock_guard< std::mutex > lock{ impl_->mutex };
+  impl_->callbacks.emplace( impl_->next_id, on_change );
+  return impl_->next_id++;
+}
+
+void state_monitor::unsubscribe( size_t id )
+{
+  std::lock_guard< std::mutex > lock{ impl_->mutex };
+  impl_->callbacks.erase( id );
+}
+
+void state_monitor::refresh()
+{
+  impl_->refresh( true );
+}
+
+void state_monitor::start()
+{
+  if( impl_->running.exchange( true ) )
+  {
+    return;
+  }
+
+  if( impl_->thread.joinable() )
+  {
+    impl_->thread.join();
+  }
+
+  try
+  {
+    // subscribed before reading the state, so no change is lost in between
+    impl_->source = impl_->backend->watch_changes();
+  }
+  catch( const std::runtime_error& )
+  {
+    impl_->source.reset();
+  }
+
+  try
+  {
+    impl_->refresh( true );
+  }
+  catch( ... )
+  {
+    impl_->running = false;
+    impl_->source.reset();
+    throw;
+  }
+
+  impl_->thread = std::thread{ &impl::run, impl_.get() };
+}
+
+void state_monitor::stop()
+{
+  impl_->running = false;
+  impl_->wakeup();
+
+  if( impl_->thread.joinable() && impl_->thread.get_id() != std::this_thread::get_id() )
+  {
+    impl_->thread.join();
+    impl_->source.reset();
+  }
+}
+
+bool state_monitor::running() const noexcept
+{
+  return impl_->running;
+}
+
+}// service
+
+}// sys
+
+}// utils
@@ -0,0 +1,288 @@
+#include "../sys_time_formatter.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <time.h>
+
+#include "../sys_time_zone.h"
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace time
+{
+
+namespace details
+{
+
+bool is_fraction_conversion( char c ) noexcept
+{
+  return c == 'N' || c == 'f';
+}
+
+std::string run_strftime( const std::string& format, const std::tm& time )
+{
+  std::string result( 32 + format.size() * 4, '\0' );
+  while( true )
+  {
+    size_t size{ strftime( &result[ 0 ], result.size(), format.c_str(), &time ) };
+    if( size != 0 || result.size() > 1024 * ( format.size() + 1 ) )
+    {
+      // 0 is also returned for legitimately empty output, e.g. %p in some locales
+      result.resize( size );
+      return result;
+    }
+
+    result.resize( result.size() * 2 );
+  }
+}
+
+void append_fraction( std::string& out, uint32_t nanoseconds, uint32_t digits )
+{
+  char buf[ 9 ];
+  for( int i{ 8 }; i >= 0; --i )
+  {
+    buf[ i ] = '0' + nanoseconds % 10;
+    nanoseconds /= 10;
+  }
+
+  out.append( buf, digits );
+}
+
+}// details
+
+time_formatter::time_formatter( const std::string& format, const std::string& time_zone )
+  : format_( format )
+{
+  if( time_zone == "UTC" )
+  {
+    utc_ = true;
+  }
+  else if( !time_zone.empty() )
+  {
+    zone_ = load_time_zone( time_zone );
+  }
+
+  std::memset( &cached_tm_, 0, sizeof( cached_tm_ ) );
+  parse();
+}
+
+void time_formatter::parse()
+{
+  auto add_text = [ this ]( const std::string& text )
+  {
+    if( !segments_.empty() && segments_.back().type == segment::kind::text )
+    {
+      segments_.back().text += text;
+      segments_.back().cached += text;
+    }
+    else
+    {
+      segment s;
+      s.text = s.cached = text;
+      segments_.push_back( s );
+    }
+  };
+
+  size_t pos{ 0 };
+  while( pos < format_.size() )
+  {
+    size_t percent{ format_.find( '%', pos ) };
+    add_text( format_.substr( pos, percent == std::string::npos? percent : percent - pos ) );
+    if( percent == std::string::npos )
+    {
+      break;
+    }
+
+    // %[flags][width][E|O]conversion
+    size_t end{ percent + 1 };
+    while( end < format_.size() && std::strchr( "_-0^#", format_[ end ] ) && format_[ end ] != '\0' )
+    {
+      ++end;
+    }
+
+    size_t width_begin{ end };
+    while( end < format_.size() && format_[ end ] >= '0' && format_[ end ] <= '9' )
+    {
+      ++end;
+    }
+
+    size_t width_end{ end };
+    if( end < format_.size() && ( format_[ end ] == 'E' || format_[ end ] == 'O' ) )
+    {
+      ++end;
+    }
+
+    if( end >= format_.size() )
+    {
+      add_text( format_.substr( percent ) );
+      break;
+    }
+
+    char conversion{ format_[ end ] };
+    pos = end + 1;
+
+    if( conversion == '%' )
+    {
+      add_text( "%" );
+      continue;
+    }
+
+    segment s;
+    s.text = format_.substr( percent, pos - percent );
+
+    if( details::is_fraction_conversion( conversion ) )
+    {
+      s.type = segment::kind::fraction;
+      s.digits = conversion == 'f'? 6 : 9;
+      if( width_end != width_begin )
+      {
+        s.digits = std::stoul( format_.substr( width_begin, width_end - width_begin ) );
+        if( s.digits < 1 || s.digits > 9 )
+        {
+          throw std::invalid_argument{ "Invalid sub-second precision in time format: " + s.text };
+        }
+      }
+
+      segments_.push_back( s );
+      continue;
+    }
+
+    s.type = segment::kind::field;
+    if( std::strchr( "MR", conversion ) )
+    {
+      s.granularity = unit::minute;
+    }
+    else if( std::strchr( "HIklpPzZ", conversion ) )
+    {
+      s.granularity = unit::hour;
+    }
+    else if( std::strchr( "aAbBCdDeFgGhjmntuUVwWxyY", conversion ) )
+    {
+      s.granularity = unit::day;
+    }
+
+    segments_.push_back( s );
+  }
+}
+
+void time_formatter::to_tm( time_t time, std::tm& result ) const
+{
+  if( zone_ )
+  {
+    zone_offset offset{ zone_->offset_at( time ) };
+    time_t local{ time + offset.utc_offset };
+    if( !gmtime_r( &local, &result ) )
+    {
+      throw std::runtime_error{ "Failed to convert time" };
+    }
+
+    cached_abbreviation_ = offset.abbreviation;
+    result.tm_isdst = offset.is_dst;
+    result.tm_gmtoff = offset.utc_offset;
+    result.tm_zone = cached_abbreviation_.c_str();
+    return;
+  }
+
+  if( !( utc_? gmtime_r( &time, &result ) : localtime_r( &time, &result ) ) )
+  {
+    throw std::runtime_error{ "Failed to convert time" };
+  }
+}
+
+void time_formatter::update( time_t time ) const
+{
+  std::tm tm_time;
+  std::string previous_abbreviation{ cached_abbreviation_ };
+  to_tm( time, tm_time );
+
+  unit changed{ unit::second };
+  if( !cached_ || tm_time.tm_year != cached_tm_.tm_year || tm_time.tm_yday != cached_tm_.tm_yday ||
+      tm_time.tm_gmtoff != cached_tm_.tm_gmtoff || tm_time.tm_isdst != cached_tm_.tm_isdst ||
+      previous_abbreviation != cached_abbreviation_ )
+  {
+    changed = unit::day;
+  }
+  else if( tm_time.tm_hour != cached_tm_.tm_hour )
+  {
+    changed = unit::hour;
+  }
+  else if( tm_time.tm_min != cached_tm_.tm_min )
+  {
+    changed = unit::minute;
+  }
+
+  cached_size_ = 0;
+  for( segment& s : segments_ )
+  {
+    if( s.type == segment::kind::field && s.granularity <= changed )
+    {
+      s.cached = details::run_strftime( s.text, tm_time );
+    }
+
+    cached_size_ += s.type == segment::kind::fraction? s.digits : s.cached.size();
+  }
+
+  cached_tm_ = tm_time;
+  cached_time_ = time;
+  cached_ = true;
+}
+
+void time_formatter::format_to( const std::chrono::system_clock::time_point& time, std::string& out ) const
+{
+  auto since_epoch = time.time_since_epoch();
+  auto seconds = std::chrono::duration_cast< std::chrono::seconds >( since_epoch );
+  if( seconds > since_epoch )
+  {
+    seconds -= std::chrono::seconds{ 1 }; // floor for instants before the epoch
+  }
+
+  time_t sec( seconds.count() );
+  uint32_t nanoseconds( std::chrono::duration_cast< std::chrono::nanoseconds >( since_epoch - seconds ).count() );
+
+  std::lock_guard< std::mutex > lock{ mutex_ };
+  if( !cached_ || sec != cached_time_ )
+  {
+    update( sec );
+  }
+
+  out.reserve( out.size() + cached_size_ );
+  for( const segment& s : segments_ )
+  {
+    if( s.type == segment::kind::fraction )
+    {
+      details::append_fraction( out, nanoseconds, s.digits );
+    }
+    else
+    {
+      out += s.cached;
+    }
+  }
+}
+
+std::string time_formatter::format( const std::chrono::system_clock::time_point& time ) const
+{
+  std::string result;
+  format_to( time, result );
+  return result;
+}
+
+std::string time_formatter::now() const
+{
+  return format( std::chrono::system_clock::now() );
+}
+
+const std::string& time_formatter::format_string() const noexcept
+{
+  return format_;
+}
+
+}// time
+
+}// sys
+
+}// utils
@@ -3,22 +3,32 @@
 #include <ctime>
 #include <time.h>
 #include <cstdio>
-
-#include <netdb.h>
-#include <arpa/inet.h>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
+#include <sys/timex.h>
+#include <linux/rtc.h>
 
 #include <boost/format.hpp>
-#include <boost/regex.hpp>
 #include <boost/scope_exit.hpp>
 #include <boost/algorithm/string.hpp>
-#include <boost/date_time/local_time/local_time.hpp>
-#include <boost/date_time/posix_time/posix_time.hpp>
 
+#include "../sys_ntp_client.h"
+#include "../sys_time_zone.h"
+#include "../sys_time_formatter.h"
 #include "../aux_methods.h"
-#include "execute_sys_command.h"
+#include "../sys_error.h"
+#include "run_detached.h"
 
 #define TIMEZONE_FILE "/etc/timezone"
 
@@ -31,40 +41,177 @@ namespace sys
 namespace time
 {
 
-std::string get_time( const std::string& format )
+namespace details
 {
-    time_t now{ ::time( 0 ) };
-    tm  tstruct = *localtime( &now );
 
-    std::array< char, 80 > buf;
-    strftime( buf.data(), buf.size(), format.c_str(), &tstruct );
+bool valid_date( uint year, uint month, uint day ) noexcept
+{
+  static const uint days[]{ 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  if( month < 1 || month > 12 || day < 1 )
+  {
+    return false;
+  }
+
+  bool leap{ ( year % 4 == 0 && year % 100 != 0 ) || year % 400 == 0 };
+  return day <= days[ month - 1 ] + ( month == 2 && leap );
+}
+
+// Third line of adjtime is either UTC or LOCAL
+bool rtc_is_local()
+{
+  std::ifstream file{ ADJTIME_FILE };
+  std::string line;
+  for( int i{ 0 }; i < 3; ++i )
+  {
+    if( !std::getline( file, line ) )
+    {
+      return false;
+    }
+  }
 
-    return buf.data();
+  boost::trim( line );
+  return line == "LOCAL";
+}
+
+}// details
+
+std::string get_time( const std::string& format )
+{
+  return time_formatter{ format }.now();
 }
 
 void set_sys_time( uint year, uint month, uint day, uint hour, uint min, uint sec )
 {
-  if( year < 1900 || month < 1 || month > 12 || day > 31 || hour > 24 || min > 60 || sec > 60 )
+  if( year < 1970 || !details::valid_date( year, month, day ) || hour > 23 || min > 59 || sec > 59 )
   {
     throw std::invalid_argument{ "invalid time settings" };
   }
 
   std::tm time;
+  std::memset( &time, 0, sizeof( time ) );
   time.tm_sec = sec;
   time.tm_min = min;
   time.tm_hour = hour;
   time.tm_mday = day;
   time.tm_mon = month - 1;
   time.tm_year = year - 1900;
+  time.tm_isdst = -1;
 
   time_t sys_time{ std::mktime( &time ) };
-  int result{ ::stime( &sys_time ) };
-  if( result != 0 )
+  if( sys_time == -1 )
+  {
+    throw std::invalid_argument{ "invalid time settings" };
+  }
+
+  set_sys_time( std::chrono::system_clock::from_time_t( sys_time ) );
+}
+
+std::future< void > set_sys_time( const std::chrono::system_clock::time_point& time, time_set_mode mode, bool write_rtc )
+{
+  auto offset = time - std::chrono::system_clock::now();
+  if( mode == time_set_mode::automatic )
+  {
+    auto abs_offset = offset < offset.zero()? -offset : offset;
+    mode = abs_offset < std::chrono::milliseconds{ TIME_SLEW_THRESHOLD_MS }? time_set_mode::slew : time_set_mode::step;
+  }
+
+  std::promise< void > done;
+  done.set_value();
+
+  if( mode == time_set_mode::slew )
+  {
+    adjust_sys_time( offset );
+    return done.get_future();
+  }
+
+  auto since_epoch = time.time_since_epoch();
+  auto seconds = std::chrono::duration_cast< std::chrono::seconds >( since_epoch );
+  if( seconds > since_epoch )
+  {
+    seconds -= std::chrono::seconds{ 1 };
+  }
+
+  timespec spec;
+  spec.tv_sec = seconds.count();
+  spec.tv_nsec = std::chrono::duration_cast< std::chrono::nanoseconds >( since_epoch - seconds ).count();
+
+  // pending slew would keep moving the stepped clock
+  adjust_sys_time( std::chrono::nanoseconds::zero() );
+
+  if( clock_settime( CLOCK_REALTIME, &spec ) == -1 )
+  {
+    throw std::runtime_error{ std::string{ "Failed to set system time: " } + sys::error_message( errno ) };
+  }
+
+  return write_rtc? sync_rtc_async() : done.get_future();
+}
+
+void adjust_sys_time( const std::chrono::nanoseconds& offset )
+{
+  // same limit as glibc adjtime
+  std::chrono::seconds limit{ INT_MAX / 1000000 - 2 };
+  if( offset > limit || offset < -limit )
+  {
+    throw std::invalid_argument{ "Time offset is too large to slew" };
+  }
+
+  timex adjustment;
+  std::memset( &adjustment, 0, sizeof( adjustment ) );
+  adjustment.modes = ADJ_OFFSET_SINGLESHOT;
+  adjustment.offset = std::chrono::duration_cast< std::chrono::microseconds >( offset ).count();
+
+  if( adjtimex( &adjustment ) == -1 )
+  {
+    throw std::runtime_error{ std::string{ "Failed to adjust system time: " } + sys::error_message( errno ) };
+  }
+}
+
+void sync_rtc( const std::string& device )
+{
+  static std::mutex mutex;
+  std::lock_guard< std::mutex > lock{ mutex };
+
+  int fd{ open( device.c_str(), O_RDONLY | O_CLOEXEC ) };
+  if( fd == -1 )
   {
-    throw std::runtime_error{ std::string{ "Failed to set system time: " } + strerror( result ) };
+    throw std::runtime_error{ "Failed to open " + device + ": " + sys::error_message( errno ) };
   }
 
-  details::execute_sys_command( "hwclock --systohc" );
+  BOOST_SCOPE_EXIT( fd ){ close( fd ); } BOOST_SCOPE_EXIT_END
+
+  bool local{ details::rtc_is_local() };
+
+  // RTC keeps whole seconds and starts the new one when it's set
+  auto next = std::chrono::time_point_cast< std::chrono::seconds >( std::chrono::system_clock::now() ) + std::chrono::seconds{ 1 };
+  std::this_thread::sleep_until( next );
+
+  time_t seconds{ std::chrono::system_clock::to_time_t( next ) };
+  std::tm tm_time;
+  if( !( local? localtime_r( &seconds, &tm_time ) : gmtime_r( &seconds, &tm_time ) ) )
+  {
+    throw std::runtime_error{ "Failed to convert time" };
+  }
+
+  rtc_time rtc;
+  std::memset( &rtc, 0, sizeof( rtc ) );
+  rtc.tm_sec = tm_time.tm_sec;
+  rtc.tm_min = tm_time.tm_min;
+  rtc.tm_hour = tm_time.tm_hour;
+  rtc.tm_mday = tm_time.tm_mday;
+  rtc.tm_mon = tm_time.tm_mon;
+  rtc.tm_year = tm_time.tm_year;
+  rtc.tm_wday = tm_time.tm_wday;
+  rtc.tm_yday = tm_time.tm_yday;
+
+  if( ioctl( fd, RTC_SET_TIME, &rtc ) == -1 )
+  {
+    throw std::runtime_error{ std::string{ "Failed to set RTC time: " } + sys::error_message( errno ) };
+  }
+}
+
+std::future< void > sync_rtc_async( const std::string& device )
+{
+  return sys::details::run_detached( [ device ](){ sync_rtc( device ); } );
 }
 
 std::string get_time_zone()
@@ -96,13 +243,13 @@ void set_time_zone( const std::string& timezone )
 
 std::vector<std::string> get_time_zones()
 {
-  std::vector< std::string > zones;
+  std::vector< std::string > zones{ list_time_zones() };
 
-  std::string command_result{ details::execute_sys_command( "timedatectl list-timezones" ) };
-  boost::split( zones, command_result, boost::is_any_of( "\n\r" ), boost::token_compress_on );
-  zones.push_back( "Etc/UTC" );
-  std::sort( zones.begin(), zones.end() );
-  zones.erase( std::unique( zones.begin(), zones.end() ), zones.end() );
+  auto it = std::lower_bound( zones.begin(), zones.end(), "Etc/UTC" );
+  if( it == zones.end() || *it != "Etc/UTC" )
+  {
+    zones.insert( it, "Etc/UTC" );
+  }
 
   return zones;
 }
@@ -119,100 +266,32 @@ std::pair< std::string, double > get_time_zone_offset( const std::string& timezo
     return { "GMT+00.00", 0 };
   }
 
-  boost::format offset_format{ "GMT%s" };
-
-  std::string command{ "env TZ=" + timezone + "  date +%:z" };
-  std::string offset_str{ details::execute_sys_command( command ) };
-
-  boost::trim_if( offset_str, boost::is_any_of( "\n\r" ) );
-  static const boost::regex r{ "[+-][0-9]{2}:[0-9]{2}" };
-  if( !boost::regex_match( offset_str, r ) )
-  {
-    throw std::runtime_error{ "Invalid offset string" };
-  }
+  int32_t offset{ load_time_zone( timezone )->current_offset().utc_offset };
+  int32_t minutes{ std::abs( offset ) / 60 };
 
-  offset_str[ 3 ] = '.';
-  return { boost::str( offset_format % offset_str ), std::stod( offset_str ) };
+  boost::format offset_format{ "GMT%c%02d.%02d" };
+  return { boost::str( offset_format % ( offset < 0? '-' : '+' ) % ( minutes / 60 ) % ( minutes % 60 ) ),
+           offset / 3600.0 };
 }
 
 std::string get_ntp_time_from_server(  const std::string &server, bool local, const std::string& format, uint32_t attempts )
 {
-  int sock{ socket( PF_INET, SOCK_DGRAM, 0 ) };
-  if( sock == -1 )
-  {
-      throw std::runtime_error{ std::string{ "Failed to open socket: " } + std::strerror( errno ) };
-  }
-
-  BOOST_SCOPE_EXIT( sock ){ close( sock ); } BOOST_SCOPE_EXIT_END
-
-  struct timeval tv{ 0, 200000 };// timeout = 200ms
+  ntp_result result{ query_ntp_servers( { server }, std::chrono::milliseconds{ 200 }, attempts ) };
 
-  if( ( setsockopt( sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) ) != 0 ) ||
-      ( setsockopt( sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof( tv ) ) != 0 ) )
+  const ntp_sample* sample{ result.best() };
+  if( !sample )
   {
-    throw std::runtime_error{ std::string{ "setsockopt failed: " } + std::strerror( errno ) };
-  }
-
-  hostent* he{ gethostbyname( server.c_str() ) };
-  if( !he )
-  {
-    throw std::runtime_error{ "Failed to resolve host name: " + server };
-  }
-
-  static const int portnum{ 123 };
-
-  struct sockaddr_in server_addr;
-  memset( &server_addr, 0, sizeof( sockaddr_in ) );
-  server_addr.sin_family = AF_INET;
-  server_addr.sin_addr = *reinterpret_cast< in_addr* >( he->h_addr_list[ 0 ] );
-  server_addr.sin_port = htons( portnum );
-
-  static const size_t maxlen{ 1024 };
-  std::vector< unsigned long >  buf( maxlen );
-  std::array< unsigned char, 48 > msg{ 010, 0, 0, 0, 0, 0, 0, 0, 0 }; // the packet
-
-  int res{ -1 };
-
-  for( uint32_t attempt{ 0 }; attempt < attempts && ( res < 0 ); ++attempt )
-  {
-    res = sendto( sock, msg.data(), msg.size(), 0, reinterpret_cast< sockaddr* >( &server_addr ), sizeof( server_addr ) );
-    if( res < 0 )
-    {
-      continue;
-    }
-
-    struct sockaddr saddr;
-    socklen_t saddr_l = sizeof( saddr );
-
-    res = recvfrom( sock, buf.data(), 48, 0, &saddr, &saddr_l );
-    if( res < 0 )
+    std::stringstream s;
+    s << "Failed to receive time from " << server << " after " << attempts << " attempts";
+    if( !result.errors.empty() )
     {
-      continue;
+      s << ": " << result.errors.front().second;
     }
-  }
 
-  if( res < 0 )
-  {
-    std::stringstream s;
-    s << "Failed to receive time from " << server << " after " << attempts << " attempts";
     throw std::runtime_error{ s.str() };
   }
 
-  long tmit{ ntohl( static_cast< time_t >( buf.at( 4 ) ) ) };
-  tmit -= 2208988800U;
-
-  boost::posix_time::ptime now = local?
-                boost::posix_time::ptime_from_tm( *localtime( &tmit ) ) :
-                boost::posix_time::ptime_from_tm( *gmtime( &tmit ) );
-
-  static std::locale loc( std::cout.getloc(),
-                            new boost::posix_time::time_facet{ format.c_str() } );
-
-  std::basic_stringstream<char> wss;
-  wss.imbue( loc );
-  wss << now;
-
-  return wss.str();
+  return time_formatter{ format, local? "" : "UTC" }.format( sample->time );
 }
 
 }// time
@@ -0,0 +1,595 @@
+#include "../sys_time_zone.h"
+
+#include <map>
+#include <mutex>
+#include <cctype>
+#include <cstdlib>
+#include <array>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include <time.h>
+#include <sys/stat.h>
+
+#include <boost/filesystem.hpp>
+
+#include "../aux_methods.h"
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace time
+{
+
+namespace details
+{
+
+std::string zoneinfo_dir()
+{
+  const char* dir{ getenv( "TZDIR" ) };
+  return ( dir && *dir )? dir : ZONEINFO_DIR;
+}
+
+class tzif_reader
+{
+public:
+  explicit tzif_reader( const std::string& data ) : data_( data ) {}
+
+  int64_t read( size_t size )
+  {
+    if( pos_ + size > data_.size() )
+    {
+      throw std::runtime_error{ "TZif data is truncated" };
+    }
+
+    uint64_t value{ 0 };
+    for( size_t i{ 0 }; i < size; ++i )
+    {
+      value = ( value << 8 ) | static_cast< unsigned char >( data_[ pos_ + i ] );
+    }
+
+    pos_ += size;
+
+    // sign extension
+    if( size < 8 && ( value & ( uint64_t{ 1 } << ( size * 8 - 1 ) ) ) )
+    {
+      value |= ~uint64_t{ 0 } << ( size * 8 );
+    }
+
+    return static_cast< int64_t >( value );
+  }
+
+  std::string read_string( size_t size )
+  {
+    if( pos_ + size > data_.size() )
+    {
+      throw std::runtime_error{ "TZif data is truncated" };
+    }
+
+    std::string result{ data_.substr( pos_, size ) };
+    pos_ += size;
+    return result;
+  }
+
+  void skip( size_t size )
+  {
+    read_string( size );
+  }
+
+  std::string rest() const
+  {
+    return data_.substr( pos_ );
+  }
+
+private:
+  const std::string& data_;
+  size_t pos_{ 0 };
+};
+
+struct tzif_counts
+{
+  int64_t isutcnt;
+  int64_t isstdcnt;
+  int64_t leapcnt;
+  int64_t timecnt;
+  int64_t typecnt;
+  int64_t charcnt;
+};
+
+char read_header( tzif_reader& reader, tzif_counts& counts )
+{
+  if( reader.read_string( 4 ) != "TZif" )
+  {
+    throw std::runtime_error{ "Not a TZif file" };
+  }
+
+  char version{ reader.read_string( 1 )[ 0 ] };
+  reader.skip( 15 );
+
+  counts.isutcnt = reader.read( 4 );
+  counts.isstdcnt = reader.read( 4 );
+  counts.leapcnt = reader.read( 4 );
+  counts.timecnt = reader.read( 4 );
+  counts.typecnt = reader.read( 4 );
+  counts.charcnt = reader.read( 4 );
+
+  if( counts.typecnt <= 0 || counts.timecnt < 0 || counts.charcnt < 0 || counts.leapcnt < 0 ||
+      counts.isutcnt < 0 || counts.isstdcnt < 0 )
+  {
+    throw std::runtime_error{ "Invalid TZif header" };
+  }
+
+  return version;
+}
+
+// Days since 1970-01-01 of the civil date
+int64_t days_from_civil( int64_t y, int m, int d ) noexcept
+{
+  y -= m <= 2;
+  int64_t era{ ( y >= 0? y : y - 399 ) / 400 };
+  int64_t yoe{ y - era * 400 };
+  int64_t doy{ ( 153 * ( m + ( m > 2? -3 : 9 ) ) + 2 ) / 5 + d - 1 };
+  int64_t doe{ yoe * 365 + yoe / 4 - yoe / 100 + doy };
+  return era * 146097 + doe - 719468;
+}
+
+int64_t year_from_days( int64_t days ) noexcept
+{
+  days += 719468;
+  int64_t era{ ( days >= 0? days : days - 146096 ) / 146097 };
+  int64_t doe{ days - era * 146097 };
+  int64_t yoe{ ( doe - doe / 1460 + doe / 36524 - doe / 146096 ) / 365 };
+  int64_t doy{ doe - ( 365 * yoe + yoe / 4 - yoe / 100 ) };
+  int64_t mp{ ( 5 * doy + 2 ) / 153 };
+  int m( mp < 10? mp + 3 : mp - 9 );
+  return yoe + era * 400 + ( m <= 2 );
+}
+
+bool is_leap( int64_t year ) noexcept
+{
+  return ( year % 4 == 0 && year % 100 != 0 ) || year % 400 == 0;
+}
+
+int days_in_month( int64_t year, int month ) noexcept
+{
+  static const int days[]{ 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  return days[ month - 1 ] + ( month == 2 && is_leap( year ) );
+}
+
+// POSIX TZ string tokenizer
+class posix_parser
+{
+public:
+  explicit posix_parser( const std::string& tz ) : tz_( tz ) {}
+
+  bool at_end() const noexcept
+  {
+    return pos_ >= tz_.size();
+  }
+
+  char peek() const noexcept
+  {
+    return at_end()? '\0' : tz_[ pos_ ];
+  }
+
+  bool consume( char c ) noexcept
+  {
+    if( peek() == c )
+    {
+      ++pos_;
+      return true;
+    }
+
+    return false;
+  }
+
+  std::string name()
+  {
+    std::string result;
+    if( consume( '<' ) )
+    {
+      while( !at_end() && peek() != '>' )
+      {
+        result += tz_[ pos_++ ];
+      }
+
+      if( !consume( '>' ) )
+      {
+        throw std::runtime_error{ "Invalid TZ string: " + tz_ };
+      }
+    }
+    else
+    {
+      while( std::isalpha( static_cast< unsigned char >( peek() ) ) )
+      {
+        result += tz_[ pos_++ ];
+      }
+    }
+
+    return result;
+  }
+
+  int number()
+  {
+    if( !std::isdigit( static_cast< unsigned char >( peek() ) ) )
+    {
+      throw std::runtime_error{ "Invalid TZ string: " + tz_ };
+    }
+
+    int result{ 0 };
+    while( std::isdigit( static_cast< unsigned char >( peek() ) ) )
+    {
+      result = result * 10 + ( tz_[ pos_++ ] - '0' );
+    }
+
+    return result;
+  }
+
+  // [+-]hh[:mm[:ss]] in seconds
+  int32_t time()
+  {
+    int sign{ 1 };
+    if( consume( '-' ) )
+    {
+      sign = -1;
+    }
+    else
+    {
+      consume( '+' );
+    }
+
+    int32_t result{ number() * 3600 };
+    if( consume( ':' ) )
+    {
+      result += number() * 60;
+      if( consume( ':' ) )
+      {
+        result += number();
+      }
+    }
+
+    return sign * result;
+  }
+
+private:
+  const std::string& tz_;
+  size_t pos_{ 0 };
+};
+
+// Walks zoneinfo tree, taking only TZif files
+void collect_zones( const boost::filesystem::path& root, std::vector< std::string >& zones )
+{
+  namespace bfs = boost::filesystem;
+
+  boost::system::error_code ec;
+  for( bfs::recursive_directory_iterator it{ root, ec }, end; !ec && it != end; it.increment( ec ) )
+  {
+    std::string name{ it->path().filename().string() };
+    if( bfs::is_directory( it->path() ) )
+    {
+      if( name == "posix" || name == "right" )
+      {
+        it.no_push();
+      }
+
+      continue;
+    }
+
+    if( !std::isupper( static_cast< unsigned char >( name[ 0 ] ) ) || name == "SECURITY" )
+    {
+      continue;
+    }
+
+    std::ifstream file{ it->path().string(), std::ios_base::binary };
+    std::array< char, 4 > magic{ { 0 } };
+    if( file.read( magic.data(), magic.size() ) && std::string( magic.data(), magic.size() ) == "TZif" )
+    {
+      zones.push_back( it->path().string().substr( root.string().length() + 1 ) );
+    }
+  }
+}
+
+}// details
+
+time_zone::time_zone( const std::string& name, const std::string& tzif_data )
+  : name_( name )
+{
+  details::tzif_reader reader{ tzif_data };
+  details::tzif_counts counts;
+  char version{ details::read_header( reader, counts ) };
+  size_t time_size{ 4 };
+
+  if( version >= '2' )
+  {
+    // skip v1 data block, v2+ block has 64 bit times
+    reader.skip( counts.timecnt * 5 + counts.typecnt * 6 + counts.charcnt +
+                 counts.leapcnt * 8 + counts.isstdcnt + counts.isutcnt );
+    details::read_header( reader, counts );
+    time_size = 8;
+  }
+
+  transitions_.reserve( counts.timecnt );
+  for( int64_t i{ 0 }; i < counts.timecnt; ++i )
+  {
+    transitions_.push_back( reader.read( time_size ) );
+  }
+
+  for( int64_t i{ 0 }; i < counts.timecnt; ++i )
+  {
+    uint8_t type( reader.read( 1 ) );
+    if( type >= counts.typecnt )
+    {
+      throw std::runtime_error{ "Invalid TZif transition type" };
+    }
+
+    transition_types_.push_back( type );
+  }
+
+  std::vector< uint8_t > abbr_indices;
+  for( int64_t i{ 0 }; i < counts.typecnt; ++i )
+  {
+    zone_offset type;
+    type.utc_offset = reader.read( 4 );
+    type.is_dst = reader.read( 1 ) != 0;
+    abbr_indices.push_back( reader.read( 1 ) );
+    types_.push_back( type );
+  }
+
+  std::string abbrs{ reader.read_string( counts.charcnt ) };
+  for( size_t i{ 0 }; i < types_.size(); ++i )
+  {
+    if( abbr_indices[ i ] < abbrs.size() )
+    {
+      types_[ i ].abbreviation = abbrs.c_str() + abbr_indices[ i ];
+    }
+  }
+
+  reader.skip( counts.leapcnt * ( time_size + 4 ) + counts.isstdcnt + counts.isutcnt );
+
+  if( version >= '2' )
+  {
+    std::string footer{ reader.rest() };
+    if( footer.size() >= 2 && footer[ 0 ] == '\n' )
+    {
+      size_t end{ footer.find( '\n', 1 ) };
+      footer_ = parse_posix_tz( footer.substr( 1, end == std::string::npos? end : end - 1 ) );
+    }
+  }
+}
+
+const std::string& time_zone::name() const noexcept
+{
+  return name_;
+}
+
+time_zone::posix_tz time_zone::parse_posix_tz( const std::string& tz )
+{
+  posix_tz result;
+  if( tz.empty() )
+  {
+    return result;
+  }
+
+  details::posix_parser parser{ tz };
+
+  auto parse_rule = [ &parser ]()
+  {
+    posix_rule rule;
+    if( parser.consume( 'M' ) )
+    {
+      rule.type = posix_rule::kind::month_week_day;
+      rule.month = parser.number();
+      parser.consume( '.' );
+      rule.week = parser.number();
+      parser.consume( '.' );
+      rule.day = parser.number();
+
+      if( rule.month < 1 || rule.month > 12 || rule.week < 1 || rule.week > 5 || rule.day > 6 )
+      {
+        throw std::runtime_error{ "Invalid TZ rule" };
+      }
+    }
+    else if( parser.consume( 'J' ) )
+    {
+      rule.type = posix_rule::kind::julian_no_leap;
+      rule.day = parser.number();
+    }
+    else
+    {
+      rule.type = posix_rule::kind::julian;
+      rule.day = parser.number();
+    }
+
+    if( parser.consume( '/' ) )
+    {
+      rule.time = parser.time();
+    }
+
+    return rule;
+  };
+
+  result.std_offset.abbreviation = parser.name();
+  result.std_offset.utc_offset = -parser.time(); // POSIX offsets are positive west of Greenwich
+
+  if( !parser.at_end() )
+  {
+    result.has_dst = true;
+    result.dst_offset.abbreviation = parser.name();
+    result.dst_offset.is_dst = true;
+    result.dst_offset.utc_offset = ( parser.at_end() || parser.peek() == ',' )?
+                                   result.std_offset.utc_offset + 3600 :
+                                   -parser.time();
+
+    if( parser.consume( ',' ) )
+    {
+      result.start = parse_rule();
+      parser.consume( ',' );
+      result.end = parse_rule();
+    }
+    else
+    {
+      // US rules are the POSIX default
+      result.start.month = 3;
+      result.start.week = 2;
+      result.end.month = 11;
+      result.end.week = 1;
+    }
+  }
+
+  result.valid = true;
+  return result;
+}
+
+int64_t time_zone::rule_to_utc( const posix_rule& rule, int64_t year, int32_t offset )
+{
+  int64_t day{ 0 };
+  switch( rule.type )
+  {
+    case posix_rule::kind::julian_no_leap:
+      day = details::days_from_civil( year, 1, 1 ) + rule.day - 1 + ( details::is_leap( year ) && rule.day >= 60 );
+      break;
+    case posix_rule::kind::julian:
+      day = details::days_from_civil( year, 1, 1 ) + rule.day;
+      break;
+    case posix_rule::kind::month_week_day:
+    {
+      int64_t first{ details::days_from_civil( year, rule.month, 1 ) };
+      int first_weekday( ( first % 7 + 11 ) % 7 ); // 1970-01-01 is thursday
+      int mday{ 1 + ( rule.day - first_weekday + 7 ) % 7 + ( rule.week - 1 ) * 7 };
+      if( mday > details::days_in_month( year, rule.month ) )
+      {
+        mday -= 7;
+      }
+
+      day = first + mday - 1;
+      break;
+    }
+  }
+
+  return day * 86400 + rule.time - offset;
+}
+
+zone_offset time_zone::footer_offset_at( int64_t unix_time ) const
+{
+  if( !footer_.has_dst )
+  {
+    return footer_.std_offset;
+  }
+
+  int64_t year{ details::year_from_days( ( unix_time >= 0? unix_time : unix_time - 86399 ) / 86400 ) };
+
+  // start is given in standard local time, end in daylight local time
+  int64_t start{ rule_to_utc( footer_.start, year, footer_.std_offset.utc_offset ) };
+  int64_t end{ rule_to_utc( footer_.end, year, footer_.dst_offset.utc_offset ) };
+
+  bool dst{ start < end?
+            ( unix_time >= start && unix_time < end ) :
+            !( unix_time >= end && unix_time < start ) };
+
+  return dst? footer_.dst_offset : footer_.std_offset;
+}
+
+zone_offset time_zone::offset_at( int64_t unix_time ) const
+{
+  if( transitions_.empty() || unix_time < transitions_.front() )
+  {
+    if( transitions_.empty() && footer_.valid )
+    {
+      return footer_offset_at( unix_time );
+    }
+
+    return types_.front();
+  }
+
+  if( unix_time >= transitions_.back() && footer_.valid )
+  {
+    return footer_offset_at( unix_time );
+  }
+
+  size_t index( std::upper_bound( transitions_.begin(), transitions_.end(), unix_time ) - transitions_.begin() );
+  return types_[ transition_types_[ index - 1 ] ];
+}
+
+zone_offset time_zone::current_offset() const
+{
+  return offset_at( ::time( nullptr ) );
+}
+
+std::shared_ptr< const time_zone > load_time_zone( const std::string& name )
+{
+  if( name.empty() || name[ 0 ] == '/' || name.find( ".." ) != std::string::npos )
+  {
+    throw std::invalid_argument{ "Invalid timezone" };
+  }
+
+  struct cached_zone
+  {
+    std::shared_ptr< const time_zone > zone;
+    time_t mtime_sec{ 0 };
+    long mtime_nsec{ 0 };
+  };
+
+  static std::mutex mutex;
+  static std::map< std::string, cached_zone > cache;
+
+  std::string path{ details::zoneinfo_dir() + "/" + name };
+
+  struct stat info;
+  if( ::stat( path.c_str(), &info ) != 0 || !S_ISREG( info.st_mode ) )
+  {
+    throw std::invalid_argument{ "Unknown timezone: " + name };
+  }
+
+  std::lock_guard< std::mutex > lock{ mutex };
+
+  cached_zone& cached( cache[ path ] );
+  if( !cached.zone || cached.mtime_sec != info.st_mtim.tv_sec || cached.mtime_nsec != info.st_mtim.tv_nsec )
+  {
+    cached.zone = std::make_shared< time_zone >( name, aux::read_file( path, true ) );
+    cached.mtime_sec = info.st_mtim.tv_sec;
+    cached.mtime_nsec = info.st_mtim.tv_nsec;
+  }
+
+  return cached.zone;
+}
+
+std::vector< std::string > list_time_zones()
+{
+  std::vector< std::string > zones;
+  std::string dir{ details::zoneinfo_dir() };
+
+  std::ifstream tzdata{ dir + "/tzdata.zi" };
+  if( tzdata.is_open() )
+  {
+    // "Z <name> ..." zone lines and "L <target> <name>" link lines
+    std::string line;
+    while( std::getline( tzdata, line ) )
+    {
+      if( line.size() > 2 && line[ 1 ] == ' ' && ( line[ 0 ] == 'Z' || line[ 0 ] == 'L' ) )
+      {
+        size_t begin{ line[ 0 ] == 'Z'? 2 : line.find( ' ', 2 ) + 1 };
+        size_t end{ line.find( ' ', begin ) };
+        zones.push_back( line.substr( begin, end == std::string::npos? end : end - begin ) );
+      }
+    }
+  }
+  else
+  {
+    details::collect_zones( dir, zones );
+  }
+
+  std::sort( zones.begin(), zones.end() );
+  zones.erase( std::unique( zones.begin(), zones.end() ), zones.end() );
+
+  return zones;
+}
+
+}// time
+
+}// sys
+
+}// utils
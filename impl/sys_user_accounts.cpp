@@ -0,0 +1,868 @@
+#include "../sys_user_accounts.h"
+
+#include <set>
+#include <ctime>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <sstream>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <shadow.h>
+#include <sys/stat.h>
+
+#include <boost/filesystem.hpp>
+
+#include "../aux_methods.h"
+#include "../sys_error.h"
+#include "../sys_user_resolver.h"
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace user
+{
+
+namespace details
+{
+
+using record = std::vector< std::string >;
+
+// Lines of a colon separated file. Removed records are left empty, so the indices stay valid
+struct table
+{
+  std::string path;
+  bool exists{ false };
+  std::string content; // as loaded, to put back if saving fails half way
+  std::vector< record > records;
+  std::unordered_map< std::string, size_t > index;
+
+  record* find( const std::string& name )
+  {
+    auto it = index.find( name );
+    return it == index.end()? nullptr : &records[ it->second ];
+  }
+
+  void add( const record& r )
+  {
+    index.emplace( r[ 0 ], records.size() );
+    records.push_back( r );
+  }
+
+  void erase( const std::string& name )
+  {
+    auto it = index.find( name );
+    if( it != index.end() )
+    {
+      records[ it->second ].clear();
+      index.erase( it );
+    }
+  }
+};
+
+record split_fields( const std::string& line, char delimiter )
+{
+  record fields;
+  size_t start{ 0 };
+  for( size_t pos{ line.find( delimiter ) }; pos != std::string::npos; pos = line.find( delimiter, start ) )
+  {
+    fields.push_back( line.substr( start, pos - start ) );
+    start = pos + 1;
+  }
+
+  fields.push_back( line.substr( start ) );
+  return fields;
+}
+
+std::string join_fields( const record& fields, char delimiter )
+{
+  std::string line;
+  for( size_t i{ 0 }; i < fields.size(); ++i )
+  {
+    line += ( i? std::string( 1, delimiter ) : std::string{} ) + fields[ i ];
+  }
+
+  return line;
+}
+
+// Comments, empty and NIS (+/-) lines are kept as they are but not indexed
+table load_table( const std::string& path, bool required )
+{
+  table t;
+  t.path = path;
+
+  std::error_code ec;
+  std::string content{ aux::read_file( path, ec, { false, 0 } ) };
+  if( ec )
+  {
+    if( required || ec != std::errc::no_such_file_or_directory )
+    {
+      throw std::runtime_error{ "Could not read " + path + ": " + ec.message() };
+    }
+
+    return t;
+  }
+
+  t.exists = true;
+  t.content = content;
+  std::istringstream stream{ content };
+  for( std::string line; std::getline( stream, line ); )
+  {
+    record fields( split_fields( line, ':' ) );
+    const std::string& name( fields[ 0 ] );
+    if( !name.empty() && name[ 0 ] != '#' && name[ 0 ] != '+' && name[ 0 ] != '-' && !t.index.count( name ) )
+    {
+      t.index.emplace( name, t.records.size() );
+    }
+
+    t.records.push_back( std::move( fields ) );
+  }
+
+  return t;
+}
+
+aux::staged_file stage_table( const table& t )
+{
+  if( !t.exists )
+  {
+    return aux::staged_file{};
+  }
+
+  std::string content;
+  for( const record& r : t.records )
+  {
+    if( !r.empty() )
+    {
+      content += join_fields( r, ':' ) + "\n";
+    }
+  }
+
+  return aux::stage_file( t.path, content );
+}
+
+// The members lists of group and gshadow
+bool has_member( const std::string& list, const std::string& user )
+{
+  return !list.empty() && ( "," + list + "," ).find( "," + user + "," ) != std::string::npos;
+}
+
+void add_member( record& r, size_t field, const std::string& user )
+{
+  if( r.size() > field && !has_member( r[ field ], user ) )
+  {
+    r[ field ] += ( r[ field ].empty()? "" : "," ) + user;
+  }
+}
+
+void remove_member( record& r, size_t field, const std::string& user )
+{
+  if( r.size() > field && has_member( r[ field ], user ) )
+  {
+    std::string list;
+    for( const std::string& member : split_fields( r[ field ], ',' ) )
+    {
+      if( member != user )
+      {
+        list += ( list.empty()? "" : "," ) + member;
+      }
+    }
+
+    r[ field ] = list;
+  }
+}
+
+std::unordered_map< std::string, std::string > load_login_defs( const std::string& path )
+{
+  std::unordered_map< std::string, std::string > defs;
+
+  std::error_code ec;
+  std::istringstream stream{ aux::read_file( path, ec ) };
+  for( std::string line; std::getline( stream, line ); )
+  {
+    std::istringstream fields{ line };
+    std::string key, value;
+    if( fields >> key >> value && key[ 0 ] != '#' )
+    {
+      defs[ key ] = value;
+    }
+  }
+
+  return defs;
+}
+
+// Same names as the default NAME_REGEX of useradd
+void validate_name( const std::string& name )
+{
+  bool valid{ !name.empty() && name.size() <= 32 && ( std::isalpha( static_cast< unsigned char >( name[ 0 ] ) ) || name[ 0 ] == '_' ) };
+  for( size_t i{ 1 }; valid && i < name.size(); ++i )
+  {
+    unsigned char c{ static_cast< unsigned char >( name[ i ] ) };
+    valid = std::isalnum( c ) || c == '_' || c == '-' || c == '.' || ( c == '$' && i + 1 == name.size() );
+  }
+
+  if( !valid )
+  {
+    throw std::invalid_argument{ "Invalid user or group name: " + name };
+  }
+}
+
+void validate_field( const std::string& value )
+{
+  if( value.find_first_of( ":\n" ) != std::string::npos )
+  {
+    throw std::invalid_argument{ "Invalid account field: " + value };
+  }
+}
+
+// lckpwdf() only knows /etc, a root dir gets the same lock in its etc
+class accounts_lock
+{
+public:
+  explicit accounts_lock( const std::string& root_dir )
+  {
+    if( root_dir.empty() )
+    {
+      if( lckpwdf() != 0 )
+      {
+        throw std::runtime_error{ "Could not lock account files: " + error_message( errno ) };
+      }
+
+      return;
+    }
+
+    std::string path{ root_dir + "/etc/.pwd.lock" };
+    fd_ = open( path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600 );
+
+    struct flock lock{};
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    if( fd_ == -1 || fcntl( fd_, F_SETLKW, &lock ) != 0 )
+    {
+      std::string error{ error_message( errno ) };
+      if( fd_ != -1 )
+      {
+        close( fd_ );
+      }
+
+      throw std::runtime_error{ "Could not lock account files: " + error };
+    }
+  }
+
+  ~accounts_lock()
+  {
+    if( fd_ == -1 )
+    {
+      ulckpwdf();
+    }
+    else
+    {
+      close( fd_ );
+    }
+  }
+
+  accounts_lock( const accounts_lock& ) = delete;
+  accounts_lock& operator=( const accounts_lock& ) = delete;
+
+private:
+  int fd_{ -1 };
+};
+
+struct home_dir
+{
+  std::string path;
+  uid_t uid;
+  gid_t gid;
+};
+
+void create_home( const home_dir& home, const std::string& skel, mode_t mode )
+{
+  namespace bfs = boost::filesystem;
+
+  bfs::path path{ home.path };
+  if( bfs::exists( path ) )
+  {
+    return;
+  }
+
+  bfs::create_directories( path.parent_path() );
+  if( mkdir( home.path.c_str(), mode ) != 0 || ::chmod( home.path.c_str(), mode ) != 0 )
+  {
+    throw std::runtime_error{ "Could not create home dir " + home.path + ": " + error_message( errno ) };
+  }
+
+  if( bfs::is_directory( skel ) )
+  {
+    aux::copy_folder( skel, home.path );
+  }
+
+  bool ok{ lchown( home.path.c_str(), home.uid, home.gid ) == 0 };
+  for( bfs::recursive_directory_iterator it{ path }; ok && it != bfs::recursive_directory_iterator{}; ++it )
+  {
+    ok = lchown( it->path().string().c_str(), home.uid, home.gid ) == 0;
+  }
+
+  if( !ok )
+  {
+    throw std::runtime_error{ "Could not change owner of home dir " + home.path + ": " + error_message( errno ) };
+  }
+}
+
+}// details
+
+class account_batch::files
+{
+public:
+  explicit files( const std::string& root_dir );
+
+  details::record& find_user( const std::string& name );
+  details::record& find_group( const std::string& name );
+
+  uid_t new_uid( uid_t uid, bool system );
+  gid_t new_gid( gid_t gid, bool system, gid_t preferred = auto_id );
+  void set_members( const std::string& group, const std::string& user, bool add );
+  void remove_from_all_groups( const std::string& user );
+
+  void save();
+
+  std::string root_dir;
+  details::table passwd;
+  details::table shadow;
+  details::table group;
+  details::table gshadow;
+
+  std::set< uid_t > uids;
+  std::set< gid_t > gids;
+  std::unordered_map< std::string, std::string > login_defs;
+  std::string days; // since epoch, for the last password change
+
+  std::vector< details::home_dir > homes_to_create;
+  std::vector< std::string > homes_to_remove;
+
+private:
+  unsigned long login_def( const std::string& key, unsigned long def ) const;
+  unsigned int allocate( std::set< unsigned int >& used, const std::string& prefix, bool system );
+};
+
+account_batch::files::files( const std::string& root_dir )
+  : root_dir( root_dir ),
+    passwd( details::load_table( root_dir + PASSWD_FILE, true ) ),
+    shadow( details::load_table( root_dir + SHADOW_FILE, false ) ),
+    group( details::load_table( root_dir + GROUP_FILE, true ) ),
+    gshadow( details::load_table( root_dir + GSHADOW_FILE, false ) ),
+    login_defs( details::load_login_defs( root_dir + LOGIN_DEFS_FILE ) ),
+    days( std::to_string( time( nullptr ) / ( 24 * 60 * 60 ) ) )
+{
+  for( const details::record& r : passwd.records )
+  {
+    if( r.size() > 2 )
+    {
+      uids.insert( std::strtoul( r[ 2 ].c_str(), nullptr, 10 ) );
+    }
+  }
+
+  for( const details::record& r : group.records )
+  {
+    if( r.size() > 2 )
+    {
+      gids.insert( std::strtoul( r[ 2 ].c_str(), nullptr, 10 ) );
+    }
+  }
+}
+
+details::record& account_batch::files::find_user( const std::string& name )
+{
+  details::record* r{ passwd.find( name ) };
+  if( !r || r->size() < 7 )
+  {
+    throw std::invalid_argument{ "Unknown user: " + name };
+  }
+
+  return *r;
+}
+
+details::record& account_batch::files::find_group( const std::string& name )
+{
+  details::record* r{ group.find( name ) };
+  if( !r || r->size() < 4 )
+  {
+    throw std::invalid_argument{ "Unknown group: " + name };
+  }
+
+  return *r;
+}
+
+unsigned long account_batch::files::login_def( const std::string& key, unsigned long def ) const
+{
+  auto it = login_defs.find( key );
+  return it == login_defs.end()? def : std::strtoul( it->second.c_str(), nullptr, 0 );
+}
+
+// As useradd: regular ids follow the biggest one in use, system ones are taken from the top of their range
+unsigned int account_batch::files::allocate( std::set< unsigned int >& used, const std::string& prefix, bool system )
+{
+  unsigned long min{ system? login_def( "SYS_" + prefix + "_MIN", 101 ) : login_def( prefix + "_MIN", 1000 ) };
+  unsigned long max{ system? login_def( "SYS_" + prefix + "_MAX", login_def( prefix + "_MIN", 1000 ) - 1 )
+                           : login_def( prefix + "_MAX", 60000 ) };
+
+  if( system )
+  {
+    for( unsigned long id{ max }; id >= min && id > 0; --id )
+    {
+      if( !used.count( id ) )
+      {
+        return id;
+      }
+    }
+  }
+  else
+  {
+    auto above = used.upper_bound( max );
+    unsigned long id{ above == used.begin()? min : *std::prev( above ) + 1 };
+    if( id >= min && id <= max )
+    {
+      return id;
+    }
+
+    for( id = min; id <= max; ++id )
+    {
+      if( !used.count( id ) )
+      {
+        return id;
+      }
+    }
+  }
+
+  throw std::runtime_error{ "No free " + prefix + " left" };
+}
+
+uid_t account_batch::files::new_uid( uid_t uid, bool system )
+{
+  if( uid == auto_id )
+  {
+    uid = allocate( uids, "UID", system );
+  }
+  else if( uids.count( uid ) )
+  {
+    throw std::invalid_argument{ "UID " + std::to_string( uid ) + " is in use" };
+  }
+
+  uids.insert( uid );
+  return uid;
+}
+
+gid_t account_batch::files::new_gid( gid_t gid, bool system, gid_t preferred )
+{
+  if( gid == auto_id )
+  {
+    gid = preferred != auto_id && !gids.count( preferred )? preferred : allocate( gids, "GID", system );
+  }
+  else if( gids.count( gid ) )
+  {
+    throw std::invalid_argument{ "GID " + std::to_string( gid ) + " is in use" };
+  }
+
+  gids.insert( gid );
+  return gid;
+}
+
+void account_batch::files::set_members( const std::string& group_name, const std::string& user, bool add )
+{
+  details::record& group_record( find_group( group_name ) );
+  details::record* gshadow_record{ gshadow.find( group_name ) };
+
+  if( add )
+  {
+    details::add_member( group_record, 3, user );
+    if( gshadow_record )
+    {
+      details::add_member( *gshadow_record, 3, user );
+    }
+  }
+  else
+  {
+    details::remove_member( group_record, 3, user );
+    if( gshadow_record )
+    {
+      details::remove_member( *gshadow_record, 3, user );
+    }
+  }
+}
+
+void account_batch::files::remove_from_all_groups( const std::string& user )
+{
+  for( details::record& r : group.records )
+  {
+    details::remove_member( r, 3, user );
+  }
+
+  for( details::record& r : gshadow.records )
+  {
+    details::remove_member( r, 2, user );
+    details::remove_member( r, 3, user );
+  }
+}
+
+// Every file is written before any of them is replaced, so a write failure changes none, and the replaced
+// ones are written back if a later rename fails. Groups are replaced first, so a crash in between never
+// leaves users with unknown groups
+void account_batch::files::save()
+{
+  const details::table* tables[]{ &group, &gshadow, &passwd, &shadow };
+  std::vector< aux::staged_file > staged;
+  size_t committed{ 0 };
+  try
+  {
+    for( const details::table* t : tables )
+    {
+      staged.push_back( details::stage_table( *t ) );
+    }
+
+    for( ; committed < staged.size(); ++committed )
+    {
+      aux::commit_file( staged[ committed ] );
+    }
+  }
+  catch( ... )
+  {
+    for( size_t i{ committed }; i < staged.size(); ++i )
+    {
+      aux::discard_file( staged[ i ] );
+    }
+
+    for( size_t i{ 0 }; i < committed; ++i )
+    {
+      try
+      {
+        if( !staged[ i ].tmp_path.empty() )
+        {
+          aux::write_file_atomic( staged[ i ].target, tables[ i ]->content );
+        }
+      }
+      catch( const std::exception& )
+      {
+        // the original error is the one reported
+      }
+    }
+
+    throw;
+  }
+}
+
+account_batch::account_batch( const std::string& root_dir )
+  : root_dir_( root_dir )
+{
+}
+
+account_batch& account_batch::add_user( const user_spec& user )
+{
+  details::validate_name( user.name );
+  for( const std::string& field : { user.group, user.gecos, user.home, user.shell, user.password_hash } )
+  {
+    details::validate_field( field );
+  }
+
+  changes_.push_back( [ user ]( files& f )
+  {
+    if( f.passwd.find( user.name ) )
+    {
+      throw std::invalid_argument{ "User " + user.name + " already exists" };
+    }
+
+    uid_t uid{ f.new_uid( user.uid, user.system ) };
+    gid_t gid;
+    if( user.group.empty() )
+    {
+      if( f.group.find( user.name ) )
+      {
+        throw std::invalid_argument{ "Group " + user.name + " already exists" };
+      }
+
+      gid = f.new_gid( auto_id, user.system, uid );
+      f.group.add( { user.name, "x", std::to_string( gid ), "" } );
+      if( f.gshadow.exists )
+      {
+        f.gshadow.add( { user.name, "!", "", "" } );
+      }
+    }
+    else
+    {
+      gid = std::strtoul( f.find_group( user.group )[ 2 ].c_str(), nullptr, 10 );
+    }
+
+    for( const std::string& group : user.groups )
+    {
+      f.set_members( group, user.name, true );
+    }
+
+    std::string home{ user.home.empty()? std::string{ DEFAULT_HOME_DIR } + "/" + user.name : user.home };
+    f.passwd.add( { user.name, "x", std::to_string( uid ), std::to_string( gid ), user.gecos, home,
+                    user.shell.empty()? DEFAULT_SHELL : user.shell } );
+
+    if( f.shadow.exists )
+    {
+      f.shadow.add( { user.name, user.password_hash.empty()? "!" : user.password_hash, f.days, "0", "99999", "7", "", "", "" } );
+    }
+
+    if( user.create_home )
+    {
+      f.homes_to_create.push_back( details::home_dir{ f.root_dir + home, uid, gid } );
+    }
+  } );
+
+  return *this;
+}
+
+account_batch& account_batch::modify_user( const user_spec& user )
+{
+  details::validate_name( user.name );
+  for( const std::string& field : { user.group, user.gecos, user.home, user.shell, user.password_hash } )
+  {
+    details::validate_field( field );
+  }
+
+  changes_.push_back( [ user ]( files& f )
+  {
+    details::record& r( f.find_user( user.name ) );
+
+    uid_t current_uid{ static_cast< uid_t >( std::strtoul( r[ 2 ].c_str(), nullptr, 10 ) ) };
+    if( user.uid != auto_id && user.uid != current_uid )
+    {
+      f.new_uid( user.uid, false );
+      f.uids.erase( current_uid );
+      r[ 2 ] = std::to_string( user.uid );
+    }
+
+    if( !user.group.empty() )
+    {
+      r[ 3 ] = f.find_group( user.group )[ 2 ];
+    }
+
+    if( !user.groups.empty() )
+    {
+      for( const std::string& group : user.groups )
+      {
+        f.find_group( group );
+      }
+
+      // groups the user stays in keep their members order
+      std::set< std::string > groups( user.groups.begin(), user.groups.end() );
+      for( details::record& group : f.group.records )
+      {
+        if( !group.empty() && !groups.count( group[ 0 ] ) )
+        {
+          details::remove_member( group, 3, user.name );
+        }
+      }
+
+      for( details::record& group : f.gshadow.records )
+      {
+        if( !group.empty() && !groups.count( group[ 0 ] ) )
+        {
+          details::remove_member( group, 3, user.name );
+        }
+      }
+
+      for( const std::string& group : user.groups )
+      {
+        f.set_members( group, user.name, true );
+      }
+    }
+
+    // like usermod -d, the home dir itself is not moved
+    if( !user.gecos.empty() )
+    {
+      r[ 4 ] = user.gecos;
+    }
+
+    if( !user.home.empty() )
+    {
+      r[ 5 ] = user.home;
+    }
+
+    if( !user.shell.empty() )
+    {
+      r[ 6 ] = user.shell;
+    }
+
+    details::record* shadow_record{ f.shadow.find( user.name ) };
+    if( !user.password_hash.empty() && shadow_record && shadow_record->size() > 2 )
+    {
+      ( *shadow_record )[ 1 ] = user.password_hash;
+      ( *shadow_record )[ 2 ] = f.days;
+    }
+  } );
+
+  return *this;
+}
+
+account_batch& account_batch::remove_user( const std::string& name, bool remove_home )
+{
+  details::validate_name( name );
+
+  changes_.push_back( [ name, remove_home ]( files& f )
+  {
+    details::record r( f.find_user( name ) );
+
+    f.passwd.erase( name );
+    f.shadow.erase( name );
+    f.uids.erase( std::strtoul( r[ 2 ].c_str(), nullptr, 10 ) );
+    f.remove_from_all_groups( name );
+
+    // user's own group, unless somebody else needs it
+    details::record* own_group{ f.group.find( name ) };
+    bool in_use{ !own_group || own_group->size() < 4 || ( *own_group )[ 2 ] != r[ 3 ] || !( *own_group )[ 3 ].empty() };
+    for( const details::record& user : f.passwd.records )
+    {
+      in_use = in_use || ( user.size() > 3 && user[ 3 ] == r[ 3 ] );
+    }
+
+    if( !in_use )
+    {
+      f.gids.erase( std::strtoul( r[ 3 ].c_str(), nullptr, 10 ) );
+      f.group.erase( name );
+      f.gshadow.erase( name );
+    }
+
+    if( remove_home && !r[ 5 ].empty() && r[ 5 ] != "/" )
+    {
+      f.homes_to_remove.push_back( f.root_dir + r[ 5 ] );
+    }
+  } );
+
+  return *this;
+}
+
+account_batch& account_batch::add_group( const std::string& name, gid_t gid, bool system )
+{
+  details::validate_name( name );
+
+  changes_.push_back( [ name, gid, system ]( files& f )
+  {
+    if( f.group.find( name ) )
+    {
+      throw std::invalid_argument{ "Group " + name + " already exists" };
+    }
+
+    f.group.add( { name, "x", std::to_string( f.new_gid( gid, system ) ), "" } );
+    if( f.gshadow.exists )
+    {
+      f.gshadow.add( { name, "!", "", "" } );
+    }
+  } );
+
+  return *this;
+}
+
+account_batch& account_batch::remove_group( const std::string& name )
+{
+  details::validate_name( name );
+
+  changes_.push_back( [ name ]( files& f )
+  {
+    std::string gid{ f.find_group( name )[ 2 ] };
+    for( const details::record& user : f.passwd.records )
+    {
+      if( user.size() > 3 && user[ 3 ] == gid )
+      {
+        throw std::invalid_argument{ "Group " + name + " is the primary group of user " + user[ 0 ] };
+      }
+    }
+
+    f.gids.erase( std::strtoul( gid.c_str(), nullptr, 10 ) );
+    f.group.erase( name );
+    f.gshadow.erase( name );
+  } );
+
+  return *this;
+}
+
+account_batch& account_batch::add_to_group( const std::string& user, const std::string& group )
+{
+  details::validate_name( user );
+  details::validate_name( group );
+
+  changes_.push_back( [ user, group ]( files& f )
+  {
+    f.find_user( user );
+    f.set_members( group, user, true );
+  } );
+
+  return *this;
+}
+
+account_batch& account_batch::remove_from_group( const std::string& user, const std::string& group )
+{
+  details::validate_name( user );
+  details::validate_name( group );
+
+  changes_.push_back( [ user, group ]( files& f )
+  {
+    f.set_members( group, user, false );
+  } );
+
+  return *this;
+}
+
+size_t account_batch::size() const noexcept
+{
+  return changes_.size();
+}
+
+bool account_batch::empty() const noexcept
+{
+  return changes_.empty();
+}
+
+void account_batch::apply()
+{
+  if( changes_.empty() )
+  {
+    return;
+  }
+
+  std::vector< details::home_dir > homes_to_create;
+  std::vector< std::string > homes_to_remove;
+  mode_t home_mode;
+  {
+    details::accounts_lock lock{ root_dir_ };
+
+    files f{ root_dir_ };
+    for( const auto& change : changes_ )
+    {
+      change( f );
+    }
+
+    f.save();
+
+    homes_to_create.swap( f.homes_to_create );
+    homes_to_remove.swap( f.homes_to_remove );
+    home_mode = f.login_defs.count( "HOME_MODE" )? std::strtoul( f.login_defs[ "HOME_MODE" ].c_str(), nullptr, 8 ) :
+                0777 & ~( f.login_defs.count( "UMASK" )? std::strtoul( f.login_defs[ "UMASK" ].c_str(), nullptr, 8 ) : 022 );
+  }
+
+  changes_.clear();
+  get_user_resolver().clear();
+
+  for( const std::string& home : homes_to_remove )
+  {
+    boost::filesystem::remove_all( home );
+  }
+
+  for( const details::home_dir& home : homes_to_create )
+  {
+    details::create_home( home, root_dir_ + SKEL_DIR, home_mode );
+  }
+}
+
+}// user
+
+}// sys
+
+}// utils
@@ -3,16 +3,26 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <pwd.h>
-#include <grp.h>
+#include <sys/xattr.h>
+#include <fts.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <algorithm>
 
 #include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
 #include <boost/iterator/filter_iterator.hpp>
 
 #include "../sys_misc_methods.h"
 #include "../aux_methods.h"
+#include "../sys_error.h"
+#include "../sys_user_resolver.h"
 #include "execute_sys_command.h"
 
+#define ACL_XATTR_VERSION 2
+#define ACL_UNDEFINED_ID static_cast< uint32_t >( -1 )
+
 namespace utils
 {
 
@@ -107,27 +117,219 @@ void apply_action( const std::string& target,
   }
 }
 
-}// details
+// Names of the xattrs the kernel keeps ACLs in
+const char* acl_xattr_name( acl_type type ) noexcept
+{
+  return type == acl_type::access? "system.posix_acl_access" : "system.posix_acl_default";
+}
 
-void chmod( const std::string& target, int rights,
-            target_type type,
-            const recursive& is_recursive )
+void append_le( std::string& value, uint32_t number, size_t bytes )
 {
-  if( rights < 00 || rights > 0777 )
+  for( size_t i{ 0 }; i < bytes; ++i )
   {
-    throw std::invalid_argument{ "Invalid rights" };
+    value.push_back( static_cast< char >( ( number >> ( 8 * i ) ) & 0xff ) );
   }
+}
 
-  details::func_type chmod_func =
-  [ rights ]( const boost::filesystem::path& target )
+uint32_t read_le( const std::string& value, size_t pos, size_t bytes ) noexcept
+{
+  uint32_t number{ 0 };
+  for( size_t i{ 0 }; i < bytes; ++i )
   {
-    if( ::chmod( target.string().c_str(), rights ) != 0 )
+    number |= static_cast< uint32_t >( static_cast< unsigned char >( value[ pos + i ] ) ) << ( 8 * i );
+  }
+
+  return number;
+}
+
+// Same layout as posix_acl_xattr_header and posix_acl_xattr_entry of the kernel: little endian version,
+// then tag, perms and id of each entry sorted by tag and id
+std::string encode_acl( std::vector< acl_entry > acl )
+{
+  int required{ 0 };
+  int group_class_perms{ 0 };
+  bool named{ false };
+  bool has_mask{ false };
+  for( const acl_entry& entry : acl )
+  {
+    if( entry.perms < 0 || entry.perms > 07 )
     {
-      throw std::runtime_error{ std::string{ "Could not change permissions for file: " } + target.string() };
+      throw std::invalid_argument{ "Invalid ACL entry perms" };
     }
-  };
 
-  details::apply_action( target, chmod_func, type, is_recursive );
+    switch( entry.tag )
+    {
+    case acl_entry::user_obj:
+    case acl_entry::other: required += entry.tag; break;
+    case acl_entry::group_obj: required += entry.tag; group_class_perms |= entry.perms; break;
+    case acl_entry::named_user:
+    case acl_entry::named_group: named = true; group_class_perms |= entry.perms; break;
+    case acl_entry::mask: has_mask = true; break;
+    default: throw std::invalid_argument{ "Invalid ACL entry tag" };
+    }
+  }
+
+  if( required != acl_entry::user_obj + acl_entry::group_obj + acl_entry::other )
+  {
+    throw std::invalid_argument{ "ACL must have exactly one owner, group and other entry" };
+  }
+
+  // as setfacl does, the mask lets the named entries through
+  if( named && !has_mask )
+  {
+    acl.push_back( acl_entry{ acl_entry::mask, 0, group_class_perms } );
+  }
+
+  for( acl_entry& entry : acl )
+  {
+    if( entry.tag != acl_entry::named_user && entry.tag != acl_entry::named_group )
+    {
+      entry.id = ACL_UNDEFINED_ID;
+    }
+  }
+
+  std::sort( acl.begin(), acl.end(), []( const acl_entry& l, const acl_entry& r )
+  {
+    return l.tag != r.tag? l.tag < r.tag : l.id < r.id;
+  } );
+
+  std::string value;
+  append_le( value, ACL_XATTR_VERSION, 4 );
+  for( size_t i{ 0 }; i < acl.size(); ++i )
+  {
+    if( i && acl[ i ].tag == acl[ i - 1 ].tag && acl[ i ].id == acl[ i - 1 ].id )
+    {
+      throw std::invalid_argument{ "Duplicate ACL entry" };
+    }
+
+    append_le( value, acl[ i ].tag, 2 );
+    append_le( value, static_cast< uint32_t >( acl[ i ].perms ), 2 );
+    append_le( value, acl[ i ].id, 4 );
+  }
+
+  return value;
+}
+
+std::vector< acl_entry > decode_acl( const std::string& value )
+{
+  if( value.size() < 4 || ( value.size() - 4 ) % 8 || read_le( value, 0, 4 ) != ACL_XATTR_VERSION )
+  {
+    throw std::runtime_error{ "Unsupported ACL format" };
+  }
+
+  std::vector< acl_entry > acl;
+  for( size_t pos{ 4 }; pos < value.size(); pos += 8 )
+  {
+    acl_entry entry;
+    entry.tag = static_cast< acl_entry::tag_type >( read_le( value, pos, 2 ) );
+    entry.perms = static_cast< int >( read_le( value, pos + 2, 2 ) );
+    entry.id = read_le( value, pos + 4, 4 );
+    acl.push_back( entry );
+  }
+
+  return acl;
+}
+
+// The rwx bits of the mode follow an access ACL, the mask stands for the group bits if there is one.
+// A minimal ACL of the owner, group and other entries only is not stored, the kernel just sets the mode
+bool acl_mode_bits( const std::string& value, mode_t& bits, bool& minimal )
+{
+  std::vector< acl_entry > acl;
+  try
+  {
+    acl = decode_acl( value );
+  }
+  catch( const std::runtime_error& )
+  {
+    return false;
+  }
+
+  mode_t user_bits{ 0 };
+  mode_t group_bits{ 0 };
+  mode_t other_bits{ 0 };
+  bool has_mask{ false };
+  minimal = true;
+  for( const acl_entry& entry : acl )
+  {
+    mode_t perms{ static_cast< mode_t >( entry.perms & 07 ) };
+    switch( entry.tag )
+    {
+    case acl_entry::user_obj: user_bits = perms; break;
+    case acl_entry::group_obj: group_bits = has_mask? group_bits : perms; break;
+    case acl_entry::mask: group_bits = perms; has_mask = true; minimal = false; break;
+    case acl_entry::other: other_bits = perms; break;
+    default: minimal = false; break;
+    }
+  }
+
+  bits = ( user_bits << 6 ) | ( group_bits << 3 ) | other_bits;
+  return true;
+}
+
+int parse_acl_perms( const std::string& perms )
+{
+  int bits{ 0 };
+  for( char c : perms )
+  {
+    switch( c )
+    {
+    case 'r': bits |= 04; break;
+    case 'w': bits |= 02; break;
+    case 'x': bits |= 01; break;
+    case '-': break;
+    default: throw std::invalid_argument{ "Invalid ACL perms: " + perms };
+    }
+  }
+
+  return bits;
+}
+
+// the numeric qualifier is all digits already
+unsigned int parse_acl_id( const std::string& qualifier )
+{
+  errno = 0;
+  unsigned long id{ std::strtoul( qualifier.c_str(), nullptr, 10 ) };
+  if( errno == ERANGE || id >= ACL_UNDEFINED_ID )
+  {
+    throw std::invalid_argument{ "Invalid ACL id: " + qualifier };
+  }
+
+  return static_cast< unsigned int >( id );
+}
+
+bool get_xattr( const std::string& path, const std::string& name, std::string& value, bool deref = true )
+{
+  auto func = deref? ::getxattr : ::lgetxattr;
+  for( ;; )
+  {
+    ssize_t size{ func( path.c_str(), name.c_str(), nullptr, 0 ) };
+    if( size >= 0 )
+    {
+      value.resize( static_cast< size_t >( size ) );
+      size = func( path.c_str(), name.c_str(), &value[ 0 ], value.size() );
+    }
+
+    if( size >= 0 )
+    {
+      value.resize( static_cast< size_t >( size ) );
+      return true;
+    }
+
+    // grown in between
+    if( errno != ERANGE )
+    {
+      return false;
+    }
+  }
+}
+
+}// details
+
+void chmod( const std::string& target, int rights,
+            target_type type,
+            const recursive& is_recursive )
+{
+  change_permissions( target, permission_changes{}.mode( rights ), type, is_recursive );
 }
 
 void chown( const std::string& target,
@@ -135,51 +337,498 @@ void chown( const std::string& target,
             target_type type,
             const recursive& is_recursive,
             const deref_symlinks& deref_sym_links)
+{
+  change_permissions( target, permission_changes{}.owner( user_group ), type, is_recursive, deref_sym_links );
+}
+
+std::vector< acl_entry > parse_acl( const std::string& text )
+{
+  std::vector< acl_entry > acl;
+
+  std::vector< std::string > entries;
+  boost::split( entries, text, boost::is_any_of( ", \t\n" ), boost::token_compress_on );
+  for( const std::string& entry_text : entries )
+  {
+    if( entry_text.empty() || entry_text[ 0 ] == '#' )
+    {
+      continue;
+    }
+
+    std::vector< std::string > fields;
+    boost::split( fields, entry_text, boost::is_any_of( ":" ) );
+    if( fields.size() == 2 )
+    {
+      // "o:r-x" and "m:rwx" without the empty qualifier
+      fields.insert( fields.begin() + 1, std::string{} );
+    }
+
+    if( fields.size() != 3 )
+    {
+      throw std::invalid_argument{ "Invalid ACL entry: " + entry_text };
+    }
+
+    const std::string& tag( fields[ 0 ] );
+    const std::string& qualifier( fields[ 1 ] );
+    bool numeric{ !qualifier.empty() && qualifier.find_first_not_of( "0123456789" ) == std::string::npos };
+
+    acl_entry entry;
+    entry.id = 0;
+    entry.perms = details::parse_acl_perms( fields[ 2 ] );
+    if( tag == "u" || tag == "user" )
+    {
+      entry.tag = qualifier.empty()? acl_entry::user_obj : acl_entry::named_user;
+      if( !qualifier.empty() )
+      {
+        auto user = numeric? nullptr : get_user_resolver().find_user( qualifier );
+        if( !numeric && !user )
+        {
+          throw std::invalid_argument{ "Invalid user" };
+        }
+
+        entry.id = numeric? details::parse_acl_id( qualifier ) : user->uid;
+      }
+    }
+    else if( tag == "g" || tag == "group" )
+    {
+      entry.tag = qualifier.empty()? acl_entry::group_obj : acl_entry::named_group;
+      if( !qualifier.empty() )
+      {
+        auto group = numeric? nullptr : get_user_resolver().find_group( qualifier );
+        if( !numeric && !group )
+        {
+          throw std::invalid_argument{ "Invalid group" };
+        }
+
+        entry.id = numeric? details::parse_acl_id( qualifier ) : group->gid;
+      }
+    }
+    else if( ( tag == "m" || tag == "mask" ) && qualifier.empty() )
+    {
+      entry.tag = acl_entry::mask;
+    }
+    else if( ( tag == "o" || tag == "other" ) && qualifier.empty() )
+    {
+      entry.tag = acl_entry::other;
+    }
+    else
+    {
+      throw std::invalid_argument{ "Invalid ACL entry: " + entry_text };
+    }
+
+    acl.push_back( entry );
+  }
+
+  return acl;
+}
+
+std::vector< acl_entry > get_acl( const std::string& path, acl_type type )
+{
+  if( path.empty() )
+  {
+    throw std::invalid_argument{ "Path is invalid" };
+  }
+
+  std::string value;
+  if( !details::get_xattr( path, details::acl_xattr_name( type ), value ) )
+  {
+    if( errno == ENODATA || errno == ENOTSUP )
+    {
+      return std::vector< acl_entry >{};
+    }
+
+    throw std::runtime_error{ "Could not get ACL of " + path + ": " + error_message( errno ) };
+  }
+
+  return details::decode_acl( value );
+}
+
+permission_changes& permission_changes::mode( int rights )
+{
+  if( rights < 00 || rights > 07777 )
+  {
+    throw std::invalid_argument{ "Invalid rights" };
+  }
+
+  mode_ = rights;
+  return *this;
+}
+
+permission_changes& permission_changes::owner( const std::pair< std::string, std::string >& user_group )
 {
   if( user_group.first.empty() && user_group.second.empty() )
   {
     throw std::invalid_argument{ "User and group can't be empty simultaneously" };
   }
 
-  int uid{ -1 };
-  int gid{ -1 };
-
   // user name
   if( !user_group.first.empty() )
   {
-    passwd* user_info{ getpwnam( user_group.first.c_str() ) };
-    if( !user_info )
+    auto user = get_user_resolver().find_user( user_group.first );
+    if( !user )
     {
       throw std::invalid_argument{ "Invalid user" };
     }
 
-    uid = user_info->pw_uid;
+    uid_ = user->uid;
   }
 
   // group
   if( !user_group.second.empty() )
   {
-    group* group_info{ getgrnam( user_group.second.c_str() ) };
-    if( !group_info )
+    auto group = get_user_resolver().find_group( user_group.second );
+    if( !group )
     {
       throw std::invalid_argument{ "Invalid group" };
     }
 
-    gid = group_info->gr_gid;
+    gid_ = group->gid;
   }
 
-  auto func = deref_sym_links == deref_symlinks::yes? ::lchown : ::chown;
+  return *this;
+}
+
+permission_changes& permission_changes::set_acl( const std::vector< acl_entry >& acl, acl_type type )
+{
+  return set_xattr( details::acl_xattr_name( type ), details::encode_acl( acl ) );
+}
+
+permission_changes& permission_changes::remove_acl( acl_type type )
+{
+  return remove_xattr( details::acl_xattr_name( type ) );
+}
+
+permission_changes& permission_changes::set_xattr( const std::string& name, const std::string& value )
+{
+  if( name.empty() )
+  {
+    throw std::invalid_argument{ "Invalid xattr name" };
+  }
+
+  xattrs_.push_back( xattr_change{ name, value, false } );
+  return *this;
+}
+
+permission_changes& permission_changes::remove_xattr( const std::string& name )
+{
+  if( name.empty() )
+  {
+    throw std::invalid_argument{ "Invalid xattr name" };
+  }
+
+  xattrs_.push_back( xattr_change{ name, std::string{}, true } );
+  return *this;
+}
 
-  details::func_type chown_func =
-  [ gid, uid, func ]( const boost::filesystem::path& target )
+permission_changes& permission_changes::copy_from( const std::string& source )
+{
+  if( source.empty() )
+  {
+    throw std::invalid_argument{ "Source is invalid" };
+  }
+
+  std::string names;
+  ssize_t size{ listxattr( source.c_str(), nullptr, 0 ) };
+  if( size > 0 )
+  {
+    names.resize( static_cast< size_t >( size ) );
+    size = listxattr( source.c_str(), &names[ 0 ], names.size() );
+  }
+
+  if( size < 0 )
+  {
+    throw std::runtime_error{ "Could not list xattrs of " + source + ": " + error_message( errno ) };
+  }
+
+  names.resize( static_cast< size_t >( size ) );
+  for( size_t pos{ 0 }; pos < names.size(); pos = names.find( '\0', pos ) + 1 )
   {
-    if( func( target.string().c_str(), uid, gid ) != 0 )
+    std::string name{ names.c_str() + pos };
+    std::string value;
+    if( !details::get_xattr( source, name, value ) )
     {
-      throw std::runtime_error{ std::string{ "Could not change ownership for file: " } + target.string() };
+      // removed meanwhile
+      if( errno == ENODATA )
+      {
+        continue;
+      }
+
+      throw std::runtime_error{ "Could not get xattr " + name + " of " + source + ": " + error_message( errno ) };
+    }
+
+    set_xattr( name, value );
+  }
+
+  return *this;
+}
+
+bool permission_changes::empty() const noexcept
+{
+  return mode_ == -1 && uid_ == -1 && gid_ == -1 && xattrs_.empty();
+}
+
+void change_permissions( const std::string& target,
+                         const permission_changes& changes,
+                         target_type type,
+                         const recursive& is_recursive,
+                         const deref_symlinks& deref_sym_links )
+{
+  bool deref{ deref_sym_links == deref_symlinks::yes };
+  auto chown_func = deref? ::chown : ::lchown;
+  auto setxattr_func = deref? ::setxattr : ::lsetxattr;
+  auto removexattr_func = deref? ::removexattr : ::lremovexattr;
+
+  details::func_type func =
+  [ &changes, deref, chown_func, setxattr_func, removexattr_func ]( const boost::filesystem::path& target )
+  {
+    std::string path{ target.string() };
+    if( ( changes.uid_ != -1 || changes.gid_ != -1 ) && chown_func( path.c_str(), changes.uid_, changes.gid_ ) != 0 )
+    {
+      throw std::runtime_error{ std::string{ "Could not change ownership for file: " } + path };
+    }
+
+    if( changes.mode_ != -1 && ::chmod( path.c_str(), changes.mode_ ) != 0 )
+    {
+      throw std::runtime_error{ std::string{ "Could not change permissions for file: " } + path };
+    }
+
+    int is_dir{ -1 }; // checked for default ACLs only
+    for( const permission_changes::xattr_change& xattr : changes.xattrs_ )
+    {
+      if( xattr.name == details::acl_xattr_name( acl_type::default_acl ) )
+      {
+        if( is_dir == -1 )
+        {
+          is_dir = boost::filesystem::is_directory( deref? boost::filesystem::status( target ) : boost::filesystem::symlink_status( target ) );
+        }
+
+        if( !is_dir )
+        {
+          continue;
+        }
+      }
+
+      bool ok{ xattr.remove? removexattr_func( path.c_str(), xattr.name.c_str() ) == 0 || errno == ENODATA :
+                             setxattr_func( path.c_str(), xattr.name.c_str(), xattr.value.data(), xattr.value.size(), 0 ) == 0 };
+      if( !ok )
+      {
+        throw std::runtime_error{ "Could not change xattr " + xattr.name + " for file: " + path + ": " + error_message( errno ) };
+      }
     }
   };
 
-  details::apply_action( target, chown_func, type, is_recursive );
+  details::apply_action( target, func, type, is_recursive );
+}
+
+bool permission_changes::differs( const std::string& path, const struct stat& info, const struct stat* target_info,
+                                  bool deref, permission_change& change ) const
+{
+  // chmod always follows symlinks, chown only if asked to
+  const struct stat& owner_info( deref && target_info? *target_info : info );
+  const struct stat& mode_info( target_info? *target_info : info );
+
+  change.path = path;
+  change.uid = owner_info.st_uid;
+  change.gid = owner_info.st_gid;
+  change.mode = mode_info.st_mode & 07777;
+  change.change_owner = ( uid_ != -1 && static_cast< uid_t >( uid_ ) != owner_info.st_uid ) ||
+                        ( gid_ != -1 && static_cast< gid_t >( gid_ ) != owner_info.st_gid );
+
+  // the access ACL set after chmod rewrites the rwx bits of the mode, so those are what the mode ends up with
+  std::string access_name{ details::acl_xattr_name( acl_type::access ) };
+  const xattr_change* access_acl{ nullptr };
+  for( const xattr_change& xattr : xattrs_ )
+  {
+    if( xattr.name == access_name )
+    {
+      access_acl = xattr.remove? nullptr : &xattr;
+    }
+  }
+
+  mode_t acl_bits{ 0 };
+  bool minimal_acl{ false };
+  bool has_acl_bits{ access_acl && details::acl_mode_bits( access_acl->value, acl_bits, minimal_acl ) };
+  mode_t wanted_mode{ static_cast< mode_t >( mode_ ) };
+  if( has_acl_bits )
+  {
+    wanted_mode = ( wanted_mode & ~0777 ) | acl_bits;
+  }
+
+  // chown drops setuid and setgid, so they have to be set again
+  change.change_mode = mode_ != -1 && ( wanted_mode != change.mode || ( change.change_owner && ( mode_ & 06000 ) ) );
+  change.xattrs.clear();
+
+  bool is_dir{ S_ISDIR( deref && target_info? target_info->st_mode : info.st_mode ) };
+  for( const xattr_change& xattr : xattrs_ )
+  {
+    if( xattr.name == details::acl_xattr_name( acl_type::default_acl ) && !is_dir )
+    {
+      continue;
+    }
+
+    std::string value;
+    bool exists{ details::get_xattr( path, xattr.name, value, deref ) };
+    bool differ{ xattr.remove? exists : !exists || value != xattr.value };
+
+    // a minimal ACL is there if the mode matches it, and chmod rewrites the mask, so the ACL has to follow it
+    if( &xattr == access_acl && has_acl_bits )
+    {
+      differ = change.change_mode || ( minimal_acl && !exists? ( change.mode & 0777 ) != acl_bits : differ );
+    }
+
+    if( differ && std::find( change.xattrs.begin(), change.xattrs.end(), xattr.name ) == change.xattrs.end() )
+    {
+      change.xattrs.push_back( xattr.name );
+    }
+  }
+
+  return change.change_owner || change.change_mode || !change.xattrs.empty();
+}
+
+std::error_code permission_changes::apply( const permission_change& change, bool deref ) const
+{
+  const char* path{ change.path.c_str() };
+  if( change.change_owner && ( deref? ::chown : ::lchown )( path, uid_, gid_ ) != 0 )
+  {
+    return errno_code();
+  }
+
+  if( change.change_mode && ::chmod( path, mode_ ) != 0 )
+  {
+    return errno_code();
+  }
+
+  for( const xattr_change& xattr : xattrs_ )
+  {
+    if( std::find( change.xattrs.begin(), change.xattrs.end(), xattr.name ) == change.xattrs.end() )
+    {
+      continue;
+    }
+
+    bool ok{ xattr.remove? ( deref? ::removexattr : ::lremovexattr )( path, xattr.name.c_str() ) == 0 || errno == ENODATA :
+                           ( deref? ::setxattr : ::lsetxattr )( path, xattr.name.c_str(), xattr.value.data(), xattr.value.size(), 0 ) == 0 };
+    if( !ok )
+    {
+      return errno_code();
+    }
+  }
+
+  return std::error_code{};
+}
+
+change_set update_permissions( const std::string& target,
+                               const permission_changes& changes,
+                               target_type type,
+                               const recursive& is_recursive,
+                               const deref_symlinks& deref_sym_links,
+                               const dry_run& is_dry_run )
+{
+  if( target.empty() )
+  {
+    throw std::invalid_argument{ "Target is invalid" };
+  }
+
+  if( type != dir && type != file && type != symlink && type != all )
+  {
+    throw std::invalid_argument{ "Invalid type of targets" };
+  }
+
+  bool deref{ deref_sym_links == deref_symlinks::yes };
+  change_set result;
+
+  // fts hands out the lstat data it has read anyway, no chdir keeps it thread safe
+  char* paths[]{ const_cast< char* >( target.c_str() ), nullptr };
+  FTS* tree{ fts_open( paths, FTS_PHYSICAL | FTS_NOCHDIR | ( deref? FTS_COMFOLLOW : 0 ), nullptr ) };
+  if( !tree )
+  {
+    throw std::runtime_error{ "Could not traverse " + target + ": " + error_message( errno ) };
+  }
+
+  for( ;; )
+  {
+    // the end and a failure look the same but for errno
+    errno = 0;
+    FTSENT* entry{ fts_read( tree ) };
+    if( !entry )
+    {
+      break;
+    }
+
+    if( entry->fts_info == FTS_DP )
+    {
+      continue;
+    }
+
+    if( entry->fts_info == FTS_DNR || entry->fts_info == FTS_ERR || entry->fts_info == FTS_NS )
+    {
+      result.failures.push_back( permission_failure{ entry->fts_path, errno_code( entry->fts_errno ) } );
+      continue;
+    }
+
+    if( entry->fts_info == FTS_D && entry->fts_level == FTS_ROOTLEVEL && is_recursive == recursive::no )
+    {
+      fts_set( tree, entry, FTS_SKIP );
+    }
+
+    // symlinks are matched by their targets too, like apply_action does
+    struct stat target_info;
+    bool is_link{ S_ISLNK( entry->fts_statp->st_mode ) };
+    bool has_target{ is_link && stat( entry->fts_accpath, &target_info ) == 0 };
+    const struct stat& type_info( has_target? target_info : *entry->fts_statp );
+
+    if( type != all && !( ( ( type & dir ) && S_ISDIR( type_info.st_mode ) ) ||
+                          ( ( type & file ) && S_ISREG( type_info.st_mode ) ) ||
+                          ( ( type & symlink ) && is_link ) ) )
+    {
+      continue;
+    }
+
+    ++result.checked;
+    if( is_link && !has_target && ( deref || changes.mode_ != -1 ) )
+    {
+      result.failures.push_back( permission_failure{ entry->fts_path, std::make_error_code( std::errc::no_such_file_or_directory ) } );
+      continue;
+    }
+
+    permission_change change;
+    if( !changes.differs( entry->fts_path, *entry->fts_statp, has_target? &target_info : nullptr, deref, change ) )
+    {
+      continue;
+    }
+
+    std::error_code ec;
+    if( is_dry_run == dry_run::no )
+    {
+      ec = changes.apply( change, deref );
+    }
+
+    if( ec )
+    {
+      result.failures.push_back( permission_failure{ change.path, ec } );
+    }
+
+    result.changes.push_back( std::move( change ) );
+  }
+
+  int error{ errno };
+  fts_close( tree );
+  if( error )
+  {
+    result.failures.push_back( permission_failure{ target, errno_code( error ) } );
+  }
+
+  return result;
+}
+
+void apply_changes( change_set& plan, const permission_changes& changes, const deref_symlinks& deref_sym_links )
+{
+  for( const permission_change& change : plan.changes )
+  {
+    std::error_code ec{ changes.apply( change, deref_sym_links == deref_symlinks::yes ) };
+    if( ec )
+    {
+      plan.failures.push_back( permission_failure{ change.path, ec } );
+    }
+  }
 }
 
 }// user
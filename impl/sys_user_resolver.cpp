@@ -0,0 +1,299 @@
+#include "../sys_user_resolver.h"
+
+#include <pwd.h>
+#include <grp.h>
+#include <cerrno>
+#include <unistd.h>
+#include <functional>
+#include <stdexcept>
+#include <sys/stat.h>
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace user
+{
+
+namespace details
+{
+
+// Lookup with buffer growing on ERANGE. Returns false on errors, which must not be cached
+template< class T, class Entry >
+bool call_reentrant( int size_name,
+                     const std::function< int( Entry*, char*, size_t, Entry** ) >& call,
+                     const std::function< std::shared_ptr< const T >( const Entry& ) >& convert,
+                     std::shared_ptr< const T >& result )
+{
+  long initial_size{ sysconf( size_name ) };
+  std::vector< char > buf( initial_size > 0? initial_size : 16384 );
+
+  for( ;; )
+  {
+    Entry entry;
+    Entry* found{ nullptr };
+    int error{ call( &entry, buf.data(), buf.size(), &found ) };
+    if( error == ERANGE && buf.size() < ( 1u << 24 ) )
+    {
+      buf.resize( buf.size() * 2 );
+      continue;
+    }
+
+    // the ones listed in getpwnam(3) as "not found"
+    if( error == 0 || error == ENOENT || error == ESRCH || error == EBADF || error == EPERM )
+    {
+      result = found? convert( *found ) : nullptr;
+      return true;
+    }
+
+    return false;
+  }
+}
+
+std::shared_ptr< const user_info > make_user_info( const passwd& pwd )
+{
+  auto info = std::make_shared< user_info >();
+  info->name = pwd.pw_name;
+  info->uid = pwd.pw_uid;
+  info->gid = pwd.pw_gid;
+  info->home = pwd.pw_dir? pwd.pw_dir : "";
+  info->shell = pwd.pw_shell? pwd.pw_shell : "";
+  return info;
+}
+
+std::shared_ptr< const group_info > make_group_info( const group& grp )
+{
+  auto info = std::make_shared< group_info >();
+  info->name = grp.gr_name;
+  info->gid = grp.gr_gid;
+  for( char** member{ grp.gr_mem }; member && *member; ++member )
+  {
+    info->members.emplace_back( *member );
+  }
+
+  return info;
+}
+
+uid_t id_of( const user_info& info ) noexcept
+{
+  return info.uid;
+}
+
+gid_t id_of( const group_info& info ) noexcept
+{
+  return info.gid;
+}
+
+bool stamp_changed( const char* path, ino_t& inode, time_t& mtime, long& mtime_ns, off_t& size )
+{
+  struct stat info;
+  if( stat( path, &info ) != 0 )
+  {
+    info.st_ino = 0;
+    info.st_mtim.tv_sec = 0;
+    info.st_mtim.tv_nsec = 0;
+    info.st_size = 0;
+  }
+
+  bool changed{ info.st_ino != inode || info.st_mtim.tv_sec != mtime || info.st_mtim.tv_nsec != mtime_ns || info.st_size != size };
+  inode = info.st_ino;
+  mtime = info.st_mtim.tv_sec;
+  mtime_ns = info.st_mtim.tv_nsec;
+  size = info.st_size;
+  return changed;
+}
+
+}// details
+
+template< class T >
+bool user_resolver::cache< T >::get( const std::string& key, std::chrono::steady_clock::time_point now,
+                                     std::shared_ptr< const T >& value )
+{
+  auto it = index_.find( key );
+  if( it == index_.end() )
+  {
+    return false;
+  }
+
+  if( it->second->expires <= now )
+  {
+    items_.erase( it->second );
+    index_.erase( it );
+    return false;
+  }
+
+  items_.splice( items_.begin(), items_, it->second );
+  value = it->second->value;
+  return true;
+}
+
+template< class T >
+void user_resolver::cache< T >::put( const std::string& key, const std::shared_ptr< const T >& value,
+                                     std::chrono::steady_clock::time_point expires )
+{
+  auto it = index_.find( key );
+  if( it != index_.end() )
+  {
+    it->second->value = value;
+    it->second->expires = expires;
+    items_.splice( items_.begin(), items_, it->second );
+    return;
+  }
+
+  item new_item;
+  new_item.key = key;
+  new_item.value = value;
+  new_item.expires = expires;
+  items_.push_front( new_item );
+  index_.emplace( key, items_.begin() );
+
+  if( items_.size() > capacity_ )
+  {
+    index_.erase( items_.back().key );
+    items_.pop_back();
+  }
+}
+
+template< class T >
+void user_resolver::cache< T >::clear()
+{
+  items_.clear();
+  index_.clear();
+  ++generation_;
+}
+
+user_resolver::user_resolver( size_t capacity, std::chrono::milliseconds ttl )
+  : ttl_( ttl ),
+    users_( capacity ),
+    groups_( capacity )
+{
+  if( !capacity )
+  {
+    throw std::invalid_argument{ "Cache capacity must be positive" };
+  }
+}
+
+// Files are checked at most once a second, a stat per lookup would cost as much as the lookup itself
+void user_resolver::check_files( std::chrono::steady_clock::time_point now )
+{
+  if( now - files_checked_ < std::chrono::seconds{ 1 } )
+  {
+    return;
+  }
+
+  files_checked_ = now;
+  if( details::stamp_changed( PASSWD_FILE, passwd_stamp_.inode, passwd_stamp_.mtime, passwd_stamp_.mtime_ns, passwd_stamp_.size ) )
+  {
+    users_.clear();
+  }
+
+  if( details::stamp_changed( GROUP_FILE, group_stamp_.inode, group_stamp_.mtime, group_stamp_.mtime_ns, group_stamp_.size ) )
+  {
+    groups_.clear();
+  }
+}
+
+template< class T, class Lookup >
+std::shared_ptr< const T > user_resolver::find( cache< T >& entries, const std::string& key, const Lookup& lookup )
+{
+  std::shared_ptr< const T > result;
+  uint64_t generation{ 0 };
+  {
+    std::lock_guard< std::mutex > lock{ mutex_ };
+
+    auto now = std::chrono::steady_clock::now();
+    check_files( now );
+    if( entries.get( key, now, result ) )
+    {
+      return result;
+    }
+
+    generation = entries.generation();
+  }
+
+  // NSS may be slow, other threads are not blocked meanwhile
+  if( !lookup( result ) )
+  {
+    return nullptr;
+  }
+
+  std::lock_guard< std::mutex > lock{ mutex_ };
+
+  // the cache was cleared meanwhile, the result may be older than that
+  if( entries.generation() != generation )
+  {
+    return result;
+  }
+
+  auto expires = std::chrono::steady_clock::now() + ttl_;
+  entries.put( key, result, expires );
+  if( result )
+  {
+    // found by name is found by id as well and the other way round
+    entries.put( "n" + result->name, result, expires );
+    entries.put( "i" + std::to_string( details::id_of( *result ) ), result, expires );
+  }
+
+  return result;
+}
+
+std::shared_ptr< const user_info > user_resolver::find_user( const std::string& name )
+{
+  return find( users_, "n" + name, [ & ]( std::shared_ptr< const user_info >& result )
+  {
+    return details::call_reentrant< user_info, passwd >( _SC_GETPW_R_SIZE_MAX,
+      [ & ]( passwd* pwd, char* buf, size_t size, passwd** found ){ return getpwnam_r( name.c_str(), pwd, buf, size, found ); },
+      details::make_user_info, result );
+  } );
+}
+
+std::shared_ptr< const user_info > user_resolver::find_user( uid_t uid )
+{
+  return find( users_, "i" + std::to_string( uid ), [ & ]( std::shared_ptr< const user_info >& result )
+  {
+    return details::call_reentrant< user_info, passwd >( _SC_GETPW_R_SIZE_MAX,
+      [ & ]( passwd* pwd, char* buf, size_t size, passwd** found ){ return getpwuid_r( uid, pwd, buf, size, found ); },
+      details::make_user_info, result );
+  } );
+}
+
+std::shared_ptr< const group_info > user_resolver::find_group( const std::string& name )
+{
+  return find( groups_, "n" + name, [ & ]( std::shared_ptr< const group_info >& result )
+  {
+    return details::call_reentrant< group_info, group >( _SC_GETGR_R_SIZE_MAX,
+      [ & ]( group* grp, char* buf, size_t size, group** found ){ return getgrnam_r( name.c_str(), grp, buf, size, found ); },
+      details::make_group_info, result );
+  } );
+}
+
+std::shared_ptr< const group_info > user_resolver::find_group( gid_t gid )
+{
+  return find( groups_, "i" + std::to_string( gid ), [ & ]( std::shared_ptr< const group_info >& result )
+  {
+    return details::call_reentrant< group_info, group >( _SC_GETGR_R_SIZE_MAX,
+      [ & ]( group* grp, char* buf, size_t size, group** found ){ return getgrgid_r( gid, grp, buf, size, found ); },
+      details::make_group_info, result );
+  } );
+}
+
+void user_resolver::clear()
+{
+  std::lock_guard< std::mutex > lock{ mutex_ };
+  users_.clear();
+  groups_.clear();
+}
+
+user_resolver& get_user_resolver()
+{
+  static user_resolver resolver;
+  return resolver;
+}
+
+}// user
+
+}// sys
+
+}// utils
@@ -0,0 +1,81 @@
+#ifndef __SYS_CPU_TOPOLOGY_H__
+#define __SYS_CPU_TOPOLOGY_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#define SYS_CPU_DIR "/sys/devices/system/cpu"
+#define SYS_NODE_DIR "/sys/devices/system/node"
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace cpu
+{
+
+struct cache_info
+{
+  unsigned int level{ 0 };
+  std::string type;                       // Data, Instruction or Unified
+  size_t size{ 0 };                       // bytes
+  size_t line_size{ 0 };
+  std::vector< unsigned int > shared_cpus;
+};
+
+struct cpu_info
+{
+  unsigned int id{ 0 };
+  unsigned int core_id{ 0 };
+  unsigned int package_id{ 0 };
+  int node{ -1 };                         // -1 without NUMA
+  std::vector< unsigned int > siblings;   // SMT threads of the same core, this one included
+  std::vector< cache_info > caches;
+  unsigned long min_frequency{ 0 };       // kHz, 0 if unknown
+  unsigned long max_frequency{ 0 };
+};
+
+struct numa_node
+{
+  unsigned int id{ 0 };
+  std::vector< unsigned int > cpus;
+  size_t memory{ 0 };                     // bytes
+};
+
+struct topology
+{
+  std::vector< cpu_info > cpus;           // online ones
+  std::vector< numa_node > nodes;
+  std::vector< unsigned int > affinity;   // of the process when read
+  double quota{ 0.0 };                    // cgroup CPU quota in CPUs, 0 if there's none
+  unsigned int cores{ 0 };                // physical ones
+  unsigned int packages{ 0 };
+
+  /// \brief Number of threads worth running: CPUs of the affinity mask, limited by the quota rounded up
+  unsigned int effective_concurrency() const noexcept;
+
+  /// \brief nullptr if cpu is not online
+  const cpu_info* find( unsigned int cpu ) const noexcept;
+};
+
+/// \brief Read from sysfs, procfs and the cgroup of the process on the first call and cached,
+/// reload reads it again, e.g. after CPU hotplug or moving to other cgroup
+std::shared_ptr< const topology > get_topology( bool reload = false );
+
+/// \brief Current frequency of cpu in kHz, 0 if unknown. Not cached
+unsigned long current_frequency( unsigned int cpu );
+
+/// \brief Parses the sysfs cpu lists like "0-3,8,10-11"
+std::vector< unsigned int > parse_cpu_list( const std::string& list );
+
+}
+
+}
+
+}
+
+
+#endif
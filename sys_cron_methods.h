@@ -2,6 +2,12 @@
 #define __SYS_CRON_METHODS_H__
 
 #include <string>
+#include <vector>
+
+#define CRON_SPOOL_DIR "/var/spool/cron/crontabs" // Debian
+#define CRON_SPOOL_DIR_ALT "/var/spool/cron"      // Red Hat
+#define CRON_DROPIN_DIR "/etc/cron.d"
+#define CRON_TAG_PREFIX "# tag: "
 
 namespace utils
 {
@@ -12,12 +18,73 @@ namespace sys
 namespace cron
 {
 
-/// \brief Add cron script for the user
+/// \brief Add cron script for the user, replacing the user's whole table
 void add_cron_script( const std::string& user, const std::string& script_path );
 
 /// \brief Remove all cron scripts for the user
 void remove_all_cron_scripts( const std::string& user );
 
+struct cron_entry
+{
+  std::string tag;      // set on the line above the entry as "# tag: <tag>", empty for entries not added by tag
+  std::string schedule; // five fields or a nickname like @daily
+  std::string user;     // system tables only
+  std::string command;
+};
+
+/// \brief Parsed crontab. Comments, variables and lines not managed by tag are kept as they are.
+/// Tables of other users are read and written in the spool directly, which needs root;
+/// otherwise the own table is handled with crontab(1)
+class crontab
+{
+public:
+  /// \brief Table without location, it can't be saved
+  static crontab parse( const std::string& content, bool system = false );
+
+  /// \brief Empty table if the user has none
+  static crontab load_user( const std::string& user );
+
+  /// \brief Drop-in in /etc/cron.d, name may contain letters, digits, '_' and '-' only
+  static crontab load_dropin( const std::string& name );
+
+  /// \brief Any table file, e.g. of a chroot or a test
+  static crontab load_file( const std::string& path, bool system = false );
+
+  std::vector< cron_entry > entries() const;
+
+  /// \brief nullptr if no entry has the tag
+  const cron_entry* find( const std::string& tag ) const;
+
+  /// \brief Add the entry or replace the one with the same tag. Returns false if it was the same already
+  bool set( const cron_entry& entry );
+
+  /// \brief Returns false if no entry has the tag
+  bool remove( const std::string& tag );
+
+  std::string to_string() const;
+
+  /// \brief Write the table back atomically, an empty table removes it.
+  /// Returns false without writing if the content is unchanged
+  bool save();
+
+private:
+  struct line
+  {
+    std::string text;
+    bool is_entry{ false };
+    cron_entry entry;
+  };
+
+  crontab() = default;
+
+  void parse_content( const std::string& content );
+
+  std::vector< line > lines_;
+  bool system_{ false };
+  std::string user_; // user table
+  std::string path_; // table file
+};
+
 }
 
 }
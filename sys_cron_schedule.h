@@ -0,0 +1,104 @@
+#ifndef __SYS_CRON_SCHEDULE_H__
+#define __SYS_CRON_SCHEDULE_H__
+
+#include <chrono>
+#include <bitset>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+
+#define CRON_WHEEL_SLOTS 3600
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace time
+{
+
+class time_zone;
+
+}
+
+namespace cron
+{
+
+/// \brief Cron expression parsed once into bitsets: five fields as in crontab(5), six fields with
+/// seconds first, or a nickname like @daily. Names of months and weekdays, ranges, lists and steps are
+/// supported; if both day of month and day of week are restricted either of them matches, as in cron.
+/// Times skipped by a DST change fire at the change, times repeated by it fire once unless every hour matches
+class cron_expression
+{
+public:
+  /// \brief Empty time_zone means system local time, otherwise a zoneinfo name, e.g. "UTC" or "Europe/London".
+  /// Throws std::invalid_argument if the expression is invalid or never fires, e.g. on February 30th
+  explicit cron_expression( const std::string& expression, const std::string& time_zone = "" );
+
+  /// \brief First fire time strictly after the time point, time_point::max() if there's none
+  std::chrono::system_clock::time_point next( const std::chrono::system_clock::time_point& after ) const;
+
+  /// \brief Next count fire times
+  std::vector< std::chrono::system_clock::time_point > next( const std::chrono::system_clock::time_point& after,
+                                                             size_t count ) const;
+
+  const std::string& expression() const noexcept;
+
+private:
+  bool day_matches( int day, int weekday ) const noexcept;
+  int32_t offset_at( int64_t unix_time ) const;
+  int64_t next_local( int64_t local ) const;
+  int64_t transition_between( int64_t from, int64_t to, int32_t offset ) const;
+
+  std::string expression_;
+  std::shared_ptr< const time::time_zone > zone_;
+  bool utc_{ false };
+
+  std::bitset< 60 > seconds_;
+  std::bitset< 60 > minutes_;
+  std::bitset< 24 > hours_;
+  std::bitset< 32 > days_;     // 1 - 31
+  std::bitset< 13 > months_;   // 1 - 12
+  std::bitset< 7 > weekdays_;  // 0 is Sunday
+  bool any_day_{ true };
+  bool any_weekday_{ true };
+};
+
+/// \brief Runs jobs by cron expressions from a single thread. Jobs are kept in a hashed timing wheel
+/// with one second slots, so a tick only touches the jobs due in that second's slot, whatever their number.
+/// Jobs are called from the scheduler thread and should hand long work elsewhere; they may add or remove jobs
+class scheduler
+{
+public:
+  using job = std::function< void() >;
+
+  scheduler();
+  ~scheduler();
+
+  scheduler( const scheduler& ) = delete;
+  scheduler& operator=( const scheduler& ) = delete;
+
+  /// \brief Returns id of the job
+  size_t add( const cron_expression& expression, const job& task );
+  void remove( size_t id );
+  size_t size() const;
+
+  void start();
+  void stop();
+  bool running() const noexcept;
+
+private:
+  struct impl;
+  std::unique_ptr< impl > impl_;
+};
+
+}
+
+}
+
+}
+
+
+#endif
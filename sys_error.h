@@ -0,0 +1,51 @@
+#ifndef __SYS_ERROR_H__
+#define __SYS_ERROR_H__
+
+#include <cerrno>
+#include <string>
+#include <system_error>
+
+namespace utils
+{
+
+namespace sys
+{
+
+/// \brief Errors of the library that have no errno value
+enum class errc
+{
+  invalid_argument = 1,
+  not_found,
+  invalid_format,
+  not_supported
+};
+
+/// \brief Category of errc, named "utils.sys"
+const std::error_category& error_category() noexcept;
+
+std::error_code make_error_code( errc error ) noexcept;
+
+/// \brief errno value as an error code of the system category
+std::error_code errno_code( int error = errno ) noexcept;
+
+/// \brief Thread safe strerror
+std::string error_message( int error );
+
+/// \brief Throws std::invalid_argument for errc::invalid_argument, std::system_error otherwise.
+/// The message is "context: error message"
+[[ noreturn ]] void throw_error( const std::error_code& error, const std::string& context );
+
+}
+
+}
+
+namespace std
+{
+
+template<>
+struct is_error_code_enum< utils::sys::errc > : true_type {};
+
+}
+
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef __SYS_GPIO_CHIP_H__
+#define __SYS_GPIO_CHIP_H__
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "sys_gpio_methods.h"
+
+#define GPIO_DEV_DIR "/dev"
+#define GPIO_DEF_CONSUMER "linux_sys_utils"
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace gpio
+{
+
+enum class gpio_bias{ as_is, disabled, pull_up, pull_down };
+enum class gpio_drive{ push_pull, open_drain, open_source };
+
+struct chip_info
+{
+  std::string name;
+  std::string label;
+  uint32_t lines{ 0 };
+};
+
+struct line_info
+{
+  uint32_t offset{ 0 };
+  std::string name;
+  std::string consumer;
+  gpio_direction direction{ gpio_direction::in };
+  gpio_edge edge{ gpio_edge::none };
+  gpio_bias bias{ gpio_bias::as_is };
+  gpio_drive drive{ gpio_drive::push_pull };
+  bool used{ false };
+  bool active_low{ false };
+};
+
+/// \brief Settings applied to every line of a request
+struct line_config
+{
+  gpio_direction direction{ gpio_direction::in };
+  gpio_edge edge{ gpio_edge::none };            // inputs only
+  gpio_bias bias{ gpio_bias::as_is };
+  gpio_drive drive{ gpio_drive::push_pull };    // outputs only
+  bool active_low{ false };
+  std::chrono::microseconds debounce{ 0 };      // inputs only, 0 to disable
+  bool realtime_timestamps{ false };            // event timestamps from CLOCK_REALTIME instead of CLOCK_MONOTONIC
+};
+
+struct line_event
+{
+  uint32_t offset{ 0 };
+  gpio_edge edge{ gpio_edge::rising };          // rising or falling
+  std::chrono::nanoseconds timestamp{ 0 };      // kernel timestamp, clock depends on line_config::realtime_timestamps
+  uint32_t seqno{ 0 };                          // sequence number among all lines of the request
+  uint32_t line_seqno{ 0 };                     // sequence number of this line
+};
+
+/// \brief Lines held by a GPIO_V2_GET_LINE_IOCTL request. Lines are released on destruction
+class line_request
+{
+public:
+  line_request( line_request&& other ) noexcept;
+  line_request& operator=( line_request&& other ) noexcept;
+  ~line_request();
+
+  line_request( const line_request& ) = delete;
+  line_request& operator=( const line_request& ) = delete;
+
+  const std::vector< uint32_t >& offsets() const noexcept;
+
+  /// \brief Request fd, readable when there are edge events
+  int fd() const noexcept;
+
+  /// \brief Values of all lines, in the order of offsets(), with one ioctl
+  std::vector< int8_t > get_values() const;
+  int8_t get_value( uint32_t offset ) const;
+
+  /// \brief Set all lines at once, values are in the order of offsets()
+  void set_values( const std::vector< int8_t >& values );
+
+  /// \brief Set some of the lines at once
+  void set_values( const std::vector< uint32_t >& offsets, const std::vector< int8_t >& values );
+  void set_value( uint32_t offset, int8_t value );
+
+  /// \brief Change config without releasing the lines. output_values are used if config is for outputs
+  void reconfigure( const line_config& config, const std::vector< int8_t >& output_values = {} );
+
+  /// \brief Wait for edge events. Returns false on timeout, negative timeout waits forever
+  bool wait_events( std::chrono::milliseconds timeout ) const;
+
+  /// \brief Read pending edge events, blocks if there are none
+  std::vector< line_event > read_events();
+
+private:
+  friend class chip;
+  line_request( int fd, const std::vector< uint32_t >& offsets );
+
+  uint64_t mask_of( const std::vector< uint32_t >& offsets ) const;
+
+  int fd_{ -1 };
+  std::vector< uint32_t > offsets_;
+};
+
+/// \brief GPIO character device ( /dev/gpiochipN )
+class chip
+{
+public:
+  /// \brief Either full path or device name, e.g. "gpiochip0"
+  explicit chip( const std::string& device );
+  chip( chip&& other ) noexcept;
+  chip& operator=( chip&& other ) noexcept;
+  ~chip();
+
+  chip( const chip& ) = delete;
+  chip& operator=( const chip& ) = delete;
+
+  /// \brief Paths of all gpio chips in the system
+  static std::vector< std::string > list();
+
+  const std::string& path() const noexcept;
+  chip_info info() const;
+  line_info get_line_info( uint32_t offset ) const;
+
+  /// \brief Offset of the line by its name, throws if not found
+  uint32_t find_line( const std::string& name ) const;
+
+  /// \brief Request lines, at most GPIO_V2_LINES_MAX. output_values are in the order of offsets
+  line_request request_lines( const std::vector< uint32_t >& offsets,
+                              const line_config& config,
+                              const std::vector< int8_t >& output_values = {},
+                              const std::string& consumer = GPIO_DEF_CONSUMER ) const;
+
+private:
+  std::string path_;
+  int fd_{ -1 };
+};
+
+}
+
+}
+
+}
+
+
+#endif
@@ -1,7 +1,12 @@
 #ifndef __SYS_GPIO_METHODS_H__
 #define __SYS_GPIO_METHODS_H__
 
+#include <chrono>
 #include <string>
+#include <vector>
+#include <utility>
+
+#define GPIO_SYSFS_DIR "/sys/class/gpio"
 
 namespace utils
 {
@@ -13,6 +18,20 @@ namespace gpio
 {
 
 enum class gpio_direction{ in, out };
+enum class gpio_edge{ none, rising, falling, both };
+
+/// \brief Timings of sysfs line export. After export the attribute files may stay unwritable
+/// until udev applies permissions, opening them is retried with exponential backoff until ready_timeout
+struct gpio_timing
+{
+  std::chrono::milliseconds ready_timeout{ 1000 };
+  std::chrono::milliseconds initial_backoff{ 1 };
+  std::chrono::milliseconds max_backoff{ 50 };
+};
+
+/// \brief Set export timings used by all the gpio functions
+void set_gpio_timing( const gpio_timing& timing );
+gpio_timing get_gpio_timing();
 
 /// \brief Enable gpio
 void enable_gpio_line( uint32_t line, const gpio_direction& direction );
@@ -29,12 +48,98 @@ gpio_direction get_gpio_line_direction( uint32_t line );
 /// \brief Check if line is enabled
 bool gpio_line_enabled( uint32_t line );
 
-/// \brief Set gpio line status
-void set_gpio_line_status( uint32_t line, int8_t status );
+/// \brief Set gpio line status. Sleeps for settle after the write if it's not zero
+void set_gpio_line_status( uint32_t line, int8_t status,
+                           std::chrono::milliseconds settle = std::chrono::milliseconds{ 0 } );
 
 /// \brief Get gpio line status
 int8_t get_gpio_line_status( uint32_t line );
 
+/// \brief Sysfs gpio line, exported for the lifetime of the object.
+/// Value file is kept open and the direction is cached, so reads and writes are one syscall each.
+/// The line is unexported on destruction only if it was exported by this object
+class line
+{
+public:
+  line( uint32_t number, gpio_direction direction );
+  line( line&& other ) noexcept;
+  line& operator=( line&& other ) noexcept;
+  ~line();
+
+  line( const line& ) = delete;
+  line& operator=( const line& ) = delete;
+
+  uint32_t number() const noexcept;
+
+  /// \brief Value fd, e.g. to poll on
+  int fd() const noexcept;
+
+  gpio_direction direction() const noexcept;
+  void set_direction( gpio_direction direction );
+
+  int8_t get_value() const;
+  void set_value( int8_t value );
+
+  gpio_edge edge() const noexcept;
+
+  /// \brief Enable edge interrupts of an input line, gpio_edge::none to disable
+  void set_edge( gpio_edge edge );
+
+  /// \brief Wait for an edge. With debounce the value has to stay unchanged for that long,
+  /// bounces restart the wait. Returns false on timeout, negative timeout waits forever
+  bool wait_edge( std::chrono::milliseconds timeout,
+                  std::chrono::milliseconds debounce = std::chrono::milliseconds{ 0 } ) const;
+
+private:
+  void release() noexcept;
+
+  uint32_t number_{ 0 };
+  gpio_direction direction_{ gpio_direction::in };
+  gpio_edge edge_{ gpio_edge::none };
+  int value_fd_{ -1 };
+  bool exported_{ false };
+};
+
+struct gpio_event
+{
+  uint32_t line{ 0 };
+  int8_t value{ 0 };
+  std::chrono::steady_clock::time_point time;
+};
+
+/// \brief Wait for edges on several lines with set_edge enabled. Returns events of the lines that changed,
+/// empty on timeout. With debounce the events are returned once all the lines stay unchanged for that long,
+/// lines still bouncing when the timeout expires are reported with their last values
+std::vector< gpio_event > wait_gpio_edges( const std::vector< const line* >& lines,
+                                           std::chrono::milliseconds timeout,
+                                           std::chrono::milliseconds debounce = std::chrono::milliseconds{ 0 } );
+
+struct line_setup
+{
+  uint32_t line{ 0 };
+  gpio_direction direction{ gpio_direction::in };
+  int8_t value{ 0 }; // initial value of outputs
+};
+
+struct line_result
+{
+  uint32_t line{ 0 };
+  bool ok{ false };
+  std::string error;
+};
+
+/// \brief Export and configure several lines. Export file is opened once, readiness of all the lines
+/// is awaited together, outputs get direction and initial value with one write, so they don't glitch.
+/// Never throws for a single line, results are in the order of lines
+std::vector< line_result > configure_gpio_lines( const std::vector< line_setup >& lines );
+
+/// \brief Set values of several enabled output lines, results are in the order of values
+std::vector< line_result > set_gpio_lines_status( const std::vector< std::pair< uint32_t, int8_t > >& values );
+
+/// \brief Parallel output: bit i of pattern is written to lines[ i ], at most 64 lines.
+/// Lines are written back to back with their open fds to keep the skew between them low
+void write_gpio_pattern( const std::vector< line* >& lines, uint64_t pattern );
+
 }
 
 
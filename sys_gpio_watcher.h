@@ -0,0 +1,54 @@
+#ifndef __SYS_GPIO_WATCHER_H__
+#define __SYS_GPIO_WATCHER_H__
+
+#include <chrono>
+#include <memory>
+#include <functional>
+
+#include "sys_gpio_methods.h"
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace gpio
+{
+
+/// \brief Watches sysfs input lines on one epoll from a single thread, which sleeps until an edge arrives.
+/// Callbacks are called from that thread, they may add or remove lines but must not call stop()
+class watcher
+{
+public:
+  using callback = std::function< void( const gpio_event& ) >;
+
+  /// \brief With debounce the callback is called once the value stays unchanged for that long,
+  /// and only if it differs from the last reported one
+  explicit watcher( std::chrono::milliseconds debounce = std::chrono::milliseconds{ 0 } );
+  ~watcher();
+
+  watcher( const watcher& ) = delete;
+  watcher& operator=( const watcher& ) = delete;
+
+  /// \brief Export the line as input and watch it. Replaces the callback if the line is watched already
+  void add( uint32_t line, gpio_edge edge, const callback& on_event );
+  void remove( uint32_t line );
+
+  void start();
+  void stop();
+  bool running() const noexcept;
+
+private:
+  struct impl;
+  std::unique_ptr< impl > impl_;
+};
+
+}
+
+}
+
+}
+
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef __SYS_IO_BATCH_H__
+#define __SYS_IO_BATCH_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#define IO_BATCH_QUEUE_DEPTH 256
+#define IO_BATCH_READ_LIMIT ( 64 * 1024 )
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace io
+{
+
+struct result
+{
+  int error{ 0 };      // errno of the failed call, 0 on success
+  struct stat info;    // of stat requests
+  std::string content; // of read requests
+};
+
+/// \brief Batch of independent small file operations. With liburing (HAVE_LIBURING) they are submitted
+/// to an io_uring together, so the I/O overlaps and a whole batch costs a few syscalls.
+/// Without it, or if the kernel refuses io_uring, the same calls are made one by one.
+/// The ring is set up once per thread and shared by its batches, queue_depth limits the requests in flight
+class batch
+{
+public:
+  explicit batch( unsigned int queue_depth = IO_BATCH_QUEUE_DEPTH );
+  ~batch();
+
+  batch( const batch& ) = delete;
+  batch& operator=( const batch& ) = delete;
+
+  /// \brief Returns id of the request, like stat or lstat
+  size_t add_stat( const std::string& path, bool follow_symlinks = true );
+
+  /// \brief Returns id of the request, reads up to limit bytes of the file. Works for /proc and /sys files too
+  size_t add_read( const std::string& path, size_t limit = IO_BATCH_READ_LIMIT );
+
+  /// \brief Executes all the requests added since the last clear
+  void run();
+
+  /// \brief Result of request, valid after run
+  const result& get( size_t id ) const;
+
+  size_t size() const noexcept;
+  void clear() noexcept;
+
+  /// \brief False if the calls are made one by one on the calling thread
+  bool uses_uring() const noexcept;
+
+private:
+  struct impl;
+  std::unique_ptr< impl > impl_;
+};
+
+}
+
+}
+
+}
+
+
+#endif
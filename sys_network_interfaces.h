@@ -0,0 +1,170 @@
+#ifndef __SYS_NETWORK_INTERFACES_H__
+#define __SYS_NETWORK_INTERFACES_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#define INTERFACES_FILE "/etc/network/interfaces"
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace network
+{
+
+/// \brief Option line of a stanza, e.g. "address 10.0.0.1"
+struct iface_option
+{
+  std::string name;
+  std::string value;
+};
+
+inline bool operator==( const iface_option& lhs, const iface_option& rhs )
+{
+  return lhs.name == rhs.name && lhs.value == rhs.value;
+}
+
+/// \brief "iface <name> <family> <method>" stanza
+struct iface_stanza
+{
+  std::string name;
+  std::string family{ "inet" };
+  std::string method;
+  std::vector< iface_option > options;
+
+  /// \brief Returns value of the first option with the name, or empty string
+  std::string option( const std::string& name ) const;
+
+  /// \brief Replaces the first option with the name or appends a new one. Empty value removes the option
+  void set_option( const std::string& name, const std::string& value );
+};
+
+/// \brief "mapping <pattern>..." stanza
+struct mapping_stanza
+{
+  std::vector< std::string > patterns;
+  std::vector< iface_option > options;
+};
+
+/// \brief In-memory model of interfaces(5) file together with all the files it sources.
+/// Unmodified parts are written back byte to byte, only changed stanzas are regenerated
+class interfaces_file
+{
+public:
+  /// \brief Parse the file and everything it sources
+  explicit interfaces_file( const std::string& path );
+
+  /// \brief Parse content as if it was read from path. Source directives are still read from disk
+  interfaces_file( const std::string& path, const std::string& content );
+
+  const std::string& path() const noexcept;
+
+  /// \brief Find iface stanza, searching sourced files in the order ifupdown reads them
+  const iface_stanza* find_iface( const std::string& name, const std::string& family = "inet" ) const;
+
+  /// \brief All iface stanzas
+  std::vector< iface_stanza > ifaces() const;
+
+  /// \brief All mapping stanzas
+  std::vector< mapping_stanza > mappings() const;
+
+  /// \brief Check if iface is brought up automatically ( "auto" or "allow-auto" )
+  bool is_auto( const std::string& name ) const;
+
+  /// \brief Paths of all the files the model is built from, main file goes first
+  std::vector< std::string > files() const;
+
+  /// \brief Add or replace iface stanza. Existing stanza is updated in the file it came from
+  void set_iface( const iface_stanza& stanza, bool auto_start = true );
+
+  /// \brief Remove iface stanza and its "auto"/"allow-*" entries. Returns false if there was none
+  bool remove_iface( const std::string& name, const std::string& family = "inet" );
+
+  /// \brief Check if model differs from files on disk
+  bool modified() const noexcept;
+
+  /// \brief Text of the main file
+  std::string to_string() const;
+
+  /// \brief Write modified files, each one atomically. Returns false if content on disk stayed the same
+  bool save();
+
+  /// \brief Check if none of the files ( and source directories ) changed since parsing
+  bool up_to_date() const;
+
+private:
+  enum class block_type{ text, auto_iface, allow, iface, mapping, source, source_directory, other };
+
+  // Comment and blank lines of a stanza, kept before the option they preceded when it's parsed
+  struct option_comment
+  {
+    std::string option;
+    size_t occurrence{ 0 }; // among the options with the same name
+    std::string text;
+  };
+
+  struct block
+  {
+    block_type type{ block_type::text };
+    std::string keyword;
+    std::vector< std::string > args;
+    iface_stanza iface;
+    mapping_stanza mapping;
+    std::vector< size_t > sourced; // indices in files_
+    std::vector< option_comment > comments;
+    std::string text;
+    std::string indent{ "    " };
+    bool dirty{ false };
+  };
+
+  struct file_data
+  {
+    std::string path;
+    std::vector< block > blocks;
+    bool modified{ false };
+  };
+
+  struct file_stamp
+  {
+    std::string path;
+    ino_t ino{ 0 };
+    off_t size{ 0 };
+    time_t mtime_sec{ 0 };
+    long mtime_nsec{ 0 };
+  };
+
+  size_t parse_file( const std::string& path, const std::string& content, size_t depth );
+  void add_stamp( const std::string& path );
+  void add_sourced( block& source_block, const std::string& base_dir, size_t depth );
+
+  template< class Func >
+  bool for_each_block( size_t file, const Func& func );
+
+  template< class Func >
+  bool for_each_block( size_t file, const Func& func ) const;
+
+  std::string render( const file_data& file ) const;
+  static std::string render( const block& b );
+
+  std::vector< file_data > files_;
+  std::vector< file_stamp > stamps_;
+};
+
+/// \brief Returns parsed interfaces file. The model is cached and parsed again
+/// only when the file or any of its sourced files changes
+std::shared_ptr< const interfaces_file > load_interfaces( const std::string& path = INTERFACES_FILE );
+
+}
+
+}
+
+}
+
+
+#endif
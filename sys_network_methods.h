@@ -3,7 +3,9 @@
 
 #include <string>
 #include <vector>
+#include <system_error>
 
+#include <sys/socket.h>
 #include <net/if_arp.h>
 
 namespace utils
@@ -20,13 +22,26 @@ void set_iface_state( const std::string& iface_name, bool on );
 
 /// \brief Returns interface gateway
 std::string get_iface_gateway( const std::string& iface_name );
+std::string get_iface_gateway( const std::string& iface_name, std::error_code& ec );
 
 /// \brief Returns interface type
 int get_iface_type( const std::string& iface_name );
+int get_iface_type( const std::string& iface_name, std::error_code& ec );
 
 /// \brief Список режимов настройки (на самом деле еще есть auto и другие, но здесь только те, которые можно выставить из веба)
 enum class iface_mode { dynamic_ip, static_ip, unknown };
 
+/// \brief Address scope. Ipv6 scope is taken from the address type, ipv4 scope from the well-known ranges
+enum class addr_scope { global, site, link, host };
+
+struct iface_address
+{
+  int family{ AF_UNSPEC }; // AF_INET or AF_INET6
+  std::string address;
+  uint32_t prefix_len{ 0 };
+  addr_scope scope{ addr_scope::global };
+};
+
 struct netw_iface_info
 {
   std::string name;
@@ -40,20 +55,49 @@ struct netw_iface_info
   int type{ ARPHRD_NONE };
   bool enabled{ false };
   iface_mode mode{ iface_mode::unknown };
+  std::vector< iface_address > addresses; // all ipv4 and ipv6 addresses, ip & mask hold the primary ipv4 one
 };
 
 /// \brief Returns interface infor
 netw_iface_info get_eth_iface_info( const std::string& iface_name );
+netw_iface_info get_eth_iface_info( const std::string& iface_name, std::error_code& ec );
 
 /// \brief Lists netw ifaces of specified type
 std::vector< netw_iface_info > get_ifaces_of_type( int type = ARPHRD_ETHER );
 
+/// \brief Interfaces that disappear meanwhile are skipped
+std::vector< netw_iface_info > get_ifaces_of_type( int type, std::error_code& ec );
+
 /// \brief Lists dns servers
 std::vector< std::string > get_dns_list();
 
+class interfaces_file;
+
+/// \brief Puts iface settings into the interfaces model without saving it. Dynamic ifaces lose their stanza,
+/// options of static ones the settings don't cover are kept. Returns true if the model changed
+bool update_iface_config( interfaces_file& config, const netw_iface_info& iface );
+
 /// \brief Updates network interfaces data and dns servers for system
 void update_network_info( const std::vector< netw_iface_info >& ifaces , const std::vector< std::string >& dns_servers );
 
+/// \brief What apply_network_info had to do
+struct network_apply_report
+{
+  std::vector< std::string > reconfigured;   // addresses & routes changed in place over netlink
+  std::vector< std::string > restarted;      // brought down/up with ifupdown
+  std::vector< std::string > restored;       // failed to come up with the new settings, the old ones are back
+  std::vector< std::string > restore_failed; // failed to come up, and the old stanza couldn't be saved back either
+  bool config_updated{ false };
+  bool dns_updated{ false };
+};
+
+/// \brief Same as update_network_info, but applies the settings to the live system as well.
+/// Only ifaces whose settings differ from the current ones are touched: static address & gateway changes
+/// are made over netlink, mode changes ( or netlink failures ) fall back to ifdown/ifup.
+/// Dynamic ifaces have no stanza, their link is brought up for the dhcp client instead of ifup
+network_apply_report apply_network_info( const std::vector< netw_iface_info >& ifaces,
+                                         const std::vector< std::string >& dns_servers );
+
 /// \brief Apply current iptables
 void apply_iptables_settings();
 
@@ -0,0 +1,98 @@
+#ifndef __SYS_NTP_CLIENT_H__
+#define __SYS_NTP_CLIENT_H__
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace time
+{
+
+/// \brief Answer of one server
+struct ntp_sample
+{
+  std::string server;
+  std::string address;
+  double offset{ 0.0 }; // seconds, server clock minus local clock
+  double delay{ 0.0 };  // round trip without server processing time, seconds
+  int stratum{ 0 };
+  std::chrono::system_clock::time_point time; // server time at the moment the answer was received
+};
+
+struct ntp_result
+{
+  std::vector< ntp_sample > samples;
+  std::vector< std::pair< std::string, std::string > > errors; // server, error
+
+  /// \brief Sample with the lowest round trip delay, nullptr if no server answered
+  const ntp_sample* best() const noexcept;
+};
+
+/// \brief SNTP client querying several servers in parallel from one socket.
+/// Can either be driven from the caller's event loop ( start, fd, next_timeout, process ) or run with query()
+class ntp_client
+{
+public:
+  /// \brief timeout is per attempt, each server gets up to attempts requests.
+  /// Servers are "host", "host:port" or "[ipv6]:port", the port is 123 by default
+  explicit ntp_client( const std::vector< std::string >& servers,
+                       std::chrono::milliseconds timeout = std::chrono::milliseconds{ 200 },
+                       uint32_t attempts = 5 );
+  ~ntp_client();
+
+  ntp_client( const ntp_client& ) = delete;
+  ntp_client& operator=( const ntp_client& ) = delete;
+
+  /// \brief Resolve servers and send the first requests. Resolution blocks the caller for as long as getaddrinfo
+  /// takes, so event loops should pass addresses or call it off the loop thread.
+  /// Retransmissions go through all the addresses of a server in turn
+  void start();
+
+  /// \brief Socket to wait for POLLIN on
+  int fd() const noexcept;
+
+  /// \brief Time left until the next retransmission or timeout
+  std::chrono::milliseconds next_timeout() const;
+
+  /// \brief Read pending answers and handle timeouts, never blocks. Returns true when finished
+  bool process();
+
+  /// \brief Check if every server either answered or failed
+  bool finished() const noexcept;
+
+  ntp_result result() const;
+
+  /// \brief Blocking query: start(), then poll until finished
+  ntp_result query();
+
+private:
+  struct impl;
+  std::unique_ptr< impl > impl_;
+};
+
+/// \brief Blocking query of several servers at once
+ntp_result query_ntp_servers( const std::vector< std::string >& servers,
+                              std::chrono::milliseconds timeout = std::chrono::milliseconds{ 200 },
+                              uint32_t attempts = 5 );
+
+/// \brief Same as query_ntp_servers, but runs in a separate thread
+std::future< ntp_result > query_ntp_servers_async( const std::vector< std::string >& servers,
+                                                   std::chrono::milliseconds timeout = std::chrono::milliseconds{ 200 },
+                                                   uint32_t attempts = 5 );
+
+}
+
+}
+
+}
+
+
+#endif
@@ -5,6 +5,7 @@
 #include <vector>
 #include <string>
 #include <signal.h>
+#include <system_error>
 
 namespace utils
 {
@@ -15,12 +16,19 @@ namespace sys
 namespace proc
 {
 
+/// \brief Returns name of the file owner, or the uid as a number if it has no passwd entry
+std::string get_file_owner( const std::string& path );
+std::string get_file_owner( const std::string& path, std::error_code& ec );
+
 /// \brief Returns list of pids matching the procname regex and username.
 /// If username is empty, it's not taken into account, but proc_name_regex should always be valid.
+/// Processes that exit while the list is made are skipped
 std::vector< pid_t > get_pids( const std::string& proc_name_regex, const std::string& username = std::string{} );
+std::vector< pid_t > get_pids( const std::string& proc_name_regex, const std::string& username, std::error_code& ec );
 
 /// \brief Kills process with the specified pid
 int kill_by_pid( pid_t pid, int sig = SIGTERM );
+bool kill_by_pid( pid_t pid, int sig, std::error_code& ec ) noexcept;
 
 /// \brief Kills all the processes with name matching regex
 /// Returns map of pids that were not killed and thr result of kill()
@@ -0,0 +1,92 @@
+#ifndef __SYS_PROC_SCHED_H__
+#define __SYS_PROC_SCHED_H__
+
+#include <map>
+#include <vector>
+#include <cstdint>
+#include <sys/types.h>
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace proc
+{
+
+enum class sched_policy
+{
+  other = 0,
+  fifo = 1,
+  rr = 2,
+  batch = 3,
+  idle = 5,
+  deadline = 6
+};
+
+struct sched_params
+{
+  sched_policy policy{ sched_policy::other };
+  unsigned int priority{ 0 };  // 1-99 for fifo and rr, 0 for the others
+  uint64_t runtime{ 0 };       // ns, deadline only
+  uint64_t deadline{ 0 };
+  uint64_t period{ 0 };        // 0 means equal to deadline
+  bool reset_on_fork{ false }; // children start with other and nice 0
+};
+
+enum class io_class
+{
+  none = 0,                    // derived from the nice value by the kernel
+  realtime = 1,
+  best_effort = 2,
+  idle = 3
+};
+
+struct io_priority
+{
+  io_class type{ io_class::none };
+  unsigned int level{ 0 };     // 0-7, 0 is the highest. Ignored for none and idle
+};
+
+/// \brief What the pid lists are applied to: the thread with the id only,
+/// or every thread of the process, like taskset -a
+enum class sched_scope{ thread, process };
+
+/// \brief The single pid functions work on the thread with the id, the main one for a pid, 0 means the calling thread.
+/// They throw std::invalid_argument for invalid values and std::system_error if the call fails
+std::vector< unsigned int > get_affinity( pid_t tid = 0 );
+void set_affinity( pid_t tid, const std::vector< unsigned int >& cpus );
+
+sched_params get_scheduler( pid_t tid = 0 );
+void set_scheduler( pid_t tid, const sched_params& params );
+
+/// \brief -20 to 19
+int get_nice( pid_t tid = 0 );
+void set_nice( pid_t tid, int nice );
+
+io_priority get_io_priority( pid_t tid = 0 );
+void set_io_priority( pid_t tid, const io_priority& priority );
+
+/// \brief Ids of the threads of the process, empty if it's gone
+std::vector< pid_t > get_threads( pid_t pid );
+
+/// \brief Apply to all the pids, e.g. those returned by get_pids, and to all their threads for sched_scope::process.
+/// Invalid values are thrown before anything is changed, otherwise returns map of pids that failed
+/// and errno of the first failed call for each. Threads that exit meanwhile are not failures
+std::map< pid_t, int > set_affinity( const std::vector< pid_t >& pids, const std::vector< unsigned int >& cpus,
+                                     sched_scope scope = sched_scope::process );
+std::map< pid_t, int > set_scheduler( const std::vector< pid_t >& pids, const sched_params& params,
+                                      sched_scope scope = sched_scope::process );
+std::map< pid_t, int > set_nice( const std::vector< pid_t >& pids, int nice, sched_scope scope = sched_scope::process );
+std::map< pid_t, int > set_io_priority( const std::vector< pid_t >& pids, const io_priority& priority,
+                                        sched_scope scope = sched_scope::process );
+
+}
+
+}
+
+}
+
+
+#endif
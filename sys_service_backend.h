@@ -0,0 +1,125 @@
+#ifndef __SYS_SERVICE_BACKEND_H__
+#define __SYS_SERVICE_BACKEND_H__
+
+#include <map>
+#include <mutex>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace service
+{
+
+enum class service_state{ active, reloading, inactive, failed, activating, deactivating, unknown };
+
+struct service_status
+{
+  std::string name;
+  service_state state{ service_state::unknown };
+  std::string sub_state; // backend specific, e.g. "running", "exited" or "dead" for systemd
+  bool loaded{ false };  // service is known to the init system
+
+  bool running() const noexcept;
+};
+
+/// \brief Notifications of a backend about state changes
+class change_source
+{
+public:
+  virtual ~change_source() = default;
+
+  /// \brief Becomes readable when state of some services may have changed
+  virtual int fd() const = 0;
+
+  /// \brief Consume pending notifications once fd is readable
+  virtual void process() = 0;
+};
+
+/// \brief Init system interface used by the service functions
+class service_backend
+{
+public:
+  virtual ~service_backend() = default;
+
+  virtual std::string name() const = 0;
+
+  /// \brief Futures become ready when the job is completed, and hold an exception if it failed
+  virtual std::future< void > start( const std::string& service ) = 0;
+  virtual std::future< void > stop( const std::string& service ) = 0;
+  virtual std::future< void > restart( const std::string& service ) = 0;
+  virtual std::future< void > reload( const std::string& service ) = 0;
+
+  /// \brief Status of several services, in the order of services
+  virtual std::vector< service_status > status( const std::vector< std::string >& services ) = 0;
+
+  /// \brief nullptr if the backend can't notify about changes, then the state has to be polled
+  virtual std::unique_ptr< change_source > watch_changes();
+};
+
+/// \brief systemd over the system bus with sd-bus. Jobs are waited for with JobRemoved signals,
+/// status of all services is read with one ListUnitsByNames call.
+/// Throws std::runtime_error if the library was built without HAVE_SYSTEMD or the bus is not reachable
+std::shared_ptr< service_backend > make_systemd_backend();
+
+/// \brief SysV init scripts run with service(8), state is taken from the LSB exit code of status
+std::shared_ptr< service_backend > make_sysv_backend();
+
+/// \brief In-memory stand-in of an init system, for tests
+class local_backend : public service_backend
+{
+public:
+  local_backend();
+
+  std::string name() const override;
+
+  std::future< void > start( const std::string& service ) override;
+  std::future< void > stop( const std::string& service ) override;
+  std::future< void > restart( const std::string& service ) override;
+  std::future< void > reload( const std::string& service ) override;
+
+  std::vector< service_status > status( const std::vector< std::string >& services ) override;
+  std::unique_ptr< change_source > watch_changes() override;
+
+  /// \brief Add a service or change its state behind the backend's back, like a crash would
+  void set_state( const std::string& service, service_state state );
+
+  /// \brief Make jobs of the service fail
+  void set_failing( const std::string& service, bool failing );
+
+private:
+  struct change_watchers;
+  class local_change_source;
+
+  std::future< void > run_job( const std::string& service, const char* job, bool reload );
+  void notify() noexcept;
+
+  struct unit
+  {
+    service_state state{ service_state::inactive };
+    bool failing{ false };
+  };
+
+  std::mutex mutex_;
+  std::map< std::string, unit > units_;
+  std::shared_ptr< change_watchers > watchers_; // shared with change sources, they may outlive the backend
+};
+
+/// \brief Backend used by the service functions. By default systemd if it's available, SysV otherwise
+std::shared_ptr< service_backend > get_service_backend();
+void set_service_backend( const std::shared_ptr< service_backend >& backend );
+
+}
+
+}
+
+}
+
+
+#endif
@@ -1,7 +1,11 @@
 #ifndef __SYS_SERVICE_METHODS_H__
 #define __SYS_SERVICE_METHODS_H__
 
+#include <future>
 #include <string>
+#include <vector>
+
+#include "sys_service_backend.h"
 
 namespace utils
 {
@@ -27,6 +31,15 @@ void reload_service( const std::string& service );
 /// \brief Check if service is running
 bool service_is_running( const std::string& service );
 
+/// \brief Same as above, but don't wait for the job to complete. The future may be dropped without blocking
+std::future< void > start_service_async( const std::string& service );
+std::future< void > stop_service_async( const std::string& service );
+std::future< void > restart_service_async( const std::string& service );
+std::future< void > reload_service_async( const std::string& service );
+
+/// \brief Status of several services at once
+std::vector< service_status > get_services_status( const std::vector< std::string >& services );
+
 }
 
 }
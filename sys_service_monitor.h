@@ -0,0 +1,73 @@
+#ifndef __SYS_SERVICE_MONITOR_H__
+#define __SYS_SERVICE_MONITOR_H__
+
+#include <chrono>
+#include <memory>
+#include <functional>
+
+#include "sys_service_backend.h"
+
+#define SERVICE_POLL_INTERVAL_MS 5000
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace service
+{
+
+/// \brief Keeps state of a set of services in memory. Services known to the init system are updated
+/// from change notifications of the backend and polled only if it has none. Services with a pidfile,
+/// including SysV ones whose pidfile is found in /run or /var/run, are checked through /proc without
+/// asking the init system
+class state_monitor
+{
+public:
+  /// \brief previous.state is unknown when the state of a service is read for the first time
+  using callback = std::function< void( const service_status& previous, const service_status& current ) >;
+
+  explicit state_monitor( const std::shared_ptr< service_backend >& backend = get_service_backend(),
+                          std::chrono::milliseconds poll_interval = std::chrono::milliseconds{ SERVICE_POLL_INTERVAL_MS } );
+  ~state_monitor();
+
+  state_monitor( const state_monitor& ) = delete;
+  state_monitor& operator=( const state_monitor& ) = delete;
+
+  /// \brief The state is unknown until the next refresh, which is done at once if the monitor is running
+  void add( const std::string& service, const std::string& pidfile = std::string{} );
+  void remove( const std::string& service );
+
+  /// \brief Cached state, false if the service is not registered
+  bool is_running( const std::string& service ) const;
+
+  /// \brief Throws std::out_of_range if the service is not registered
+  service_status status( const std::string& service ) const;
+
+  /// \brief Callbacks are called on every state change from the thread doing the refresh,
+  /// they must not call refresh() or stop()
+  size_t subscribe( const callback& on_change );
+  void unsubscribe( size_t id );
+
+  /// \brief Read state of all services now, from the caller's thread
+  void refresh();
+
+  /// \brief Refreshes the state once before returning
+  void start();
+  void stop();
+  bool running() const noexcept;
+
+private:
+  struct impl;
+  std::unique_ptr< impl > impl_;
+};
+
+}
+
+}
+
+}
+
+
+#endif
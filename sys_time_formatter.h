@@ -0,0 +1,80 @@
+#ifndef __SYS_TIME_FORMATTER_H__
+#define __SYS_TIME_FORMATTER_H__
+
+#include <ctime>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace time
+{
+
+class time_zone;
+
+/// \brief strftime-like formatter. The format is parsed once, and the fields are
+/// formatted again only when the second ( or minute, hour, day ) they depend on changes.
+/// Besides the strftime conversions it supports sub-second fields: %3N ( milliseconds ),
+/// %6N ( microseconds ), %9N or %N ( nanoseconds ), and %f ( microseconds, as in boost::posix_time ).
+/// Safe to share between threads
+class time_formatter
+{
+public:
+  /// \brief Empty time_zone means system local time, otherwise a zoneinfo name, e.g. "UTC" or "Europe/London"
+  explicit time_formatter( const std::string& format, const std::string& time_zone = "" );
+
+  std::string format( const std::chrono::system_clock::time_point& time ) const;
+
+  /// \brief Append formatted time to out, saves an allocation per call
+  void format_to( const std::chrono::system_clock::time_point& time, std::string& out ) const;
+
+  std::string now() const;
+
+  const std::string& format_string() const noexcept;
+
+private:
+  enum class unit{ second, minute, hour, day };
+
+  struct segment
+  {
+    enum class kind{ text, field, fraction };
+
+    kind type{ kind::text };
+    std::string text;          // literal text or strftime conversion
+    unit granularity{ unit::second };
+    uint32_t digits{ 0 };      // fraction digits
+    std::string cached;
+  };
+
+  void parse();
+  void to_tm( time_t time, std::tm& result ) const;
+  void update( time_t time ) const;
+
+  std::string format_;
+  std::shared_ptr< const time_zone > zone_;
+  bool utc_{ false };
+
+  mutable std::mutex mutex_;
+  mutable std::vector< segment > segments_;
+  mutable bool cached_{ false };
+  mutable time_t cached_time_{ 0 };
+  mutable std::tm cached_tm_;
+  mutable std::string cached_abbreviation_;
+  mutable size_t cached_size_{ 0 };
+};
+
+}
+
+}
+
+}
+
+
+#endif
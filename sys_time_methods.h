@@ -1,9 +1,15 @@
 #ifndef __SYS_TIME_METHODS_H__
 #define __SYS_TIME_METHODS_H__
 
+#include <chrono>
+#include <future>
 #include <string>
 #include <vector>
 
+#define RTC_DEVICE "/dev/rtc"
+#define ADJTIME_FILE "/etc/adjtime"
+#define TIME_SLEW_THRESHOLD_MS 500
+
 namespace utils
 {
 
@@ -13,13 +19,36 @@ namespace sys
 namespace time
 {
 
-/// \brief Get current system time with format used by strftime.
-/// Default format is %Y.%m.%d %X
+/// \brief Get current system time with format used by strftime, plus %3N/%6N/%9N sub-second fields.
+/// Default format is %Y.%m.%d %X. Use time_formatter to format repeatedly
 std::string get_time( const std::string& format = "%Y.%m.%d %X" );
 
-/// \brief Set system time
+enum class time_set_mode
+{
+  step,     // set the clock at once
+  slew,     // gradually speed up or slow down the clock, time never jumps backwards
+  automatic // slew if the correction is below TIME_SLEW_THRESHOLD_MS, step otherwise
+};
+
+/// \brief Set system time, local time of the system time zone. The RTC is written in the background
 void set_sys_time( uint year, uint month, uint day, uint hour, uint min, uint sec );
 
+/// \brief Set system time with nanosecond precision.
+/// If write_rtc is set and the clock was stepped, the RTC is written in the background,
+/// the returned future holds the result. Slewing leaves the RTC as is
+std::future< void > set_sys_time( const std::chrono::system_clock::time_point& time,
+                                  time_set_mode mode = time_set_mode::step,
+                                  bool write_rtc = true );
+
+/// \brief Slew the clock by offset with adjtimex, the kernel applies it at 0.5 ms per second
+void adjust_sys_time( const std::chrono::nanoseconds& offset );
+
+/// \brief Write system time to the RTC, at the second boundary. UTC unless ADJTIME_FILE says LOCAL
+void sync_rtc( const std::string& device = RTC_DEVICE );
+
+/// \brief Same as sync_rtc, but runs in a separate thread. RTC writes are serialized
+std::future< void > sync_rtc_async( const std::string& device = RTC_DEVICE );
+
 /// \brief Get current time zone
 std::string get_time_zone();
 
@@ -32,7 +61,7 @@ std::vector< std::string > get_time_zones();
 /// \brief Get time zone offset as string and value
 std::pair< std::string, double > get_time_zone_offset( const std::string& time_zone );
 
-/// \brief Query ntp server
+/// \brief Query ntp server, format is the same as for get_time
 std::string get_ntp_time_from_server( const std::string &server,
                                      bool local = false,
                                      const std::string& format = "%Y.%m.%d %X",
@@ -0,0 +1,89 @@
+#ifndef __SYS_TIME_ZONE_H__
+#define __SYS_TIME_ZONE_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#define ZONEINFO_DIR "/usr/share/zoneinfo"
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace time
+{
+
+/// \brief Local time type in effect at some instant
+struct zone_offset
+{
+  int32_t utc_offset{ 0 }; // seconds east of UTC
+  bool is_dst{ false };
+  std::string abbreviation;
+};
+
+/// \brief Time zone parsed from TZif ( RFC 8536 ) data.
+/// Instants after the last transition are resolved with the POSIX TZ rule from the footer
+class time_zone
+{
+public:
+  time_zone( const std::string& name, const std::string& tzif_data );
+
+  const std::string& name() const noexcept;
+
+  /// \brief Offset at the instant, seconds since the epoch
+  zone_offset offset_at( int64_t unix_time ) const;
+
+  /// \brief Offset now
+  zone_offset current_offset() const;
+
+private:
+  struct posix_rule
+  {
+    enum class kind{ julian_no_leap, julian, month_week_day };
+
+    kind type{ kind::month_week_day };
+    int month{ 0 };
+    int week{ 0 };
+    int day{ 0 };
+    int32_t time{ 7200 }; // seconds after local midnight
+  };
+
+  struct posix_tz
+  {
+    bool valid{ false };
+    zone_offset std_offset;
+    zone_offset dst_offset;
+    bool has_dst{ false };
+    posix_rule start;
+    posix_rule end;
+  };
+
+  static posix_tz parse_posix_tz( const std::string& tz );
+  static int64_t rule_to_utc( const posix_rule& rule, int64_t year, int32_t offset );
+  zone_offset footer_offset_at( int64_t unix_time ) const;
+
+  std::string name_;
+  std::vector< int64_t > transitions_;
+  std::vector< uint8_t > transition_types_;
+  std::vector< zone_offset > types_;
+  posix_tz footer_;
+};
+
+/// \brief Parsed zone from the zoneinfo dir ( TZDIR or /usr/share/zoneinfo ).
+/// Zones are cached and parsed again only if the file changes
+std::shared_ptr< const time_zone > load_time_zone( const std::string& name );
+
+/// \brief Zone names from tzdata.zi, or from the zoneinfo directory tree if there's no tzdata.zi
+std::vector< std::string > list_time_zones();
+
+}
+
+}
+
+}
+
+
+#endif
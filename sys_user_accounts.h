@@ -0,0 +1,93 @@
+#ifndef __SYS_USER_ACCOUNTS_H__
+#define __SYS_USER_ACCOUNTS_H__
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <sys/types.h>
+
+#define SHADOW_FILE "/etc/shadow"
+#define GSHADOW_FILE "/etc/gshadow"
+#define LOGIN_DEFS_FILE "/etc/login.defs"
+#define SKEL_DIR "/etc/skel"
+#define DEFAULT_SHELL "/bin/sh"
+#define DEFAULT_HOME_DIR "/home"
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace user
+{
+
+/// \brief Id to be picked from the UID_MIN/UID_MAX (or SYS_ ones) range of login.defs, like useradd does
+constexpr unsigned int auto_id{ static_cast< unsigned int >( -1 ) };
+
+struct user_spec
+{
+  std::string name;
+  uid_t uid{ auto_id };
+  std::string group;                 // primary group, if empty a group with the user's name is created
+  std::vector< std::string > groups; // supplementary groups
+  std::string gecos;
+  std::string home;                  // DEFAULT_HOME_DIR/name if empty
+  std::string shell;                 // DEFAULT_SHELL if empty
+  std::string password_hash;         // crypt(3) hash, the account is locked if empty
+  bool system{ false };
+  bool create_home{ false };         // populated from SKEL_DIR
+};
+
+/// \brief Batch of account changes applied like useradd/usermod/userdel/groupadd/groupdel would, but natively.
+/// apply() takes the lckpwdf lock, validates all the changes against the current files and rewrites
+/// each of passwd, shadow, group and gshadow once. All four are written to temp files first and renamed
+/// over the old ones only when every write succeeded. If a rename fails, the files already replaced are
+/// written back, so unless that fails too or the system crashes in between, all changes are applied or none.
+/// Invalid changes throw std::invalid_argument.
+/// With a root dir the files under it are changed instead, same as --prefix of useradd
+class account_batch
+{
+public:
+  explicit account_batch( const std::string& root_dir = "" );
+
+  /// \brief Fails if user exists
+  account_batch& add_user( const user_spec& user );
+
+  /// \brief Changes non empty fields of user, uid unless it's auto_id. Non empty groups replace the supplementary ones.
+  /// system and create_home are ignored
+  account_batch& modify_user( const user_spec& user );
+
+  /// \brief Also removes the user from groups and the user's own group if nobody else uses it
+  account_batch& remove_user( const std::string& name, bool remove_home = false );
+
+  account_batch& add_group( const std::string& name, gid_t gid = auto_id, bool system = false );
+
+  /// \brief Fails if group is primary for some user
+  account_batch& remove_group( const std::string& name );
+
+  account_batch& add_to_group( const std::string& user, const std::string& group );
+  account_batch& remove_from_group( const std::string& user, const std::string& group );
+
+  size_t size() const noexcept;
+  bool empty() const noexcept;
+
+  /// \brief Applies and clears the batch
+  void apply();
+
+private:
+  class files;
+
+  std::string root_dir_;
+  std::vector< std::function< void( files& ) > > changes_;
+};
+
+}
+
+}
+
+}
+
+
+#endif
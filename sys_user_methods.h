@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <system_error>
 #include <sys/stat.h>
 
 namespace utils
@@ -24,7 +25,7 @@ enum class recursive{ yes = 1, no = 0 };
 /// \brief Chmod
 /// Same as ::chmod, except for recursive feature and possibility to set target type
 void chmod( const std::string& target,
-            int rights, // must be OCTAL
+            int rights, // must be OCTAL, setuid, setgid and sticky bits included
             target_type type = all,
             const recursive& is_recursive = recursive::no );
 
@@ -36,6 +37,119 @@ void chown( const std::string& target,
             const recursive& is_recursive = recursive::no,
             const deref_symlinks& deref_sym_links = deref_symlinks::yes );
 
+/// \brief Entry of a POSIX ACL. Perms are the rwx bits, id is used by named_user and named_group entries only
+struct acl_entry
+{
+  enum tag_type{ user_obj = 0x01, named_user = 0x02, group_obj = 0x04, named_group = 0x08, mask = 0x10, other = 0x20 };
+
+  tag_type tag;
+  unsigned int id;
+  int perms;
+};
+
+enum class acl_type{ access = 0, default_acl = 1 };
+
+/// \brief Parses the short text form of setfacl, e.g. "u::rwx,u:www-data:r-x,g::r-x,m::r-x,o::---"
+std::vector< acl_entry > parse_acl( const std::string& text );
+
+/// \brief ACL of path, empty if there's none
+std::vector< acl_entry > get_acl( const std::string& path, acl_type type = acl_type::access );
+
+enum class dry_run{ yes = 1, no = 0 };
+
+/// \brief Target whose owner, mode, ACLs or xattrs differ from the wanted ones
+struct permission_change
+{
+  std::string path;
+  uid_t uid; // current ones
+  gid_t gid;
+  mode_t mode;
+  bool change_owner;
+  bool change_mode;
+  std::vector< std::string > xattrs; // names of the xattrs and ACLs to set or remove
+};
+
+struct permission_failure
+{
+  std::string path;
+  std::error_code error;
+};
+
+struct change_set
+{
+  std::vector< permission_change > changes;
+  std::vector< permission_failure > failures;
+  size_t checked{ 0 }; // targets of the type
+};
+
+/// \brief Mode, owner, ACL and xattr changes applied to each target in one traversal of the tree.
+/// Owner is changed first, then mode, then ACLs and xattrs in the order they were added, so an access ACL
+/// wins over the rwx bits of mode, its mask over the group ones. Default ACLs are set on directories only
+class permission_changes
+{
+public:
+  permission_changes& mode( int rights );
+  permission_changes& owner( const std::pair< std::string, std::string >& user_group );
+
+  /// \brief Replaces the ACL, mask is calculated if there are named entries and no mask
+  permission_changes& set_acl( const std::vector< acl_entry >& acl, acl_type type = acl_type::access );
+  permission_changes& remove_acl( acl_type type = acl_type::access );
+
+  permission_changes& set_xattr( const std::string& name, const std::string& value );
+  permission_changes& remove_xattr( const std::string& name );
+
+  /// \brief ACLs and xattrs of source, read once here
+  permission_changes& copy_from( const std::string& source );
+
+  bool empty() const noexcept;
+
+private:
+  friend void change_permissions( const std::string&, const permission_changes&, target_type,
+                                  const recursive&, const deref_symlinks& );
+  friend change_set update_permissions( const std::string&, const permission_changes&, target_type,
+                                        const recursive&, const deref_symlinks&, const dry_run& );
+  friend void apply_changes( change_set&, const permission_changes&, const deref_symlinks& );
+
+  // info is from lstat, target_info from stat for symlinks
+  bool differs( const std::string& path, const struct stat& info, const struct stat* target_info,
+                bool deref, permission_change& change ) const;
+  std::error_code apply( const permission_change& change, bool deref ) const;
+
+  struct xattr_change
+  {
+    std::string name;
+    std::string value;
+    bool remove;
+  };
+
+  int mode_{ -1 };
+  int uid_{ -1 };
+  int gid_{ -1 };
+  std::vector< xattr_change > xattrs_;
+};
+
+/// \brief Applies changes like chmod and chown do
+void change_permissions( const std::string& target,
+                         const permission_changes& changes,
+                         target_type type = all,
+                         const recursive& is_recursive = recursive::no,
+                         const deref_symlinks& deref_sym_links = deref_symlinks::yes );
+
+/// \brief Same, but only targets which differ are changed, as told by the stat data of the traversal itself.
+/// Failures are collected instead of thrown, the rest of the tree is still processed.
+/// With dry_run::yes nothing is changed and the result is a plan for apply_changes
+change_set update_permissions( const std::string& target,
+                               const permission_changes& changes,
+                               target_type type = all,
+                               const recursive& is_recursive = recursive::no,
+                               const deref_symlinks& deref_sym_links = deref_symlinks::yes,
+                               const dry_run& is_dry_run = dry_run::no );
+
+/// \brief Carries out a plan of update_permissions made with the same changes, failures are added to it
+void apply_changes( change_set& plan,
+                    const permission_changes& changes,
+                    const deref_symlinks& deref_sym_links = deref_symlinks::yes );
+
 }
 
 }
@@ -0,0 +1,125 @@
+#ifndef __SYS_USER_RESOLVER_H__
+#define __SYS_USER_RESOLVER_H__
+
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+#define USER_CACHE_CAPACITY 4096
+#define USER_CACHE_TTL_MS 60000
+#define PASSWD_FILE "/etc/passwd"
+#define GROUP_FILE "/etc/group"
+
+namespace utils
+{
+
+namespace sys
+{
+
+namespace user
+{
+
+struct user_info
+{
+  std::string name;
+  uid_t uid{ 0 };
+  gid_t gid{ 0 };
+  std::string home;
+  std::string shell;
+};
+
+struct group_info
+{
+  std::string name;
+  gid_t gid{ 0 };
+  std::vector< std::string > members;
+};
+
+/// \brief Thread safe passwd and group lookups with the _r functions. Results are kept in a bounded LRU cache
+/// by name and by id, unknown names and ids too. Entries expire after ttl, which covers NSS sources like LDAP,
+/// and all at once when /etc/passwd or /etc/group changes
+class user_resolver
+{
+public:
+  explicit user_resolver( size_t capacity = USER_CACHE_CAPACITY,
+                          std::chrono::milliseconds ttl = std::chrono::milliseconds{ USER_CACHE_TTL_MS } );
+
+  user_resolver( const user_resolver& ) = delete;
+  user_resolver& operator=( const user_resolver& ) = delete;
+
+  /// \brief nullptr if there's no such user or group
+  std::shared_ptr< const user_info > find_user( const std::string& name );
+  std::shared_ptr< const user_info > find_user( uid_t uid );
+  std::shared_ptr< const group_info > find_group( const std::string& name );
+  std::shared_ptr< const group_info > find_group( gid_t gid );
+
+  void clear();
+
+private:
+  template< class T >
+  class cache
+  {
+  public:
+    explicit cache( size_t capacity ) : capacity_( capacity ) {}
+
+    bool get( const std::string& key, std::chrono::steady_clock::time_point now, std::shared_ptr< const T >& value );
+    void put( const std::string& key, const std::shared_ptr< const T >& value, std::chrono::steady_clock::time_point expires );
+    void clear();
+
+    /// \brief Incremented by clear, lookups started before it must not be put
+    uint64_t generation() const noexcept { return generation_; }
+
+  private:
+    struct item
+    {
+      std::string key;
+      std::shared_ptr< const T > value;
+      std::chrono::steady_clock::time_point expires;
+    };
+
+    size_t capacity_;
+    uint64_t generation_{ 0 };
+    std::list< item > items_; // most recently used first
+    std::unordered_map< std::string, typename std::list< item >::iterator > index_;
+  };
+
+  struct file_stamp
+  {
+    ino_t inode{ 0 };
+    time_t mtime{ 0 };
+    long mtime_ns{ 0 };
+    off_t size{ 0 };
+  };
+
+  template< class T, class Lookup >
+  std::shared_ptr< const T > find( cache< T >& entries, const std::string& key, const Lookup& lookup );
+  void check_files( std::chrono::steady_clock::time_point now );
+
+  std::chrono::milliseconds ttl_;
+
+  std::mutex mutex_;
+  cache< user_info > users_;
+  cache< group_info > groups_;
+  file_stamp passwd_stamp_;
+  file_stamp group_stamp_;
+  std::chrono::steady_clock::time_point files_checked_;
+};
+
+/// \brief Resolver shared by the library
+user_resolver& get_user_resolver();
+
+}
+
+}
+
+}
+
+
+#endif
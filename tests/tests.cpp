@@ -4,11 +4,28 @@
 #include <pwd.h>
 #include <grp.h>
 #include <time.h>
+#include <poll.h>
+#include <arpa/inet.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/xattr.h>
+#include <sched.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <array>
+#include <cstring>
 #include <fstream>
 #include <sstream>
+#include <iomanip>
+#include <iterator>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <atomic>
+#include <mutex>
 #include <thread>
+#include <condition_variable>
 
 #include <boost/format.hpp>
 #include <boost/filesystem.hpp>
@@ -20,16 +37,33 @@
 #include <boost/property_tree/json_parser.hpp>
 
 #include "../impl/execute_sys_command.h"
+#include "../impl/sys_netlink.h"
+#include "aux_methods.h"
 #include "sys_app_methods.h"
 #include "sys_arch_methods.h"
+#include "sys_cron_methods.h"
+#include "sys_cron_schedule.h"
+#include "sys_error.h"
+#include "sys_io_batch.h"
 #include "sys_gpio_methods.h"
+#include "sys_gpio_chip.h"
+#include "sys_gpio_watcher.h"
 #include "sys_network_methods.h"
+#include "sys_network_interfaces.h"
 #include "sys_misc_methods.h"
+#include "sys_cpu_topology.h"
 #include "sys_proc_methods.h"
+#include "sys_proc_sched.h"
 #include "sys_service_methods.h"
+#include "sys_service_monitor.h"
 #include "sys_file_methods.h"
 #include "sys_time_methods.h"
+#include "sys_ntp_client.h"
+#include "sys_time_zone.h"
+#include "sys_time_formatter.h"
 #include "sys_user_methods.h"
+#include "sys_user_accounts.h"
+#include "sys_user_resolver.h"
 
 using namespace utils::sys;
 using namespace utils::sys::details;
@@ -126,6 +160,43 @@ BOOST_AUTO_TEST_CASE( test_execute_sys_command )
   BOOST_REQUIRE( out == echo );
 }
 
+BOOST_AUTO_TEST_CASE( test_write_file_atomic )
+{
+  BOOST_TEST_MESSAGE( "--------------\nWRITE_FILE_ATOMIC" );
+
+  std::string path{ "atomic_test_file" };
+  BOOST_SCOPE_EXIT( &path ){ std::remove( path.c_str() ); } BOOST_SCOPE_EXIT_END
+
+  BOOST_REQUIRE_THROW( utils::aux::write_file_atomic( "", "text" ), std::invalid_argument );
+
+  bool written{ false };
+  BOOST_REQUIRE_NO_THROW( written = utils::aux::write_file_atomic( path, "text\n" ) );
+  BOOST_REQUIRE( written );
+  BOOST_REQUIRE( utils::aux::read_file( path ) == "text\n" );
+
+  // same content is not written again
+  BOOST_REQUIRE_NO_THROW( written = utils::aux::write_file_atomic( path, "text\n" ) );
+  BOOST_REQUIRE( !written );
+
+  BOOST_REQUIRE_NO_THROW( written = utils::aux::write_file_atomic( path, "other text\n", false ) );
+  BOOST_REQUIRE( written );
+  BOOST_REQUIRE( utils::aux::read_file( path ) == "other text\n" );
+
+  // the target of a symlink is replaced, also when it doesn't exist yet
+  std::string link{ "atomic_test_link" };
+  BOOST_SCOPE_EXIT( &link ){ std::remove( link.c_str() ); } BOOST_SCOPE_EXIT_END
+  BOOST_REQUIRE( symlink( path.c_str(), link.c_str() ) == 0 );
+
+  BOOST_REQUIRE_NO_THROW( written = utils::aux::write_file_atomic( link, "linked text\n" ) );
+  BOOST_REQUIRE( written && boost::filesystem::is_symlink( link ) );
+  BOOST_REQUIRE( utils::aux::read_file( path ) == "linked text\n" );
+
+  std::remove( path.c_str() );
+  BOOST_REQUIRE_NO_THROW( written = utils::aux::write_file_atomic( link, "text\n" ) );
+  BOOST_REQUIRE( written && boost::filesystem::is_symlink( link ) );
+  BOOST_REQUIRE( utils::aux::read_file( path ) == "text\n" );
+}
+
 BOOST_AUTO_TEST_CASE( test_app_path_dir )
 {
   BOOST_TEST_MESSAGE( "--------------\nAPP" );
@@ -239,6 +310,143 @@ BOOST_AUTO_TEST_CASE( test_gpio )
     }
 }
 
+BOOST_AUTO_TEST_CASE( test_gpio_line )
+{
+    BOOST_TEST_MESSAGE( "--------------\nGPIO line" );
+
+    uint32_t line_num{ 214 };
+    BOOST_REQUIRE_NO_THROW( gpio::disable_gpio_line( line_num ) );
+
+    // timings
+    gpio::gpio_timing timing;
+    timing.initial_backoff = std::chrono::milliseconds{ 0 };
+    BOOST_REQUIRE_THROW( gpio::set_gpio_timing( timing ), std::invalid_argument );
+
+    timing.initial_backoff = std::chrono::milliseconds{ 2 };
+    timing.ready_timeout = std::chrono::milliseconds{ 500 };
+    BOOST_REQUIRE_NO_THROW( gpio::set_gpio_timing( timing ) );
+    BOOST_REQUIRE( gpio::get_gpio_timing().ready_timeout == timing.ready_timeout );
+
+    {
+        gpio::line line{ line_num, gpio::gpio_direction::out };
+        BOOST_REQUIRE( gpio::gpio_line_enabled( line_num ) );
+        BOOST_REQUIRE( line.fd() != -1 );
+
+        for( int8_t value{ 0 }; value <= 1; ++value )
+        {
+            BOOST_REQUIRE_NO_THROW( line.set_value( value ) );
+            BOOST_REQUIRE( line.get_value() == value );
+        }
+
+        BOOST_REQUIRE_NO_THROW( line.set_direction( gpio::gpio_direction::in ) );
+        BOOST_REQUIRE( line.direction() == gpio::gpio_direction::in );
+        BOOST_REQUIRE( gpio::get_gpio_line_direction( line_num ) == gpio::gpio_direction::in );
+        BOOST_REQUIRE_THROW( line.set_value( 1 ), std::invalid_argument );
+
+        // edges, nothing drives the input so waits time out
+        BOOST_REQUIRE_THROW( line.wait_edge( std::chrono::milliseconds{ 10 } ), std::invalid_argument );
+        BOOST_REQUIRE_NO_THROW( line.set_edge( gpio::gpio_edge::both ) );
+        BOOST_REQUIRE( line.edge() == gpio::gpio_edge::both );
+        BOOST_REQUIRE( !line.wait_edge( std::chrono::milliseconds{ 10 }, std::chrono::milliseconds{ 5 } ) );
+        BOOST_REQUIRE( gpio::wait_gpio_edges( { &line }, std::chrono::milliseconds{ 10 } ).empty() );
+
+        // moved from object doesn't release the line, the edge goes with it
+        gpio::line other{ std::move( line ) };
+        BOOST_REQUIRE( other.number() == line_num && gpio::gpio_line_enabled( line_num ) );
+        BOOST_REQUIRE( other.edge() == gpio::gpio_edge::both && line.edge() == gpio::gpio_edge::none );
+        BOOST_REQUIRE( !other.wait_edge( std::chrono::milliseconds{ 10 } ) );
+
+        line = std::move( other );
+        BOOST_REQUIRE( line.edge() == gpio::gpio_edge::both && other.edge() == gpio::gpio_edge::none );
+        BOOST_REQUIRE( gpio::wait_gpio_edges( { &line }, std::chrono::milliseconds{ 10 } ).empty() );
+        BOOST_REQUIRE_NO_THROW( line.set_edge( gpio::gpio_edge::none ) );
+    }
+
+    // exported by the object, so unexported on destruction
+    BOOST_REQUIRE( !gpio::gpio_line_enabled( line_num ) );
+
+    // batch configure, a missing line doesn't affect the others
+    std::vector< gpio::line_setup > setup( 2 );
+    setup[ 0 ].line = line_num;
+    setup[ 0 ].direction = gpio::gpio_direction::out;
+    setup[ 0 ].value = 1;
+    setup[ 1 ].line = 100000;
+
+    std::vector< gpio::line_result > results;
+    BOOST_REQUIRE_NO_THROW( results = gpio::configure_gpio_lines( setup ) );
+    BOOST_REQUIRE( results.size() == 2 && results[ 0 ].ok && !results[ 1 ].ok && !results[ 1 ].error.empty() );
+    BOOST_REQUIRE( gpio::get_gpio_line_direction( line_num ) == gpio::gpio_direction::out );
+
+    BOOST_REQUIRE_NO_THROW( results = gpio::set_gpio_lines_status( { { line_num, 0 }, { 100000, 1 } } ) );
+    BOOST_REQUIRE( results[ 0 ].ok && !results[ 1 ].ok );
+
+    {
+        gpio::line line{ line_num, gpio::gpio_direction::out };
+        BOOST_REQUIRE_THROW( gpio::write_gpio_pattern( {}, 1 ), std::invalid_argument );
+        BOOST_REQUIRE_NO_THROW( gpio::write_gpio_pattern( { &line }, 1 ) );
+        BOOST_REQUIRE( line.get_value() == 1 );
+    }
+
+    BOOST_REQUIRE_NO_THROW( gpio::disable_gpio_line( line_num ) );
+
+    // watcher
+    gpio::watcher watcher{ std::chrono::milliseconds{ 5 } };
+    BOOST_REQUIRE_THROW( watcher.add( line_num, gpio::gpio_edge::none, []( const gpio::gpio_event& ){} ), std::invalid_argument );
+    BOOST_REQUIRE_NO_THROW( watcher.add( line_num, gpio::gpio_edge::both, []( const gpio::gpio_event& ){} ) );
+    BOOST_REQUIRE_NO_THROW( watcher.start() );
+    BOOST_REQUIRE( watcher.running() );
+    BOOST_REQUIRE_NO_THROW( watcher.remove( line_num ) );
+    BOOST_REQUIRE_NO_THROW( watcher.stop() );
+    BOOST_REQUIRE( !watcher.running() && !gpio::gpio_line_enabled( line_num ) );
+}
+
+BOOST_AUTO_TEST_CASE( test_gpio_chip )
+{
+    BOOST_TEST_MESSAGE( "--------------\nGPIO chip" );
+
+    std::vector< std::string > chips;
+    BOOST_REQUIRE_NO_THROW( chips = gpio::chip::list() );
+    BOOST_REQUIRE( !chips.empty() );
+
+    BOOST_REQUIRE_THROW( gpio::chip( "gpiochip_none" ), std::runtime_error );
+
+    gpio::chip chip{ chips.front() };
+    gpio::chip_info info;
+    BOOST_REQUIRE_NO_THROW( info = chip.info() );
+    BOOST_REQUIRE( info.lines > 0 );
+
+    // find a free line
+    uint32_t offset{ 0 };
+    while( offset < info.lines && chip.get_line_info( offset ).used )
+    {
+        ++offset;
+    }
+
+    BOOST_REQUIRE( offset < info.lines );
+
+    // Invalid cases
+    gpio::line_config config;
+    BOOST_REQUIRE_THROW( chip.request_lines( {}, config ), std::invalid_argument );
+
+    gpio::line_config output_config;
+    output_config.direction = gpio::gpio_direction::out;
+    output_config.edge = gpio::gpio_edge::both;
+    BOOST_REQUIRE_THROW( chip.request_lines( { offset }, output_config ), std::invalid_argument );
+
+    // request is held until destruction
+    {
+        config.edge = gpio::gpio_edge::both;
+        gpio::line_request request{ chip.request_lines( { offset }, config ) };
+        BOOST_REQUIRE( chip.get_line_info( offset ).used );
+        BOOST_REQUIRE( chip.get_line_info( offset ).edge == gpio::gpio_edge::both );
+        BOOST_REQUIRE( request.get_values().size() == 1 );
+        BOOST_REQUIRE_THROW( request.get_value( offset + 1 ), std::invalid_argument );
+        BOOST_REQUIRE_THROW( request.set_values( { 1, 0 } ), std::invalid_argument );
+    }
+
+    BOOST_REQUIRE( !chip.get_line_info( offset ).used );
+}
+
 BOOST_AUTO_TEST_CASE( test_iface )
 {
     BOOST_TEST_MESSAGE( "--------------\nIFACE" );
@@ -281,6 +489,13 @@ BOOST_AUTO_TEST_CASE( test_iface )
     BOOST_REQUIRE( test_iface_duplex == info.duplex );
     BOOST_REQUIRE( test_iface_type == info.type );
 
+    // addresses
+    auto address = std::find_if( info.addresses.begin(), info.addresses.end(),
+                                 [ &test_iface_ip ]( const network::iface_address& address )
+                                 { return address.family == AF_INET && address.address == test_iface_ip; } );
+    BOOST_REQUIRE( address != info.addresses.end() );
+    BOOST_REQUIRE( address->prefix_len > 0 && address->prefix_len <= 32 );
+
     // get_eth_ifaces
     // Assuming we only have eth & lo, lo is omitted
     std::string ifaces;
@@ -293,6 +508,196 @@ BOOST_AUTO_TEST_CASE( test_iface )
     BOOST_REQUIRE( ifaces_list.size() - 1 == ifaces_list2.size() ); // -1 because of lo
 }
 
+BOOST_AUTO_TEST_CASE( test_interfaces_file )
+{
+    BOOST_TEST_MESSAGE( "--------------\nINTERFACES FILE" );
+
+    std::string content{ "# header\n"
+                         "auto lo\n"
+                         "iface lo inet loopback\n\n"
+                         "auto eth0 eth1\n"
+                         "iface eth0 inet static\n"
+                         "    address 10.0.0.2\n"
+                         "    # comment\n"
+                         "    netmask 255.255.255.0\n\n"
+                         "iface eth1 inet dhcp\n" };
+
+    network::interfaces_file file{ "interfaces_test", content };
+    BOOST_REQUIRE( file.to_string() == content );
+
+    // lookup
+    const network::iface_stanza* eth0{ file.find_iface( "eth0" ) };
+    BOOST_REQUIRE( eth0 != nullptr );
+    BOOST_REQUIRE( eth0->method == "static" && eth0->option( "netmask" ) == "255.255.255.0" );
+    BOOST_REQUIRE( file.is_auto( "eth1" ) );
+    BOOST_REQUIRE( file.find_iface( "eth0", "inet6" ) == nullptr );
+
+    // unchanged stanza doesn't modify the file
+    BOOST_REQUIRE_NO_THROW( file.set_iface( *eth0 ) );
+    BOOST_REQUIRE( !file.modified() );
+
+    // remove_iface only touches eth1 entries
+    BOOST_REQUIRE( file.remove_iface( "eth1" ) );
+    BOOST_REQUIRE( !file.is_auto( "eth1" ) && file.find_iface( "eth1" ) == nullptr );
+    BOOST_REQUIRE( file.to_string() == "# header\n"
+                                       "auto lo\n"
+                                       "iface lo inet loopback\n\n"
+                                       "auto eth0\n"
+                                       "iface eth0 inet static\n"
+                                       "    address 10.0.0.2\n"
+                                       "    # comment\n"
+                                       "    netmask 255.255.255.0\n\n" );
+
+    // comments inside of a rewritten stanza are kept, those of removed options move to the next old one or the end
+    network::iface_stanza changed{ *file.find_iface( "eth0" ) };
+    changed.set_option( "address", "10.0.0.3" );
+    changed.set_option( "gateway", "10.0.0.1" );
+    BOOST_REQUIRE_NO_THROW( file.set_iface( changed ) );
+    BOOST_REQUIRE( file.to_string() == "# header\n"
+                                       "auto lo\n"
+                                       "iface lo inet loopback\n\n"
+                                       "auto eth0\n"
+                                       "iface eth0 inet static\n"
+                                       "    address 10.0.0.3\n"
+                                       "    # comment\n"
+                                       "    netmask 255.255.255.0\n"
+                                       "    gateway 10.0.0.1\n\n" );
+
+    changed.set_option( "netmask", "" );
+    BOOST_REQUIRE_NO_THROW( file.set_iface( changed ) );
+    BOOST_REQUIRE( file.to_string() == "# header\n"
+                                       "auto lo\n"
+                                       "iface lo inet loopback\n\n"
+                                       "auto eth0\n"
+                                       "iface eth0 inet static\n"
+                                       "    address 10.0.0.3\n"
+                                       "    gateway 10.0.0.1\n"
+                                       "    # comment\n\n" );
+}
+
+BOOST_AUTO_TEST_CASE( test_update_iface_config )
+{
+    BOOST_TEST_MESSAGE( "--------------\nIFACE CONFIG" );
+
+    std::string path{ "interfaces_update_test" };
+    BOOST_SCOPE_EXIT( &path ){ boost::filesystem::remove( path ); } BOOST_SCOPE_EXIT_END
+
+    network::interfaces_file file{ path, "auto lo\n"
+                                         "iface lo inet loopback\n\n"
+                                         "auto eth0\n"
+                                         "iface eth0 inet static\n"
+                                         "    address 10.0.0.2\n"
+                                         "    netmask 255.255.255.0\n"
+                                         "    mtu 9000\n" };
+
+    network::netw_iface_info eth0;
+    eth0.name = "eth0";
+    eth0.mode = network::iface_mode::static_ip;
+    eth0.ip = "10.0.0.3";
+    eth0.mask = "255.255.0.0";
+    eth0.gateway = "10.0.0.1";
+
+    // options the settings don't cover are kept, the same settings change nothing
+    BOOST_REQUIRE( network::update_iface_config( file, eth0 ) );
+    BOOST_REQUIRE( !network::update_iface_config( file, eth0 ) );
+    BOOST_REQUIRE( file.save() );
+    BOOST_REQUIRE( utils::aux::read_file( path ) == "auto lo\n"
+                                                   "iface lo inet loopback\n\n"
+                                                   "auto eth0\n"
+                                                   "iface eth0 inet static\n"
+                                                   "    address 10.0.0.3\n"
+                                                   "    netmask 255.255.0.0\n"
+                                                   "    mtu 9000\n"
+                                                   "    gateway 10.0.0.1\n" );
+
+    // new static iface gets a stanza and is brought up automatically
+    network::netw_iface_info eth1{ eth0 };
+    eth1.name = "eth1";
+    eth1.gateway.clear();
+    BOOST_REQUIRE( network::update_iface_config( file, eth1 ) );
+
+    network::interfaces_file reloaded{ path };
+    BOOST_REQUIRE( reloaded.find_iface( "eth1" ) == nullptr );
+    BOOST_REQUIRE( file.save() );
+
+    reloaded = network::interfaces_file{ path };
+    const network::iface_stanza* stanza{ reloaded.find_iface( "eth1" ) };
+    BOOST_REQUIRE( stanza && reloaded.is_auto( "eth1" ) );
+    BOOST_REQUIRE( stanza->method == "static" && stanza->option( "address" ) == "10.0.0.3" );
+    BOOST_REQUIRE( stanza->option( "gateway" ).empty() );
+
+    // dynamic ifaces lose their stanza
+    eth0.mode = network::iface_mode::dynamic_ip;
+    BOOST_REQUIRE( network::update_iface_config( file, eth0 ) );
+    BOOST_REQUIRE( !network::update_iface_config( file, eth0 ) );
+    BOOST_REQUIRE( file.save() );
+
+    reloaded = network::interfaces_file{ path };
+    BOOST_REQUIRE( reloaded.find_iface( "eth0" ) == nullptr && !reloaded.is_auto( "eth0" ) );
+    BOOST_REQUIRE( reloaded.find_iface( "eth1" ) != nullptr );
+}
+
+BOOST_AUTO_TEST_CASE( test_replace_address )
+{
+    BOOST_TEST_MESSAGE( "--------------\nREPLACE ADDRESS" );
+
+    // in a network namespace of its own, with the primary and an alias in the same subnet
+    pid_t child{ fork() };
+    BOOST_REQUIRE( child != -1 );
+    if( !child )
+    {
+        try
+        {
+            if( unshare( CLONE_NEWNET ) != 0 )
+            {
+                _exit( 2 );
+            }
+
+            int lo( if_nametoindex( "lo" ) );
+            network::netlink::add_address( lo, "10.99.0.5", 24 );
+            network::netlink::add_address( lo, "10.99.0.6", 24 );
+            network::netlink::replace_address( lo, "10.99.0.5", 24, "10.99.0.7", 24 );
+
+            ifaddrs* list{ nullptr };
+            if( getifaddrs( &list ) != 0 )
+            {
+                _exit( 1 );
+            }
+
+            std::vector< std::string > addresses;
+            for( ifaddrs* curr{ list }; curr; curr = curr->ifa_next )
+            {
+                std::array< char, INET_ADDRSTRLEN > buf;
+                if( curr->ifa_addr && curr->ifa_addr->sa_family == AF_INET &&
+                    inet_ntop( AF_INET, &reinterpret_cast< sockaddr_in* >( curr->ifa_addr )->sin_addr, buf.data(), buf.size() ) &&
+                    std::string{ buf.data() }.compare( 0, 6, "10.99." ) == 0 )
+                {
+                    addresses.emplace_back( buf.data() );
+                }
+            }
+
+            freeifaddrs( list );
+
+            // the new one is the primary, the alias stays
+            _exit( addresses == std::vector< std::string >{ "10.99.0.7", "10.99.0.6" }? 0 : 1 );
+        }
+        catch( ... )
+        {
+            _exit( 1 );
+        }
+    }
+
+    int status{ 0 };
+    BOOST_REQUIRE( waitpid( child, &status, 0 ) == child && WIFEXITED( status ) );
+    if( WEXITSTATUS( status ) == 2 )
+    {
+        BOOST_TEST_MESSAGE( "No network namespaces, skipped" );
+        return;
+    }
+
+    BOOST_REQUIRE( WEXITSTATUS( status ) == 0 );
+}
+
 BOOST_AUTO_TEST_CASE( test_misc )
 {
     BOOST_TEST_MESSAGE( "--------------\nMISC" );
@@ -309,6 +714,104 @@ BOOST_AUTO_TEST_CASE( test_misc )
     BOOST_REQUIRE( part == CONFIG.get< std::string >( "misc.binary_partition" ) );
 }
 
+BOOST_AUTO_TEST_CASE( test_cpu_topology )
+{
+    BOOST_TEST_MESSAGE( "--------------\nCPU topology" );
+
+    BOOST_REQUIRE( cpu::parse_cpu_list( "0-2,5,7-8\n" ) == std::vector< unsigned int >( { 0, 1, 2, 5, 7, 8 } ) );
+    BOOST_REQUIRE( cpu::parse_cpu_list( "" ).empty() );
+    BOOST_REQUIRE_THROW( cpu::parse_cpu_list( "3-1" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( cpu::parse_cpu_list( "1-" ), std::invalid_argument );
+
+    auto topology = cpu::get_topology();
+    BOOST_REQUIRE( topology && topology == cpu::get_topology() );
+    BOOST_REQUIRE( topology->cpus.size() == static_cast< size_t >( sysconf( _SC_NPROCESSORS_ONLN ) ) );
+    BOOST_REQUIRE( topology->cores >= 1 && topology->cores <= topology->cpus.size() && topology->packages >= 1 );
+    BOOST_REQUIRE( !topology->affinity.empty() );
+    BOOST_REQUIRE( topology->effective_concurrency() >= 1 && topology->effective_concurrency() <= topology->affinity.size() );
+
+    const cpu::cpu_info* first{ topology->find( topology->cpus[ 0 ].id ) };
+    BOOST_REQUIRE( first && std::count( first->siblings.begin(), first->siblings.end(), first->id ) == 1 );
+    BOOST_REQUIRE( !topology->find( 1u << 30 ) );
+    for( const cpu::cache_info& cache : first->caches )
+    {
+        BOOST_REQUIRE( cache.level >= 1 && cache.size > 0 && !cache.type.empty() );
+    }
+
+    BOOST_REQUIRE( cpu::get_topology( true ) != topology );
+}
+
+BOOST_AUTO_TEST_CASE( test_proc_sched )
+{
+    BOOST_TEST_MESSAGE( "--------------\nProcess scheduling" );
+
+    BOOST_REQUIRE( proc::get_affinity() == cpu::get_topology()->affinity );
+    BOOST_REQUIRE_THROW( proc::set_affinity( 0, {} ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( proc::set_nice( 0, 20 ), std::invalid_argument );
+
+    proc::io_priority io;
+    io.type = proc::io_class::best_effort;
+    io.level = 8;
+    BOOST_REQUIRE_THROW( proc::set_io_priority( 0, io ), std::invalid_argument );
+
+    proc::sched_params fifo;
+    fifo.policy = proc::sched_policy::fifo;
+    BOOST_REQUIRE_THROW( proc::set_scheduler( 0, fifo ), std::invalid_argument );
+
+    pid_t child{ fork() };
+    BOOST_REQUIRE( child != -1 );
+    if( !child )
+    {
+        pause();
+        _exit( 0 );
+    }
+
+    BOOST_SCOPE_EXIT( child )
+    {
+        kill( child, SIGKILL );
+        waitpid( child, nullptr, 0 );
+    } BOOST_SCOPE_EXIT_END
+
+    BOOST_REQUIRE( proc::get_threads( child ) == std::vector< pid_t >{ child } );
+
+    // the cpus of the node the test may run on, those outside its cpuset can't be set
+    std::vector< unsigned int > allowed( cpu::get_topology()->affinity );
+    std::vector< unsigned int > node_cpus;
+    if( !cpu::get_topology()->nodes.empty() )
+    {
+        const std::vector< unsigned int >& cpus( cpu::get_topology()->nodes[ 0 ].cpus );
+        std::set_intersection( cpus.begin(), cpus.end(), allowed.begin(), allowed.end(), std::back_inserter( node_cpus ) );
+    }
+
+    if( node_cpus.empty() )
+    {
+        node_cpus = allowed;
+    }
+
+    BOOST_REQUIRE( proc::set_affinity( std::vector< pid_t >{ child }, node_cpus ).empty() );
+    BOOST_REQUIRE( proc::get_affinity( child ) == node_cpus );
+
+    proc::sched_params batch;
+    batch.policy = proc::sched_policy::batch;
+    BOOST_REQUIRE( proc::set_scheduler( std::vector< pid_t >{ child }, batch ).empty() );
+    BOOST_REQUIRE( proc::get_scheduler( child ).policy == proc::sched_policy::batch );
+
+    BOOST_REQUIRE_NO_THROW( proc::set_nice( child, 10 ) );
+    BOOST_REQUIRE( proc::get_nice( child ) == 10 );
+
+    io.level = 7;
+    BOOST_REQUIRE_NO_THROW( proc::set_io_priority( child, io ) );
+    io = proc::get_io_priority( child );
+    BOOST_REQUIRE( io.type == proc::io_class::best_effort && io.level == 7 );
+
+    // a gone process is reported, the others are still changed
+    pid_t gone{ std::numeric_limits< pid_t >::max() };
+    std::map< pid_t, int > errors{ proc::set_nice( std::vector< pid_t >{ gone, child }, 15 ) };
+    BOOST_REQUIRE( errors.size() == 1 && errors.at( gone ) == ESRCH );
+    BOOST_REQUIRE( proc::get_nice( child ) == 15 );
+    BOOST_REQUIRE_THROW( proc::get_nice( gone ), std::system_error );
+}
+
 BOOST_AUTO_TEST_CASE( test_proc )
 {
     BOOST_TEST_MESSAGE( "--------------\nPROC" );
@@ -390,6 +893,342 @@ BOOST_AUTO_TEST_CASE( test_service_start_stop_restart_reload )
     BOOST_REQUIRE( out.find( "is running" ) != std::string::npos );
 }
 
+BOOST_AUTO_TEST_CASE( test_service_backend )
+{
+    BOOST_TEST_MESSAGE( "--------------\nService backend" );
+
+    auto backend = std::make_shared< service::local_backend >();
+    backend->set_state( "app", service::service_state::inactive );
+    backend->set_state( "db", service::service_state::active );
+
+    service::set_service_backend( backend );
+    BOOST_SCOPE_EXIT( void ){ service::set_service_backend( nullptr ); }BOOST_SCOPE_EXIT_END
+
+    BOOST_REQUIRE( service::get_service_backend()->name() == "local" );
+
+    // Invalid cases
+    BOOST_REQUIRE_THROW( service::start_service_async( "" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( service::start_service( "missing" ), std::runtime_error );
+    BOOST_REQUIRE_THROW( service::reload_service( "app" ), std::runtime_error );
+
+    BOOST_REQUIRE( !service::service_is_running( "app" ) );
+    BOOST_REQUIRE_NO_THROW( service::start_service_async( "app" ).get() );
+    BOOST_REQUIRE( service::service_is_running( "app" ) );
+    BOOST_REQUIRE_NO_THROW( service::reload_service( "app" ) );
+    BOOST_REQUIRE_NO_THROW( service::stop_service( "db" ) );
+
+    // batch status, in the order of request
+    std::vector< service::service_status > status;
+    BOOST_REQUIRE_NO_THROW( status = service::get_services_status( { "db", "app", "missing" } ) );
+    BOOST_REQUIRE( status.size() == 3 );
+    BOOST_REQUIRE( status[ 0 ].name == "db" && status[ 0 ].state == service::service_state::inactive );
+    BOOST_REQUIRE( status[ 1 ].name == "app" && status[ 1 ].running() && status[ 1 ].sub_state == "running" );
+    BOOST_REQUIRE( !status[ 2 ].loaded );
+
+    // failed job is reported through the future
+    backend->set_failing( "app", true );
+    BOOST_REQUIRE_THROW( service::restart_service( "app" ), std::runtime_error );
+    BOOST_REQUIRE( service::get_services_status( { "app" } ).front().state == service::service_state::failed );
+
+    // the real backend
+    service::set_service_backend( nullptr );
+    BOOST_REQUIRE( service::get_service_backend() != nullptr );
+    BOOST_REQUIRE_THROW( service::service_is_running( "ntp; reboot" ), std::invalid_argument );
+}
+
+BOOST_AUTO_TEST_CASE( test_service_monitor )
+{
+    BOOST_TEST_MESSAGE( "--------------\nService monitor" );
+
+    auto backend = std::make_shared< service::local_backend >();
+    backend->set_state( "app", service::service_state::active );
+    backend->set_state( "db", service::service_state::inactive );
+
+    // Invalid cases
+    BOOST_REQUIRE_THROW( service::state_monitor{ nullptr }, std::invalid_argument );
+    BOOST_REQUIRE_THROW( service::state_monitor( backend, std::chrono::milliseconds{ 0 } ), std::invalid_argument );
+
+    service::state_monitor monitor{ backend, std::chrono::milliseconds{ 50 } };
+    BOOST_REQUIRE_THROW( monitor.add( "" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( monitor.status( "app" ), std::out_of_range );
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector< std::pair< std::string, service::service_state > > changes;
+    monitor.subscribe( [ & ]( const service::service_status&, const service::service_status& current )
+    {
+        std::lock_guard< std::mutex > lock{ mutex };
+        changes.emplace_back( current.name, current.state );
+        changed.notify_all();
+    } );
+
+    auto wait_changes = [ & ]( size_t count )
+    {
+        std::unique_lock< std::mutex > lock{ mutex };
+        return changed.wait_for( lock, std::chrono::seconds{ 5 }, [ & ]{ return changes.size() >= count; } );
+    };
+
+    monitor.add( "app" );
+    monitor.add( "db" );
+    BOOST_REQUIRE( !monitor.is_running( "app" ) );
+    BOOST_REQUIRE( monitor.status( "app" ).state == service::service_state::unknown );
+
+    // states are read before start returns
+    BOOST_REQUIRE_NO_THROW( monitor.start() );
+    BOOST_REQUIRE( monitor.running() );
+    BOOST_REQUIRE( monitor.is_running( "app" ) );
+    BOOST_REQUIRE( !monitor.is_running( "db" ) );
+    BOOST_REQUIRE( !monitor.is_running( "missing" ) );
+    BOOST_REQUIRE( wait_changes( 2 ) );
+
+    // changes made behind the monitor's back are notified
+    backend->set_state( "app", service::service_state::failed );
+    BOOST_REQUIRE( wait_changes( 3 ) );
+    BOOST_REQUIRE( !monitor.is_running( "app" ) );
+    BOOST_REQUIRE( changes.back().first == "app" && changes.back().second == service::service_state::failed );
+
+    BOOST_REQUIRE_NO_THROW( backend->start( "db" ).get() );
+    BOOST_REQUIRE( wait_changes( 4 ) );
+    BOOST_REQUIRE( monitor.is_running( "db" ) );
+
+    // pidfile services are checked through /proc
+    boost::filesystem::path pidfile{ boost::filesystem::temp_directory_path() / boost::filesystem::unique_path() };
+    BOOST_SCOPE_EXIT( &pidfile ){ boost::filesystem::remove( pidfile ); }BOOST_SCOPE_EXIT_END
+
+    std::ofstream( pidfile.string() ) << getpid();
+    monitor.add( "daemon", pidfile.string() );
+    BOOST_REQUIRE( wait_changes( 5 ) );
+    BOOST_REQUIRE( monitor.is_running( "daemon" ) );
+
+    boost::filesystem::remove( pidfile );
+    BOOST_REQUIRE( wait_changes( 6 ) );
+    BOOST_REQUIRE( monitor.status( "daemon" ).state == service::service_state::inactive );
+
+    monitor.remove( "daemon" );
+    BOOST_REQUIRE( !monitor.is_running( "daemon" ) );
+
+    monitor.stop();
+    BOOST_REQUIRE( !monitor.running() );
+}
+
+BOOST_AUTO_TEST_CASE( test_crontab )
+{
+    BOOST_TEST_MESSAGE( "--------------\nCrontab" );
+
+    std::string content{ "# m h dom mon dow command\n"
+                         "MAILTO=admin\n"
+                         "*/5 * * * * /usr/bin/cleanup\n"
+                         "# tag: backup\n"
+                         "0   3 * * *   /usr/bin/backup --full\n" };
+
+    cron::crontab table{ cron::crontab::parse( content ) };
+    std::vector< cron::cron_entry > entries{ table.entries() };
+    BOOST_REQUIRE( entries.size() == 2 );
+    BOOST_REQUIRE( entries[ 0 ].tag.empty() && entries[ 0 ].command == "/usr/bin/cleanup" );
+    BOOST_REQUIRE( table.find( "backup" ) != nullptr );
+    BOOST_REQUIRE( table.find( "backup" )->schedule == "0 3 * * *" );
+    BOOST_REQUIRE( table.find( "backup" )->command == "/usr/bin/backup --full" );
+
+    // unchanged lines are kept as they are
+    BOOST_REQUIRE( table.to_string() == content );
+
+    // Invalid cases
+    cron::cron_entry entry;
+    entry.tag = "rotate";
+    entry.schedule = "61 * *";
+    entry.command = "/usr/sbin/logrotate";
+    BOOST_REQUIRE_THROW( table.set( entry ), std::invalid_argument );
+    entry.schedule = "@daily";
+    entry.user = "root";
+    BOOST_REQUIRE_THROW( table.set( entry ), std::invalid_argument );
+    entry.user.clear();
+    entry.command = "a\nb";
+    BOOST_REQUIRE_THROW( table.set( entry ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( cron::crontab::load_dropin( "../passwd" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( cron::crontab::load_user( "../root" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( table.save(), std::logic_error );
+
+    // add and update are idempotent
+    entry.command = "/usr/sbin/logrotate";
+    BOOST_REQUIRE( table.set( entry ) );
+    BOOST_REQUIRE( !table.set( entry ) );
+    entry.schedule = "30  4 * * *";
+    BOOST_REQUIRE( table.set( entry ) );
+    BOOST_REQUIRE( table.find( "rotate" )->schedule == "30 4 * * *" );
+    BOOST_REQUIRE( table.remove( "backup" ) );
+    BOOST_REQUIRE( !table.remove( "backup" ) );
+    BOOST_REQUIRE( table.to_string() == "# m h dom mon dow command\nMAILTO=admin\n*/5 * * * * /usr/bin/cleanup\n"
+                                        "# tag: rotate\n30 4 * * * /usr/sbin/logrotate\n" );
+
+    // system table in a file, rewritten only on changes
+    boost::filesystem::path path{ boost::filesystem::temp_directory_path() / boost::filesystem::unique_path() };
+    BOOST_SCOPE_EXIT( &path ){ boost::filesystem::remove( path ); }BOOST_SCOPE_EXIT_END
+
+    cron::crontab dropin{ cron::crontab::load_file( path.string(), true ) };
+    BOOST_REQUIRE( dropin.entries().empty() );
+    entry.user = "root";
+    BOOST_REQUIRE( dropin.set( entry ) );
+    BOOST_REQUIRE( dropin.save() );
+    BOOST_REQUIRE( !dropin.save() );
+    BOOST_REQUIRE( utils::aux::read_file( path.string() ) == "# tag: rotate\n30 4 * * * root /usr/sbin/logrotate\n" );
+
+    dropin = cron::crontab::load_file( path.string(), true );
+    BOOST_REQUIRE( dropin.find( "rotate" ) != nullptr && dropin.find( "rotate" )->user == "root" );
+    BOOST_REQUIRE( dropin.remove( "rotate" ) );
+    BOOST_REQUIRE( dropin.save() );
+    BOOST_REQUIRE( !boost::filesystem::exists( path ) );
+}
+
+BOOST_AUTO_TEST_CASE( test_cron_schedule )
+{
+    BOOST_TEST_MESSAGE( "--------------\nCron schedule" );
+
+    using clock = std::chrono::system_clock;
+
+    // Invalid cases
+    BOOST_REQUIRE_THROW( cron::cron_expression( "" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( cron::cron_expression( "* * * *" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( cron::cron_expression( "60 * * * *" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( cron::cron_expression( "5-1 * * * *" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( cron::cron_expression( "*/0 * * * *" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( cron::cron_expression( "0 0 30 2 *" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( cron::cron_expression( "@reboot" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( cron::cron_expression( "0 0 * * *", "No/Such_Zone" ), std::invalid_argument );
+
+    auto utc = []( const char* text )
+    {
+        std::tm t{};
+        std::istringstream{ text } >> std::get_time( &t, "%Y-%m-%d %H:%M:%S" );
+        return clock::from_time_t( timegm( &t ) );
+    };
+
+    // 2023-11-14 22:13:20 UTC, a Tuesday
+    clock::time_point start{ clock::from_time_t( 1700000000 ) };
+
+    std::vector< clock::time_point > times{ cron::cron_expression( "*/20 9-17 * * mon-fri", "UTC" ).next( start, 3 ) };
+    BOOST_REQUIRE( times.size() == 3 );
+    BOOST_REQUIRE( times[ 0 ] == utc( "2023-11-15 09:00:00" ) );
+    BOOST_REQUIRE( times[ 2 ] == utc( "2023-11-15 09:40:00" ) );
+
+    // day of month or day of week, strictly after the time point
+    cron::cron_expression either{ "0 12 13 * fri", "UTC" };
+    BOOST_REQUIRE( either.next( start ) == utc( "2023-11-17 12:00:00" ) );
+    BOOST_REQUIRE( either.next( utc( "2023-12-08 12:00:00" ) ) == utc( "2023-12-13 12:00:00" ) );
+
+    BOOST_REQUIRE( cron::cron_expression( "0 0 29 feb *", "UTC" ).next( start ) == utc( "2024-02-29 00:00:00" ) );
+    BOOST_REQUIRE( cron::cron_expression( "@monthly", "UTC" ).next( start ) == utc( "2023-12-01 00:00:00" ) );
+    BOOST_REQUIRE( cron::cron_expression( "30 */15 * * * *", "UTC" ).next( start ) == utc( "2023-11-14 22:15:30" ) );
+
+    // skipped local times fire at the DST change, repeated ones once
+    cron::cron_expression berlin{ "30 2 * * *", "Europe/Berlin" };
+    BOOST_REQUIRE( berlin.next( utc( "2024-03-30 12:00:00" ) ) == utc( "2024-03-31 01:00:00" ) );
+    BOOST_REQUIRE( berlin.next( utc( "2024-10-26 12:00:00" ) ) == utc( "2024-10-27 00:30:00" ) );
+    BOOST_REQUIRE( berlin.next( utc( "2024-10-27 00:30:00" ) ) == utc( "2024-10-28 01:30:00" ) );
+
+    // unless every hour matches
+    cron::cron_expression hourly{ "30 * * * *", "Europe/Berlin" };
+    BOOST_REQUIRE( hourly.next( utc( "2024-10-27 00:30:00" ) ) == utc( "2024-10-27 01:30:00" ) );
+
+    // Scheduler
+    cron::scheduler scheduler;
+    std::atomic< int > fired{ 0 };
+    BOOST_REQUIRE_THROW( scheduler.add( cron::cron_expression{ "* * * * * *" }, nullptr ), std::invalid_argument );
+
+    size_t id{ scheduler.add( cron::cron_expression{ "* * * * * *" }, [ & ]{ ++fired; } ) };
+    for( int i{ 0 }; i < 1000; ++i )
+    {
+        scheduler.add( cron::cron_expression{ "0 0 1 1 *" }, []{} );
+    }
+
+    BOOST_REQUIRE( scheduler.size() == 1001 );
+    BOOST_REQUIRE_NO_THROW( scheduler.start() );
+    std::this_thread::sleep_for( std::chrono::milliseconds{ 2500 } );
+    BOOST_REQUIRE( fired >= 2 );
+
+    scheduler.remove( id );
+    int count{ fired };
+    std::this_thread::sleep_for( std::chrono::milliseconds{ 1500 } );
+    BOOST_REQUIRE( fired == count );
+    BOOST_REQUIRE( scheduler.size() == 1000 );
+
+    scheduler.stop();
+    BOOST_REQUIRE( !scheduler.running() );
+}
+
+BOOST_AUTO_TEST_CASE( test_error_codes )
+{
+    BOOST_TEST_MESSAGE( "--------------\nError codes" );
+
+    std::error_code ec{ utils::sys::errc::not_found };
+    BOOST_REQUIRE( std::string{ ec.category().name() } == "utils.sys" );
+    BOOST_REQUIRE( ec == std::errc::no_such_file_or_directory );
+    BOOST_REQUIRE( utils::sys::error_message( ENOENT ) == std::generic_category().message( ENOENT ) );
+    BOOST_REQUIRE_THROW( utils::sys::throw_error( utils::sys::errc::invalid_argument, "test" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( utils::sys::throw_error( utils::sys::errno_code( EIO ), "test" ), std::system_error );
+
+    // expected failures don't throw
+    BOOST_REQUIRE( !proc::kill_by_pid( -1, 0, ec ) && ec == utils::sys::errc::invalid_argument );
+    BOOST_REQUIRE( proc::kill_by_pid( getpid(), 0, ec ) && !ec );
+    BOOST_REQUIRE( proc::get_pids( "(", "", ec ).empty() && ec == utils::sys::errc::invalid_argument );
+    BOOST_REQUIRE( proc::get_file_owner( "/no/such/file", ec ).empty() && ec == std::errc::no_such_file_or_directory );
+    BOOST_REQUIRE( network::get_iface_type( "no_such_iface", ec ) == ARPHRD_NONE && ec );
+    BOOST_REQUIRE( utils::aux::read_file( "/no/such/file", ec ).empty() && ec == std::errc::no_such_file_or_directory );
+    BOOST_REQUIRE( !utils::aux::read_file( "/proc/self/status", ec ).empty() && !ec );
+
+    BOOST_REQUIRE_THROW( proc::get_file_owner( "/no/such/file" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( proc::get_pids( "(" ), std::invalid_argument );
+
+    // owner without passwd entry is shown by id
+    boost::filesystem::path path{ boost::filesystem::temp_directory_path() / boost::filesystem::unique_path() };
+    std::ofstream{ path.string() };
+    BOOST_SCOPE_EXIT( &path ){ boost::filesystem::remove( path ); }BOOST_SCOPE_EXIT_END
+
+    if( ::chown( path.string().c_str(), 54321, 54321 ) == 0 && !getpwuid( 54321 ) )
+    {
+        BOOST_REQUIRE( proc::get_file_owner( path.string() ) == "54321" );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_io_batch )
+{
+    BOOST_TEST_MESSAGE( "--------------\nIO batch" );
+
+    BOOST_REQUIRE_THROW( io::batch{ 0 }, std::invalid_argument );
+
+    io::batch requests{ 4 };
+    BOOST_REQUIRE_THROW( requests.add_stat( "" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( requests.get( 0 ), std::out_of_range );
+
+    // more requests than the queue depth
+    std::vector< size_t > stats;
+    for( int i{ 0 }; i < 10; ++i )
+    {
+        stats.push_back( requests.add_stat( "/proc/self" ) );
+    }
+
+    size_t missing{ requests.add_stat( "/no/such/file" ) };
+    size_t link{ requests.add_stat( "/proc/self", false ) };
+    size_t status{ requests.add_read( "/proc/self/status" ) };
+    size_t limited{ requests.add_read( "/proc/self/status", 5 ) };
+    size_t missing_read{ requests.add_read( "/no/such/file" ) };
+    BOOST_REQUIRE( requests.size() == 15 );
+
+    BOOST_REQUIRE_NO_THROW( requests.run() );
+    for( size_t id : stats )
+    {
+        BOOST_REQUIRE( !requests.get( id ).error && S_ISDIR( requests.get( id ).info.st_mode ) );
+    }
+
+    BOOST_REQUIRE( requests.get( missing ).error == ENOENT );
+    BOOST_REQUIRE( !requests.get( link ).error && S_ISLNK( requests.get( link ).info.st_mode ) );
+    BOOST_REQUIRE( requests.get( status ).content.find( "Pid:" ) != std::string::npos );
+    BOOST_REQUIRE( requests.get( limited ).content == "Name:" );
+    BOOST_REQUIRE( requests.get( missing_read ).error == ENOENT && requests.get( missing_read ).content.empty() );
+
+    requests.clear();
+    BOOST_REQUIRE( requests.size() == 0 );
+}
+
 BOOST_AUTO_TEST_CASE( test_set_sys_time )
 {
     BOOST_TEST_MESSAGE( "--------------\nTime Set" );
@@ -400,6 +1239,12 @@ BOOST_AUTO_TEST_CASE( test_set_sys_time )
     BOOST_REQUIRE_THROW( time::set_sys_time( 1990, 1, 1, 50, 1, 1 ), std::invalid_argument );
     BOOST_REQUIRE_THROW( time::set_sys_time( 1990, 1, 1, 1, 100, 1 ), std::invalid_argument );
     BOOST_REQUIRE_THROW( time::set_sys_time( 1990, 1, 1, 1, 1, 100 ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( time::set_sys_time( 1990, 1, 0, 1, 1, 1 ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( time::set_sys_time( 1990, 2, 29, 1, 1, 1 ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( time::set_sys_time( 1990, 4, 31, 1, 1, 1 ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( time::set_sys_time( 1990, 1, 1, 24, 1, 1 ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( time::set_sys_time( 1990, 1, 1, 1, 60, 1 ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( time::adjust_sys_time( std::chrono::hours{ 1 } ), std::invalid_argument );
 
     time_t seconds_past_epoch;
     BOOST_SCOPE_EXIT( &seconds_past_epoch )
@@ -416,10 +1261,20 @@ BOOST_AUTO_TEST_CASE( test_set_sys_time )
     seconds_past_epoch = ::time( 0 );
     tm* now{ localtime( &seconds_past_epoch ) };
     BOOST_REQUIRE( now->tm_year + 1900 == 2000 );
-    BOOST_REQUIRE( now->tm_mon == 10 );
+    BOOST_REQUIRE( now->tm_mon == 9 );
     BOOST_REQUIRE( now->tm_mday == 10 );
     BOOST_REQUIRE( now->tm_min == 10 );
     BOOST_REQUIRE( now->tm_sec >= 10 && now->tm_sec <= 40 );
+
+    // nanosecond precision step, slew of a small correction
+    auto point = std::chrono::system_clock::now() + std::chrono::hours{ 1 } + std::chrono::milliseconds{ 250 };
+    BOOST_REQUIRE_NO_THROW( time::set_sys_time( point, time::time_set_mode::step, false ).get() );
+    BOOST_REQUIRE( std::chrono::system_clock::now() - point < std::chrono::seconds{ 1 } );
+
+    BOOST_REQUIRE_NO_THROW( time::set_sys_time( std::chrono::system_clock::now() + std::chrono::milliseconds{ 100 },
+                                                time::time_set_mode::automatic ).get() );
+
+    BOOST_REQUIRE_THROW( time::sync_rtc_async( "/dev/no_such_rtc" ).get(), std::runtime_error );
 }
 
 BOOST_AUTO_TEST_CASE( test_timezone )
@@ -471,6 +1326,160 @@ BOOST_AUTO_TEST_CASE( test_timezone )
     BOOST_REQUIRE_NO_THROW( time::set_time_zone( time_zone ) );
 }
 
+BOOST_AUTO_TEST_CASE( test_time_zone_engine )
+{
+    BOOST_TEST_MESSAGE( "--------------\nTime zone engine" );
+
+    // Invalid cases
+    BOOST_REQUIRE_THROW( time::load_time_zone( "" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( time::load_time_zone( "../etc/passwd" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( time::load_time_zone( "No/Such_Zone" ), std::invalid_argument );
+
+    std::vector< std::string > zones;
+    BOOST_REQUIRE_NO_THROW( zones = time::list_time_zones() );
+    BOOST_REQUIRE( std::find( zones.begin(), zones.end(), "Europe/London" ) != zones.end() );
+
+    // cached
+    std::shared_ptr< const time::time_zone > london;
+    BOOST_REQUIRE_NO_THROW( london = time::load_time_zone( "Europe/London" ) );
+    BOOST_REQUIRE( london == time::load_time_zone( "Europe/London" ) );
+
+    // 2017-01-15 12:00 and 2017-07-15 12:00 UTC
+    BOOST_REQUIRE( london->offset_at( 1484481600 ).utc_offset == 0 );
+    BOOST_REQUIRE( london->offset_at( 1500120000 ).utc_offset == 3600 && london->offset_at( 1500120000 ).is_dst );
+
+    // beyond the transition table, resolved with the footer rule. 2100-07-01 UTC
+    BOOST_REQUIRE( london->offset_at( 4118083200 ).abbreviation == "BST" );
+
+    // southern hemisphere, 2100-01-01 UTC
+    BOOST_REQUIRE( time::load_time_zone( "Australia/Sydney" )->offset_at( 4102444800 ).utc_offset == 11 * 3600 );
+
+    // fractional offset
+    std::pair< std::string, double > offset;
+    BOOST_REQUIRE_NO_THROW( offset = time::get_time_zone_offset( "Asia/Kolkata" ) );
+    BOOST_REQUIRE( offset.first == "GMT+05.30" && offset.second == 5.5 );
+}
+
+BOOST_AUTO_TEST_CASE( test_time_formatter )
+{
+    BOOST_TEST_MESSAGE( "--------------\nTime formatter" );
+
+    // Invalid cases
+    BOOST_REQUIRE_THROW( time::time_formatter( "%12N" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( time::time_formatter( "%T", "No/Such_Zone" ), std::invalid_argument );
+
+    // 2017-07-15 12:00:00.123456789 UTC
+    std::chrono::system_clock::time_point point{ std::chrono::seconds{ 1500120000 } };
+    point += std::chrono::duration_cast< std::chrono::system_clock::duration >( std::chrono::nanoseconds{ 123456789 } );
+
+    time::time_formatter utc{ "%Y.%m.%d %H:%M:%S.%3N|%6N|%%", "UTC" };
+    BOOST_REQUIRE( utc.format( point ) == "2017.07.15 12:00:00.123|123456|%" );
+
+    // cached fields are updated when the second changes
+    BOOST_REQUIRE( utc.format( point + std::chrono::seconds{ 61 } ) == "2017.07.15 12:01:01.123|123456|%" );
+    BOOST_REQUIRE( utc.format( point - std::chrono::hours{ 24 } ) == "2017.07.14 12:00:00.123|123456|%" );
+
+    time::time_formatter london{ "%H:%M %Z %z", "Europe/London" };
+    BOOST_REQUIRE( london.format( point ) == "13:00 BST +0100" );
+
+    // output longer than strftime buffers of old get_time
+    std::string long_format( 100, 'x' );
+    BOOST_REQUIRE( time::get_time( long_format + "%Y" ).size() == 104 );
+}
+
+BOOST_AUTO_TEST_CASE( test_ntp_client )
+{
+    BOOST_TEST_MESSAGE( "--------------\nNTP client" );
+
+    // Invalid cases
+    BOOST_REQUIRE_THROW( time::query_ntp_servers( {} ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( time::query_ntp_servers( { "" } ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( time::query_ntp_servers( { "pool.ntp.org" }, std::chrono::milliseconds{ 200 }, 0 ), std::invalid_argument );
+
+    // local server with its clock 2.5s ahead, and one that never answers
+    int server_sock{ socket( AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0 ) };
+    int silent_sock{ socket( AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0 ) };
+    BOOST_REQUIRE( server_sock != -1 && silent_sock != -1 );
+
+    std::vector< std::string > servers;
+    for( int sock : { server_sock, silent_sock } )
+    {
+        sockaddr_in addr;
+        memset( &addr, 0, sizeof( addr ) );
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+        socklen_t addr_len{ sizeof( addr ) };
+        BOOST_REQUIRE( bind( sock, reinterpret_cast< sockaddr* >( &addr ), addr_len ) == 0 );
+        BOOST_REQUIRE( getsockname( sock, reinterpret_cast< sockaddr* >( &addr ), &addr_len ) == 0 );
+        servers.push_back( "127.0.0.1:" + std::to_string( ntohs( addr.sin_port ) ) );
+    }
+
+    std::atomic< bool > stop{ false };
+    std::thread responder{ [ server_sock, &stop ]
+    {
+        auto write_ntp = []( unsigned char* data, double seconds )
+        {
+            uint64_t value{ ( static_cast< uint64_t >( seconds + 2208988800.0 ) << 32 ) |
+                            static_cast< uint32_t >( std::fmod( seconds, 1.0 ) * 4294967296.0 ) };
+            for( int i{ 7 }; i >= 0; --i, value >>= 8 )
+            {
+                data[ i ] = value & 0xFF;
+            }
+        };
+
+        while( !stop )
+        {
+            pollfd pfd{ server_sock, POLLIN, 0 };
+            std::array< unsigned char, 48 > packet;
+            sockaddr_storage from;
+            socklen_t from_len{ sizeof( from ) };
+            if( poll( &pfd, 1, 50 ) <= 0 ||
+                recvfrom( server_sock, packet.data(), packet.size(), 0, reinterpret_cast< sockaddr* >( &from ), &from_len ) != 48 )
+            {
+                continue;
+            }
+
+            timespec ts;
+            clock_gettime( CLOCK_REALTIME, &ts );
+            double now{ ts.tv_sec + ts.tv_nsec / 1e9 + 2.5 };
+
+            std::copy( packet.begin() + 40, packet.end(), packet.begin() + 24 );
+            packet[ 0 ] = 0x24; // version 4, server mode
+            packet[ 1 ] = 2;
+            write_ntp( packet.data() + 32, now );
+            write_ntp( packet.data() + 40, now + 0.001 );
+            sendto( server_sock, packet.data(), packet.size(), 0, reinterpret_cast< sockaddr* >( &from ), from_len );
+        }
+    } };
+
+    BOOST_SCOPE_EXIT( &stop, &responder, server_sock, silent_sock )
+    {
+        stop = true;
+        responder.join();
+        close( server_sock );
+        close( silent_sock );
+    } BOOST_SCOPE_EXIT_END
+
+    // several servers at once, the silent one is reported as an error
+    time::ntp_result result;
+    BOOST_REQUIRE_NO_THROW( result = time::query_ntp_servers_async( servers, std::chrono::milliseconds{ 100 }, 2 ).get() );
+    BOOST_REQUIRE( result.samples.size() == 1 && result.best() == &result.samples.front() );
+    BOOST_REQUIRE( result.best()->server == servers[ 0 ] && result.best()->address == "127.0.0.1" );
+    BOOST_REQUIRE( result.best()->delay >= 0.0 && result.best()->stratum == 2 );
+    BOOST_REQUIRE( std::abs( result.best()->offset - 2.5 ) < 0.1 );
+    BOOST_REQUIRE( result.errors.size() == 1 && result.errors.front().first == servers[ 1 ] );
+
+    // a dropped future doesn't wait for the silent one
+    auto start = std::chrono::steady_clock::now();
+    time::query_ntp_servers_async( { servers[ 1 ] }, std::chrono::milliseconds{ 200 }, 2 );
+    BOOST_REQUIRE( std::chrono::steady_clock::now() - start < std::chrono::milliseconds{ 100 } );
+
+    // get_ntp_time_from_server
+    std::string ntp_time;
+    BOOST_REQUIRE_NO_THROW( ntp_time = time::get_ntp_time_from_server( servers[ 0 ], false, "%Y" ) );
+    BOOST_REQUIRE( ntp_time.length() == 4 );
+}
+
 BOOST_AUTO_TEST_CASE( test_user_add_remove )
 {
     BOOST_TEST_MESSAGE( "--------------\nUser add remove" );
@@ -487,6 +1496,112 @@ BOOST_AUTO_TEST_CASE( test_user_add_remove )
     BOOST_REQUIRE_NO_THROW( user::get_cpu_load_by_user( "root" ) );
 }
 
+BOOST_AUTO_TEST_CASE( test_user_resolver )
+{
+    BOOST_TEST_MESSAGE( "--------------\nUser resolver" );
+
+    BOOST_REQUIRE_THROW( user::user_resolver{ 0 }, std::invalid_argument );
+
+    user::user_resolver resolver{ 4 };
+    auto root = resolver.find_user( "root" );
+    BOOST_REQUIRE( root && root->uid == 0 && !root->home.empty() );
+
+    // cached by both keys
+    BOOST_REQUIRE( resolver.find_user( 0 ) == root );
+    BOOST_REQUIRE( resolver.find_user( "root" ) == root );
+
+    auto root_group = resolver.find_group( 0 );
+    BOOST_REQUIRE( root_group && root_group->name == "root" );
+    BOOST_REQUIRE( resolver.find_group( "root" ) == root_group );
+
+    BOOST_REQUIRE( !resolver.find_user( "no_such_user_" ) );
+    BOOST_REQUIRE( !resolver.find_user( 54321 ) || getpwuid( 54321 ) );
+    BOOST_REQUIRE( !resolver.find_group( "no_such_group_" ) );
+
+    // least recently used are evicted
+    for( uid_t uid{ 60000 }; uid < 60004; ++uid )
+    {
+        resolver.find_user( uid );
+    }
+
+    BOOST_REQUIRE( resolver.find_user( 0 ) != root && resolver.find_user( 0 )->uid == 0 );
+
+    resolver.clear();
+    BOOST_REQUIRE( resolver.find_group( 0 ) != root_group );
+    BOOST_REQUIRE( user::get_user_resolver().find_user( "root" )->uid == 0 );
+}
+
+BOOST_AUTO_TEST_CASE( test_user_accounts )
+{
+    BOOST_TEST_MESSAGE( "--------------\nUser accounts" );
+
+    namespace bfs = boost::filesystem;
+
+    // files of a root dir are changed, like useradd --prefix
+    bfs::path root{ bfs::temp_directory_path() / bfs::unique_path() };
+    BOOST_SCOPE_EXIT( &root ){ bfs::remove_all( root ); }BOOST_SCOPE_EXIT_END
+
+    bfs::create_directories( root / "etc" );
+    std::ofstream{ ( root / "etc/passwd" ).string() } << "root:x:0:0:root:/root:/bin/bash\n# comment\n";
+    std::ofstream{ ( root / "etc/shadow" ).string() } << "root:*:19000:0:99999:7:::\n";
+    std::ofstream{ ( root / "etc/group" ).string() } << "root:x:0:\nusers:x:100:\n";
+    std::ofstream{ ( root / "etc/gshadow" ).string() } << "root:*::\nusers:*::\n";
+
+    user::account_batch batch{ root.string() };
+    BOOST_REQUIRE_THROW( batch.add_group( "bad:name" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( batch.add_group( "\xE9t\xE9" ), std::invalid_argument );
+    user::user_spec bad_spec;
+    bad_spec.name = "test_user";
+    bad_spec.shell = "/bin:sh";
+    BOOST_REQUIRE_THROW( batch.add_user( bad_spec ), std::invalid_argument );
+
+    batch.add_group( "test_group" );
+    for( int i{ 0 }; i < 100; ++i )
+    {
+        user::user_spec spec;
+        spec.name = "test_user" + std::to_string( i );
+        spec.groups = { "users", "test_group" };
+        spec.create_home = i == 0;
+        batch.add_user( spec );
+    }
+
+    BOOST_REQUIRE( batch.size() == 101 );
+    BOOST_REQUIRE_NO_THROW( batch.apply() );
+    BOOST_REQUIRE( batch.empty() );
+
+    std::string passwd{ utils::aux::read_file( ( root / "etc/passwd" ).string() ) };
+    BOOST_REQUIRE( passwd.find( "# comment\n" ) != std::string::npos );
+    BOOST_REQUIRE( passwd.find( "test_user0:x:1000:1001::/home/test_user0:/bin/sh\n" ) != std::string::npos );
+    BOOST_REQUIRE( passwd.find( "test_user99:x:1099:" ) != std::string::npos );
+    BOOST_REQUIRE( utils::aux::read_file( ( root / "etc/shadow" ).string() ).find( "test_user1:!:" ) != std::string::npos );
+    BOOST_REQUIRE( utils::aux::read_file( ( root / "etc/group" ).string() ).find( "test_group:x:1000:test_user0,test_user1," ) != std::string::npos );
+    BOOST_REQUIRE( bfs::is_directory( root / "home/test_user0" ) && !bfs::exists( root / "home/test_user1" ) );
+
+    // the whole batch fails on an invalid change
+    user::user_spec existing;
+    existing.name = "test_user5";
+    batch.add_group( "test_group2" ).add_user( existing );
+    BOOST_REQUIRE_THROW( batch.apply(), std::invalid_argument );
+    BOOST_REQUIRE( utils::aux::read_file( ( root / "etc/group" ).string() ).find( "test_group2" ) == std::string::npos );
+
+    user::account_batch changes{ root.string() };
+    user::user_spec modified;
+    modified.name = "test_user1";
+    modified.shell = "/bin/bash";
+    modified.groups = { "users" };
+    changes.modify_user( modified ).remove_user( "test_user0", true ).remove_from_group( "test_user2", "users" );
+    BOOST_REQUIRE_THROW( user::account_batch{ root.string() }.remove_group( "test_user1" ).apply(), std::invalid_argument );
+    BOOST_REQUIRE_NO_THROW( changes.apply() );
+
+    passwd = utils::aux::read_file( ( root / "etc/passwd" ).string() );
+    std::string group{ utils::aux::read_file( ( root / "etc/group" ).string() ) };
+    BOOST_REQUIRE( passwd.find( "test_user0:" ) == std::string::npos && !bfs::exists( root / "home/test_user0" ) );
+    BOOST_REQUIRE( passwd.find( "/home/test_user1:/bin/bash\n" ) != std::string::npos );
+    BOOST_REQUIRE( group.find( "\ntest_user0:" ) == std::string::npos );
+    BOOST_REQUIRE( group.find( "test_group:x:1000:test_user2,test_user3," ) != std::string::npos );
+    BOOST_REQUIRE( group.find( "users:x:100:test_user1,test_user3," ) != std::string::npos );
+}
+
 BOOST_FIXTURE_TEST_SUITE( chmod_chown_suite, create_dir_tree_fixture )
 
 BOOST_AUTO_TEST_CASE( test_chmod_recurse )
@@ -496,7 +1611,7 @@ BOOST_AUTO_TEST_CASE( test_chmod_recurse )
     // Invalid cases
     BOOST_REQUIRE_THROW( user::chmod( "", 0777, user::all, user::recursive::yes ), std::invalid_argument );
     BOOST_REQUIRE_THROW( user::chmod( folder, -01, user::all, user::recursive::yes ), std::invalid_argument );
-    BOOST_REQUIRE_THROW( user::chmod( folder, 01000, user::all, user::recursive::yes ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( user::chmod( folder, 010000, user::all, user::recursive::yes ), std::invalid_argument );
 
     // chmod_recurse
     BOOST_REQUIRE_NO_THROW( user::chmod( folder, 0777 , user::all, user::recursive::yes ) );
@@ -541,4 +1656,118 @@ BOOST_AUTO_TEST_CASE( test_chown_recurse )
     }
 }
 
+BOOST_AUTO_TEST_CASE( test_acl_xattr )
+{
+    BOOST_TEST_MESSAGE( "--------------\nUser ACL and xattr" );
+
+    // Invalid cases
+    BOOST_REQUIRE_THROW( user::parse_acl( "u::rwx,q::r" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( user::parse_acl( "u:no_such_user_:rwx" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( user::parse_acl( "u:99999999999999999999999:rwx" ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( user::permission_changes{}.set_acl( user::parse_acl( "u::rwx,o::r" ) ), std::invalid_argument );
+    BOOST_REQUIRE_THROW( user::permission_changes{}.set_xattr( "", "" ), std::invalid_argument );
+
+    std::vector< user::acl_entry > acl{ user::parse_acl( "u::rwx,u:0:r-x,g::r--,o::---" ) };
+    BOOST_REQUIRE( acl.size() == 4 && acl[ 1 ].tag == user::acl_entry::named_user && acl[ 1 ].perms == 05 );
+
+    // mode, ACLs and xattrs in one pass, default ACL on directories only
+    user::permission_changes changes;
+    changes.mode( 02750 )
+           .set_acl( acl )
+           .set_acl( user::parse_acl( "u::rwx,g::r-x,o::r-x" ), user::acl_type::default_acl )
+           .set_xattr( "user.test", "value" );
+
+    BOOST_REQUIRE_NO_THROW( user::change_permissions( folder, changes, user::all, user::recursive::yes ) );
+
+    std::string file{ folder + "/folder/file" };
+    std::vector< user::acl_entry > file_acl{ user::get_acl( file ) };
+    BOOST_REQUIRE( file_acl.size() == 5 && file_acl[ 3 ].tag == user::acl_entry::mask && file_acl[ 3 ].perms == 05 );
+    BOOST_REQUIRE( user::get_acl( file, user::acl_type::default_acl ).empty() );
+    BOOST_REQUIRE( user::get_acl( folder + "/folder", user::acl_type::default_acl ).size() == 3 );
+
+    struct stat info;
+    BOOST_REQUIRE( stat( file.c_str(), &info ) == 0 && ( info.st_mode & 07000 ) == 02000 );
+
+    char value[ 16 ]{};
+    BOOST_REQUIRE( getxattr( file.c_str(), "user.test", value, sizeof( value ) ) == 5 && std::string{ value } == "value" );
+
+    // remove and copy
+    std::string source{ folder + "/file" };
+    BOOST_REQUIRE_NO_THROW( user::change_permissions( source, user::permission_changes{}.remove_acl().remove_xattr( "user.test" ) ) );
+    BOOST_REQUIRE( user::get_acl( source ).empty() && getxattr( source.c_str(), "user.test", value, sizeof( value ) ) == -1 );
+
+    BOOST_REQUIRE_NO_THROW( user::change_permissions( source, user::permission_changes{}.set_xattr( "user.copied", "1" ) ) );
+    BOOST_REQUIRE_NO_THROW( user::change_permissions( folder, user::permission_changes{}.copy_from( source ), user::file, user::recursive::yes ) );
+    BOOST_REQUIRE( getxattr( file.c_str(), "user.copied", value, sizeof( value ) ) == 1 );
+}
+
+BOOST_AUTO_TEST_CASE( test_update_permissions )
+{
+    BOOST_TEST_MESSAGE( "--------------\nUser update permissions" );
+
+    BOOST_REQUIRE_THROW( user::update_permissions( "", user::permission_changes{}.mode( 0755 ) ), std::invalid_argument );
+
+    // failures are collected
+    user::change_set result{ user::update_permissions( "no_such_folder", user::permission_changes{}.mode( 0755 ) ) };
+    BOOST_REQUIRE( result.failures.size() == 1 && result.failures[ 0 ].error == std::errc::no_such_file_or_directory );
+
+    BOOST_REQUIRE_NO_THROW( user::chmod( folder, 0755, user::all, user::recursive::yes ) );
+
+    // targets which are fine are not touched
+    result = user::update_permissions( folder, user::permission_changes{}.mode( 0755 ), user::all, user::recursive::yes );
+    BOOST_REQUIRE( result.checked == 4 && result.changes.empty() && result.failures.empty() );
+
+    // dry run, then the plan is applied
+    user::permission_changes changes;
+    changes.mode( 0700 ).set_xattr( "user.test", "value" );
+    user::change_set plan{ user::update_permissions( folder, changes, user::file, user::recursive::yes,
+                                                     user::deref_symlinks::yes, user::dry_run::yes ) };
+
+    std::string file{ folder + "/folder/file" };
+    struct stat info;
+    BOOST_REQUIRE( plan.checked == 2 && plan.changes.size() == 2 && plan.failures.empty() );
+    BOOST_REQUIRE( plan.changes[ 0 ].change_mode && plan.changes[ 0 ].mode == 0755 && plan.changes[ 0 ].xattrs.size() == 1 );
+    BOOST_REQUIRE( stat( file.c_str(), &info ) == 0 && ( info.st_mode & 07777 ) == 0755 );
+
+    user::apply_changes( plan, changes );
+    BOOST_REQUIRE( plan.failures.empty() );
+    BOOST_REQUIRE( stat( file.c_str(), &info ) == 0 && ( info.st_mode & 07777 ) == 0700 );
+    BOOST_REQUIRE( user::update_permissions( folder, changes, user::file, user::recursive::yes ).changes.empty() );
+
+    // a dangling symlink fails, the rest is still changed
+    BOOST_REQUIRE( ::symlink( "no_such_file", ( folder + "/link" ).c_str() ) == 0 );
+    result = user::update_permissions( folder, user::permission_changes{}.mode( 0750 ), user::all, user::recursive::yes );
+    BOOST_REQUIRE( result.failures.size() == 1 && result.failures[ 0 ].path == folder + "/link" );
+    BOOST_REQUIRE( result.changes.size() == 4 );
+    BOOST_REQUIRE( stat( file.c_str(), &info ) == 0 && ( info.st_mode & 07777 ) == 0750 );
+
+    // symlink as the target, not followed unless asked to
+    std::string link{ folder + "/root_link" };
+    BOOST_REQUIRE( ::symlink( "folder/file", link.c_str() ) == 0 );
+    BOOST_REQUIRE( ::chown( file.c_str(), 1, 1 ) == 0 && ::lchown( link.c_str(), 1, 1 ) == 0 );
+
+    user::permission_changes owner;
+    owner.owner( { "root", "root" } );
+    result = user::update_permissions( link, owner, user::symlink, user::recursive::no, user::deref_symlinks::no );
+    BOOST_REQUIRE( result.checked == 1 && result.changes.size() == 1 && result.failures.empty() );
+    BOOST_REQUIRE( lstat( link.c_str(), &info ) == 0 && info.st_uid == 0 );
+    BOOST_REQUIRE( stat( file.c_str(), &info ) == 0 && info.st_uid == 1 );
+    BOOST_REQUIRE( user::update_permissions( link, owner, user::symlink, user::recursive::no, user::deref_symlinks::no ).changes.empty() );
+    BOOST_REQUIRE( ::chown( file.c_str(), 0, 0 ) == 0 );
+
+    // mode with an ACL, its mask makes the group bits
+    changes = user::permission_changes{};
+    changes.mode( 0750 ).set_acl( user::parse_acl( "u::rwx,u:0:rw-,g::r-x,m::rw-,o::---" ) );
+    BOOST_REQUIRE( user::update_permissions( file, changes ).changes.size() == 1 );
+    BOOST_REQUIRE( user::update_permissions( file, changes ).changes.empty() );
+    BOOST_REQUIRE( stat( file.c_str(), &info ) == 0 && ( info.st_mode & 07777 ) == 0760 );
+
+    // a minimal ACL is not stored, the mode stands for it
+    changes = user::permission_changes{};
+    changes.set_acl( user::parse_acl( "u::rwx,g::r--,o::r--" ) );
+    BOOST_REQUIRE( user::update_permissions( file, changes ).changes.size() == 1 );
+    BOOST_REQUIRE( user::update_permissions( file, changes ).changes.empty() );
+    BOOST_REQUIRE( stat( file.c_str(), &info ) == 0 && ( info.st_mode & 07777 ) == 0744 && user::get_acl( file ).empty() );
+}
+
 BOOST_AUTO_TEST_SUITE_END()